@@ -0,0 +1,585 @@
+#include "simfs.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <sys/resource.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// simfs_bench - seeded workloads against the simfs API
+//
+// Every workload runs on a freshly formatted in-memory volume, which is unmounted after it, with a fixed caller,
+// and draws its random choices from its own generator seeded with the given seed, so two runs with the same
+// arguments perform the same operations. The latency of every call is recorded in a log-linear histogram per
+// operation. The free blocks are read through simfsGetUsage(), like any other client of the library would.
+//
+// usage: simfs_bench [-s seed] [-n operations] [-b block size] [-N number of blocks] [workload ...]
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define BENCH_SUB_BUCKETS 16 // buckets per power of two; the relative error of a percentile is below 1/16
+#define BENCH_BUCKETS (61 * BENCH_SUB_BUCKETS)
+#define BENCH_FILES 64 // files kept open by the workloads; at most SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS
+
+typedef enum bench_operation_type {
+    BENCH_CREATE,
+    BENCH_DELETE,
+    BENCH_OPEN,
+    BENCH_CLOSE,
+    BENCH_WRITE,
+    BENCH_WRITE_AT,
+    BENCH_APPEND,
+    BENCH_READ,
+    BENCH_READ_AT,
+    BENCH_OPERATIONS
+} BENCH_OPERATION_TYPE;
+
+static const char *benchOperationName[BENCH_OPERATIONS] = {
+    "create", "delete", "open", "close", "write", "writeAt", "append", "read", "readAt"
+};
+
+typedef struct bench_histogram_type {
+    uint64_t count;
+    uint64_t failed; // calls that returned an error
+    uint64_t total; // nanoseconds
+    uint64_t max;
+    uint64_t bucket[BENCH_BUCKETS];
+} BENCH_HISTOGRAM_TYPE;
+
+typedef struct bench_type {
+    uint64_t seed;
+    uint64_t random; // state of the generator of the running workload
+    long operations;
+    unsigned int blockSize;
+    SIMFS_INDEX_TYPE numberOfBlocks;
+    SIMFS_VOLUME *volume;
+    BENCH_HISTOGRAM_TYPE histogram[BENCH_OPERATIONS];
+    SIMFS_INDEX_TYPE leastFreeBlocks; // the most blocks used during the running workload
+    SIMFS_FILE_HANDLE_TYPE handle[BENCH_FILES];
+    char *buffer; // content written by the workloads
+    size_t bufferSize;
+} BENCH_TYPE;
+
+//////////////////////////////////////////////////////////////////////////
+//
+// measurement
+//
+//////////////////////////////////////////////////////////////////////////
+
+static uint64_t benchNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static SIMFS_INDEX_TYPE benchFreeBlocks()
+{
+    SIMFS_INDEX_TYPE numberOfBlocks, freeBlocks;
+    unsigned int blockSize;
+    simfsGetUsage(&numberOfBlocks, &freeBlocks, &blockSize);
+    return freeBlocks;
+}
+
+/*
+ * Returns the next number of the xorshift64* generator of the running workload.
+ */
+static uint64_t benchRandom(BENCH_TYPE *bench)
+{
+    bench->random ^= bench->random >> 12;
+    bench->random ^= bench->random << 25;
+    bench->random ^= bench->random >> 27;
+    return bench->random * 2685821657736338717u;
+}
+
+static size_t benchBelow(BENCH_TYPE *bench, size_t bound)
+{
+    return (size_t) (benchRandom(bench) % bound);
+}
+
+/*
+ * Values below BENCH_SUB_BUCKETS have a bucket each; larger values share BENCH_SUB_BUCKETS buckets per power of two.
+ */
+static int benchBucket(uint64_t value)
+{
+    if (value < BENCH_SUB_BUCKETS)
+        return (int) value;
+
+    int magnitude = 63 - __builtin_clzll(value);
+    return (magnitude - 3) * BENCH_SUB_BUCKETS + (int) ((value >> (magnitude - 4)) & (BENCH_SUB_BUCKETS - 1));
+}
+
+/*
+ * Returns the largest value falling into a bucket.
+ */
+static uint64_t benchBucketLimit(int bucket)
+{
+    if (bucket < BENCH_SUB_BUCKETS)
+        return (uint64_t) bucket;
+
+    int magnitude = bucket / BENCH_SUB_BUCKETS + 3;
+    uint64_t first = (uint64_t) (BENCH_SUB_BUCKETS + bucket % BENCH_SUB_BUCKETS) << (magnitude - 4);
+    return first + ((uint64_t) 1 << (magnitude - 4)) - 1;
+}
+
+static void benchRecord(BENCH_TYPE *bench, BENCH_OPERATION_TYPE operation, uint64_t start, SIMFS_ERROR error)
+{
+    uint64_t elapsed = benchNow() - start;
+    BENCH_HISTOGRAM_TYPE *histogram = &bench->histogram[operation];
+
+    histogram->count++;
+    histogram->failed += error != SIMFS_NO_ERROR;
+    histogram->total += elapsed;
+    if (elapsed > histogram->max)
+        histogram->max = elapsed;
+    histogram->bucket[benchBucket(elapsed)]++;
+
+    SIMFS_INDEX_TYPE freeBlocks = benchFreeBlocks();
+    if (freeBlocks < bench->leastFreeBlocks)
+        bench->leastFreeBlocks = freeBlocks;
+}
+
+/*
+ * Returns the latency below which the given fraction of the calls finished, in nanoseconds.
+ */
+static uint64_t benchPercentile(const BENCH_HISTOGRAM_TYPE *histogram, double fraction)
+{
+    uint64_t rank = (uint64_t) (fraction * (double) histogram->count);
+    uint64_t seen = 0;
+
+    for (int bucket = 0; bucket < BENCH_BUCKETS; bucket++)
+    {
+        seen += histogram->bucket[bucket];
+        if (seen > rank)
+            return benchBucketLimit(bucket) < histogram->max ? benchBucketLimit(bucket) : histogram->max;
+    }
+
+    return histogram->max;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// timed calls
+//
+//////////////////////////////////////////////////////////////////////////
+
+static SIMFS_ERROR benchCreate(BENCH_TYPE *bench, int file, SIMFS_CONTENT_TYPE type)
+{
+    SIMFS_NAME_TYPE name;
+    snprintf(name, sizeof(name), "file-%d", file);
+
+    uint64_t start = benchNow();
+    SIMFS_ERROR error = simfsCreateFile(name, type);
+    benchRecord(bench, BENCH_CREATE, start, error);
+
+    return error;
+}
+
+static SIMFS_ERROR benchDelete(BENCH_TYPE *bench, int file)
+{
+    SIMFS_NAME_TYPE name;
+    snprintf(name, sizeof(name), "file-%d", file);
+
+    uint64_t start = benchNow();
+    SIMFS_ERROR error = simfsDeleteFile(name);
+    benchRecord(bench, BENCH_DELETE, start, error);
+
+    return error;
+}
+
+static SIMFS_ERROR benchOpen(BENCH_TYPE *bench, int file, SIMFS_FILE_HANDLE_TYPE *handle)
+{
+    SIMFS_NAME_TYPE name;
+    snprintf(name, sizeof(name), "file-%d", file);
+
+    uint64_t start = benchNow();
+    SIMFS_ERROR error = simfsOpenFile(name, handle);
+    benchRecord(bench, BENCH_OPEN, start, error);
+
+    return error;
+}
+
+static void benchClose(BENCH_TYPE *bench, SIMFS_FILE_HANDLE_TYPE handle)
+{
+    uint64_t start = benchNow();
+    SIMFS_ERROR error = simfsCloseFile(handle);
+    benchRecord(bench, BENCH_CLOSE, start, error);
+}
+
+/*
+ * Replaces the content of a file with size bytes of the buffer.
+ */
+static SIMFS_ERROR benchWrite(BENCH_TYPE *bench, SIMFS_FILE_HANDLE_TYPE handle, size_t size)
+{
+    char saved = bench->buffer[size];
+    bench->buffer[size] = '\0';
+
+    uint64_t start = benchNow();
+    SIMFS_ERROR error = simfsWriteFile(handle, bench->buffer);
+    benchRecord(bench, BENCH_WRITE, start, error);
+
+    bench->buffer[size] = saved;
+    return error;
+}
+
+static SIMFS_ERROR benchAppend(BENCH_TYPE *bench, SIMFS_FILE_HANDLE_TYPE handle, size_t size)
+{
+    char saved = bench->buffer[size];
+    bench->buffer[size] = '\0';
+
+    uint64_t start = benchNow();
+    SIMFS_ERROR error = simfsAppendFile(handle, bench->buffer);
+    benchRecord(bench, BENCH_APPEND, start, error);
+
+    bench->buffer[size] = saved;
+    return error;
+}
+
+static void benchRead(BENCH_TYPE *bench, SIMFS_FILE_HANDLE_TYPE handle)
+{
+    char *content = NULL;
+
+    uint64_t start = benchNow();
+    SIMFS_ERROR error = simfsReadFile(handle, &content);
+    benchRecord(bench, BENCH_READ, start, error);
+
+    simfsReleaseReadBuffer(content);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// workloads
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Creates the first BENCH_FILES files with the given size and opens them.
+ */
+static void benchOpenFiles(BENCH_TYPE *bench, size_t size)
+{
+    for (int file = 0; file < BENCH_FILES; file++)
+    {
+        benchCreate(bench, file, FILE_CONTENT_TYPE);
+        benchOpen(bench, file, &bench->handle[file]);
+        benchWrite(bench, bench->handle[file], size);
+    }
+}
+
+static void benchCloseFiles(BENCH_TYPE *bench)
+{
+    for (int file = 0; file < BENCH_FILES; file++)
+        benchClose(bench, bench->handle[file]);
+}
+
+/*
+ * Creates files in bursts and deletes them in random order.
+ */
+static void benchCreateDelete(BENCH_TYPE *bench)
+{
+    int burst = 4096;
+    int *order = malloc(burst * sizeof(int));
+
+    for (long done = 0; done < bench->operations; done += 2 * burst)
+    {
+        for (int file = 0; file < burst; file++)
+        {
+            benchCreate(bench, file, file % 8 == 0 ? FOLDER_CONTENT_TYPE : FILE_CONTENT_TYPE);
+            order[file] = file;
+        }
+
+        for (int file = burst - 1; file > 0; file--)
+        {
+            int other = (int) benchBelow(bench, (size_t) file + 1);
+            int swap = order[file];
+            order[file] = order[other];
+            order[other] = swap;
+        }
+
+        for (int file = 0; file < burst; file++)
+            benchDelete(bench, order[file]);
+    }
+
+    free(order);
+}
+
+/*
+ * Opens and closes random files of a set.
+ */
+static void benchOpenClose(BENCH_TYPE *bench)
+{
+    for (int file = 0; file < 1024; file++)
+        benchCreate(bench, file, FILE_CONTENT_TYPE);
+
+    for (long done = 0; done < bench->operations; done++)
+    {
+        SIMFS_FILE_HANDLE_TYPE handle;
+        if (benchOpen(bench, (int) benchBelow(bench, 1024), &handle) == SIMFS_NO_ERROR)
+            benchClose(bench, handle);
+    }
+}
+
+/*
+ * Replaces the content of random files with up to 200 bytes.
+ */
+static void benchSmallWrites(BENCH_TYPE *bench)
+{
+    benchOpenFiles(bench, 0);
+
+    for (long done = 0; done < bench->operations; done++)
+        benchWrite(bench, bench->handle[benchBelow(bench, BENCH_FILES)], 1 + benchBelow(bench, 200));
+
+    benchCloseFiles(bench);
+}
+
+/*
+ * Replaces the content of random files with 64 KB to 1 MB, limited to a sixteenth of the volume.
+ */
+static void benchLargeWrites(BENCH_TYPE *bench)
+{
+    size_t largest = (size_t) bench->blockSize * bench->numberOfBlocks / 16;
+    largest = largest < bench->bufferSize ? largest : bench->bufferSize;
+    size_t smallest = largest / 16;
+
+    benchOpenFiles(bench, 0);
+
+    for (long done = 0; done < bench->operations / 100 + 1; done++)
+    {
+        SIMFS_FILE_HANDLE_TYPE handle = bench->handle[benchBelow(bench, 8)];
+        benchWrite(bench, handle, smallest + benchBelow(bench, largest - smallest));
+    }
+
+    benchCloseFiles(bench);
+}
+
+/*
+ * Reads whole files of 4 KB over and over.
+ */
+static void benchRepeatedReads(BENCH_TYPE *bench)
+{
+    benchOpenFiles(bench, 4096);
+
+    for (long done = 0; done < bench->operations; done++)
+        benchRead(bench, bench->handle[benchBelow(bench, BENCH_FILES)]);
+
+    benchCloseFiles(bench);
+}
+
+/*
+ * Reads and writes 512 bytes at random offsets of files of 16 KB; readPercent of the operations are reads.
+ */
+static void benchMixed(BENCH_TYPE *bench, int readPercent)
+{
+    size_t fileSize = 16384;
+    size_t length = 512;
+    char *readBuffer = malloc(length);
+
+    benchOpenFiles(bench, fileSize);
+
+    for (long done = 0; done < bench->operations; done++)
+    {
+        SIMFS_FILE_HANDLE_TYPE handle = bench->handle[benchBelow(bench, BENCH_FILES)];
+        size_t offset = benchBelow(bench, fileSize - length);
+
+        uint64_t start = benchNow();
+        if ((int) benchBelow(bench, 100) < readPercent)
+        {
+            size_t bytesRead;
+            SIMFS_ERROR error = simfsReadFileAt(handle, offset, readBuffer, length, &bytesRead);
+            benchRecord(bench, BENCH_READ_AT, start, error);
+        }
+        else
+        {
+            SIMFS_ERROR error = simfsWriteFileAt(handle, offset, bench->buffer, length);
+            benchRecord(bench, BENCH_WRITE_AT, start, error);
+        }
+    }
+
+    benchCloseFiles(bench);
+    free(readBuffer);
+}
+
+static void benchMixed90(BENCH_TYPE *bench)
+{
+    benchMixed(bench, 90);
+}
+
+static void benchMixed50(BENCH_TYPE *bench)
+{
+    benchMixed(bench, 50);
+}
+
+/*
+ * Appends to files until the volume is full, then deletes them.
+ */
+static void benchFill(BENCH_TYPE *bench)
+{
+    size_t chunk = 16 * (size_t) bench->blockSize;
+    int files = 0;
+
+    for (int full = 0; !full && files < BENCH_FILES; files++)
+    {
+        SIMFS_FILE_HANDLE_TYPE handle;
+        if (benchCreate(bench, files, FILE_CONTENT_TYPE) != SIMFS_NO_ERROR
+            || benchOpen(bench, files, &handle) != SIMFS_NO_ERROR)
+            break;
+
+        // a file grows to at most a sixteenth of the volume, so the space is spread over several files
+        size_t size = 0;
+        while (size < (size_t) bench->blockSize * bench->numberOfBlocks / 16)
+        {
+            size_t length = chunk - benchBelow(bench, chunk / 2);
+            if (benchAppend(bench, handle, length) != SIMFS_NO_ERROR)
+            {
+                full = 1;
+                break;
+            }
+            size += length;
+        }
+        benchClose(bench, handle);
+    }
+
+    for (int file = 0; file < files; file++)
+        benchDelete(bench, file);
+}
+
+typedef struct bench_workload_type {
+    const char *name;
+    void (*run)(BENCH_TYPE *bench);
+} BENCH_WORKLOAD_TYPE;
+
+static const BENCH_WORKLOAD_TYPE benchWorkloads[] = {
+    { "create-delete", benchCreateDelete },
+    { "open-close", benchOpenClose },
+    { "small-writes", benchSmallWrites },
+    { "large-writes", benchLargeWrites },
+    { "repeated-reads", benchRepeatedReads },
+    { "mixed-90-10", benchMixed90 },
+    { "mixed-50-50", benchMixed50 },
+    { "fill", benchFill },
+};
+
+#define BENCH_NUMBER_OF_WORKLOADS ((int) (sizeof(benchWorkloads) / sizeof(benchWorkloads[0])))
+
+//////////////////////////////////////////////////////////////////////////
+//
+// driver
+//
+//////////////////////////////////////////////////////////////////////////
+
+static void benchReport(BENCH_TYPE *bench, const char *name, uint64_t elapsed)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%s: %.3f s, at most %u and finally %u blocks used, max RSS %ld KB\n", name, (double) elapsed / 1e9,
+           (unsigned int) (bench->numberOfBlocks - bench->leastFreeBlocks),
+           (unsigned int) (bench->numberOfBlocks - benchFreeBlocks()),
+           usage.ru_maxrss);
+    printf("    %-8s %10s %8s %12s %10s %10s %10s %10s %10s\n", "op", "count", "failed", "ops/s", "mean us",
+           "p50 us", "p99 us", "p999 us", "max us");
+
+    for (int operation = 0; operation < BENCH_OPERATIONS; operation++)
+    {
+        BENCH_HISTOGRAM_TYPE *histogram = &bench->histogram[operation];
+        if (histogram->count == 0)
+            continue;
+
+        printf("    %-8s %10" PRIu64 " %8" PRIu64 " %12.0f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+               benchOperationName[operation], histogram->count, histogram->failed,
+               (double) histogram->count * 1e9 / (double) elapsed,
+               (double) histogram->total / (double) histogram->count / 1e3,
+               (double) benchPercentile(histogram, 0.5) / 1e3, (double) benchPercentile(histogram, 0.99) / 1e3,
+               (double) benchPercentile(histogram, 0.999) / 1e3, (double) histogram->max / 1e3);
+    }
+}
+
+/*
+ * Runs a workload on a volume formatted and mounted for it, and unmounted afterwards; returns 0 if the volume
+ * could not be formatted or mounted.
+ */
+static int benchRun(BENCH_TYPE *bench, const BENCH_WORKLOAD_TYPE *workload)
+{
+    SIMFS_ERROR error = simfsFormatFileSystem(bench->volume, bench->blockSize, bench->numberOfBlocks);
+    if (error == SIMFS_NO_ERROR)
+        error = simfsMountFileSystem(bench->volume);
+    if (error != SIMFS_NO_ERROR)
+    {
+        fprintf(stderr, "%s: cannot format and mount the volume (error %d)\n", workload->name, (int) error);
+        return 0;
+    }
+
+    memset(bench->histogram, 0, sizeof(bench->histogram));
+    bench->leastFreeBlocks = benchFreeBlocks();
+    bench->random = bench->seed * 0x9E3779B97F4A7C15u + 1; // never 0, which the generator would keep
+
+    uint64_t start = benchNow();
+    workload->run(bench);
+    uint64_t elapsed = benchNow() - start;
+
+    benchReport(bench, workload->name, elapsed);
+
+    return simfsUnmountFileSystem() == SIMFS_NO_ERROR;
+}
+
+int main(int argc, char *argv[])
+{
+    BENCH_TYPE bench = {
+        .seed = 1,
+        .operations = 100000,
+        .blockSize = SIMFS_DEFAULT_BLOCK_SIZE,
+        .numberOfBlocks = SIMFS_DEFAULT_NUMBER_OF_BLOCKS
+    };
+    int first = 1;
+    int failed = 0;
+
+    for (; first + 1 < argc && argv[first][0] == '-'; first += 2)
+    {
+        if (strcmp(argv[first], "-s") == 0)
+            bench.seed = strtoull(argv[first + 1], NULL, 0);
+        else if (strcmp(argv[first], "-n") == 0)
+            bench.operations = strtol(argv[first + 1], NULL, 0);
+        else if (strcmp(argv[first], "-b") == 0)
+            bench.blockSize = (unsigned int) strtoul(argv[first + 1], NULL, 0);
+        else if (strcmp(argv[first], "-N") == 0)
+            bench.numberOfBlocks = (SIMFS_INDEX_TYPE) strtoul(argv[first + 1], NULL, 0);
+        else
+            break;
+    }
+
+    size_t volumeSize = simfsVolumeSize(bench.blockSize, bench.numberOfBlocks);
+    if (volumeSize == 0 || (first < argc && argv[first][0] == '-'))
+    {
+        fprintf(stderr, "usage: %s [-s seed] [-n operations] [-b block size] [-N number of blocks] [workload ...]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bench.volume = malloc(volumeSize);
+    bench.bufferSize = 1024 * 1024;
+    bench.buffer = malloc(bench.bufferSize + 1);
+    if (bench.volume == NULL || bench.buffer == NULL)
+        return EXIT_FAILURE;
+    for (size_t i = 0; i <= bench.bufferSize; i++)
+        bench.buffer[i] = (char) ('a' + i % 26);
+
+    struct fuse_context caller = { .uid = 1, .pid = 1, .gid = 1, .umask = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH };
+    simfs_debug_set_context(&caller);
+
+    printf("seed %" PRIu64 ", %ld operations, %u blocks of %u bytes\n", bench.seed, bench.operations,
+           (unsigned int) bench.numberOfBlocks, bench.blockSize);
+
+    for (int workload = 0; workload < BENCH_NUMBER_OF_WORKLOADS; workload++)
+    {
+        int selected = first == argc;
+        for (int i = first; i < argc; i++)
+            selected |= strcmp(argv[i], benchWorkloads[workload].name) == 0;
+
+        if (selected && !benchRun(&bench, &benchWorkloads[workload]))
+            failed = 1;
+    }
+
+    free(bench.buffer);
+    free(bench.volume);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,671 @@
+#define FUSE_USE_VERSION 29
+
+#include "simfs.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse_lowlevel.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// simfs_fuse - serves a simfs volume through the FUSE low-level API
+//
+// The inode numbers are the descriptor blocks of the files and folders, shifted by FUSE_ROOT_ID, so the root
+// folder (block 0 of every volume) is FUSE_ROOT_ID. The kernel caches the entries and the attributes it gets, so
+// most requests need neither a path nor a lookup by name; and every request carries its caller, which is passed on
+// with simfsSetCaller().
+//
+// An open file is an entry of the global open file table, kept in the file handle of the kernel. Reads reply with
+// the blocks of the volume holding the content, and writes copy the buffers of the request straight into them;
+// the vectors describing the blocks are kept per thread, so serving a request allocates no memory.
+//
+// usage: simfs_fuse [--format] image mountpoint [FUSE options]
+//
+// The image must hold a volume; with --format, it is created (or truncated) and formatted first.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_FUSE_TIMEOUT 1.0 // seconds the kernel keeps entries and attributes
+#define SIMFS_FUSE_MAX_TRANSFER (128 * 1024) // bytes of the largest read or write request
+#define SIMFS_FUSE_MAX_SEGMENTS (SIMFS_FUSE_MAX_TRANSFER / SIMFS_MIN_DATA_SIZE + 2) // blocks of the largest transfer
+#define SIMFS_FUSE_DIRECTORY_BUFFER 16384 // bytes of the largest reply to readdir
+#define SIMFS_FUSE_STATISTICS_INODE ((fuse_ino_t) SIMFS_MAX_NUMBER_OF_BLOCKS + FUSE_ROOT_ID) // above every node
+
+typedef struct simfs_fuse_transfer_type {
+    fuse_req_t request;
+    struct fuse_bufvec *buffers; // the content of a write request
+    int replied; // a read has been replied to by the callback
+} SIMFS_FUSE_TRANSFER_TYPE;
+
+typedef struct simfs_fuse_listing_type {
+    fuse_req_t request;
+    char *buffer;
+    size_t size;
+    size_t used;
+    off_t first; // the offset of the first folder entry in the listing
+} SIMFS_FUSE_LISTING_TYPE;
+
+static _Thread_local SIMFS_SEGMENT_TYPE simfsFuseSegments[SIMFS_FUSE_MAX_SEGMENTS];
+static _Thread_local union {
+    struct fuse_bufvec vector;
+    char space[sizeof(struct fuse_bufvec) + SIMFS_FUSE_MAX_SEGMENTS * sizeof(struct fuse_buf)];
+} simfsFuseBuffers;
+static _Thread_local char simfsFuseDirectory[SIMFS_FUSE_DIRECTORY_BUFFER];
+
+//////////////////////////////////////////////////////////////////////////
+//
+// helper functions
+//
+//////////////////////////////////////////////////////////////////////////
+
+static inline SIMFS_INDEX_TYPE simfsFuseNode(fuse_ino_t inode)
+{
+    return inode - FUSE_ROOT_ID < SIMFS_MAX_NUMBER_OF_BLOCKS ? (SIMFS_INDEX_TYPE) (inode - FUSE_ROOT_ID)
+                                                             : SIMFS_INVALID_INDEX;
+}
+
+static inline fuse_ino_t simfsFuseInode(SIMFS_INDEX_TYPE node)
+{
+    return (fuse_ino_t) node + FUSE_ROOT_ID;
+}
+
+static int simfsFuseErrno(SIMFS_ERROR error)
+{
+    switch (error)
+    {
+        case SIMFS_NO_ERROR:
+            return 0;
+        case SIMFS_ALLOC_ERROR:
+            return ENOSPC;
+        case SIMFS_DUPLICATE_ERROR:
+            return EEXIST;
+        case SIMFS_NOT_FOUND_ERROR:
+            return ENOENT;
+        case SIMFS_NOT_EMPTY_ERROR:
+            return ENOTEMPTY;
+        case SIMFS_ACCESS_ERROR:
+            return EACCES;
+        default:
+            return EIO;
+    }
+}
+
+/*
+ * Makes the caller of the request the caller of the simfs operations of the thread.
+ */
+static void simfsFuseSetCaller(fuse_req_t request)
+{
+    const struct fuse_ctx *context = fuse_req_ctx(request);
+
+    simfsSetCaller(context->uid, context->pid, context->umask);
+}
+
+static void simfsFuseAttributes(SIMFS_INDEX_TYPE node, const SIMFS_FILE_DESCRIPTOR_TYPE *descriptor,
+                                struct stat *attributes)
+{
+    SIMFS_INDEX_TYPE numberOfBlocks, freeBlocks;
+    unsigned int blockSize;
+    simfsGetUsage(&numberOfBlocks, &freeBlocks, &blockSize);
+
+    memset(attributes, 0, sizeof(struct stat));
+    attributes->st_ino = simfsFuseInode(node);
+    attributes->st_mode = (descriptor->type == FOLDER_CONTENT_TYPE ? S_IFDIR : S_IFREG)
+                          | (descriptor->accessRights & 07777);
+    attributes->st_nlink = descriptor->type == FOLDER_CONTENT_TYPE ? 2 : 1;
+    attributes->st_uid = descriptor->owner;
+    attributes->st_size = (off_t) descriptor->size;
+    attributes->st_blksize = blockSize;
+    attributes->st_blocks = (blkcnt_t) ((descriptor->size + 511) / 512);
+    attributes->st_atime = descriptor->lastAccessTime;
+    attributes->st_mtime = descriptor->lastModificationTime;
+    attributes->st_ctime = descriptor->lastModificationTime;
+}
+
+/*
+ * Describes the statistics file with the size of the current statistics; returns 0, or an errno value.
+ */
+static int simfsFuseStatisticsAttributes(struct stat *attributes)
+{
+    char *json;
+    if (simfsGetStatistics(&json) != SIMFS_NO_ERROR)
+        return ENOMEM;
+
+    memset(attributes, 0, sizeof(struct stat));
+    attributes->st_ino = SIMFS_FUSE_STATISTICS_INODE;
+    attributes->st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+    attributes->st_nlink = 1;
+    attributes->st_size = (off_t) strlen(json);
+    attributes->st_atime = attributes->st_mtime = attributes->st_ctime = time(NULL);
+    free(json);
+
+    return 0;
+}
+
+static void simfsFuseReplyEntry(fuse_req_t request, SIMFS_INDEX_TYPE node, const SIMFS_FILE_DESCRIPTOR_TYPE *descriptor)
+{
+    struct fuse_entry_param entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.ino = simfsFuseInode(node);
+    entry.generation = (unsigned long) descriptor->creationTime; // a block is reused by a later file
+    entry.attr_timeout = SIMFS_FUSE_TIMEOUT;
+    entry.entry_timeout = SIMFS_FUSE_TIMEOUT;
+    simfsFuseAttributes(node, descriptor, &entry.attr);
+
+    fuse_reply_entry(request, &entry);
+}
+
+/*
+ * Describes the segments of the volume holding a range of a file as a vector of buffers.
+ */
+static struct fuse_bufvec *simfsFuseBufferVector(SIMFS_SEGMENT_TYPE *segments, int count)
+{
+    struct fuse_bufvec *vector = &simfsFuseBuffers.vector;
+
+    vector->count = (size_t) count;
+    vector->idx = 0;
+    vector->off = 0;
+    for (int i = 0; i < count; i++)
+    {
+        vector->buf[i].size = segments[i].length;
+        vector->buf[i].flags = (enum fuse_buf_flags) 0;
+        vector->buf[i].mem = segments[i].data;
+        vector->buf[i].fd = -1;
+        vector->buf[i].pos = 0;
+    }
+
+    return vector;
+}
+
+/*
+ * Replies to a read with the segments, while the file is locked by simfsMapNodeRange().
+ */
+static int simfsFuseReplyData(SIMFS_SEGMENT_TYPE *segments, int count, void *argument)
+{
+    SIMFS_FUSE_TRANSFER_TYPE *transfer = argument;
+
+    transfer->replied = 1;
+    if (count == 0)
+        return fuse_reply_buf(transfer->request, NULL, 0) != 0;
+
+    return fuse_reply_data(transfer->request, simfsFuseBufferVector(segments, count), FUSE_BUF_SPLICE_MOVE) != 0;
+}
+
+/*
+ * Copies the buffers of a write request into the segments; the buffers may be in memory or in a pipe.
+ */
+static int simfsFuseCopyData(SIMFS_SEGMENT_TYPE *segments, int count, void *argument)
+{
+    SIMFS_FUSE_TRANSFER_TYPE *transfer = argument;
+    struct fuse_bufvec *destination = simfsFuseBufferVector(segments, count);
+    size_t size = fuse_buf_size(destination);
+
+    return fuse_buf_copy(destination, transfer->buffers, (enum fuse_buf_copy_flags) 0) != (ssize_t) size;
+}
+
+static int simfsFuseAddEntry(SIMFS_FUSE_LISTING_TYPE *listing, const char *name, fuse_ino_t inode, mode_t type,
+                             off_t next)
+{
+    struct stat attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.st_ino = inode;
+    attributes.st_mode = type;
+
+    size_t size = fuse_add_direntry(listing->request, listing->buffer + listing->used, listing->size - listing->used,
+                                    name, &attributes, next);
+    if (size > listing->size - listing->used)
+        return 1;
+
+    listing->used += size;
+    return 0;
+}
+
+static int simfsFuseAddFolderEntry(void *argument, long position, SIMFS_INDEX_TYPE node, SIMFS_CONTENT_TYPE type,
+                                   const char *name)
+{
+    SIMFS_FUSE_LISTING_TYPE *listing = argument;
+
+    return simfsFuseAddEntry(listing, name, simfsFuseInode(node), type == FOLDER_CONTENT_TYPE ? S_IFDIR : S_IFREG,
+                             listing->first + position + 1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// FUSE operations
+//
+//////////////////////////////////////////////////////////////////////////
+
+static void simfsFuseInit(void *userData, struct fuse_conn_info *connection)
+{
+    (void) userData;
+
+    if (connection->max_write > SIMFS_FUSE_MAX_TRANSFER)
+        connection->max_write = SIMFS_FUSE_MAX_TRANSFER;
+    connection->want |= connection->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+}
+
+static void simfsFuseLookup(fuse_req_t request, fuse_ino_t parent, const char *name)
+{
+    simfsFuseSetCaller(request);
+
+    struct fuse_entry_param entry;
+    memset(&entry, 0, sizeof(entry));
+
+    if (parent == FUSE_ROOT_ID && strcmp(name, SIMFS_STATISTICS_FILE_NAME) == 0)
+    {
+        int error = simfsFuseStatisticsAttributes(&entry.attr);
+        if (error != 0)
+        {
+            fuse_reply_err(request, error);
+            return;
+        }
+        entry.ino = SIMFS_FUSE_STATISTICS_INODE;
+        entry.entry_timeout = SIMFS_FUSE_TIMEOUT; // its attributes change all the time, so they are not cached
+        fuse_reply_entry(request, &entry);
+        return;
+    }
+
+    if (strlen(name) >= SIMFS_MAX_NAME_LENGTH)
+    {
+        fuse_reply_err(request, ENAMETOOLONG);
+        return;
+    }
+
+    SIMFS_INDEX_TYPE node;
+    SIMFS_FILE_DESCRIPTOR_TYPE descriptor;
+    SIMFS_ERROR error = simfsLookupNode(simfsFuseNode(parent), name, &node, &descriptor);
+    if (error == SIMFS_NO_ERROR)
+        simfsFuseReplyEntry(request, node, &descriptor);
+    else if (error == SIMFS_NOT_FOUND_ERROR) // the kernel keeps the name as missing
+    {
+        entry.entry_timeout = SIMFS_FUSE_TIMEOUT;
+        fuse_reply_entry(request, &entry);
+    }
+    else
+        fuse_reply_err(request, simfsFuseErrno(error));
+}
+
+static void simfsFuseGetAttributes(fuse_req_t request, fuse_ino_t inode, struct fuse_file_info *fileInfo)
+{
+    (void) fileInfo;
+    simfsFuseSetCaller(request);
+
+    struct stat attributes;
+    if (inode == SIMFS_FUSE_STATISTICS_INODE)
+    {
+        int error = simfsFuseStatisticsAttributes(&attributes);
+        if (error != 0)
+            fuse_reply_err(request, error);
+        else
+            fuse_reply_attr(request, &attributes, 0);
+        return;
+    }
+
+    SIMFS_FILE_DESCRIPTOR_TYPE descriptor;
+    SIMFS_ERROR error = simfsGetNodeInfo(simfsFuseNode(inode), &descriptor);
+    if (error != SIMFS_NO_ERROR)
+    {
+        fuse_reply_err(request, simfsFuseErrno(error));
+        return;
+    }
+
+    simfsFuseAttributes(simfsFuseNode(inode), &descriptor, &attributes);
+    fuse_reply_attr(request, &attributes, SIMFS_FUSE_TIMEOUT);
+}
+
+/*
+ * Only the size can be changed; the times are kept by the volume, and the owner and the access rights are fixed
+ * when a file is created.
+ */
+static void simfsFuseSetAttributes(fuse_req_t request, fuse_ino_t inode, struct stat *attributes, int toSet,
+                                   struct fuse_file_info *fileInfo)
+{
+    if (toSet & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))
+    {
+        fuse_reply_err(request, EPERM);
+        return;
+    }
+    if (inode == SIMFS_FUSE_STATISTICS_INODE)
+    {
+        fuse_reply_err(request, EACCES);
+        return;
+    }
+
+    simfsFuseSetCaller(request);
+
+    if (toSet & FUSE_SET_ATTR_SIZE)
+    {
+        SIMFS_ERROR error = simfsTruncateNode(simfsFuseNode(inode), (size_t) attributes->st_size);
+        if (error != SIMFS_NO_ERROR)
+        {
+            fuse_reply_err(request, simfsFuseErrno(error));
+            return;
+        }
+    }
+
+    simfsFuseGetAttributes(request, inode, fileInfo);
+}
+
+static void simfsFuseCreateNode(fuse_req_t request, fuse_ino_t parent, const char *name, SIMFS_CONTENT_TYPE type,
+                                mode_t mode, struct fuse_file_info *fileInfo)
+{
+    simfsFuseSetCaller(request);
+
+    if (strlen(name) >= SIMFS_MAX_NAME_LENGTH)
+    {
+        fuse_reply_err(request, ENAMETOOLONG);
+        return;
+    }
+
+    SIMFS_INDEX_TYPE node;
+    SIMFS_FILE_DESCRIPTOR_TYPE descriptor;
+    SIMFS_ERROR error = simfsCreateInFolder(simfsFuseNode(parent), name, type, mode & 07777, &node, &descriptor);
+    if (error != SIMFS_NO_ERROR)
+    {
+        fuse_reply_err(request, simfsFuseErrno(error));
+        return;
+    }
+
+    if (fileInfo == NULL)
+    {
+        simfsFuseReplyEntry(request, node, &descriptor);
+        return;
+    }
+
+    int entry;
+    int accessMode = fileInfo->flags & O_ACCMODE;
+    mode_t rights = (accessMode != O_WRONLY ? S_IRUSR : 0) | (accessMode != O_RDONLY ? S_IWUSR : 0);
+    error = simfsOpenNodeEntry(node, rights, &entry);
+    if (error != SIMFS_NO_ERROR)
+    {
+        fuse_reply_err(request, error == SIMFS_ALLOC_ERROR ? ENFILE : simfsFuseErrno(error));
+        return;
+    }
+
+    struct fuse_entry_param entryParameters;
+    memset(&entryParameters, 0, sizeof(entryParameters));
+    entryParameters.ino = simfsFuseInode(node);
+    entryParameters.generation = (unsigned long) descriptor.creationTime;
+    entryParameters.attr_timeout = SIMFS_FUSE_TIMEOUT;
+    entryParameters.entry_timeout = SIMFS_FUSE_TIMEOUT;
+    simfsFuseAttributes(node, &descriptor, &entryParameters.attr);
+
+    fileInfo->fh = (uint64_t) entry;
+    fileInfo->keep_cache = 1;
+    if (fuse_reply_create(request, &entryParameters, fileInfo) != 0)
+        simfsCloseNodeEntry(entry); // the request has been interrupted
+}
+
+static void simfsFuseMakeDirectory(fuse_req_t request, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    simfsFuseCreateNode(request, parent, name, FOLDER_CONTENT_TYPE, mode, NULL);
+}
+
+static void simfsFuseCreate(fuse_req_t request, fuse_ino_t parent, const char *name, mode_t mode,
+                            struct fuse_file_info *fileInfo)
+{
+    simfsFuseCreateNode(request, parent, name, FILE_CONTENT_TYPE, mode, fileInfo);
+}
+
+/*
+ * Deletes a file or a folder; the kernel has checked that the node is of the expected type.
+ */
+static void simfsFuseDelete(fuse_req_t request, fuse_ino_t parent, const char *name)
+{
+    simfsFuseSetCaller(request);
+
+    fuse_reply_err(request, simfsFuseErrno(simfsDeleteInFolder(simfsFuseNode(parent), name)));
+}
+
+static void simfsFuseOpen(fuse_req_t request, fuse_ino_t inode, struct fuse_file_info *fileInfo)
+{
+    simfsFuseSetCaller(request);
+
+    int accessMode = fileInfo->flags & O_ACCMODE;
+
+    if (inode == SIMFS_FUSE_STATISTICS_INODE) // the handle keeps a snapshot of the statistics
+    {
+        char *json;
+        if (accessMode != O_RDONLY)
+            fuse_reply_err(request, EACCES);
+        else if (simfsGetStatistics(&json) != SIMFS_NO_ERROR)
+            fuse_reply_err(request, ENOMEM);
+        else
+        {
+            fileInfo->fh = (uint64_t) (uintptr_t) json;
+            fileInfo->direct_io = 1;
+            if (fuse_reply_open(request, fileInfo) != 0)
+                free(json);
+        }
+        return;
+    }
+
+    int entry;
+    mode_t rights = (accessMode != O_WRONLY ? S_IRUSR : 0) | (accessMode != O_RDONLY ? S_IWUSR : 0);
+    SIMFS_ERROR error = simfsOpenNodeEntry(simfsFuseNode(inode), rights, &entry);
+    if (error != SIMFS_NO_ERROR)
+    {
+        fuse_reply_err(request, error == SIMFS_ALLOC_ERROR ? ENFILE : simfsFuseErrno(error));
+        return;
+    }
+
+    fileInfo->fh = (uint64_t) entry;
+    fileInfo->keep_cache = 1; // the content changes only through this mount
+    if (fuse_reply_open(request, fileInfo) != 0)
+        simfsCloseNodeEntry(entry);
+}
+
+static void simfsFuseRead(fuse_req_t request, fuse_ino_t inode, size_t size, off_t offset,
+                          struct fuse_file_info *fileInfo)
+{
+    simfsFuseSetCaller(request);
+
+    if (inode == SIMFS_FUSE_STATISTICS_INODE)
+    {
+        const char *json = (const char *) (uintptr_t) fileInfo->fh;
+        size_t length = strlen(json);
+        size_t start = (size_t) offset < length ? (size_t) offset : length;
+        fuse_reply_buf(request, json + start, length - start < size ? length - start : size);
+        return;
+    }
+
+    SIMFS_FUSE_TRANSFER_TYPE transfer = { .request = request, .buffers = NULL, .replied = 0 };
+    SIMFS_ERROR error = simfsMapNodeRange((int) fileInfo->fh, (size_t) offset, size, 0, simfsFuseSegments,
+                                          SIMFS_FUSE_MAX_SEGMENTS, simfsFuseReplyData, &transfer);
+    if (!transfer.replied)
+        fuse_reply_err(request, simfsFuseErrno(error));
+}
+
+static void simfsFuseWriteBuffers(fuse_req_t request, fuse_ino_t inode, struct fuse_bufvec *buffers, off_t offset,
+                                  struct fuse_file_info *fileInfo)
+{
+    simfsFuseSetCaller(request);
+
+    if (inode == SIMFS_FUSE_STATISTICS_INODE)
+    {
+        fuse_reply_err(request, EACCES);
+        return;
+    }
+
+    size_t size = fuse_buf_size(buffers);
+    SIMFS_FUSE_TRANSFER_TYPE transfer = { .request = request, .buffers = buffers, .replied = 0 };
+    SIMFS_ERROR error = simfsMapNodeRange((int) fileInfo->fh, (size_t) offset, size, 1, simfsFuseSegments,
+                                          SIMFS_FUSE_MAX_SEGMENTS, simfsFuseCopyData, &transfer);
+    if (error != SIMFS_NO_ERROR)
+        fuse_reply_err(request, simfsFuseErrno(error));
+    else
+        fuse_reply_write(request, size);
+}
+
+static void simfsFuseRelease(fuse_req_t request, fuse_ino_t inode, struct fuse_file_info *fileInfo)
+{
+    if (inode == SIMFS_FUSE_STATISTICS_INODE)
+        free((char *) (uintptr_t) fileInfo->fh);
+    else
+        simfsCloseNodeEntry((int) fileInfo->fh);
+
+    fuse_reply_err(request, 0);
+}
+
+static void simfsFuseSync(fuse_req_t request, fuse_ino_t inode, int dataOnly, struct fuse_file_info *fileInfo)
+{
+    (void) inode;
+    (void) dataOnly;
+    (void) fileInfo;
+
+    fuse_reply_err(request, simfsFuseErrno(simfsSyncFileSystem()));
+}
+
+/*
+ * Lists a folder; the offsets are positions in the listing: "." and ".." come first, then the statistics file in
+ * the root, and then the entries of the folder.
+ */
+static void simfsFuseReadDirectory(fuse_req_t request, fuse_ino_t inode, size_t size, off_t offset,
+                                   struct fuse_file_info *fileInfo)
+{
+    (void) fileInfo;
+    simfsFuseSetCaller(request);
+
+    SIMFS_FUSE_LISTING_TYPE listing = {
+        .request = request,
+        .buffer = simfsFuseDirectory,
+        .size = size < SIMFS_FUSE_DIRECTORY_BUFFER ? size : SIMFS_FUSE_DIRECTORY_BUFFER,
+        .used = 0,
+        .first = inode == FUSE_ROOT_ID ? 3 : 2
+    };
+
+    int full = 0;
+    if (offset < 1)
+        full = simfsFuseAddEntry(&listing, ".", inode, S_IFDIR, 1);
+    if (!full && offset < 2)
+        full = simfsFuseAddEntry(&listing, "..", FUSE_ROOT_ID, S_IFDIR, 2); // the parent of a folder is not kept
+    if (!full && offset < 3 && inode == FUSE_ROOT_ID)
+        full = simfsFuseAddEntry(&listing, SIMFS_STATISTICS_FILE_NAME, SIMFS_FUSE_STATISTICS_INODE, S_IFREG, 3);
+
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (!full)
+        error = simfsListFolder(simfsFuseNode(inode), offset > listing.first ? (long) (offset - listing.first) : 0,
+                                simfsFuseAddFolderEntry, &listing);
+
+    if (error != SIMFS_NO_ERROR)
+        fuse_reply_err(request, simfsFuseErrno(error));
+    else
+        fuse_reply_buf(request, listing.buffer, listing.used);
+}
+
+static void simfsFuseStatistics(fuse_req_t request, fuse_ino_t inode)
+{
+    (void) inode;
+
+    SIMFS_INDEX_TYPE numberOfBlocks, freeBlocks;
+    unsigned int blockSize;
+    simfsGetUsage(&numberOfBlocks, &freeBlocks, &blockSize);
+
+    struct statvfs status;
+    memset(&status, 0, sizeof(status));
+    status.f_bsize = blockSize;
+    status.f_frsize = blockSize;
+    status.f_blocks = numberOfBlocks;
+    status.f_bfree = freeBlocks;
+    status.f_bavail = freeBlocks;
+    status.f_files = numberOfBlocks; // every file or folder takes a block for its descriptor
+    status.f_ffree = freeBlocks;
+    status.f_favail = freeBlocks;
+    status.f_namemax = SIMFS_MAX_NAME_LENGTH - 1;
+
+    fuse_reply_statfs(request, &status);
+}
+
+static const struct fuse_lowlevel_ops simfsFuseOperations = {
+    .init = simfsFuseInit,
+    .lookup = simfsFuseLookup,
+    .getattr = simfsFuseGetAttributes,
+    .setattr = simfsFuseSetAttributes,
+    .mkdir = simfsFuseMakeDirectory,
+    .unlink = simfsFuseDelete,
+    .rmdir = simfsFuseDelete,
+    .open = simfsFuseOpen,
+    .read = simfsFuseRead,
+    .release = simfsFuseRelease,
+    .fsync = simfsFuseSync,
+    .readdir = simfsFuseReadDirectory,
+    .fsyncdir = simfsFuseSync,
+    .statfs = simfsFuseStatistics,
+    .create = simfsFuseCreate,
+    .write_buf = simfsFuseWriteBuffers
+};
+
+int main(int argc, char *argv[])
+{
+    int format = argc > 1 && strcmp(argv[1], "--format") == 0;
+    if (format) // the option is not an argument of FUSE
+    {
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s [--format] image mountpoint [FUSE options]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *image = argv[1];
+    argv[1] = argv[0]; // the image is not an argument of FUSE
+    struct fuse_args arguments = FUSE_ARGS_INIT(argc - 1, argv + 1);
+
+    char maxRead[32];
+    snprintf(maxRead, sizeof(maxRead), "-omax_read=%d", SIMFS_FUSE_MAX_TRANSFER);
+
+    char *mountPoint = NULL;
+    int multiThreaded;
+    int foreground;
+    if (fuse_opt_add_arg(&arguments, maxRead) != 0
+        || fuse_parse_cmdline(&arguments, &mountPoint, &multiThreaded, &foreground) != 0 || mountPoint == NULL)
+    {
+        fprintf(stderr, "usage: %s [--format] image mountpoint [FUSE options]\n", argv[0]);
+        fuse_opt_free_args(&arguments);
+        return EXIT_FAILURE;
+    }
+
+    SIMFS_ERROR mounted = simfsMountVolumeFile(image, format);
+    if (mounted != SIMFS_NO_ERROR)
+    {
+        fprintf(stderr, "%s: cannot mount %s: %s\n", argv[0], image,
+                mounted == SIMFS_NOT_FOUND_ERROR ? "cannot open the file"
+                : mounted == SIMFS_VERSION_ERROR ? "the volume has the layout of an earlier version"
+                : mounted == SIMFS_READ_ERROR ? "the file does not hold a volume" : "cannot map the volume");
+        fuse_opt_free_args(&arguments);
+        return EXIT_FAILURE;
+    }
+
+    int error = -1;
+    struct fuse_chan *channel = fuse_mount(mountPoint, &arguments);
+    if (channel != NULL)
+    {
+        struct fuse_session *session = fuse_lowlevel_new(&arguments, &simfsFuseOperations,
+                                                         sizeof(simfsFuseOperations), NULL);
+        if (session != NULL)
+        {
+            if (fuse_set_signal_handlers(session) == 0)
+            {
+                fuse_session_add_chan(session, channel);
+                fuse_daemonize(foreground);
+
+                error = multiThreaded ? fuse_session_loop_mt(session) : fuse_session_loop(session);
+
+                fuse_remove_signal_handlers(session);
+                fuse_session_remove_chan(channel);
+            }
+            fuse_session_destroy(session);
+        }
+        fuse_unmount(mountPoint, channel);
+    }
+
+    simfsUnmountFileSystem();
+    fuse_opt_free_args(&arguments);
+    free(mountPoint);
+
+    return error == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
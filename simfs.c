@@ -1,225 +1,6203 @@
 
 #include "simfs.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 //////////////////////////////////////////////////////////////////////////
 //
 // allocation of the in-memory data structures
 //
 //////////////////////////////////////////////////////////////////////////
 
-SIMFS_CONTEXT_TYPE simfsContext; // all in-memory information about the system
+SIMFS_CONTEXT_TYPE simfsContext; // all in-memory information about the system
+
+//////////////////////////////////////////////////////////////////////////
+//
+// helper functions
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_BLOCK(index) \
+    (*(SIMFS_BLOCK_TYPE *) (simfsContext.blocks + ((size_t) (index) << simfsContext.geometry.blockShift)))
+#define SIMFS_DESCRIPTOR(index) (SIMFS_BLOCK(index).content.fileDescriptor)
+#define SIMFS_BLOCKS_FOR(size) (((size) + simfsContext.geometry.dataSize - 1) / simfsContext.geometry.dataSize)
+#define SIMFS_IS_INLINE(descriptor) ((descriptor).numberOfExtents == 0) // the content is in the descriptor block
+#define SIMFS_DATA_SIZE_OF(blockSize) ((size_t) (blockSize) - offsetof(SIMFS_BLOCK_TYPE, content))
+#define SIMFS_VOLUME_BITVECTOR(fileSystem) ((char *) (fileSystem) + simfsContext.geometry.blockSize)
+
+_Static_assert(sizeof(SIMFS_BLOCK_TYPE) <= SIMFS_MIN_BLOCK_SIZE, "the block structures must fit the smallest block");
+_Static_assert(SIMFS_DATA_SIZE_OF(SIMFS_MIN_BLOCK_SIZE) == SIMFS_MIN_DATA_SIZE, "SIMFS_MIN_DATA_SIZE is stale");
+_Static_assert(SIMFS_MIN_DATA_SIZE - offsetof(SIMFS_FOLDER_BLOCK_TYPE, entries) == SIMFS_MIN_FOLDER_SIZE,
+               "SIMFS_MIN_FOLDER_SIZE is stale");
+
+static _Thread_local struct fuse_context simfsCaller; // set by simfsSetCaller() or simfs_debug_set_context()
+static _Thread_local int simfsCallerSet;
+static _Thread_local struct fuse_context simfsDebugContext; // returned by simfs_debug_get_context()
+
+/*
+ * Obtains the user ID, the process ID, and the umask of the caller: the ones set for the calling thread, or the
+ * simulated ones of simfs_debug_get_context().
+ */
+static void simfsGetCaller(uid_t *uid, pid_t *pid, mode_t *umask)
+{
+    struct fuse_context *context = simfsCallerSet ? &simfsCaller : simfs_debug_get_context();
+
+    if (uid != NULL)
+        *uid = context->uid;
+    if (pid != NULL)
+        *pid = context->pid;
+    if (umask != NULL)
+        *umask = context->umask;
+}
+
+/*
+ * Makes room for one more element in an array grown by doubling; returns 0 if there is no memory for it.
+ */
+static int simfsGrow(void **array, int *capacity, int count, size_t elementSize)
+{
+    if (count < *capacity)
+        return 1;
+
+    int grown = *capacity == 0 ? 64 : *capacity * 2;
+    void *larger = realloc(*array, grown * elementSize);
+    if (larger == NULL)
+        return 0;
+
+    *array = larger;
+    *capacity = grown;
+    return 1;
+}
+
+/*
+ * Checks if the user can access a file with the given owner and access rights. The right is given as the
+ * user permission (S_IRUSR or S_IWUSR); the corresponding permission for others is used for non-owners.
+ */
+static int simfsHasAccess(mode_t accessRights, uid_t owner, uid_t uid, mode_t userRight)
+{
+    if (uid == 0)
+        return 1;
+
+    if (uid == owner)
+        return (accessRights & userRight) != 0;
+
+    return (accessRights & (userRight >> 6)) != 0; // S_IRUSR >> 6 == S_IROTH, S_IWUSR >> 6 == S_IWOTH
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// statistics
+//
+// The operations and the helpers of the directory, the allocator, and the cache count into counters of the calling
+// thread, which are registered in a list the first time the thread counts, and folded into the retired counters
+// when it exits. A thread writes only its own counters, with relaxed atomic stores, so the statistics are read at
+// any time without stopping the operations.
+//
+//////////////////////////////////////////////////////////////////////////
+
+static pthread_mutex_t simfsStatisticsLock = PTHREAD_MUTEX_INITIALIZER; // protects the list and the retired counters
+static SIMFS_STATISTICS_TYPE *simfsThreadStatistics; // the counters of the running threads
+static SIMFS_STATISTICS_TYPE simfsRetiredStatistics; // the counters of the threads that have exited
+static pthread_key_t simfsStatisticsKey; // retires the counters of an exiting thread
+static _Thread_local SIMFS_STATISTICS_TYPE *simfsStatistics; // the counters of the calling thread
+
+#define SIMFS_NUMBER_OF_COUNTERS (offsetof(SIMFS_STATISTICS_TYPE, next) / sizeof(uint64_t))
+#define SIMFS_COUNT(counter, amount)                                     \
+    do                                                                   \
+    {                                                                    \
+        SIMFS_STATISTICS_TYPE *counters = simfsCounters();               \
+        if (counters != NULL)                                            \
+            simfsIncrement(&counters->counter, (amount));                \
+    } while (0)
+
+_Static_assert(offsetof(SIMFS_STATISTICS_TYPE, next) % sizeof(uint64_t) == 0, "the counters must be 64-bit words");
+
+/*
+ * Adds the counters of a thread to a sum; the longest probe is the maximum of both.
+ */
+static void simfsAddStatistics(SIMFS_STATISTICS_TYPE *sum, SIMFS_STATISTICS_TYPE *statistics)
+{
+    uint64_t longest = sum->longestDirectoryProbe;
+    uint64_t *to = (uint64_t *) sum;
+    uint64_t *from = (uint64_t *) statistics;
+
+    for (size_t i = 0; i < SIMFS_NUMBER_OF_COUNTERS; i++)
+        to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+
+    uint64_t probe = __atomic_load_n(&statistics->longestDirectoryProbe, __ATOMIC_RELAXED);
+    sum->longestDirectoryProbe = probe > longest ? probe : longest;
+}
+
+static void simfsRetireStatistics(void *statistics)
+{
+    pthread_mutex_lock(&simfsStatisticsLock);
+
+    SIMFS_STATISTICS_TYPE **link = &simfsThreadStatistics;
+    while (*link != statistics)
+        link = &(*link)->next;
+    *link = (*link)->next;
+
+    simfsAddStatistics(&simfsRetiredStatistics, statistics);
+
+    pthread_mutex_unlock(&simfsStatisticsLock);
+
+    free(statistics);
+}
+
+static void simfsCreateStatisticsKey()
+{
+    pthread_key_create(&simfsStatisticsKey, simfsRetireStatistics);
+}
+
+/*
+ * Registers the counters of the calling thread; returns NULL if there is no memory for them, and the thread does
+ * not count until it succeeds.
+ */
+static SIMFS_STATISTICS_TYPE *simfsRegisterCounters()
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, simfsCreateStatisticsKey);
+
+    SIMFS_STATISTICS_TYPE *statistics = calloc(1, sizeof(SIMFS_STATISTICS_TYPE));
+    if (statistics == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&simfsStatisticsLock);
+    statistics->next = simfsThreadStatistics;
+    simfsThreadStatistics = statistics;
+    pthread_mutex_unlock(&simfsStatisticsLock);
+
+    pthread_setspecific(simfsStatisticsKey, statistics);
+    simfsStatistics = statistics;
+
+    return statistics;
+}
+
+static inline SIMFS_STATISTICS_TYPE *simfsCounters()
+{
+    return simfsStatistics != NULL ? simfsStatistics : simfsRegisterCounters();
+}
+
+/*
+ * Adds to a counter of the calling thread; only the thread writes it, so there is no need for a locked add.
+ */
+static inline void simfsIncrement(uint64_t *counter, uint64_t amount)
+{
+    __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+}
+
+/*
+ * Counts a lookup in the directory that visited the given number of slots.
+ */
+static inline void simfsCountProbes(uint64_t probes)
+{
+    SIMFS_STATISTICS_TYPE *counters = simfsCounters();
+    if (counters == NULL)
+        return;
+
+    simfsIncrement(&counters->directoryLookups, 1);
+    simfsIncrement(&counters->directoryProbes, probes);
+    if (probes > counters->longestDirectoryProbe)
+        __atomic_store_n(&counters->longestDirectoryProbe, probes, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t simfsNanoseconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+/*
+ * Counts a call of an operation started at the given time (see simfsNanoseconds()), and passes its result on.
+ */
+static SIMFS_ERROR simfsCountOperation(SIMFS_OPERATION_TYPE operation, uint64_t started, SIMFS_ERROR error)
+{
+    uint64_t elapsed = simfsNanoseconds() - started;
+
+    SIMFS_STATISTICS_TYPE *counters = simfsCounters();
+    if (counters == NULL)
+        return error;
+
+    int bucket = elapsed == 0 ? 0 : 64 - __builtin_clzll(elapsed);
+    if (bucket >= SIMFS_LATENCY_BUCKETS)
+        bucket = SIMFS_LATENCY_BUCKETS - 1;
+
+    simfsIncrement(&counters->calls[operation], 1);
+    if (error != SIMFS_NO_ERROR)
+        simfsIncrement(&counters->errors[operation], 1);
+    simfsIncrement(&counters->nanoseconds[operation], elapsed);
+    simfsIncrement(&counters->latency[operation][bucket], 1);
+
+    return error;
+}
+
+/*
+ * Sums the counters of all threads, the running and the exited ones.
+ */
+static void simfsSumStatistics(SIMFS_STATISTICS_TYPE *sum)
+{
+    pthread_mutex_lock(&simfsStatisticsLock);
+
+    *sum = simfsRetiredStatistics;
+    for (SIMFS_STATISTICS_TYPE *statistics = simfsThreadStatistics; statistics != NULL; statistics = statistics->next)
+        simfsAddStatistics(sum, statistics);
+
+    pthread_mutex_unlock(&simfsStatisticsLock);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// geometry
+//
+// A volume is formatted with any power-of-two block size from SIMFS_MIN_BLOCK_SIZE to SIMFS_MAX_BLOCK_SIZE and any
+// multiple of 64 blocks up to SIMFS_MAX_NUMBER_OF_BLOCKS. The superblock takes the first block, the bitvector and
+// the reference counts the following whole blocks, then comes the journal, and the blocks of the file system come
+// after it, aligned to the block size; so blocks of the size of a page line up with the pages of a mapped image.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Derives the geometry of a volume from its block size and number of blocks; returns 0 if they are not supported.
+ */
+static int simfsComputeGeometry(unsigned int blockSize, SIMFS_INDEX_TYPE numberOfBlocks, SIMFS_GEOMETRY_TYPE *geometry)
+{
+    if (blockSize < SIMFS_MIN_BLOCK_SIZE || blockSize > SIMFS_MAX_BLOCK_SIZE || (blockSize & (blockSize - 1)) != 0
+        || numberOfBlocks == 0 || numberOfBlocks > SIMFS_MAX_NUMBER_OF_BLOCKS || numberOfBlocks % 64 != 0)
+        return 0;
+
+    geometry->blockSize = blockSize;
+    geometry->blockShift = __builtin_ctz(blockSize);
+    geometry->numberOfBlocks = numberOfBlocks;
+    geometry->dataSize = SIMFS_DATA_SIZE_OF(blockSize);
+    geometry->inlineSize = geometry->dataSize - offsetof(SIMFS_FILE_DESCRIPTOR_TYPE, inlineData);
+    geometry->folderSize = geometry->dataSize - offsetof(SIMFS_FOLDER_BLOCK_TYPE, entries);
+    geometry->extentsPerBlock = (int) ((geometry->dataSize - offsetof(SIMFS_EXTENT_BLOCK_TYPE, extent))
+                                       / sizeof(SIMFS_EXTENT_TYPE));
+    geometry->bitvectorWords = (int) (numberOfBlocks / 64);
+    geometry->summaryWords = (geometry->bitvectorWords + 63) / 64;
+    geometry->topWords = (geometry->summaryWords + 63) / 64;
+
+    size_t bitvectorBlocks = (numberOfBlocks / 8 + blockSize - 1) / blockSize;
+    size_t referenceBlocks = ((size_t) numberOfBlocks * sizeof(SIMFS_INDEX_TYPE) + blockSize - 1) / blockSize;
+    geometry->referencesOffset = (1 + bitvectorBlocks) * blockSize;
+    geometry->headerBlocks = (int) (1 + bitvectorBlocks + referenceBlocks);
+    geometry->journalOffset = (size_t) geometry->headerBlocks * blockSize;
+
+    size_t journalSize = (size_t) numberOfBlocks * blockSize / 32;
+    if (journalSize < SIMFS_MIN_JOURNAL_SIZE)
+        journalSize = SIMFS_MIN_JOURNAL_SIZE;
+    if (journalSize > SIMFS_MAX_JOURNAL_SIZE)
+        journalSize = SIMFS_MAX_JOURNAL_SIZE;
+    geometry->journalBlocks = (SIMFS_INDEX_TYPE) (journalSize / blockSize);
+    if (geometry->journalBlocks < SIMFS_MIN_JOURNAL_BLOCKS)
+        geometry->journalBlocks = SIMFS_MIN_JOURNAL_BLOCKS;
+
+    geometry->blocksOffset = geometry->journalOffset + (size_t) geometry->journalBlocks * blockSize;
+    geometry->volumeSize = geometry->blocksOffset + (size_t) numberOfBlocks * blockSize;
+
+    return 1;
+}
+
+/*
+ * Makes the geometry of a volume the geometry of the context, and allocates the in-memory bitvector and the
+ * records of changed blocks for it. They are allocated before the ones of the context are freed, so the context is
+ * left unchanged if an allocation fails.
+ */
+static SIMFS_ERROR simfsUseGeometry(SIMFS_VOLUME *fileSystem, const SIMFS_GEOMETRY_TYPE *geometry)
+{
+    uint64_t *bitvector = malloc(geometry->bitvectorWords * sizeof(uint64_t));
+    uint64_t *bitvectorSummary = malloc(geometry->summaryWords * sizeof(uint64_t));
+    uint64_t *bitvectorTop = malloc(geometry->topWords * sizeof(uint64_t));
+    uint64_t *bitvectorDirty = calloc(geometry->summaryWords, sizeof(uint64_t));
+    uint64_t *headerDirty = calloc((geometry->headerBlocks + 63) / 64, sizeof(uint64_t));
+    uint64_t *volumeDirty = calloc(geometry->bitvectorWords, sizeof(uint64_t));
+
+    if (bitvector == NULL || bitvectorSummary == NULL || bitvectorTop == NULL || bitvectorDirty == NULL
+        || headerDirty == NULL || volumeDirty == NULL)
+    {
+        free(bitvector);
+        free(bitvectorSummary);
+        free(bitvectorTop);
+        free(bitvectorDirty);
+        free(headerDirty);
+        free(volumeDirty);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    free(simfsContext.bitvector);
+    free(simfsContext.bitvectorSummary);
+    free(simfsContext.bitvectorTop);
+    free(simfsContext.bitvectorDirty);
+    free(simfsContext.headerDirty);
+    free(simfsContext.volumeDirty);
+
+    simfsContext.geometry = *geometry;
+    simfsContext.blocks = (char *) fileSystem + geometry->blocksOffset;
+    simfsContext.references = (SIMFS_INDEX_TYPE *) ((char *) fileSystem + geometry->referencesOffset);
+    simfsContext.bitvector = bitvector;
+    simfsContext.bitvectorSummary = bitvectorSummary;
+    simfsContext.bitvectorTop = bitvectorTop;
+    simfsContext.bitvectorDirty = bitvectorDirty;
+    simfsContext.headerDirty = headerDirty;
+    simfsContext.volumeDirty = volumeDirty;
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// changed parts of the volume
+//
+// A volume mapped from an image file is written back by the commits of its journal; to write only what changed,
+// every write to the volume records the blocks it touches (of the header, i.e., the superblock, the bitvector, and
+// the reference counts, or of the file system).
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Records a change of the given range of the volume.
+ */
+static void simfsMarkVolumeDirty(const void *address, size_t length)
+{
+    const char *blocks = simfsContext.blocks;
+    const char *start = address;
+
+    if (start < blocks)
+    {
+        const char *volume = blocks - simfsContext.geometry.blocksOffset;
+        size_t end = (size_t) (start + length - volume);
+        if (end > simfsContext.geometry.journalOffset) // the journal is written to the image file only
+            end = simfsContext.geometry.journalOffset;
+
+        for (size_t block = (size_t) (start - volume) >> simfsContext.geometry.blockShift;
+             block <= (end - 1) >> simfsContext.geometry.blockShift; block++)
+            __atomic_fetch_or(&simfsContext.headerDirty[block >> 6], (uint64_t) 1 << (block & 63), __ATOMIC_RELEASE);
+
+        if (start + length <= blocks)
+            return;
+        length -= blocks - start;
+        start = blocks;
+    }
+
+    size_t first = (size_t) (start - blocks) >> simfsContext.geometry.blockShift;
+    size_t last = (size_t) (start + length - 1 - blocks) >> simfsContext.geometry.blockShift;
+    for (size_t block = first; block <= last; block++)
+        __atomic_fetch_or(&simfsContext.volumeDirty[block >> 6], (uint64_t) 1 << (block & 63), __ATOMIC_RELEASE);
+}
+
+#define SIMFS_MARK_DIRTY(object) simfsMarkVolumeDirty(&(object), sizeof(object))
+
+//////////////////////////////////////////////////////////////////////////
+//
+// bitvector
+//
+// The in-memory bitvector is kept in 64-bit words, so the allocator can skip 64 used blocks with one test and
+// find a free block in a word with count-trailing-zeros. Two summary levels on top of it let the allocator skip
+// used regions quickly on a nearly full volume:
+//
+//    - bitvectorSummary has one bit per bitvector word; the bit is set when the word has no free block
+//    - bitvectorTop has one bit per summary word; the bit is set when all its bits are set
+//
+// All words are changed with atomic operations, so threads allocate and free blocks without locks. Blocks are
+// claimed with a compare-and-swap on their word; the summaries are hints that are corrected by whoever changes
+// the word last.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Marks the directory snapshot on the volume as stale; called on every change of the directory.
+ */
+static inline void simfsInvalidateSnapshot()
+{
+    int *valid = &simfsContext.volume->superblock.attr.snapshotValid;
+
+    if (__atomic_load_n(valid, __ATOMIC_ACQUIRE) != 0)
+    {
+        __atomic_store_n(valid, 0, __ATOMIC_RELEASE);
+        SIMFS_MARK_DIRTY(*valid);
+    }
+}
+
+#define SIMFS_ALL_BITS (~(uint64_t) 0)
+#define SIMFS_BIT(n) ((uint64_t) 1 << (n))
+#define SIMFS_LOAD(variable) __atomic_load_n(&(variable), __ATOMIC_SEQ_CST)
+
+/*
+ * The volume bitvector holds the bit for block i in bit (i % 8) of byte (i / 8), which is the memory layout of
+ * the 64-bit words on a little-endian host; on a big-endian host the words are byte-swapped when copied.
+ */
+static inline uint64_t simfsVolumeWord(uint64_t word)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(word);
+#else
+    return word;
+#endif
+}
+
+static inline int simfsIsBlockUsed(SIMFS_INDEX_TYPE block)
+{
+    return (SIMFS_LOAD(simfsContext.bitvector[block >> 6]) >> (block & 63)) & 1;
+}
+
+/*
+ * Sets or clears a bit of a summary word to reflect whether the watched word is full, and repeats until the
+ * watched word did not change its state meanwhile. A thread that changes the state of the watched word later
+ * updates the summary bit after it, so the last update always wins.
+ */
+static inline void simfsUpdateSummaryBit(uint64_t *summary, int bit, uint64_t *watched)
+{
+    uint64_t value;
+
+    do
+    {
+        value = SIMFS_LOAD(*watched);
+        if (value == SIMFS_ALL_BITS)
+            __atomic_fetch_or(summary, SIMFS_BIT(bit), __ATOMIC_SEQ_CST);
+        else
+            __atomic_fetch_and(summary, ~SIMFS_BIT(bit), __ATOMIC_SEQ_CST);
+    }
+    while ((SIMFS_LOAD(*watched) == SIMFS_ALL_BITS) != (value == SIMFS_ALL_BITS));
+}
+
+/*
+ * Updates both summary levels after a change of a bitvector word, and records the word for the next flush.
+ */
+static inline void simfsUpdateSummary(int word)
+{
+    int summaryWord = word >> 6;
+
+    simfsUpdateSummaryBit(&simfsContext.bitvectorSummary[summaryWord], word & 63, &simfsContext.bitvector[word]);
+    simfsUpdateSummaryBit(&simfsContext.bitvectorTop[summaryWord >> 6], summaryWord & 63,
+                          &simfsContext.bitvectorSummary[summaryWord]);
+
+    __atomic_fetch_or(&simfsContext.bitvectorDirty[summaryWord], SIMFS_BIT(word & 63), __ATOMIC_RELEASE);
+}
+
+/*
+ * Marks a run of blocks as used or free one word at a time.
+ */
+static void simfsMarkRun(int start, int length, int used)
+{
+    while (length > 0)
+    {
+        int word = start >> 6;
+        int bit = start & 63;
+        int count = 64 - bit < length ? 64 - bit : length;
+        uint64_t mask = (count == 64 ? SIMFS_ALL_BITS : SIMFS_BIT(count) - 1) << bit;
+
+        if (used)
+            __atomic_fetch_or(&simfsContext.bitvector[word], mask, __ATOMIC_SEQ_CST);
+        else
+            __atomic_fetch_and(&simfsContext.bitvector[word], ~mask, __ATOMIC_SEQ_CST);
+        simfsUpdateSummary(word);
+
+        start += count;
+        length -= count;
+    }
+}
+
+/*
+ * Returns the first bitvector word at or after the given one that has a free block according to the summaries;
+ * the search wraps around the end of the volume. Returns -1 if the volume is full.
+ */
+static int simfsFindFreeWord(int word)
+{
+    uint64_t scans = 0;
+    int found = -1;
+
+    for (int pass = 0; pass < 2 && found < 0; pass++, word = 0)
+    {
+        int summaryWord = word >> 6;
+        uint64_t free = ~SIMFS_LOAD(simfsContext.bitvectorSummary[summaryWord]) & (SIMFS_ALL_BITS << (word & 63));
+        if (free != 0)
+        {
+            found = (summaryWord << 6) + __builtin_ctzll(free);
+            break;
+        }
+
+        for (summaryWord++; summaryWord < simfsContext.geometry.summaryWords && found < 0;
+             summaryWord = ((summaryWord >> 6) + 1) << 6)
+        {
+            scans++;
+            free = ~SIMFS_LOAD(simfsContext.bitvectorTop[summaryWord >> 6]) & (SIMFS_ALL_BITS << (summaryWord & 63));
+            if (free != 0)
+            {
+                summaryWord = ((summaryWord >> 6) << 6) + __builtin_ctzll(free);
+                free = ~SIMFS_LOAD(simfsContext.bitvectorSummary[summaryWord]);
+                if (free != 0)
+                    found = (summaryWord << 6) + __builtin_ctzll(free);
+            }
+        }
+    }
+
+    SIMFS_COUNT(freeWordSearches, 1);
+    SIMFS_COUNT(freeWordScans, scans);
+
+    return found;
+}
+
+/*
+ * Claims the run of free blocks starting at the given bit of a word, but at most maxLength blocks. Returns the
+ * number of blocks claimed, which is 0 if the first block has been taken by another thread meanwhile.
+ */
+static int simfsClaimRun(int word, int bit, int maxLength)
+{
+    uint64_t value = SIMFS_LOAD(simfsContext.bitvector[word]);
+
+    for (;;)
+    {
+        uint64_t used = ~(~value >> bit); // bits above the word are shifted in as used
+        int run = used == 0 ? 64 : __builtin_ctzll(used);
+        if (run > maxLength)
+            run = maxLength;
+        if (run == 0)
+            return 0;
+
+        uint64_t mask = (run == 64 ? SIMFS_ALL_BITS : SIMFS_BIT(run) - 1) << bit;
+        if (__atomic_compare_exchange_n(&simfsContext.bitvector[word], &value, value | mask, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            simfsUpdateSummary(word);
+            return run;
+        }
+    }
+}
+
+/*
+ * Finds a run of at most maxLength free blocks and marks them as used.
+ *
+ * The search starts where the previous one has stopped (next fit), so consecutive allocations hand out
+ * contiguous blocks on a volume that is not fragmented. The first block of the run is returned through
+ * the parameter start, and the length of the run is the return value; 0 means that the volume is full.
+ *
+ * The cost does not depend on how full the volume is: used words are skipped through the summaries, and the
+ * run is claimed a word at a time.
+ */
+static int simfsAllocateRun(int maxLength, SIMFS_INDEX_TYPE *start)
+{
+    if (maxLength <= 0)
+        return 0;
+
+    for (;;)
+    {
+        if (SIMFS_LOAD(simfsContext.numberOfFreeBlocks) == 0)
+            return 0;
+
+        int hint = SIMFS_LOAD(simfsContext.nextFreeBlock);
+        int word = hint >> 6;
+        uint64_t free = ~SIMFS_LOAD(simfsContext.bitvector[word]) & (SIMFS_ALL_BITS << (hint & 63));
+        if (free == 0)
+        {
+            word = simfsFindFreeWord((word + 1) % simfsContext.geometry.bitvectorWords);
+            if (word < 0)
+                return 0;
+            free = ~SIMFS_LOAD(simfsContext.bitvector[word]);
+            if (free == 0) // the word has been filled meanwhile
+            {
+                SIMFS_COUNT(allocationRetries, 1);
+                continue;
+            }
+        }
+
+        int block = (word << 6) + __builtin_ctzll(free);
+        int length = simfsClaimRun(word, block & 63, maxLength);
+        if (length == 0) // the block has been taken meanwhile
+        {
+            SIMFS_COUNT(allocationRetries, 1);
+            continue;
+        }
+
+        // the run continues in the next words as long as it reaches the end of a word
+        while (length < maxLength && ((block + length) & 63) == 0 && ++word < simfsContext.geometry.bitvectorWords)
+        {
+            int run = simfsClaimRun(word, 0, maxLength - length);
+            length += run;
+            if (run == 0)
+                break;
+        }
+
+        __atomic_fetch_sub(&simfsContext.numberOfFreeBlocks, length, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&simfsContext.nextFreeBlock, (block + length) % simfsContext.geometry.numberOfBlocks,
+                         __ATOMIC_RELAXED);
+        *start = block;
+
+        SIMFS_COUNT(allocations, 1);
+        SIMFS_COUNT(allocatedBlocks, (uint64_t) length);
+
+        return length;
+    }
+}
+
+/*
+ * Allocates a single block; returns SIMFS_INVALID_INDEX if there is no free block.
+ */
+static SIMFS_INDEX_TYPE simfsAllocateBlock()
+{
+    SIMFS_INDEX_TYPE block;
+
+    if (simfsAllocateRun(1, &block) == 0)
+        return SIMFS_INVALID_INDEX;
+
+    return block;
+}
+
+static void simfsReleaseRun(SIMFS_INDEX_TYPE start, int length)
+{
+    simfsMarkRun(start, length, 0);
+    __atomic_fetch_add(&simfsContext.numberOfFreeBlocks, length, __ATOMIC_SEQ_CST);
+
+    SIMFS_COUNT(freedBlocks, (uint64_t) length);
+}
+
+/*
+ * Frees a run of blocks. With a journal, the run is released only when the transaction freeing it is captured (see
+ * simfsCaptureTransaction()), so its blocks are not reused before their release is committed; an operation that
+ * runs out of space meanwhile is retried after the commit (see simfsReclaimFreedBlocks()). If the list of such runs
+ * cannot grow, the run is released at once.
+ */
+static void simfsFreeRun(SIMFS_INDEX_TYPE start, int length)
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+
+    if (journal->active)
+    {
+        pthread_mutex_lock(&journal->freedLock);
+        int deferred = simfsGrow((void **) &journal->freed, &journal->freedCapacity, journal->numberOfFreed,
+                                 sizeof(SIMFS_EXTENT_TYPE));
+        if (deferred)
+            journal->freed[journal->numberOfFreed++] = (SIMFS_EXTENT_TYPE) { start, (SIMFS_INDEX_TYPE) length };
+        pthread_mutex_unlock(&journal->freedLock);
+
+        if (deferred)
+            return;
+    }
+
+    simfsReleaseRun(start, length);
+}
+
+/*
+ * Initializes the in-memory bitvector, its summaries and the free block count from the volume.
+ */
+static void simfsLoadBitvector(SIMFS_VOLUME *fileSystem)
+{
+    SIMFS_GEOMETRY_TYPE *geometry = &simfsContext.geometry;
+
+    memset(simfsContext.bitvectorSummary, 0xFF, geometry->summaryWords * sizeof(uint64_t));
+    memset(simfsContext.bitvectorTop, 0xFF, geometry->topWords * sizeof(uint64_t));
+    simfsContext.numberOfFreeBlocks = 0;
+    simfsContext.nextFreeBlock = 0;
+
+    for (int word = 0; word < geometry->bitvectorWords; word++)
+    {
+        uint64_t value;
+        memcpy(&value, SIMFS_VOLUME_BITVECTOR(fileSystem) + word * sizeof(uint64_t), sizeof(uint64_t));
+        simfsContext.bitvector[word] = simfsVolumeWord(value);
+        simfsContext.numberOfFreeBlocks += 64 - __builtin_popcountll(simfsContext.bitvector[word]);
+        if (simfsContext.bitvector[word] != SIMFS_ALL_BITS)
+            simfsContext.bitvectorSummary[word >> 6] &= ~SIMFS_BIT(word & 63);
+    }
+
+    for (int summaryWord = 0; summaryWord < geometry->summaryWords; summaryWord++)
+        if (simfsContext.bitvectorSummary[summaryWord] != SIMFS_ALL_BITS)
+            simfsContext.bitvectorTop[summaryWord >> 6] &= ~SIMFS_BIT(summaryWord & 63);
+
+    memset(simfsContext.bitvectorDirty, 0, geometry->summaryWords * sizeof(uint64_t));
+}
+
+/*
+ * Copies the bitvector words modified since the last flush to the bitvector blocks on the simulated disk; the
+ * caller holds the dirtyLock. A word changed again while it is copied is recorded again for the next flush.
+ */
+static void simfsFlushBitvector()
+{
+    for (int summaryWord = 0; summaryWord < simfsContext.geometry.summaryWords; summaryWord++)
+    {
+        uint64_t dirty = __atomic_exchange_n(&simfsContext.bitvectorDirty[summaryWord], 0, __ATOMIC_ACQUIRE);
+
+        while (dirty != 0)
+        {
+            int word = (summaryWord << 6) + __builtin_ctzll(dirty);
+            uint64_t value = simfsVolumeWord(SIMFS_LOAD(simfsContext.bitvector[word]));
+            char *volumeWord = SIMFS_VOLUME_BITVECTOR(simfsContext.volume) + word * sizeof(uint64_t);
+
+            memcpy(volumeWord, &value, sizeof(uint64_t));
+            simfsMarkVolumeDirty(volumeWord, sizeof(uint64_t));
+            dirty &= dirty - 1;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// shared blocks
+//
+// A clone of a file shares the data blocks of the file (see simfsCloneFile()). The reference count of a block, kept
+// on the volume next to the bitvector, counts its references besides the first, so it is 0 for the blocks of a single
+// file and for free blocks, and a new volume needs no counts. A file gets its own copies of shared blocks before it
+// writes to them (copy-on-write; see simfsUnshareContent()), and a shared block is freed by dropping its last
+// reference.
+//
+// The counts are changed with atomic operations. A count that is 0 is raised only by cloning the one file holding
+// the block, which excludes writers of that file; so a writer that finds a count of 0 may write the block in place.
+//
+//////////////////////////////////////////////////////////////////////////
+
+static inline int simfsIsBlockShared(SIMFS_INDEX_TYPE block)
+{
+    return SIMFS_LOAD(simfsContext.references[block]) != 0;
+}
+
+/*
+ * Adds a reference to every block of a run.
+ */
+static void simfsShareRun(SIMFS_INDEX_TYPE start, SIMFS_INDEX_TYPE length)
+{
+    for (SIMFS_INDEX_TYPE i = 0; i < length; i++)
+        __atomic_fetch_add(&simfsContext.references[start + i], 1, __ATOMIC_SEQ_CST);
+    simfsMarkVolumeDirty(&simfsContext.references[start], length * sizeof(SIMFS_INDEX_TYPE));
+
+    SIMFS_COUNT(sharedBlocks, length);
+}
+
+/*
+ * Drops a reference to a block; returns 1 if it was the last one, and the block is to be freed.
+ */
+static int simfsDropReference(SIMFS_INDEX_TYPE block)
+{
+    SIMFS_INDEX_TYPE *count = &simfsContext.references[block];
+    SIMFS_INDEX_TYPE value = SIMFS_LOAD(*count);
+
+    do
+    {
+        if (value == 0)
+            return 1;
+    }
+    while (!__atomic_compare_exchange_n(count, &value, value - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    simfsMarkVolumeDirty(count, sizeof(*count));
+
+    return 0;
+}
+
+/*
+ * Drops a reference to every block of a run of data blocks, and frees the blocks that lost their last reference.
+ */
+static void simfsFreeDataRun(SIMFS_INDEX_TYPE start, int length)
+{
+    int first = 0; // the first block of the run of blocks to free
+
+    for (int i = 0; i < length; i++)
+        if (!simfsDropReference(start + i))
+        {
+            if (i > first)
+                simfsFreeRun(start + first, i - first);
+            first = i + 1;
+        }
+
+    if (length > first)
+        simfsFreeRun(start + first, length - first);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// extents
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Iterates over the extents of a file; the first extents are in the descriptor and the rest in the
+ * chain of extent blocks starting at the block reference of the descriptor.
+ */
+typedef struct simfs_extent_cursor_type {
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor;
+    SIMFS_INDEX_TYPE extentBlock; // the block holding the current extent; SIMFS_INVALID_INDEX for the descriptor
+    int position; // position of the next extent in the descriptor or in the extent block
+    int remaining; // number of extents not visited yet
+} SIMFS_EXTENT_CURSOR_TYPE;
+
+static void simfsFirstExtent(SIMFS_EXTENT_CURSOR_TYPE *cursor, SIMFS_FILE_DESCRIPTOR_TYPE *descriptor)
+{
+    cursor->descriptor = descriptor;
+    cursor->extentBlock = SIMFS_INVALID_INDEX;
+    cursor->position = 0;
+    cursor->remaining = descriptor->numberOfExtents;
+}
+
+static SIMFS_EXTENT_TYPE *simfsNextExtent(SIMFS_EXTENT_CURSOR_TYPE *cursor)
+{
+    if (cursor->remaining == 0)
+        return NULL;
+    cursor->remaining--;
+
+    if (cursor->extentBlock == SIMFS_INVALID_INDEX)
+    {
+        if (cursor->position < SIMFS_DIRECT_EXTENTS)
+            return &cursor->descriptor->extent[cursor->position++];
+
+        cursor->extentBlock = cursor->descriptor->block_ref;
+        cursor->position = 0;
+    }
+    else if (cursor->position == simfsContext.geometry.extentsPerBlock)
+    {
+        cursor->extentBlock = SIMFS_BLOCK(cursor->extentBlock).content.extents.next;
+        cursor->position = 0;
+    }
+
+    return &SIMFS_BLOCK(cursor->extentBlock).content.extents.extent[cursor->position++];
+}
+
+/*
+ * Returns the number of extent blocks needed for the given number of extents.
+ */
+static int simfsExtentBlocksFor(int numberOfExtents)
+{
+    if (numberOfExtents <= SIMFS_DIRECT_EXTENTS)
+        return 0;
+
+    int extentsPerBlock = simfsContext.geometry.extentsPerBlock;
+    return (numberOfExtents - SIMFS_DIRECT_EXTENTS + extentsPerBlock - 1) / extentsPerBlock;
+}
+
+/*
+ * Adds a run of data blocks at the end of the file mapping. The run is merged with the last extent if
+ * the two are contiguous; otherwise, a new extent is added, which may require a new extent block.
+ */
+static SIMFS_ERROR simfsAppendExtent(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, SIMFS_INDEX_TYPE start, int length)
+{
+    int count = descriptor->numberOfExtents;
+    SIMFS_EXTENT_TYPE *last = NULL;
+    SIMFS_INDEX_TYPE lastBlock = SIMFS_INVALID_INDEX;
+
+    if (count > SIMFS_DIRECT_EXTENTS)
+    {
+        lastBlock = descriptor->block_ref;
+        while (SIMFS_BLOCK(lastBlock).content.extents.next != SIMFS_INVALID_INDEX)
+            lastBlock = SIMFS_BLOCK(lastBlock).content.extents.next;
+        last = &SIMFS_BLOCK(lastBlock).content.extents.extent[SIMFS_BLOCK(lastBlock).content.extents.count - 1];
+    }
+    else if (count > 0)
+        last = &descriptor->extent[count - 1];
+
+    if (last != NULL && last->start + last->length == start && last->length + length <= SIMFS_INVALID_INDEX)
+    {
+        last->length += length;
+        simfsMarkVolumeDirty(last, sizeof(*last));
+        return SIMFS_NO_ERROR;
+    }
+
+    SIMFS_EXTENT_TYPE *extent;
+    if (count < SIMFS_DIRECT_EXTENTS)
+        extent = &descriptor->extent[count];
+    else if (lastBlock != SIMFS_INVALID_INDEX
+             && SIMFS_BLOCK(lastBlock).content.extents.count < (SIMFS_INDEX_TYPE) simfsContext.geometry.extentsPerBlock)
+    {
+        extent = &SIMFS_BLOCK(lastBlock).content.extents.extent[SIMFS_BLOCK(lastBlock).content.extents.count++];
+        SIMFS_MARK_DIRTY(SIMFS_BLOCK(lastBlock));
+    }
+    else
+    {
+        SIMFS_INDEX_TYPE newBlock = simfsAllocateBlock();
+        if (newBlock == SIMFS_INVALID_INDEX)
+            return SIMFS_ALLOC_ERROR;
+
+        SIMFS_BLOCK(newBlock).type = EXTENT_CONTENT_TYPE;
+        SIMFS_BLOCK(newBlock).content.extents.next = SIMFS_INVALID_INDEX;
+        SIMFS_BLOCK(newBlock).content.extents.count = 1;
+
+        if (lastBlock == SIMFS_INVALID_INDEX)
+            descriptor->block_ref = newBlock;
+        else
+        {
+            SIMFS_BLOCK(lastBlock).content.extents.next = newBlock;
+            SIMFS_MARK_DIRTY(SIMFS_BLOCK(lastBlock));
+        }
+        SIMFS_MARK_DIRTY(SIMFS_BLOCK(newBlock));
+
+        extent = &SIMFS_BLOCK(newBlock).content.extents.extent[0];
+    }
+
+    extent->start = start;
+    extent->length = length;
+    descriptor->numberOfExtents++;
+    SIMFS_MARK_DIRTY(*descriptor);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Allocates count data blocks at the end of a file in as few runs of contiguous blocks as possible.
+ */
+static SIMFS_ERROR simfsAllocateExtents(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, int count)
+{
+    while (count > 0)
+    {
+        SIMFS_INDEX_TYPE start;
+        int length = simfsAllocateRun(count, &start);
+        if (length == 0)
+            return SIMFS_ALLOC_ERROR;
+
+        SIMFS_ERROR error = simfsAppendExtent(descriptor, start, length);
+        if (error != SIMFS_NO_ERROR)
+        {
+            simfsFreeRun(start, length);
+            return error;
+        }
+
+        count -= length;
+    }
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Shrinks the mapping of a file to its first numberOfBlocks data blocks. The data blocks after them (or the
+ * references to them, if they are shared) and the extent blocks that are not needed any more are freed.
+ */
+static void simfsTruncateExtents(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, int numberOfBlocks)
+{
+    SIMFS_EXTENT_CURSOR_TYPE cursor;
+    SIMFS_EXTENT_TYPE *extent;
+    int mapped = 0;
+    int kept = 0;
+
+    simfsFirstExtent(&cursor, descriptor);
+    while ((extent = simfsNextExtent(&cursor)) != NULL)
+    {
+        int keep = numberOfBlocks - mapped;
+        keep = keep < 0 ? 0 : keep > (int) extent->length ? (int) extent->length : keep;
+        mapped += extent->length;
+
+        if (keep < (int) extent->length)
+        {
+            simfsFreeDataRun(extent->start + keep, extent->length - keep);
+            extent->length = keep;
+            simfsMarkVolumeDirty(extent, sizeof(*extent));
+        }
+        if (keep > 0)
+            kept++;
+    }
+
+    int extentBlocks = simfsExtentBlocksFor(kept);
+    SIMFS_INDEX_TYPE *link = &descriptor->block_ref;
+    for (int i = 0; i < extentBlocks; i++)
+    {
+        if (i == extentBlocks - 1)
+        {
+            SIMFS_BLOCK(*link).content.extents.count =
+                kept - SIMFS_DIRECT_EXTENTS - i * simfsContext.geometry.extentsPerBlock;
+            SIMFS_MARK_DIRTY(SIMFS_BLOCK(*link));
+        }
+        link = &SIMFS_BLOCK(*link).content.extents.next;
+    }
+
+    SIMFS_INDEX_TYPE block = *link;
+    *link = SIMFS_INVALID_INDEX;
+    simfsMarkVolumeDirty(link, sizeof(*link));
+    while (block != SIMFS_INVALID_INDEX)
+    {
+        SIMFS_INDEX_TYPE next = SIMFS_BLOCK(block).content.extents.next;
+        simfsFreeRun(block, 1);
+        block = next;
+    }
+
+    descriptor->numberOfExtents = kept;
+    SIMFS_MARK_DIRTY(*descriptor);
+}
+
+/*
+ * Frees all data blocks and extent blocks of a file.
+ */
+static void simfsReleaseExtents(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor)
+{
+    simfsTruncateExtents(descriptor, 0);
+}
+
+/*
+ * Moves the content of a file held inline in its descriptor block to a new data block, which becomes the first
+ * extent of the file.
+ */
+static SIMFS_ERROR simfsMoveContentToBlock(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor)
+{
+    SIMFS_INDEX_TYPE block = simfsAllocateBlock();
+    if (block == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_BLOCK(block).type = DATA_CONTENT_TYPE;
+    memcpy(SIMFS_BLOCK(block).content.data, descriptor->inlineData, descriptor->size);
+    SIMFS_MARK_DIRTY(SIMFS_BLOCK(block));
+
+    return simfsAppendExtent(descriptor, block, 1); // the first extent is direct, so this does not fail
+}
+
+/*
+ * Moves the first size bytes of the content of a file into its descriptor block, and frees all its data blocks;
+ * size must not exceed the inline size.
+ */
+static void simfsMoveContentInline(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, size_t size)
+{
+    simfsTruncateExtents(descriptor, 1);
+
+    SIMFS_INDEX_TYPE block = descriptor->extent[0].start;
+    memcpy(descriptor->inlineData, SIMFS_BLOCK(block).content.data, size < descriptor->size ? size : descriptor->size);
+    simfsFreeDataRun(block, 1);
+
+    descriptor->numberOfExtents = 0;
+    SIMFS_MARK_DIRTY(*descriptor);
+}
+
+/*
+ * Positions the cursor after the extent that holds the given data block of a file, and returns that extent;
+ * the position of the block within the extent is passed back through the parameter first. Returns NULL if the
+ * file does not have that many blocks.
+ */
+static SIMFS_EXTENT_TYPE *simfsSeekExtent(SIMFS_EXTENT_CURSOR_TYPE *cursor, SIMFS_FILE_DESCRIPTOR_TYPE *descriptor,
+                                          int block, int *first)
+{
+    SIMFS_EXTENT_TYPE *extent;
+
+    simfsFirstExtent(cursor, descriptor);
+    while ((extent = simfsNextExtent(cursor)) != NULL)
+    {
+        if (block < (int) extent->length)
+        {
+            *first = block;
+            return extent;
+        }
+        block -= extent->length;
+    }
+
+    return NULL;
+}
+
+/*
+ * Copies length bytes between a buffer and the content of a file starting at the given offset; the blocks
+ * covering the range must be allocated. If toFile is set, the buffer is copied to the file, and a NULL buffer
+ * fills the range with zeros. Only the blocks covering the range are visited.
+ *
+ * The block size is a parameter so that the copy loop can be specialized for the common block sizes, where the
+ * divisions and the stride become constants.
+ */
+static inline __attribute__((always_inline))
+void simfsTransferBlocks(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, size_t offset, char *buffer, size_t length,
+                         int toFile, size_t dataSize, int blockShift)
+{
+    SIMFS_EXTENT_CURSOR_TYPE cursor;
+    int first;
+    SIMFS_EXTENT_TYPE *extent = simfsSeekExtent(&cursor, descriptor, offset / dataSize, &first);
+    size_t position = offset % dataSize;
+
+    while (length > 0 && extent != NULL)
+    {
+        char *address = simfsContext.blocks + ((size_t) (extent->start + first) << blockShift);
+        for (int i = first; i < (int) extent->length && length > 0; i++, address += (size_t) 1 << blockShift)
+        {
+            SIMFS_BLOCK_TYPE *block = (SIMFS_BLOCK_TYPE *) address;
+            size_t chunk = dataSize - position < length ? dataSize - position : length;
+
+            if (!toFile)
+                memcpy(buffer, block->content.data + position, chunk);
+            else if (buffer != NULL)
+                memcpy(block->content.data + position, buffer, chunk);
+            else
+                memset(block->content.data + position, 0, chunk);
+
+            if (toFile)
+            {
+                block->type = DATA_CONTENT_TYPE;
+                SIMFS_MARK_DIRTY(*block);
+            }
+            if (buffer != NULL)
+                buffer += chunk;
+            length -= chunk;
+            position = 0;
+        }
+
+        first = 0;
+        extent = simfsNextExtent(&cursor);
+    }
+}
+
+static void simfsTransfer(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, size_t offset, char *buffer, size_t length,
+                          int toFile)
+{
+    if (SIMFS_IS_INLINE(*descriptor))
+    {
+        char *content = descriptor->inlineData + offset;
+        if (!toFile)
+            memcpy(buffer, content, length);
+        else if (buffer != NULL)
+            memcpy(content, buffer, length);
+        else
+            memset(content, 0, length);
+
+        if (toFile)
+            simfsMarkVolumeDirty(content, length);
+        return;
+    }
+
+    switch (simfsContext.geometry.blockShift)
+    {
+        case 8:
+            simfsTransferBlocks(descriptor, offset, buffer, length, toFile, SIMFS_DATA_SIZE_OF(256), 8);
+            break;
+        case 12:
+            simfsTransferBlocks(descriptor, offset, buffer, length, toFile, SIMFS_DATA_SIZE_OF(4096), 12);
+            break;
+        default:
+            simfsTransferBlocks(descriptor, offset, buffer, length, toFile, simfsContext.geometry.dataSize,
+                                simfsContext.geometry.blockShift);
+            break;
+    }
+}
+
+/*
+ * Replaces the extents of a file with the given ones. The extent blocks of the file are reused, and the missing
+ * ones are allocated first; if there is no space for them, SIMFS_ALLOC_ERROR is returned and the extents are not
+ * changed.
+ */
+static SIMFS_ERROR simfsReplaceExtents(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, const SIMFS_EXTENT_TYPE *extents,
+                                       int count)
+{
+    int heldBlocks = simfsExtentBlocksFor((int) descriptor->numberOfExtents);
+    int neededBlocks = simfsExtentBlocksFor(count);
+    int extentsPerBlock = simfsContext.geometry.extentsPerBlock;
+
+    SIMFS_INDEX_TYPE *chain = NULL; // the extent blocks of the file, followed by the new ones
+    if (heldBlocks + neededBlocks > 0)
+    {
+        chain = malloc((size_t) (heldBlocks > neededBlocks ? heldBlocks : neededBlocks) * sizeof(SIMFS_INDEX_TYPE));
+        if (chain == NULL)
+            return SIMFS_ALLOC_ERROR;
+    }
+
+    SIMFS_INDEX_TYPE block = descriptor->block_ref;
+    for (int i = 0; i < heldBlocks; i++, block = SIMFS_BLOCK(block).content.extents.next)
+        chain[i] = block;
+
+    for (int i = heldBlocks; i < neededBlocks; i++)
+    {
+        chain[i] = simfsAllocateBlock();
+        if (chain[i] == SIMFS_INVALID_INDEX)
+        {
+            while (--i >= heldBlocks)
+                simfsFreeRun(chain[i], 1);
+            free(chain);
+            return SIMFS_ALLOC_ERROR;
+        }
+    }
+
+    int direct = count < SIMFS_DIRECT_EXTENTS ? count : SIMFS_DIRECT_EXTENTS;
+    memcpy(descriptor->extent, extents, (size_t) direct * sizeof(SIMFS_EXTENT_TYPE));
+
+    for (int i = 0; i < neededBlocks; i++)
+    {
+        SIMFS_EXTENT_BLOCK_TYPE *extentBlock = &SIMFS_BLOCK(chain[i]).content.extents;
+        int first = SIMFS_DIRECT_EXTENTS + i * extentsPerBlock;
+
+        SIMFS_BLOCK(chain[i]).type = EXTENT_CONTENT_TYPE;
+        extentBlock->next = i + 1 < neededBlocks ? chain[i + 1] : SIMFS_INVALID_INDEX;
+        extentBlock->count = (SIMFS_INDEX_TYPE) (count - first < extentsPerBlock ? count - first : extentsPerBlock);
+        memcpy(extentBlock->extent, extents + first, extentBlock->count * sizeof(SIMFS_EXTENT_TYPE));
+        SIMFS_MARK_DIRTY(SIMFS_BLOCK(chain[i]));
+    }
+
+    for (int i = neededBlocks; i < heldBlocks; i++)
+        simfsFreeRun(chain[i], 1);
+
+    descriptor->block_ref = neededBlocks > 0 ? chain[0] : SIMFS_INVALID_INDEX;
+    descriptor->numberOfExtents = (unsigned int) count;
+    SIMFS_MARK_DIRTY(*descriptor);
+
+    free(chain);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Adds a run of blocks to a list of extents, merging it with the last extent if the two are contiguous.
+ */
+static int simfsAddToExtents(SIMFS_EXTENT_TYPE **extents, int *count, int *capacity, SIMFS_INDEX_TYPE start,
+                             SIMFS_INDEX_TYPE length)
+{
+    if (*count > 0 && (*extents)[*count - 1].start + (*extents)[*count - 1].length == start)
+    {
+        (*extents)[*count - 1].length += length;
+        return 1;
+    }
+
+    if (!simfsGrow((void **) extents, capacity, *count, sizeof(SIMFS_EXTENT_TYPE)))
+        return 0;
+
+    (*extents)[(*count)++] = (SIMFS_EXTENT_TYPE) { start, length };
+
+    return 1;
+}
+
+/*
+ * Copies the shared blocks among the data blocks first to last of a file to new blocks, and maps the copies in their
+ * place; then the references to the shared blocks are dropped. If there is not enough space for the copies and their
+ * extents, SIMFS_ALLOC_ERROR is returned and the file is not modified.
+ */
+static SIMFS_ERROR simfsCopySharedBlocks(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, SIMFS_INDEX_TYPE first,
+                                         SIMFS_INDEX_TYPE last)
+{
+    SIMFS_EXTENT_TYPE *extents = NULL; // the new mapping of the file
+    int count = 0;
+    int capacity = 0;
+    SIMFS_EXTENT_TYPE *shared = NULL; // the runs of shared blocks that are copied
+    int numberOfShared = 0;
+    int sharedCapacity = 0;
+    SIMFS_EXTENT_TYPE *copies = NULL; // the runs of blocks holding the copies
+    int numberOfCopies = 0;
+    int copiesCapacity = 0;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+
+    SIMFS_EXTENT_CURSOR_TYPE cursor;
+    SIMFS_EXTENT_TYPE *extent;
+    SIMFS_INDEX_TYPE position = 0; // the position of the first block of the extent in the file
+
+    simfsFirstExtent(&cursor, descriptor);
+    while (error == SIMFS_NO_ERROR && (extent = simfsNextExtent(&cursor)) != NULL)
+    {
+        for (SIMFS_INDEX_TYPE i = 0; i < extent->length && error == SIMFS_NO_ERROR;)
+        {
+            // the run of blocks from i that are all copied or all kept
+            int copy = position + i >= first && position + i <= last && simfsIsBlockShared(extent->start + i);
+            SIMFS_INDEX_TYPE run = 1;
+            while (i + run < extent->length
+                   && copy == (position + i + run >= first && position + i + run <= last
+                               && simfsIsBlockShared(extent->start + i + run)))
+                run++;
+
+            if (!copy)
+            {
+                if (!simfsAddToExtents(&extents, &count, &capacity, extent->start + i, run))
+                    error = SIMFS_ALLOC_ERROR;
+            }
+            else if (!simfsGrow((void **) &shared, &sharedCapacity, numberOfShared, sizeof(SIMFS_EXTENT_TYPE)))
+                error = SIMFS_ALLOC_ERROR;
+            else
+            {
+                shared[numberOfShared++] = (SIMFS_EXTENT_TYPE) { extent->start + i, run };
+
+                for (SIMFS_INDEX_TYPE done = 0; done < run && error == SIMFS_NO_ERROR;)
+                {
+                    SIMFS_INDEX_TYPE start;
+                    int length = simfsAllocateRun((int) (run - done), &start);
+                    if (length == 0)
+                        error = SIMFS_ALLOC_ERROR;
+                    else if (!simfsGrow((void **) &copies, &copiesCapacity, numberOfCopies,
+                                        sizeof(SIMFS_EXTENT_TYPE)))
+                    {
+                        simfsFreeRun(start, length);
+                        error = SIMFS_ALLOC_ERROR;
+                    }
+                    else
+                    {
+                        copies[numberOfCopies++] = (SIMFS_EXTENT_TYPE) { start, (SIMFS_INDEX_TYPE) length };
+
+                        size_t bytes = (size_t) length << simfsContext.geometry.blockShift;
+                        memcpy(&SIMFS_BLOCK(start), &SIMFS_BLOCK(extent->start + i + done), bytes);
+                        simfsMarkVolumeDirty(&SIMFS_BLOCK(start), bytes);
+
+                        if (!simfsAddToExtents(&extents, &count, &capacity, start, length))
+                            error = SIMFS_ALLOC_ERROR;
+                        done += length;
+                    }
+                }
+            }
+
+            i += run;
+        }
+
+        position += extent->length;
+    }
+
+    if (error == SIMFS_NO_ERROR)
+        error = simfsReplaceExtents(descriptor, extents, count);
+
+    if (error == SIMFS_NO_ERROR)
+        for (int i = 0; i < numberOfShared; i++)
+        {
+            simfsFreeDataRun(shared[i].start, (int) shared[i].length);
+            SIMFS_COUNT(copiedBlocks, shared[i].length);
+        }
+    else
+        for (int i = 0; i < numberOfCopies; i++)
+            simfsFreeRun(copies[i].start, (int) copies[i].length);
+
+    free(extents);
+    free(shared);
+    free(copies);
+
+    return error;
+}
+
+/*
+ * Gives a file its own copies of the shared data blocks holding the range of length bytes at offset (copy-on-write),
+ * so the range can be written in place; the part of the range beyond the blocks of the file is left out. If there is
+ * not enough space for the copies, SIMFS_ALLOC_ERROR is returned and the file is not modified.
+ */
+static SIMFS_ERROR simfsUnshareContent(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, size_t offset, size_t length)
+{
+    if (SIMFS_IS_INLINE(*descriptor) || length == 0)
+        return SIMFS_NO_ERROR;
+
+    size_t heldBlocks = SIMFS_BLOCKS_FOR(descriptor->size);
+    size_t first = offset / simfsContext.geometry.dataSize;
+    size_t last = (offset + length - 1) / simfsContext.geometry.dataSize;
+    if (first >= heldBlocks)
+        return SIMFS_NO_ERROR;
+    if (last >= heldBlocks)
+        last = heldBlocks - 1;
+
+    // only the files that are clones or have been cloned find shared blocks
+    SIMFS_EXTENT_CURSOR_TYPE cursor;
+    int position;
+    size_t remaining = last - first + 1;
+    int shared = 0;
+    for (SIMFS_EXTENT_TYPE *extent = simfsSeekExtent(&cursor, descriptor, (int) first, &position);
+         extent != NULL && remaining > 0 && !shared; extent = simfsNextExtent(&cursor), position = 0)
+        for (int i = position; i < (int) extent->length && remaining > 0 && !shared; i++, remaining--)
+            shared = simfsIsBlockShared(extent->start + i);
+
+    if (!shared)
+        return SIMFS_NO_ERROR;
+
+    return simfsCopySharedBlocks(descriptor, (SIMFS_INDEX_TYPE) first, (SIMFS_INDEX_TYPE) last);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// folder content
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns the entry of a folder block at the given offset.
+ */
+static inline SIMFS_FOLDER_ENTRY_TYPE *simfsFolderEntry(SIMFS_FOLDER_BLOCK_TYPE *block, size_t offset)
+{
+    return (SIMFS_FOLDER_ENTRY_TYPE *) (block->entries + offset);
+}
+
+/*
+ * Adds an entry for a file or a folder to the first folder block of a folder with room for it; a new block is
+ * appended if none has.
+ */
+static SIMFS_ERROR simfsAddToFolder(SIMFS_INDEX_TYPE folder, SIMFS_INDEX_TYPE node, SIMFS_CONTENT_TYPE type,
+                                    const char *name)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(folder);
+    size_t nameLength = strnlen(name, SIMFS_MAX_NAME_LENGTH - 1);
+    size_t size = SIMFS_FOLDER_ENTRY_SIZE(nameLength);
+    SIMFS_INDEX_TYPE *link = &descriptor->block_ref;
+    SIMFS_FOLDER_BLOCK_TYPE *block = NULL;
+
+    while (*link != SIMFS_INVALID_INDEX)
+    {
+        block = &SIMFS_BLOCK(*link).content.folder;
+        if (simfsContext.geometry.folderSize - block->used >= size)
+            break;
+        link = &block->next;
+        block = NULL;
+    }
+
+    if (block == NULL)
+    {
+        SIMFS_INDEX_TYPE newBlock = simfsAllocateBlock();
+        if (newBlock == SIMFS_INVALID_INDEX)
+            return SIMFS_ALLOC_ERROR;
+
+        SIMFS_BLOCK(newBlock).type = INDEX_CONTENT_TYPE;
+        block = &SIMFS_BLOCK(newBlock).content.folder;
+        block->next = SIMFS_INVALID_INDEX;
+        block->used = 0;
+
+        *link = newBlock;
+        simfsMarkVolumeDirty(link, sizeof(*link));
+    }
+
+    SIMFS_FOLDER_ENTRY_TYPE *entry = simfsFolderEntry(block, block->used);
+    entry->node = node;
+    entry->type = (unsigned char) type;
+    entry->nameLength = (unsigned char) nameLength;
+    memcpy(entry->name, name, nameLength);
+    entry->name[nameLength] = '\0';
+    block->used += size;
+    SIMFS_MARK_DIRTY(*block);
+
+    descriptor->size++;
+    SIMFS_MARK_DIRTY(*descriptor);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Removes the entry of a file or a folder from the folder blocks of a folder; the following entries of its block
+ * are moved up, and a block left empty is freed.
+ */
+static void simfsRemoveFromFolder(SIMFS_INDEX_TYPE folder, SIMFS_INDEX_TYPE node)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(folder);
+    SIMFS_INDEX_TYPE *link = &descriptor->block_ref;
+
+    while (*link != SIMFS_INVALID_INDEX)
+    {
+        SIMFS_FOLDER_BLOCK_TYPE *block = &SIMFS_BLOCK(*link).content.folder;
+        for (size_t offset = 0; offset < block->used;)
+        {
+            SIMFS_FOLDER_ENTRY_TYPE *entry = simfsFolderEntry(block, offset);
+            size_t size = SIMFS_FOLDER_ENTRY_SIZE(entry->nameLength);
+            if (entry->node != node)
+            {
+                offset += size;
+                continue;
+            }
+
+            memmove(entry, block->entries + offset + size, block->used - offset - size);
+            block->used -= size;
+            descriptor->size--;
+            SIMFS_MARK_DIRTY(*descriptor);
+
+            if (block->used > 0)
+                SIMFS_MARK_DIRTY(*block);
+            else
+            {
+                SIMFS_INDEX_TYPE empty = *link;
+                *link = block->next;
+                simfsMarkVolumeDirty(link, sizeof(*link));
+                simfsFreeRun(empty, 1);
+            }
+            return;
+        }
+        link = &block->next;
+    }
+}
+
+/*
+ * Frees the folder blocks of an empty folder.
+ */
+static void simfsReleaseFolder(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor)
+{
+    SIMFS_INDEX_TYPE block = descriptor->block_ref;
+
+    while (block != SIMFS_INVALID_INDEX)
+    {
+        SIMFS_INDEX_TYPE next = SIMFS_BLOCK(block).content.folder.next;
+        simfsFreeRun(block, 1);
+        block = next;
+    }
+
+    descriptor->block_ref = SIMFS_INVALID_INDEX;
+    SIMFS_MARK_DIRTY(*descriptor);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// in-memory directory
+//
+//////////////////////////////////////////////////////////////////////////
+
+static uint32_t simfsHash(SIMFS_INDEX_TYPE parent, const char *name)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+
+    for (int i = 0; i < (int) sizeof(parent); i++)
+        hash = (hash ^ ((parent >> (8 * i)) & 0xFF)) * 16777619u;
+    for (int i = 0; i < SIMFS_MAX_NAME_LENGTH && name[i] != '\0'; i++)
+        hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+
+    return hash == 0 ? 1 : hash; // 0 marks empty slots
+}
+
+/*
+ * Returns the shard of the directory holding the entry with the given hash.
+ */
+static inline SIMFS_DIRECTORY *simfsShard(uint32_t hash)
+{
+    return &simfsContext.directory[(hash >> 24) & (SIMFS_DIRECTORY_SHARDS - 1)];
+}
+
+/*
+ * Finds the slot of the entry for a file or folder with the given name in the given folder; returns NULL if there
+ * is none. The caller holds the lock of the shard.
+ */
+static SIMFS_DIR_ENT *simfsFindDirEnt(SIMFS_DIRECTORY *directory, uint32_t hash, SIMFS_INDEX_TYPE parent,
+                                      const char *name)
+{
+    if (directory->count == 0)
+    {
+        simfsCountProbes(0);
+        return NULL;
+    }
+
+    unsigned int mask = directory->capacity - 1;
+    uint64_t probes = 1;
+
+    for (unsigned int i = hash & mask; directory->slot[i].hash != 0; i = (i + 1) & mask, probes++)
+    {
+        SIMFS_DIR_ENT *entry = &directory->slot[i];
+        if (entry->hash == hash && entry->parentReference == parent
+            && strncmp(SIMFS_DESCRIPTOR(entry->nodeReference).name, name, SIMFS_MAX_NAME_LENGTH) == 0)
+        {
+            simfsCountProbes(probes);
+            return entry;
+        }
+    }
+
+    simfsCountProbes(probes);
+
+    return NULL;
+}
+
+/*
+ * Returns the node of the file or folder with the given name in the given folder, or SIMFS_INVALID_INDEX if
+ * there is none.
+ */
+static SIMFS_INDEX_TYPE simfsFindNode(SIMFS_INDEX_TYPE parent, const char *name)
+{
+    uint32_t hash = simfsHash(parent, name);
+    SIMFS_DIRECTORY *directory = simfsShard(hash);
+
+    pthread_rwlock_rdlock(&directory->lock);
+    SIMFS_DIR_ENT *entry = simfsFindDirEnt(directory, hash, parent, name);
+    SIMFS_INDEX_TYPE node = entry == NULL ? SIMFS_INVALID_INDEX : entry->nodeReference;
+    pthread_rwlock_unlock(&directory->lock);
+
+    return node;
+}
+
+static void simfsInsertDirEnt(SIMFS_DIR_ENT *slot, unsigned int capacity, SIMFS_DIR_ENT entry)
+{
+    unsigned int i = entry.hash & (capacity - 1);
+
+    while (slot[i].hash != 0)
+        i = (i + 1) & (capacity - 1);
+
+    slot[i] = entry;
+}
+
+/*
+ * Rehashes a shard of the directory into a table with the given number of slots.
+ */
+static SIMFS_ERROR simfsResizeDirectory(SIMFS_DIRECTORY *directory, unsigned int capacity)
+{
+    SIMFS_DIR_ENT *slot = calloc(capacity, sizeof(SIMFS_DIR_ENT));
+    if (slot == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    for (unsigned int i = 0; i < directory->capacity; i++)
+        if (directory->slot[i].hash != 0)
+            simfsInsertDirEnt(slot, capacity, directory->slot[i]);
+
+    free(directory->slot);
+    directory->slot = slot;
+    directory->capacity = capacity;
+
+    return SIMFS_NO_ERROR;
+}
+
+static SIMFS_ERROR simfsAddDirEnt(SIMFS_INDEX_TYPE parent, const char *name, SIMFS_INDEX_TYPE node)
+{
+    SIMFS_DIR_ENT entry = { simfsHash(parent, name), parent, node };
+    SIMFS_DIRECTORY *directory = simfsShard(entry.hash);
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+
+    pthread_rwlock_wrlock(&directory->lock);
+
+    if ((directory->count + 1) * 4 > directory->capacity * 3)
+        error = simfsResizeDirectory(directory, directory->capacity == 0
+                                                ? SIMFS_DIRECTORY_INITIAL_SIZE : directory->capacity * 2);
+
+    if (error == SIMFS_NO_ERROR)
+    {
+        simfsInsertDirEnt(directory->slot, directory->capacity, entry);
+        directory->count++;
+        simfsInvalidateSnapshot();
+    }
+
+    pthread_rwlock_unlock(&directory->lock);
+
+    return error;
+}
+
+/*
+ * Removes the entry of a file or folder; the entries following it in the probe sequence are shifted back, so no
+ * tombstones are needed.
+ */
+static void simfsRemoveDirEnt(SIMFS_INDEX_TYPE parent, const char *name)
+{
+    uint32_t hash = simfsHash(parent, name);
+    SIMFS_DIRECTORY *directory = simfsShard(hash);
+
+    pthread_rwlock_wrlock(&directory->lock);
+
+    SIMFS_DIR_ENT *entry = simfsFindDirEnt(directory, hash, parent, name);
+    if (entry != NULL)
+    {
+        unsigned int mask = directory->capacity - 1;
+        unsigned int hole = (unsigned int) (entry - directory->slot);
+
+        for (unsigned int i = (hole + 1) & mask; directory->slot[i].hash != 0; i = (i + 1) & mask)
+        {
+            unsigned int home = directory->slot[i].hash & mask;
+            int stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+            if (!stays)
+            {
+                directory->slot[hole] = directory->slot[i];
+                hole = i;
+            }
+        }
+
+        directory->slot[hole].hash = 0;
+        directory->count--;
+        simfsInvalidateSnapshot();
+    }
+
+    pthread_rwlock_unlock(&directory->lock);
+}
+
+static void simfsClearDirectory()
+{
+    for (int shard = 0; shard < SIMFS_DIRECTORY_SHARDS; shard++)
+    {
+        free(simfsContext.directory[shard].slot);
+        simfsContext.directory[shard].slot = NULL;
+        simfsContext.directory[shard].capacity = 0;
+        simfsContext.directory[shard].count = 0;
+    }
+}
+
+/*
+ * Returns the number of entries in the directory.
+ */
+static unsigned int simfsDirectorySize()
+{
+    unsigned int count = 0;
+
+    for (int shard = 0; shard < SIMFS_DIRECTORY_SHARDS; shard++)
+        count += simfsContext.directory[shard].count;
+
+    return count;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// folders
+//
+// The content of a folder (its folder blocks, its size, and the directory entries of its children) is changed
+// only while holding the lock of the folder. The locks are striped: a folder uses the lock
+// folderLock[node % SIMFS_FOLDER_LOCKS].
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Locks up to two folders; the second one may be SIMFS_INVALID_INDEX. The locks are taken by increasing index,
+ * and a lock shared by both folders is taken once.
+ */
+static void simfsLockFolders(SIMFS_INDEX_TYPE first, SIMFS_INDEX_TYPE second)
+{
+    int a = first % SIMFS_FOLDER_LOCKS;
+    int b = second == SIMFS_INVALID_INDEX ? a : (int) (second % SIMFS_FOLDER_LOCKS);
+
+    pthread_mutex_lock(&simfsContext.folderLock[a < b ? a : b]);
+    if (a != b)
+        pthread_mutex_lock(&simfsContext.folderLock[a < b ? b : a]);
+}
+
+static void simfsUnlockFolders(SIMFS_INDEX_TYPE first, SIMFS_INDEX_TYPE second)
+{
+    int a = first % SIMFS_FOLDER_LOCKS;
+    int b = second == SIMFS_INVALID_INDEX ? a : (int) (second % SIMFS_FOLDER_LOCKS);
+
+    if (a != b)
+        pthread_mutex_unlock(&simfsContext.folderLock[b]);
+    pthread_mutex_unlock(&simfsContext.folderLock[a]);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// processes and open files
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns the chain of the hashtable of process control blocks for a process; pids are assigned mostly
+ * sequentially, so their low bits spread them evenly.
+ */
+static inline SIMFS_PROCESS_CONTROL_BLOCK_TYPE **simfsProcessChain(pid_t pid)
+{
+    return &simfsContext.processControlBlocks[(unsigned int) pid & (SIMFS_PROCESS_BUCKETS - 1)];
+}
+
+/*
+ * Finds the process control block of a process; the caller holds the openFileLock.
+ */
+static SIMFS_PROCESS_CONTROL_BLOCK_TYPE *simfsFindProcess(pid_t pid)
+{
+    for (SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = *simfsProcessChain(pid); pcb != NULL; pcb = pcb->next)
+        if (pcb->pid == pid)
+            return pcb;
+
+    return NULL;
+}
+
+/*
+ * Puts a process control block that is no longer used into the pool; the caller holds the openFileLock.
+ */
+static void simfsPoolProcess(SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb)
+{
+    pcb->next = simfsContext.freeProcessControlBlocks;
+    simfsContext.freeProcessControlBlocks = pcb;
+}
+
+/*
+ * Fills the pool of process control blocks with the blocks of a new slab; the caller holds the openFileLock.
+ * The slabs are never freed, so the pool grows to the largest number of processes with open files at the same
+ * time, and processes opening and closing files again and again do not allocate memory.
+ */
+static int simfsAddProcessSlab()
+{
+    SIMFS_PROCESS_SLAB_TYPE *slab = malloc(sizeof(SIMFS_PROCESS_SLAB_TYPE));
+    if (slab == NULL)
+        return 0;
+
+    slab->next = simfsContext.processSlabs;
+    simfsContext.processSlabs = slab;
+    for (int i = SIMFS_PROCESS_SLAB_SIZE - 1; i >= 0; i--)
+        simfsPoolProcess(&slab->block[i]);
+
+    SIMFS_COUNT(processSlabs, 1);
+
+    return 1;
+}
+
+/*
+ * Creates the process control block of a process with no open files and the root as the current working
+ * directory; the caller holds the openFileLock.
+ */
+static SIMFS_PROCESS_CONTROL_BLOCK_TYPE *simfsAddProcess(pid_t pid)
+{
+    if (simfsContext.freeProcessControlBlocks == NULL && !simfsAddProcessSlab())
+        return NULL;
+
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsContext.freeProcessControlBlocks;
+    simfsContext.freeProcessControlBlocks = pcb->next;
+
+    memset(pcb, 0, sizeof(SIMFS_PROCESS_CONTROL_BLOCK_TYPE));
+    pcb->pid = pid;
+    pcb->numberOfOpenFiles = 0;
+    pcb->freeHandles = SIMFS_ALL_BITS >> (64 - SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS);
+    pcb->currentWorkingDirectory = simfsContext.volume->superblock.attr.rootNodeIndex;
+
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE **chain = simfsProcessChain(pid);
+    pcb->next = *chain;
+    *chain = pcb;
+
+    return pcb;
+}
+
+static void simfsRemoveProcess(SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb)
+{
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE **link = simfsProcessChain(pcb->pid);
+    while (*link != pcb)
+        link = &(*link)->next;
+    *link = pcb->next;
+
+    simfsPoolProcess(pcb);
+}
+
+/*
+ * The open files are found by their node through openFileMap, an open-addressing table with the indices of the
+ * entries of the global open file table. An entry is in the map while it is in use for an existing file; it leaves
+ * the map when the file is deleted or the last reference to it is given back. The caller holds the openFileLock.
+ */
+static inline unsigned int simfsOpenFileSlot(SIMFS_INDEX_TYPE node)
+{
+    return (((uint32_t) node * 2654435761u) >> 16) & (SIMFS_OPEN_FILE_SLOTS - 1);
+}
+
+static SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *simfsLookupOpenFile(SIMFS_INDEX_TYPE node)
+{
+    short *map = simfsContext.openFileMap;
+
+    for (unsigned int i = simfsOpenFileSlot(node); map[i] >= 0; i = (i + 1) & (SIMFS_OPEN_FILE_SLOTS - 1))
+        if (simfsContext.globalOpenFileTable[map[i]].fileDescriptor == node)
+            return &simfsContext.globalOpenFileTable[map[i]];
+
+    return NULL;
+}
+
+static void simfsMapOpenFile(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry)
+{
+    short *map = simfsContext.openFileMap;
+    unsigned int i = simfsOpenFileSlot(globalEntry->fileDescriptor);
+
+    while (map[i] >= 0)
+        i = (i + 1) & (SIMFS_OPEN_FILE_SLOTS - 1);
+    map[i] = (short) (globalEntry - simfsContext.globalOpenFileTable);
+}
+
+/*
+ * Removes an entry from the map; the entries following it in the probe sequence are shifted back, as in the
+ * directory.
+ */
+static void simfsUnmapOpenFile(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry)
+{
+    short *map = simfsContext.openFileMap;
+    unsigned int mask = SIMFS_OPEN_FILE_SLOTS - 1;
+    short index = (short) (globalEntry - simfsContext.globalOpenFileTable);
+    unsigned int hole = simfsOpenFileSlot(globalEntry->fileDescriptor);
+
+    while (map[hole] != index)
+        hole = (hole + 1) & mask;
+
+    for (unsigned int i = (hole + 1) & mask; map[i] >= 0; i = (i + 1) & mask)
+    {
+        unsigned int home = simfsOpenFileSlot(simfsContext.globalOpenFileTable[map[i]].fileDescriptor);
+        int stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+        if (!stays)
+        {
+            map[hole] = map[i];
+            hole = i;
+        }
+    }
+
+    map[hole] = -1;
+}
+
+/*
+ * Returns the current working directory of the process; the root folder if the process is not known.
+ */
+static SIMFS_INDEX_TYPE simfsCurrentDirectory(pid_t pid)
+{
+    pthread_mutex_lock(&simfsContext.openFileLock);
+
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsFindProcess(pid);
+    SIMFS_INDEX_TYPE folder = pcb == NULL ? simfsContext.volume->superblock.attr.rootNodeIndex
+                                          : pcb->currentWorkingDirectory;
+
+    pthread_mutex_unlock(&simfsContext.openFileLock);
+
+    return folder;
+}
+
+/*
+ * Finds the entry of the per-process open file table for the file handle of the calling process; the caller
+ * holds the openFileLock.
+ */
+static SIMFS_ERROR simfsGetOpenFile(SIMFS_FILE_HANDLE_TYPE fileHandle, SIMFS_PER_PROCESS_OPEN_FILE_TYPE **openFile)
+{
+    pid_t pid;
+    simfsGetCaller(NULL, &pid, NULL);
+
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsFindProcess(pid);
+    if (pcb == NULL || fileHandle < 0 || fileHandle >= SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    SIMFS_PER_PROCESS_OPEN_FILE_TYPE *entry = &pcb->openFileTable[fileHandle];
+    if (entry->snapshot == NULL && (entry->globalEntry == NULL || entry->globalEntry->type == INVALID_CONTENT_TYPE))
+        return SIMFS_NOT_FOUND_ERROR;
+
+    *openFile = entry;
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Finds the global open file table entry for a file handle of the calling process, and checks that the process
+ * has the given right (S_IRUSR or S_IWUSR) for the file.
+ *
+ * The entry is returned with an additional reference, so it stays in use even if the process closes the handle
+ * meanwhile; the caller gives the reference back with simfsReleaseOpenFileEntry().
+ *
+ * A handle of a virtual file has no entry; readers pass snapshot to get its content instead, with a reference that
+ * they give back with simfsReleaseContent(), and *globalEntry set to NULL. Without snapshot, such a handle fails
+ * with SIMFS_ACCESS_ERROR.
+ */
+static SIMFS_ERROR simfsGetOpenFileEntry(SIMFS_FILE_HANDLE_TYPE fileHandle, mode_t right,
+                                         SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE **globalEntry,
+                                         SIMFS_CACHED_CONTENT_TYPE **snapshot)
+{
+    pthread_mutex_lock(&simfsContext.openFileLock);
+
+    SIMFS_PER_PROCESS_OPEN_FILE_TYPE *openFile;
+    SIMFS_ERROR error = simfsGetOpenFile(fileHandle, &openFile);
+    if (error == SIMFS_NO_ERROR && !(openFile->accessRights & right))
+        error = SIMFS_ACCESS_ERROR;
+    if (error == SIMFS_NO_ERROR && openFile->snapshot != NULL && snapshot == NULL)
+        error = SIMFS_ACCESS_ERROR;
+
+    if (error == SIMFS_NO_ERROR)
+    {
+        *globalEntry = openFile->globalEntry;
+        if (*globalEntry != NULL)
+            (*globalEntry)->referenceCount++;
+        if (snapshot != NULL)
+        {
+            *snapshot = openFile->snapshot;
+            if (*snapshot != NULL)
+                __atomic_add_fetch(&(*snapshot)->referenceCount, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    pthread_mutex_unlock(&simfsContext.openFileLock);
+
+    return error;
+}
+
+/*
+ * Changes the size of the content mapped by a file descriptor. Blocks are allocated or freed only at the tail,
+ * and the blocks that are kept stay in place; the content of a grown part is left for the caller to fill.
+ *
+ * Content that fits the inline size of the geometry is held in the descriptor block; it is moved to data blocks
+ * when it grows larger, and back when it shrinks again.
+ *
+ * If there is not enough free space for the new blocks, the function returns SIMFS_ALLOC_ERROR and the content
+ * is not modified.
+ */
+static SIMFS_ERROR simfsResizeContent(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, size_t size)
+{
+    int wasInline = SIMFS_IS_INLINE(*descriptor);
+    size_t heldBlocks = wasInline ? 0 : SIMFS_BLOCKS_FOR(descriptor->size);
+    size_t neededBlocks = size <= simfsContext.geometry.inlineSize ? 0 : SIMFS_BLOCKS_FOR(size);
+
+    if (neededBlocks > heldBlocks)
+    {
+        if (neededBlocks - heldBlocks > (size_t) SIMFS_LOAD(simfsContext.numberOfFreeBlocks))
+            return SIMFS_ALLOC_ERROR;
+
+        if (wasInline)
+        {
+            SIMFS_ERROR error = simfsMoveContentToBlock(descriptor);
+            if (error != SIMFS_NO_ERROR)
+                return error;
+            heldBlocks = 1;
+        }
+
+        SIMFS_ERROR error = simfsAllocateExtents(descriptor, (int) (neededBlocks - heldBlocks));
+        if (error != SIMFS_NO_ERROR) // there was no space left for extent blocks
+        {
+            if (wasInline)
+                simfsMoveContentInline(descriptor, descriptor->size);
+            else
+                simfsTruncateExtents(descriptor, (int) heldBlocks);
+            return error;
+        }
+    }
+    else if (neededBlocks == 0 && !wasInline)
+        simfsMoveContentInline(descriptor, size);
+    else if (neededBlocks < heldBlocks)
+        simfsTruncateExtents(descriptor, (int) neededBlocks);
+
+    descriptor->size = size;
+    SIMFS_MARK_DIRTY(*descriptor);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Changes the size of an open file as simfsResizeContent() does.
+ */
+static SIMFS_ERROR simfsResizeFile(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry, size_t size)
+{
+    SIMFS_ERROR error = simfsResizeContent(&SIMFS_DESCRIPTOR(globalEntry->fileDescriptor), size);
+
+    if (error == SIMFS_NO_ERROR)
+        globalEntry->size = size;
+
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// content cache
+//
+// The assembled content of open files is cached in their entries of the global open file table, so repeated reads
+// of an unchanged file do not walk its extents. The cache holds at most SIMFS_CACHE_SIZE bytes; when it is full,
+// the content of other files is evicted in CLOCK order: the hand sweeps the table, and content that has been read
+// since the last sweep gets a second chance.
+//
+// The content is handed out as reference-counted read-only views, so a reader keeps its view even if the content
+// is evicted or the file is changed meanwhile. The content is filled in by readers holding the entry lock shared,
+// and dropped by writers holding it exclusively.
+//
+//////////////////////////////////////////////////////////////////////////
+
+static void simfsReleaseContent(SIMFS_CACHED_CONTENT_TYPE *content)
+{
+    if (__atomic_sub_fetch(&content->referenceCount, 1, __ATOMIC_ACQ_REL) == 0)
+        free(content);
+}
+
+/*
+ * Removes the content of an entry from the cache; the caller holds the cacheLock.
+ */
+static void simfsEvictContent(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *entry)
+{
+    SIMFS_CACHED_CONTENT_TYPE *content = entry->content;
+
+    entry->content = NULL;
+    simfsContext.cacheBytes -= content->size + 1;
+    simfsReleaseContent(content);
+}
+
+/*
+ * Evicts content until the given number of bytes fits in the cache; the caller holds the cacheLock.
+ */
+static void simfsMakeRoomInCache(size_t size)
+{
+    while (simfsContext.cacheBytes + size > SIMFS_CACHE_SIZE)
+    {
+        SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *entry = &simfsContext.globalOpenFileTable[simfsContext.cacheHand];
+        simfsContext.cacheHand = (simfsContext.cacheHand + 1) % SIMFS_MAX_NUMBER_OF_OPEN_FILES;
+
+        if (entry->content == NULL)
+            continue;
+
+        if (entry->referenced)
+            entry->referenced = 0;
+        else
+        {
+            simfsEvictContent(entry);
+            SIMFS_COUNT(cacheEvictions, 1);
+        }
+    }
+}
+
+/*
+ * Drops the cached content of a file; called when the content changes, and when the entry is released.
+ */
+static void simfsInvalidateContent(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *entry)
+{
+    pthread_mutex_lock(&simfsContext.cacheLock);
+    if (entry->content != NULL)
+        simfsEvictContent(entry);
+    pthread_mutex_unlock(&simfsContext.cacheLock);
+}
+
+/*
+ * Returns a view of the content of an open file, or NULL if it is not cached. If assemble is set, content that is
+ * not cached is read from the volume and added to the cache, as long as it fits; NULL is returned only if there
+ * is no memory for it. The caller holds the lock of the entry, and releases the view with simfsReleaseContent().
+ */
+static SIMFS_CACHED_CONTENT_TYPE *simfsGetContent(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *entry, int assemble)
+{
+    pthread_mutex_lock(&simfsContext.cacheLock);
+    SIMFS_CACHED_CONTENT_TYPE *content = entry->content;
+    if (content != NULL)
+    {
+        entry->referenced = 1;
+        __atomic_add_fetch(&content->referenceCount, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&simfsContext.cacheLock);
+
+    if (content != NULL)
+        SIMFS_COUNT(cacheHits, 1);
+    else
+        SIMFS_COUNT(cacheMisses, 1);
+
+    if (content != NULL || !assemble)
+        return content;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(entry->fileDescriptor);
+    size_t size = descriptor->size;
+
+    content = malloc(sizeof(SIMFS_CACHED_CONTENT_TYPE) + size + 1);
+    if (content == NULL)
+        return NULL;
+
+    content->referenceCount = 1;
+    content->size = size;
+    simfsTransfer(descriptor, 0, content->data, size, 0);
+    content->data[size] = '\0';
+
+    if (size + 1 > SIMFS_CACHE_SIZE)
+        return content;
+
+    pthread_mutex_lock(&simfsContext.cacheLock);
+    if (entry->content == NULL)
+    {
+        simfsMakeRoomInCache(size + 1);
+        entry->content = content;
+        entry->referenced = 1;
+        content->referenceCount++;
+        simfsContext.cacheBytes += size + 1;
+    }
+    pthread_mutex_unlock(&simfsContext.cacheLock);
+
+    return content;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// read buffers
+//
+// The buffers returned by simfsReadFile() are ordinary heap blocks, which the callers may free. Given back with
+// simfsReleaseReadBuffer() instead, they are kept by the calling thread, and its next reads return them without
+// going through the allocator. The size of a buffer given back is that of its heap block, which is known only with
+// glibc; elsewhere the buffers given back are freed.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct simfs_read_buffer_pool_type {
+    char *buffer[SIMFS_READ_BUFFERS_PER_THREAD];
+    size_t capacity[SIMFS_READ_BUFFERS_PER_THREAD]; // bytes of the buffers
+    int count;
+    int registered; // the buffers are freed when the thread exits
+} SIMFS_READ_BUFFER_POOL_TYPE;
+
+static _Thread_local SIMFS_READ_BUFFER_POOL_TYPE simfsReadBuffers;
+static pthread_key_t simfsReadBuffersKey;
+static pthread_once_t simfsReadBuffersOnce = PTHREAD_ONCE_INIT;
+
+static void simfsFreeReadBuffers(void *argument)
+{
+    SIMFS_READ_BUFFER_POOL_TYPE *pool = argument;
+
+    while (pool->count > 0)
+        free(pool->buffer[--pool->count]);
+}
+
+static void simfsCreateReadBuffersKey()
+{
+    pthread_key_create(&simfsReadBuffersKey, simfsFreeReadBuffers);
+}
+
+/*
+ * Returns a buffer of at least the given size: the smallest buffer of the pool of the thread that is large enough,
+ * or a new one. Returns NULL if there is no memory for it.
+ */
+static char *simfsTakeReadBuffer(size_t size)
+{
+    SIMFS_READ_BUFFER_POOL_TYPE *pool = &simfsReadBuffers;
+
+    int best = -1;
+    for (int i = 0; i < pool->count; i++)
+        if (pool->capacity[i] >= size && (best < 0 || pool->capacity[i] < pool->capacity[best]))
+            best = i;
+
+    if (best < 0)
+        return malloc(size);
+
+    char *buffer = pool->buffer[best];
+    pool->count--;
+    pool->buffer[best] = pool->buffer[pool->count];
+    pool->capacity[best] = pool->capacity[pool->count];
+
+    SIMFS_COUNT(reusedReadBuffers, 1);
+
+    return buffer;
+}
+
+/*
+ * Keeps a buffer given back in the pool of the thread; if the pool is full, its smallest buffer is freed for a
+ * larger one. Buffers larger than SIMFS_MAX_POOLED_READ_BUFFER are freed.
+ */
+static void simfsPoolReadBuffer(char *buffer)
+{
+#ifdef __GLIBC__
+    SIMFS_READ_BUFFER_POOL_TYPE *pool = &simfsReadBuffers;
+    size_t capacity = malloc_usable_size(buffer);
+
+    if (capacity <= SIMFS_MAX_POOLED_READ_BUFFER && !pool->registered)
+    {
+        pthread_once(&simfsReadBuffersOnce, simfsCreateReadBuffersKey);
+        pool->registered = pthread_setspecific(simfsReadBuffersKey, pool) == 0;
+    }
+
+    if (capacity <= SIMFS_MAX_POOLED_READ_BUFFER && pool->registered)
+    {
+        if (pool->count < SIMFS_READ_BUFFERS_PER_THREAD)
+        {
+            pool->buffer[pool->count] = buffer;
+            pool->capacity[pool->count++] = capacity;
+            return;
+        }
+
+        int smallest = 0;
+        for (int i = 1; i < pool->count; i++)
+            if (pool->capacity[i] < pool->capacity[smallest])
+                smallest = i;
+
+        if (pool->capacity[smallest] < capacity)
+        {
+            char *replaced = pool->buffer[smallest];
+            pool->buffer[smallest] = buffer;
+            pool->capacity[smallest] = capacity;
+            buffer = replaced;
+        }
+    }
+#endif
+
+    free(buffer);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// write-back of metadata
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Records an access to an open file, and a modification if modified is set; the times are kept in the global
+ * open file table until the next flush. The caller holds the lock of the entry, so the file is not deleted
+ * meanwhile.
+ */
+static void simfsTouchEntry(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *entry, int modified)
+{
+    pthread_mutex_lock(&simfsContext.dirtyLock);
+
+    entry->lastAccessTime = time(NULL);
+    if (modified)
+        entry->lastModificationTime = entry->lastAccessTime;
+
+    if (entry->dirtySlot < 0)
+    {
+        entry->dirtySlot = simfsContext.numberOfDirtyEntries;
+        simfsContext.dirtyEntries[simfsContext.numberOfDirtyEntries++] = entry;
+    }
+
+    pthread_mutex_unlock(&simfsContext.dirtyLock);
+}
+
+/*
+ * Removes an entry from the list of entries with unwritten times; the caller holds the dirtyLock.
+ */
+static void simfsDiscardEntry(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *entry)
+{
+    if (entry->dirtySlot < 0)
+        return;
+
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *last = simfsContext.dirtyEntries[--simfsContext.numberOfDirtyEntries];
+    simfsContext.dirtyEntries[entry->dirtySlot] = last;
+    last->dirtySlot = entry->dirtySlot;
+    entry->dirtySlot = -1;
+}
+
+/*
+ * Copies the times of an open file to its file descriptor if they have changed; the caller holds the dirtyLock.
+ */
+static void simfsWriteBackEntry(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *entry)
+{
+    if (entry->dirtySlot < 0)
+        return;
+
+    if (entry->type != INVALID_CONTENT_TYPE) // the file has not been deleted
+    {
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(entry->fileDescriptor);
+        descriptor->lastAccessTime = entry->lastAccessTime;
+        descriptor->lastModificationTime = entry->lastModificationTime;
+        SIMFS_MARK_DIRTY(*descriptor);
+    }
+
+    simfsDiscardEntry(entry);
+}
+
+/*
+ * Writes all modified metadata to the volume; the cost depends only on what has been modified.
+ */
+static void simfsFlush()
+{
+    pthread_mutex_lock(&simfsContext.dirtyLock);
+
+    while (simfsContext.numberOfDirtyEntries > 0)
+        simfsWriteBackEntry(simfsContext.dirtyEntries[0]);
+
+    simfsFlushBitvector();
+
+    pthread_mutex_unlock(&simfsContext.dirtyLock);
+}
+
+static _Thread_local int simfsCommitDeferred; // set while a thread of a request queue runs a chain of requests
+
+/*
+ * Called at the end of every operation that modifies metadata; the requests of a batch leave it to the end of the
+ * batch (see simfsRunChain()).
+ */
+static void simfsCommit()
+{
+    if (!simfsCommitDeferred && __atomic_load_n(&simfsContext.writeBackPolicy, __ATOMIC_ACQUIRE) == SIMFS_WRITE_THROUGH)
+        simfsFlush();
+}
+
+/*
+ * Gives back a reference to a global open file table entry. The entry is released when the last reference is
+ * given back, after writing its times to the file descriptor; the caller holds the openFileLock.
+ */
+static void simfsDropOpenFileEntry(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry)
+{
+    if (--globalEntry->referenceCount > 0)
+        return;
+
+    pthread_mutex_lock(&simfsContext.dirtyLock);
+    simfsWriteBackEntry(globalEntry);
+    pthread_mutex_unlock(&simfsContext.dirtyLock);
+
+    if (globalEntry->type != INVALID_CONTENT_TYPE) // a deleted file has left the map already
+        simfsUnmapOpenFile(globalEntry);
+    simfsInvalidateContent(globalEntry);
+
+    globalEntry->type = INVALID_CONTENT_TYPE;
+    globalEntry->fileDescriptor = SIMFS_INVALID_INDEX;
+    globalEntry->nextFree = simfsContext.freeOpenFile;
+    simfsContext.freeOpenFile = (int) (globalEntry - simfsContext.globalOpenFileTable);
+}
+
+static void simfsReleaseOpenFileEntry(SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry)
+{
+    pthread_mutex_lock(&simfsContext.openFileLock);
+    simfsDropOpenFileEntry(globalEntry);
+    pthread_mutex_unlock(&simfsContext.openFileLock);
+}
+
+/*
+ * Finds the global open file table entry of a file if the file is open, and returns it with an additional
+ * reference; returns NULL if the file is not open.
+ */
+static SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *simfsFindOpenFileEntry(SIMFS_INDEX_TYPE node)
+{
+    pthread_mutex_lock(&simfsContext.openFileLock);
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsLookupOpenFile(node);
+    if (globalEntry != NULL)
+        globalEntry->referenceCount++;
+    pthread_mutex_unlock(&simfsContext.openFileLock);
+
+    return globalEntry;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// journal
+//
+// A volume kept in an image file is mapped privately, so its changes reach the file only when they are written
+// with pwrite(), and a crash leaves the file as it was after the last commit. The changes are committed in
+// transactions, each holding the changes of all operations completed since the previous one (group commit): the
+// operations hold the journal lock shared, and the journal thread takes it exclusively only to copy the changed
+// metadata blocks into the transaction. It then writes the changed data blocks in place and syncs the file, and
+// appends the transaction with its checksum to the journal and syncs the file again. A transaction is committed
+// every SIMFS_JOURNAL_INTERVAL milliseconds, and when simfsSyncFileSystem() waits for one; callers waiting at the
+// same time share the commit.
+//
+// When the journal is half full, it is checkpointed: the newest image of every block is written in place, and the
+// journal starts over. Mounting replays what is left in the journal, so recovering from a crash takes time
+// proportional to the journal, not to the volume.
+//
+// Blocks freed by the operations stay allocated until the transaction is captured, so they are not reused before
+// their release is committed. A transaction lists the runs it releases, and the older images of their blocks are
+// skipped by checkpoints and replays, as the blocks may hold data written in place since.
+//
+// Every page of the private mapping that is written becomes a private copy. Once the file holds the same content,
+// the copy is dropped again (see simfsDropWrittenPages()), and the page is read from the page cache of the file
+// on its next access: the data blocks after their transaction is written, and the metadata blocks after the
+// journal holding their images is checkpointed. So the private copies are bounded by the changes in flight and the
+// journal, not by the volume.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct simfs_journal_image_type {
+    SIMFS_INDEX_TYPE block; // volume block
+    uint32_t transaction; // position of the transaction in the journal
+    size_t offset; // of the image in the copy of the journal; 0 if a later transaction frees the block
+} SIMFS_JOURNAL_IMAGE_TYPE;
+
+static uint64_t simfsChecksum(const void *data, size_t length)
+{
+    const uint64_t *word = data;
+    uint64_t checksum = 0xCBF29CE484222325u; // FNV-1a over 64-bit words
+
+    for (size_t i = 0; i < length / sizeof(uint64_t); i++)
+        checksum = (checksum ^ word[i]) * 0x100000001B3u;
+
+    return checksum;
+}
+
+/*
+ * Write or read a range of the image file completely; return 0 on failure.
+ */
+static int simfsWriteImage(int file, const void *buffer, size_t length, size_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t written = pwrite(file, buffer, length, (off_t) offset);
+        if (written <= 0)
+            return 0;
+
+        buffer = (const char *) buffer + written;
+        length -= (size_t) written;
+        offset += (size_t) written;
+    }
+
+    return 1;
+}
+
+static int simfsReadImage(int file, void *buffer, size_t length, size_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t read = pread(file, buffer, length, (off_t) offset);
+        if (read <= 0)
+            return 0;
+
+        buffer = (char *) buffer + read;
+        length -= (size_t) read;
+        offset += (size_t) read;
+    }
+
+    return 1;
+}
+
+static int simfsFlushImage(int file)
+{
+    SIMFS_COUNT(journalFlushes, 1);
+
+    return fdatasync(file) == 0;
+}
+
+/*
+ * Empties the journal of an image file: its superblock is rewritten with the sequence number of the next
+ * transaction, so the transactions left in the journal do not follow it.
+ */
+static SIMFS_ERROR simfsResetJournal(int file, const SIMFS_GEOMETRY_TYPE *geometry, uint64_t sequence)
+{
+    SIMFS_JOURNAL_SUPERBLOCK_TYPE superblock;
+    memset(&superblock, 0, sizeof(superblock));
+    superblock.magic = SIMFS_JOURNAL_MAGIC;
+    superblock.sequence = sequence;
+
+    if (!simfsWriteImage(file, &superblock, sizeof(superblock), geometry->journalOffset) || !simfsFlushImage(file))
+        return SIMFS_WRITE_ERROR;
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Reads the transactions of the journal of an image file into memory, up to the first one that is missing or torn;
+ * the copy mirrors the journal blocks (its first block is not used). The sequence number of the first transaction
+ * is passed in, and the one following the last transaction read is passed out. Returns NULL if there is no memory.
+ */
+static char *simfsReadJournal(int file, const SIMFS_GEOMETRY_TYPE *geometry, uint64_t *sequence,
+                              uint32_t *numberOfTransactions)
+{
+    int shift = geometry->blockShift;
+    SIMFS_INDEX_TYPE head = 1;
+    char *journal = malloc(geometry->blockSize);
+
+    *numberOfTransactions = 0;
+    while (journal != NULL && head < geometry->journalBlocks)
+    {
+        char *larger = realloc(journal, (size_t) (head + 1) << shift);
+        if (larger == NULL)
+            break;
+        journal = larger;
+
+        size_t offset = geometry->journalOffset + ((size_t) head << shift);
+        SIMFS_TRANSACTION_HEADER_TYPE *header = (SIMFS_TRANSACTION_HEADER_TYPE *) (journal + ((size_t) head << shift));
+        if (!simfsReadImage(file, header, geometry->blockSize, offset) || header->magic != SIMFS_TRANSACTION_MAGIC
+            || header->sequence != *sequence || header->headerBlocks == 0
+            || (uint64_t) header->headerBlocks + header->numberOfImages > geometry->journalBlocks - head
+            || offsetof(SIMFS_TRANSACTION_HEADER_TYPE, list) + ((uint64_t) header->numberOfImages
+                                                               + 2 * (uint64_t) header->numberOfFreedRuns)
+                                                              * sizeof(SIMFS_INDEX_TYPE)
+               > (size_t) header->headerBlocks << shift)
+            return journal;
+
+        SIMFS_INDEX_TYPE blocks = header->headerBlocks + header->numberOfImages;
+        larger = realloc(journal, (size_t) (head + blocks) << shift);
+        if (larger == NULL)
+            break;
+        journal = larger;
+
+        header = (SIMFS_TRANSACTION_HEADER_TYPE *) (journal + ((size_t) head << shift));
+        uint64_t checksum = header->checksum;
+        header->checksum = 0;
+        if (!simfsReadImage(file, (char *) header + geometry->blockSize, (size_t) (blocks - 1) << shift,
+                            offset + geometry->blockSize)
+            || simfsChecksum(header, (size_t) blocks << shift) != checksum)
+            return journal;
+
+        head += blocks;
+        (*sequence)++;
+        (*numberOfTransactions)++;
+    }
+
+    free(journal);
+    return NULL;
+}
+
+static int simfsCompareJournalImages(const void *first, const void *second)
+{
+    const SIMFS_JOURNAL_IMAGE_TYPE *a = first;
+    const SIMFS_JOURNAL_IMAGE_TYPE *b = second;
+
+    if (a->block != b->block)
+        return a->block < b->block ? -1 : 1;
+
+    return (a->transaction > b->transaction) - (a->transaction < b->transaction);
+}
+
+/*
+ * Writes the newest image of every block held by the transactions of a copy of the journal in place, skipping the
+ * blocks freed by a later transaction.
+ */
+static SIMFS_ERROR simfsApplyJournal(int file, const SIMFS_GEOMETRY_TYPE *geometry, const char *journal,
+                                     uint32_t numberOfTransactions)
+{
+    int shift = geometry->blockShift;
+    SIMFS_INDEX_TYPE base = (SIMFS_INDEX_TYPE) (geometry->blocksOffset >> shift);
+    size_t numberOfImages = 0;
+
+    const char *position = journal + geometry->blockSize;
+    for (uint32_t transaction = 0; transaction < numberOfTransactions; transaction++)
+    {
+        const SIMFS_TRANSACTION_HEADER_TYPE *header = (const SIMFS_TRANSACTION_HEADER_TYPE *) position;
+        numberOfImages += header->numberOfImages;
+        position += (size_t) (header->headerBlocks + header->numberOfImages) << shift;
+    }
+
+    SIMFS_JOURNAL_IMAGE_TYPE *image = malloc((numberOfImages + 1) * sizeof(SIMFS_JOURNAL_IMAGE_TYPE));
+    if (image == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    numberOfImages = 0;
+    position = journal + geometry->blockSize;
+    for (uint32_t transaction = 0; transaction < numberOfTransactions; transaction++)
+    {
+        const SIMFS_TRANSACTION_HEADER_TYPE *header = (const SIMFS_TRANSACTION_HEADER_TYPE *) position;
+        for (uint32_t i = 0; i < header->numberOfImages; i++)
+        {
+            SIMFS_INDEX_TYPE block = header->list[i];
+            if (block < (SIMFS_INDEX_TYPE) geometry->headerBlocks
+                || (block >= base && block - base < geometry->numberOfBlocks)) // the rest is not on the volume
+                image[numberOfImages++] = (SIMFS_JOURNAL_IMAGE_TYPE) {
+                    block, transaction, (size_t) (position - journal) + ((size_t) (header->headerBlocks + i) << shift)
+                };
+        }
+        position += (size_t) (header->headerBlocks + header->numberOfImages) << shift;
+    }
+
+    qsort(image, numberOfImages, sizeof(SIMFS_JOURNAL_IMAGE_TYPE), simfsCompareJournalImages);
+
+    position = journal + geometry->blockSize;
+    for (uint32_t transaction = 0; transaction < numberOfTransactions; transaction++)
+    {
+        const SIMFS_TRANSACTION_HEADER_TYPE *header = (const SIMFS_TRANSACTION_HEADER_TYPE *) position;
+        for (uint32_t run = 0; run < header->numberOfFreedRuns; run++)
+        {
+            uint64_t start = (uint64_t) base + header->list[header->numberOfImages + 2 * run];
+            uint64_t end = start + header->list[header->numberOfImages + 2 * run + 1];
+
+            size_t low = 0;
+            size_t high = numberOfImages;
+            while (low < high)
+            {
+                size_t middle = (low + high) / 2;
+                if (image[middle].block < start)
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+
+            for (size_t i = low; i < numberOfImages && image[i].block < end; i++)
+                if (image[i].transaction < transaction)
+                    image[i].offset = 0;
+        }
+        position += (size_t) (header->headerBlocks + header->numberOfImages) << shift;
+    }
+
+    int written = 1;
+    for (size_t i = 0; i < numberOfImages && written; i++)
+        if ((i + 1 == numberOfImages || image[i + 1].block != image[i].block) && image[i].offset != 0)
+            written = simfsWriteImage(file, journal + image[i].offset, geometry->blockSize,
+                                      (size_t) image[i].block << shift);
+
+    free(image);
+
+    return written && simfsFlushImage(file) ? SIMFS_NO_ERROR : SIMFS_WRITE_ERROR;
+}
+
+/*
+ * Replays the journal of an image file: the transactions it holds are written in place, and the journal is
+ * emptied. A journal without a valid superblock (e.g., of a volume formatted in memory and saved to a file) is
+ * initialized as empty. The next transaction gets the sequence number passed out, which is at least the one passed
+ * in.
+ */
+static SIMFS_ERROR simfsReplayJournal(int file, const SIMFS_GEOMETRY_TYPE *geometry, uint64_t *sequence)
+{
+    SIMFS_JOURNAL_SUPERBLOCK_TYPE superblock;
+    if (!simfsReadImage(file, &superblock, sizeof(superblock), geometry->journalOffset))
+        return SIMFS_READ_ERROR;
+
+    if (superblock.magic != SIMFS_JOURNAL_MAGIC)
+        return simfsResetJournal(file, geometry, *sequence);
+
+    uint64_t next = superblock.sequence;
+    uint32_t numberOfTransactions;
+    char *journal = simfsReadJournal(file, geometry, &next, &numberOfTransactions);
+    if (journal == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_ERROR error = simfsApplyJournal(file, geometry, journal, numberOfTransactions);
+    free(journal);
+
+    if (next < *sequence)
+        next = *sequence;
+    *sequence = next;
+
+    if (error != SIMFS_NO_ERROR || (numberOfTransactions == 0 && next == superblock.sequence))
+        return error;
+
+    return simfsResetJournal(file, geometry, next);
+}
+
+/*
+ * Writes the transactions in the journal of the mounted volume in place and empties the journal.
+ */
+static SIMFS_ERROR simfsCheckpoint()
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+    if (journal->head == 1)
+        return SIMFS_NO_ERROR;
+
+    SIMFS_ERROR error = simfsReplayJournal(simfsContext.volumeFile, &simfsContext.geometry, &journal->sequence);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    journal->head = 1;
+    SIMFS_COUNT(journalCheckpoints, 1);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Records a change of a volume block again, for a transaction that was not written.
+ */
+static void simfsMarkBlockDirty(SIMFS_INDEX_TYPE block)
+{
+    SIMFS_INDEX_TYPE base = (SIMFS_INDEX_TYPE) (simfsContext.geometry.blocksOffset >> simfsContext.geometry.blockShift);
+    uint64_t *dirty = simfsContext.headerDirty;
+
+    if (block >= base)
+    {
+        dirty = simfsContext.volumeDirty;
+        block -= base;
+    }
+
+    __atomic_fetch_or(&dirty[block >> 6], (uint64_t) 1 << (block & 63), __ATOMIC_RELEASE);
+}
+
+static int simfsCompareBlocks(const void *first, const void *second)
+{
+    SIMFS_INDEX_TYPE a = *(const SIMFS_INDEX_TYPE *) first;
+    SIMFS_INDEX_TYPE b = *(const SIMFS_INDEX_TYPE *) second;
+
+    return (a > b) - (a < b);
+}
+
+/*
+ * Returns whether a volume block holds the same in the mapping as in the file: it has not changed since it was
+ * captured, and its newest image is not only in the journal. The journal itself is written only to the file. The
+ * caller holds the journal lock exclusively.
+ */
+static int simfsIsBlockWritten(SIMFS_INDEX_TYPE block)
+{
+    SIMFS_GEOMETRY_TYPE *geometry = &simfsContext.geometry;
+    SIMFS_INDEX_TYPE base = (SIMFS_INDEX_TYPE) (geometry->blocksOffset >> geometry->blockShift);
+
+    if (simfsContext.journal.journaled[block >> 6] & SIMFS_BIT(block & 63))
+        return 0;
+    if (block >= base)
+        return !(simfsContext.volumeDirty[(block - base) >> 6] & SIMFS_BIT((block - base) & 63));
+    if (block < (SIMFS_INDEX_TYPE) geometry->headerBlocks)
+        return !(simfsContext.headerDirty[block >> 6] & SIMFS_BIT(block & 63));
+
+    return 1;
+}
+
+typedef struct simfs_page_range_type {
+    size_t start; // the pages to drop, as offsets into the volume
+    size_t end;
+    size_t next; // the pages below have been considered
+} SIMFS_PAGE_RANGE_TYPE;
+
+static void simfsDropPageRange(SIMFS_PAGE_RANGE_TYPE *range)
+{
+    if (range->end > range->start)
+        madvise((char *) simfsContext.volume + range->start, range->end - range->start, MADV_DONTNEED);
+
+    range->start = range->end = 0;
+}
+
+/*
+ * Adds the pages holding a volume block to the range to drop, as far as all the blocks on them are written; the
+ * blocks are passed in increasing order, and a discontiguous range is dropped first.
+ */
+static void simfsDropPagesOf(SIMFS_PAGE_RANGE_TYPE *range, SIMFS_INDEX_TYPE block)
+{
+    SIMFS_GEOMETRY_TYPE *geometry = &simfsContext.geometry;
+    size_t pageSize = simfsContext.journal.pageSize;
+    SIMFS_INDEX_TYPE lastBlock = (SIMFS_INDEX_TYPE) (geometry->volumeSize >> geometry->blockShift) - 1;
+
+    size_t page = ((size_t) block << geometry->blockShift) & ~(pageSize - 1);
+    if (page < range->next)
+        page = range->next;
+
+    for (; page < (size_t) (block + 1) << geometry->blockShift; page += pageSize)
+    {
+        range->next = page + pageSize;
+
+        SIMFS_INDEX_TYPE first = (SIMFS_INDEX_TYPE) (page >> geometry->blockShift);
+        SIMFS_INDEX_TYPE last = (SIMFS_INDEX_TYPE) ((page + pageSize - 1) >> geometry->blockShift);
+        int written = 1;
+        for (SIMFS_INDEX_TYPE other = first; other <= last && other <= lastBlock && written; other++)
+            written = simfsIsBlockWritten(other);
+        if (!written)
+            continue;
+
+        if (page != range->end)
+        {
+            simfsDropPageRange(range);
+            range->start = page;
+        }
+        range->end = page + pageSize;
+    }
+}
+
+/*
+ * Drops the private copies of the pages of the mapping whose blocks the file holds as well: the data blocks of the
+ * previous transaction, which have been written in place unless they were recorded as changed again, and, after a
+ * checkpoint, the blocks whose images were in the journal. Called at the capture of a transaction, while the
+ * operations are held off.
+ */
+static void simfsDropWrittenPages()
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+
+    SIMFS_PAGE_RANGE_TYPE range = { 0, 0, 0 };
+    for (int i = 0; i < journal->numberOfData; i++) // in increasing order, as they were captured
+        simfsDropPagesOf(&range, journal->data[i]);
+    simfsDropPageRange(&range);
+
+    if (!journal->checkpointed)
+        return;
+    journal->checkpointed = 0;
+
+    for (int i = 0; i < journal->numberOfJournaled; i++)
+        journal->journaled[journal->journaledBlocks[i] >> 6] &= ~SIMFS_BIT(journal->journaledBlocks[i] & 63);
+    qsort(journal->journaledBlocks, (size_t) journal->numberOfJournaled, sizeof(SIMFS_INDEX_TYPE),
+          simfsCompareBlocks);
+
+    range = (SIMFS_PAGE_RANGE_TYPE) { 0, 0, 0 };
+    for (int i = 0; i < journal->numberOfJournaled; i++)
+        simfsDropPagesOf(&range, journal->journaledBlocks[i]);
+    simfsDropPageRange(&range);
+
+    journal->numberOfJournaled = 0;
+}
+
+/*
+ * Records that the newest image of a volume block is in the journal; if the list of such blocks cannot grow, the
+ * bit stays set, and the pages of the block are not dropped while the volume is mounted.
+ */
+static void simfsJournalBlock(SIMFS_INDEX_TYPE block)
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+
+    if (journal->journaled[block >> 6] & SIMFS_BIT(block & 63))
+        return;
+
+    journal->journaled[block >> 6] |= SIMFS_BIT(block & 63);
+    if (simfsGrow((void **) &journal->journaledBlocks, &journal->journaledCapacity, journal->numberOfJournaled,
+                  sizeof(SIMFS_INDEX_TYPE)))
+        journal->journaledBlocks[journal->numberOfJournaled++] = block;
+}
+
+/*
+ * Adds a volume block to a list of the transaction; returns 0 if there is no memory, and records the change again.
+ */
+static int simfsCaptureBlock(SIMFS_INDEX_TYPE **list, int *count, int *capacity, SIMFS_INDEX_TYPE block)
+{
+    if (!simfsGrow((void **) list, capacity, *count, sizeof(SIMFS_INDEX_TYPE)))
+    {
+        simfsMarkBlockDirty(block);
+        return 0;
+    }
+
+    (*list)[(*count)++] = block;
+    return 1;
+}
+
+/*
+ * Collects the changes of the operations completed so far into a new transaction: the runs they freed are released,
+ * the pending metadata is flushed, and the changed metadata blocks are copied into the buffer, while the operations
+ * are held off. The changed data blocks are only listed; they are written from the volume. Passes out the number of
+ * the transaction; returns SIMFS_ALLOC_ERROR if there is no memory for it, and the changes are left for the next.
+ */
+static SIMFS_ERROR simfsCaptureTransaction(uint64_t *transaction)
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+    SIMFS_GEOMETRY_TYPE *geometry = &simfsContext.geometry;
+    SIMFS_INDEX_TYPE base = (SIMFS_INDEX_TYPE) (geometry->blocksOffset >> geometry->blockShift);
+    int captured = 1;
+
+    pthread_rwlock_wrlock(&journal->lock);
+
+    pthread_mutex_lock(&journal->stateLock);
+    *transaction = journal->transaction++;
+    pthread_mutex_unlock(&journal->stateLock);
+
+    simfsDropWrittenPages();
+
+    int released = 0;
+    while (released < journal->numberOfFreed
+           && simfsGrow((void **) &journal->revoked, &journal->revokedCapacity, journal->numberOfRevoked,
+                        sizeof(SIMFS_EXTENT_TYPE)))
+    {
+        SIMFS_EXTENT_TYPE run = journal->freed[released++];
+        simfsReleaseRun(run.start, (int) run.length);
+        journal->revoked[journal->numberOfRevoked++] = run;
+    }
+    journal->numberOfFreed -= released;
+    if (journal->numberOfFreed > 0)
+        memmove(journal->freed, journal->freed + released, journal->numberOfFreed * sizeof(SIMFS_EXTENT_TYPE));
+
+    simfsFlush();
+
+    journal->numberOfImages = 0;
+    journal->numberOfData = 0;
+    for (int word = 0; word < (geometry->headerBlocks + 63) / 64; word++)
+        for (uint64_t dirty = __atomic_exchange_n(&simfsContext.headerDirty[word], 0, __ATOMIC_ACQUIRE); dirty != 0;
+             dirty &= dirty - 1)
+            captured &= simfsCaptureBlock(&journal->images, &journal->numberOfImages, &journal->imagesCapacity,
+                                          (SIMFS_INDEX_TYPE) (word << 6) + __builtin_ctzll(dirty));
+
+    for (int word = 0; word < geometry->bitvectorWords; word++)
+        for (uint64_t dirty = __atomic_exchange_n(&simfsContext.volumeDirty[word], 0, __ATOMIC_ACQUIRE); dirty != 0;
+             dirty &= dirty - 1)
+        {
+            SIMFS_INDEX_TYPE block = (SIMFS_INDEX_TYPE) (word << 6) + __builtin_ctzll(dirty);
+            if (!simfsIsBlockUsed(block)) // freed since it was changed
+                continue;
+
+            if (SIMFS_BLOCK(block).type == DATA_CONTENT_TYPE)
+                captured &= simfsCaptureBlock(&journal->data, &journal->numberOfData, &journal->dataCapacity,
+                                              base + block);
+            else
+                captured &= simfsCaptureBlock(&journal->images, &journal->numberOfImages, &journal->imagesCapacity,
+                                              base + block);
+        }
+
+    size_t listSize = offsetof(SIMFS_TRANSACTION_HEADER_TYPE, list)
+                      + ((size_t) journal->numberOfImages + 2 * (size_t) journal->numberOfRevoked)
+                        * sizeof(SIMFS_INDEX_TYPE);
+    uint32_t headerBlocks = (uint32_t) ((listSize + geometry->blockSize - 1) >> geometry->blockShift);
+    size_t size = ((size_t) headerBlocks + journal->numberOfImages) << geometry->blockShift;
+    if (captured && size > journal->bufferSize)
+    {
+        char *buffer = realloc(journal->buffer, size);
+        if (buffer == NULL)
+            captured = 0;
+        else
+        {
+            journal->buffer = buffer;
+            journal->bufferSize = size;
+        }
+    }
+
+    if (captured)
+    {
+        SIMFS_TRANSACTION_HEADER_TYPE *header = (SIMFS_TRANSACTION_HEADER_TYPE *) journal->buffer;
+        memset(header, 0, (size_t) headerBlocks << geometry->blockShift);
+        header->magic = SIMFS_TRANSACTION_MAGIC;
+        header->headerBlocks = headerBlocks;
+        header->numberOfImages = (uint32_t) journal->numberOfImages;
+        header->numberOfFreedRuns = (uint32_t) journal->numberOfRevoked;
+
+        for (int i = 0; i < journal->numberOfImages; i++)
+        {
+            header->list[i] = journal->images[i];
+            simfsJournalBlock(journal->images[i]);
+            memcpy(journal->buffer + ((size_t) (headerBlocks + i) << geometry->blockShift),
+                   (char *) simfsContext.volume + ((size_t) journal->images[i] << geometry->blockShift),
+                   geometry->blockSize);
+        }
+        for (int run = 0; run < journal->numberOfRevoked; run++)
+        {
+            header->list[journal->numberOfImages + 2 * run] = journal->revoked[run].start;
+            header->list[journal->numberOfImages + 2 * run + 1] = journal->revoked[run].length;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < journal->numberOfImages; i++)
+            simfsMarkBlockDirty(journal->images[i]);
+        for (int i = 0; i < journal->numberOfData; i++)
+            simfsMarkBlockDirty(journal->data[i]);
+        journal->numberOfImages = 0;
+        journal->numberOfData = 0;
+    }
+
+    pthread_rwlock_unlock(&journal->lock);
+
+    return captured ? SIMFS_NO_ERROR : SIMFS_ALLOC_ERROR;
+}
+
+/*
+ * Writes the captured transaction: first its data blocks in place, then its images to the journal. A transaction
+ * that does not fit into the rest of the journal is written after a checkpoint; one larger than the whole journal
+ * is written in place, which is not atomic. Returns 0 on failure.
+ */
+static int simfsWriteTransaction()
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+    SIMFS_GEOMETRY_TYPE *geometry = &simfsContext.geometry;
+    int file = simfsContext.volumeFile;
+    int shift = geometry->blockShift;
+    int written = 1;
+
+    // the operations run meanwhile; a data block changed again is recorded again, and written by the next transaction
+    for (int i = 0, j; i < journal->numberOfData && written; i = j)
+    {
+        for (j = i + 1; j < journal->numberOfData && journal->data[j] == journal->data[j - 1] + 1; j++)
+            ;
+        written = simfsWriteImage(file, (char *) simfsContext.volume + ((size_t) journal->data[i] << shift),
+                                  (size_t) (j - i) << shift, (size_t) journal->data[i] << shift);
+    }
+    if (!written || (journal->numberOfData > 0 && !simfsFlushImage(file)))
+        return 0;
+
+    if (journal->numberOfImages == 0)
+        return 1;
+
+    SIMFS_TRANSACTION_HEADER_TYPE *header = (SIMFS_TRANSACTION_HEADER_TYPE *) journal->buffer;
+    SIMFS_INDEX_TYPE blocks = header->headerBlocks + header->numberOfImages;
+
+    if (blocks > geometry->journalBlocks - 1)
+    {
+        if (simfsCheckpoint() != SIMFS_NO_ERROR) // no older image may be replayed over the blocks written now
+            return 0;
+
+        for (int i = 0; i < journal->numberOfImages && written; i++)
+            written = simfsWriteImage(file, journal->buffer + ((size_t) (header->headerBlocks + i) << shift),
+                                      geometry->blockSize, (size_t) journal->images[i] << shift);
+
+        return written && simfsFlushImage(file);
+    }
+
+    if (journal->head + blocks > geometry->journalBlocks && simfsCheckpoint() != SIMFS_NO_ERROR)
+        return 0;
+
+    header->sequence = journal->sequence;
+    header->checksum = 0;
+    header->checksum = simfsChecksum(header, (size_t) blocks << shift);
+    size_t offset = geometry->journalOffset + ((size_t) journal->head << shift);
+    if (!simfsWriteImage(file, header, (size_t) blocks << shift, offset) || !simfsFlushImage(file))
+        return 0;
+
+    journal->head += blocks;
+    journal->sequence++;
+
+    return 1;
+}
+
+/*
+ * Captures and writes a transaction; passes out its number, and returns 0 if it was not written. The blocks of a
+ * transaction that was not written are recorded as changed again, and the runs it freed are listed again by the
+ * next one.
+ */
+static int simfsCommitTransaction(uint64_t *transaction)
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+
+    if (simfsCaptureTransaction(transaction) != SIMFS_NO_ERROR)
+        return 0;
+
+    if (!simfsWriteTransaction())
+    {
+        for (int i = 0; i < journal->numberOfImages; i++)
+            simfsMarkBlockDirty(journal->images[i]);
+        for (int i = 0; i < journal->numberOfData; i++)
+            simfsMarkBlockDirty(journal->data[i]);
+        return 0;
+    }
+
+    if (journal->numberOfImages > 0)
+        SIMFS_COUNT(journalCommits, 1);
+    SIMFS_COUNT(journalImages, (uint64_t) journal->numberOfImages);
+    SIMFS_COUNT(journalDataBlocks, (uint64_t) journal->numberOfData);
+    journal->numberOfRevoked = 0;
+
+    return 1;
+}
+
+/*
+ * The journal thread: commits a transaction every SIMFS_JOURNAL_INTERVAL milliseconds or on request, and
+ * checkpoints the journal when it is half full. When stopping, it commits the last transaction, empties the journal
+ * and exits.
+ */
+static void *simfsJournalWorker(void *argument)
+{
+    SIMFS_JOURNAL_TYPE *journal = argument;
+    int stopping = 0;
+
+    while (!stopping)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SIMFS_JOURNAL_INTERVAL / 1000;
+        deadline.tv_nsec += (SIMFS_JOURNAL_INTERVAL % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&journal->stateLock);
+        while (!journal->stopping && journal->requestedTransaction <= journal->committedTransaction
+               && pthread_cond_timedwait(&journal->requested, &journal->stateLock, &deadline) == 0)
+            ;
+        stopping = journal->stopping;
+        pthread_mutex_unlock(&journal->stateLock);
+
+        uint64_t transaction;
+        int written = simfsCommitTransaction(&transaction);
+
+        pthread_mutex_lock(&journal->stateLock);
+        journal->committedTransaction = transaction;
+        if (!written)
+            journal->failures++;
+        pthread_cond_broadcast(&journal->committed);
+        pthread_mutex_unlock(&journal->stateLock);
+
+        if (written && (stopping || journal->head > simfsContext.geometry.journalBlocks / 2))
+        {
+            if (simfsCheckpoint() == SIMFS_NO_ERROR)
+                journal->checkpointed = 1; // every image of the journal has been written in place
+            else
+            {
+                pthread_mutex_lock(&journal->stateLock);
+                journal->failures++;
+                pthread_mutex_unlock(&journal->stateLock);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Hold and release the journal lock around an operation; a volume without a journal is not locked.
+ */
+static inline void simfsHoldJournal()
+{
+    if (simfsContext.journal.active)
+        pthread_rwlock_rdlock(&simfsContext.journal.lock);
+}
+
+static inline void simfsReleaseJournal()
+{
+    if (simfsContext.journal.active)
+        pthread_rwlock_unlock(&simfsContext.journal.lock);
+}
+
+/*
+ * Start and end a counted operation (see simfsCountOperation()) that holds the journal lock.
+ */
+static inline uint64_t simfsBeginOperation()
+{
+    uint64_t started = simfsNanoseconds();
+    simfsHoldJournal();
+
+    return started;
+}
+
+static SIMFS_ERROR simfsEndOperation(SIMFS_OPERATION_TYPE operation, uint64_t started, SIMFS_ERROR error)
+{
+    simfsReleaseJournal();
+
+    return simfsCountOperation(operation, started, error);
+}
+
+/*
+ * Waits until the changes of all operations completed so far are committed; the caller does not hold the journal
+ * lock. Returns SIMFS_WRITE_ERROR if a transaction could not be written meanwhile.
+ */
+static SIMFS_ERROR simfsCommitJournal()
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+
+    pthread_mutex_lock(&journal->stateLock);
+
+    uint64_t transaction = journal->transaction;
+    unsigned int failures = journal->failures;
+    if (journal->requestedTransaction < transaction)
+    {
+        journal->requestedTransaction = transaction;
+        pthread_cond_signal(&journal->requested);
+    }
+
+    while (journal->committedTransaction < transaction)
+        pthread_cond_wait(&journal->committed, &journal->stateLock);
+    int failed = journal->failures != failures;
+
+    pthread_mutex_unlock(&journal->stateLock);
+
+    return failed ? SIMFS_WRITE_ERROR : SIMFS_NO_ERROR;
+}
+
+/*
+ * Called by an operation that failed for lack of space, holding the journal lock: if blocks freed by the operations
+ * wait for the next transaction, commits it so they are released, and returns 1 to have the operation retried.
+ */
+static int simfsReclaimFreedBlocks()
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+    if (!journal->active)
+        return 0;
+
+    pthread_mutex_lock(&journal->freedLock);
+    int waiting = journal->numberOfFreed > 0;
+    pthread_mutex_unlock(&journal->freedLock);
+    if (!waiting)
+        return 0;
+
+    simfsReleaseJournal();
+    simfsCommitJournal();
+    simfsHoldJournal();
+
+    return 1;
+}
+
+/*
+ * Starts the journal of a volume mounted from an image file, whose journal has been replayed; the next transaction
+ * gets the given sequence number.
+ */
+static SIMFS_ERROR simfsStartJournal(uint64_t sequence)
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+
+    journal->transaction = 1;
+    journal->committedTransaction = 0;
+    journal->requestedTransaction = 0;
+    journal->failures = 0;
+    journal->stopping = 0;
+    journal->sequence = sequence;
+    journal->head = 1;
+    journal->numberOfFreed = 0;
+    journal->numberOfRevoked = 0;
+    journal->numberOfImages = 0;
+    journal->numberOfData = 0;
+    journal->numberOfJournaled = 0;
+    journal->checkpointed = 0;
+    journal->pageSize = (size_t) sysconf(_SC_PAGESIZE);
+
+    SIMFS_INDEX_TYPE volumeBlocks = (SIMFS_INDEX_TYPE) (simfsContext.geometry.volumeSize
+                                                        >> simfsContext.geometry.blockShift);
+    journal->journaled = calloc((volumeBlocks + 63) / 64, sizeof(uint64_t));
+    if (journal->journaled == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    journal->active = 1;
+    if (pthread_create(&journal->thread, NULL, simfsJournalWorker, journal) != 0)
+    {
+        journal->active = 0;
+        free(journal->journaled);
+        journal->journaled = NULL;
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Commits the last transaction, empties the journal, and stops the journal thread; no operation may run. Returns
+ * SIMFS_WRITE_ERROR if the changes could not be written.
+ */
+static SIMFS_ERROR simfsStopJournal()
+{
+    SIMFS_JOURNAL_TYPE *journal = &simfsContext.journal;
+
+    pthread_mutex_lock(&journal->stateLock);
+    unsigned int failures = journal->failures;
+    journal->stopping = 1;
+    pthread_cond_signal(&journal->requested);
+    pthread_mutex_unlock(&journal->stateLock);
+
+    pthread_join(journal->thread, NULL);
+    journal->active = 0;
+
+    free(journal->freed);
+    free(journal->revoked);
+    free(journal->images);
+    free(journal->data);
+    free(journal->buffer);
+    free(journal->journaled);
+    free(journal->journaledBlocks);
+    journal->freed = NULL;
+    journal->freedCapacity = 0;
+    journal->revoked = NULL;
+    journal->revokedCapacity = 0;
+    journal->images = NULL;
+    journal->imagesCapacity = 0;
+    journal->data = NULL;
+    journal->dataCapacity = 0;
+    journal->buffer = NULL;
+    journal->bufferSize = 0;
+    journal->journaled = NULL;
+    journal->journaledBlocks = NULL;
+    journal->journaledCapacity = 0;
+
+    return journal->failures != failures ? SIMFS_WRITE_ERROR : SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// statistics file
+//
+// The statistics are readable as the file SIMFS_STATISTICS_FILE_NAME in the root folder. The file is not on the
+// volume: it is found by its name, it cannot be created, written, or deleted, and opening it takes a snapshot of
+// the statistics in JSON, which the handle reads until it is closed.
+//
+//////////////////////////////////////////////////////////////////////////
+
+static int simfsIsStatisticsFile(SIMFS_INDEX_TYPE folder, const char *fileName)
+{
+    return folder == simfsContext.volume->superblock.attr.rootNodeIndex
+           && strncmp(fileName, SIMFS_STATISTICS_FILE_NAME, SIMFS_MAX_NAME_LENGTH) == 0;
+}
+
+/*
+ * Returns the statistics as content with a single reference, or NULL if there is no memory for them.
+ */
+static SIMFS_CACHED_CONTENT_TYPE *simfsTakeStatisticsSnapshot()
+{
+    char *json;
+    if (simfsGetStatistics(&json) != SIMFS_NO_ERROR)
+        return NULL;
+
+    size_t size = strlen(json);
+    SIMFS_CACHED_CONTENT_TYPE *snapshot = malloc(sizeof(SIMFS_CACHED_CONTENT_TYPE) + size + 1);
+    if (snapshot != NULL)
+    {
+        snapshot->referenceCount = 1;
+        snapshot->size = size;
+        memcpy(snapshot->data, json, size + 1);
+    }
+    free(json);
+
+    return snapshot;
+}
+
+/*
+ * Describes the statistics file as a read-only file of root, with the size of the current statistics.
+ */
+static SIMFS_ERROR simfsGetStatisticsFileInfo(SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    SIMFS_CACHED_CONTENT_TYPE *snapshot = simfsTakeStatisticsSnapshot();
+    if (snapshot == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    memset(infoBuffer, 0, sizeof(SIMFS_FILE_DESCRIPTOR_TYPE));
+    infoBuffer->type = FILE_CONTENT_TYPE;
+    strncpy(infoBuffer->name, SIMFS_STATISTICS_FILE_NAME, SIMFS_MAX_NAME_LENGTH - 1);
+    infoBuffer->creationTime = time(NULL);
+    infoBuffer->lastAccessTime = infoBuffer->creationTime;
+    infoBuffer->lastModificationTime = infoBuffer->creationTime;
+    infoBuffer->accessRights = S_IRUSR | S_IRGRP | S_IROTH;
+    infoBuffer->owner = 0;
+    infoBuffer->size = snapshot->size;
+    infoBuffer->block_ref = SIMFS_INVALID_INDEX;
+
+    simfsReleaseContent(snapshot);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Opens the statistics file for the process; every open takes a new snapshot, so each handle is a separate file.
+ */
+static SIMFS_ERROR simfsOpenStatisticsFile(pid_t pid, SIMFS_FILE_HANDLE_TYPE *fileHandle)
+{
+    SIMFS_CACHED_CONTENT_TYPE *snapshot = simfsTakeStatisticsSnapshot();
+    if (snapshot == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    pthread_mutex_lock(&simfsContext.openFileLock);
+
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsFindProcess(pid);
+    if (pcb == NULL)
+        pcb = simfsAddProcess(pid);
+    if (pcb == NULL || pcb->freeHandles == 0)
+    {
+        pthread_mutex_unlock(&simfsContext.openFileLock);
+        simfsReleaseContent(snapshot);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    int handle = __builtin_ctzll(pcb->freeHandles);
+    pcb->freeHandles &= pcb->freeHandles - 1;
+    pcb->openFileTable[handle].accessRights = S_IRUSR;
+    pcb->openFileTable[handle].globalEntry = NULL;
+    pcb->openFileTable[handle].snapshot = snapshot;
+    pcb->numberOfOpenFiles++;
+
+    pthread_mutex_unlock(&simfsContext.openFileLock);
+
+    *fileHandle = handle;
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// simfs function implementations
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Formats a volume with the given geometry: the superblock is initialized, all blocks are marked free, and the
+ * first block becomes an empty root folder. SIMFS_INVALID_INDEX is beyond the largest number of blocks, so no
+ * block has to be reserved for it.
+ */
+static void simfsFormatVolume(SIMFS_VOLUME *fileSystem, const SIMFS_GEOMETRY_TYPE *geometry)
+{
+    memset(fileSystem, 0, geometry->journalOffset);
+    fileSystem->superblock.attr.rootNodeIndex = 0;
+    fileSystem->superblock.attr.numberOfBlocks = geometry->numberOfBlocks;
+    fileSystem->superblock.attr.blockSize = geometry->blockSize;
+    fileSystem->superblock.attr.magic = SIMFS_MAGIC;
+    fileSystem->superblock.attr.snapshotNode = SIMFS_INVALID_INDEX;
+
+    char *bitvector = (char *) fileSystem + geometry->blockSize;
+    bitvector[0] |= 1;
+
+    SIMFS_BLOCK_TYPE *root = (SIMFS_BLOCK_TYPE *) ((char *) fileSystem + geometry->blocksOffset);
+    memset(root, 0, geometry->blockSize);
+    root->type = FOLDER_CONTENT_TYPE;
+    root->content.fileDescriptor.type = FOLDER_CONTENT_TYPE;
+    strcpy(root->content.fileDescriptor.name, "/");
+    root->content.fileDescriptor.creationTime = time(NULL);
+    root->content.fileDescriptor.lastAccessTime = root->content.fileDescriptor.creationTime;
+    root->content.fileDescriptor.lastModificationTime = root->content.fileDescriptor.creationTime;
+    root->content.fileDescriptor.accessRights = S_IRWXU | S_IRWXG | S_IRWXO;
+    root->content.fileDescriptor.owner = 0;
+    root->content.fileDescriptor.size = 0;
+    root->content.fileDescriptor.block_ref = SIMFS_INVALID_INDEX;
+}
+
+/*
+ * Replaces the directory with the given entries; every shard is sized for its entries up front, so it does not
+ * grow while they are inserted. Used only while mounting.
+ */
+static SIMFS_ERROR simfsLoadDirectory(SIMFS_DIR_ENT **entries, const unsigned int *count, int numberOfArrays)
+{
+    unsigned int shardCount[SIMFS_DIRECTORY_SHARDS] = { 0 };
+
+    for (int array = 0; array < numberOfArrays; array++)
+        for (unsigned int i = 0; i < count[array]; i++)
+            shardCount[simfsShard(entries[array][i].hash) - simfsContext.directory]++;
+
+    simfsClearDirectory();
+    for (int shard = 0; shard < SIMFS_DIRECTORY_SHARDS; shard++)
+    {
+        unsigned int capacity = SIMFS_DIRECTORY_INITIAL_SIZE;
+        while (shardCount[shard] * 4 > capacity * 3)
+            capacity *= 2;
+
+        if (simfsResizeDirectory(&simfsContext.directory[shard], capacity) != SIMFS_NO_ERROR)
+            return SIMFS_ALLOC_ERROR;
+        simfsContext.directory[shard].count = shardCount[shard];
+    }
+
+    for (int array = 0; array < numberOfArrays; array++)
+        for (unsigned int i = 0; i < count[array]; i++)
+        {
+            SIMFS_DIRECTORY *directory = simfsShard(entries[array][i].hash);
+            simfsInsertDirEnt(directory->slot, directory->capacity, entries[array][i]);
+        }
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Loads the in-memory directory from the snapshot written by simfsWriteSnapshot(). The entries hold the hashes,
+ * so they are placed into the table without reading the names from the file descriptor blocks.
+ */
+static SIMFS_ERROR simfsLoadSnapshot()
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(simfsContext.volume->superblock.attr.snapshotNode);
+    unsigned int count = (unsigned int) (descriptor->size / sizeof(SIMFS_DIR_ENT));
+
+    SIMFS_DIR_ENT *entries = malloc(descriptor->size + 1);
+    if (entries == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    simfsTransfer(descriptor, 0, (char *) entries, descriptor->size, 0);
+    SIMFS_ERROR error = simfsLoadDirectory(&entries, &count, 1);
+
+    free(entries);
+    return error;
+}
+
+/*
+ * Writes the entries of the in-memory directory as the content of the snapshot node, a file descriptor that
+ * does not belong to any folder and is referenced from the superblock; the caller holds the locks of all shards.
+ *
+ * If there is no space for the snapshot, it stays stale and the next mount traverses the folders.
+ */
+static void simfsStoreSnapshot()
+{
+    struct attr *attr = &simfsContext.volume->superblock.attr;
+
+    if (attr->snapshotNode == SIMFS_INVALID_INDEX)
+    {
+        SIMFS_INDEX_TYPE node = simfsAllocateBlock();
+        if (node == SIMFS_INVALID_INDEX)
+            return;
+
+        memset(&SIMFS_BLOCK(node), 0, sizeof(SIMFS_BLOCK_TYPE));
+        SIMFS_BLOCK(node).type = FILE_CONTENT_TYPE;
+        SIMFS_DESCRIPTOR(node).type = FILE_CONTENT_TYPE;
+        SIMFS_DESCRIPTOR(node).block_ref = SIMFS_INVALID_INDEX;
+        attr->snapshotNode = node;
+        SIMFS_MARK_DIRTY(*attr);
+    }
+
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(attr->snapshotNode);
+    size_t size = simfsDirectorySize() * sizeof(SIMFS_DIR_ENT);
+    SIMFS_DIR_ENT *entries = malloc(size + 1);
+
+    if (entries != NULL && simfsResizeContent(descriptor, size) == SIMFS_NO_ERROR)
+    {
+        unsigned int count = 0;
+        for (int shard = 0; shard < SIMFS_DIRECTORY_SHARDS; shard++)
+        {
+            SIMFS_DIRECTORY *directory = &simfsContext.directory[shard];
+            for (unsigned int i = 0; i < directory->capacity; i++)
+                if (directory->slot[i].hash != 0)
+                    entries[count++] = directory->slot[i];
+        }
+
+        simfsTransfer(descriptor, 0, (char *) entries, size, 1);
+        descriptor->lastModificationTime = time(NULL);
+        SIMFS_MARK_DIRTY(*descriptor);
+
+        pthread_mutex_lock(&simfsContext.dirtyLock);
+        simfsFlushBitvector();
+        pthread_mutex_unlock(&simfsContext.dirtyLock);
+
+        __atomic_store_n(&attr->snapshotValid, 1, __ATOMIC_RELEASE);
+        SIMFS_MARK_DIRTY(*attr);
+    }
+
+    free(entries);
+}
+
+/*
+ * Writes the directory snapshot unless it is still valid. Any change of the directory afterwards marks the
+ * snapshot as stale. All shards of the directory are locked while the snapshot is written, so it cannot miss
+ * a change.
+ */
+static void simfsWriteSnapshot()
+{
+    pthread_mutex_lock(&simfsContext.syncLock);
+    for (int shard = 0; shard < SIMFS_DIRECTORY_SHARDS; shard++)
+        pthread_rwlock_rdlock(&simfsContext.directory[shard].lock);
+
+    if (!simfsContext.volume->superblock.attr.snapshotValid)
+        simfsStoreSnapshot();
+
+    for (int shard = SIMFS_DIRECTORY_SHARDS - 1; shard >= 0; shard--)
+        pthread_rwlock_unlock(&simfsContext.directory[shard].lock);
+    pthread_mutex_unlock(&simfsContext.syncLock);
+}
+
+//
+// traversal of the folders by a pool of threads
+//
+// the work items are folder blocks; a thread that finds a folder among the entries of a folder block adds the first
+// folder block of that folder to the queue, and the next folder block of the folder it is processing
+//
+typedef struct simfs_mount_queue_type {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    SIMFS_INDEX_TYPE (*item)[2]; // pairs of the folder and its folder block
+    int count;
+    int capacity;
+    int busy; // number of threads processing an item
+    SIMFS_ERROR error;
+} SIMFS_MOUNT_QUEUE_TYPE;
+
+typedef struct simfs_mount_worker_type {
+    pthread_t thread;
+    SIMFS_MOUNT_QUEUE_TYPE *queue;
+    SIMFS_DIR_ENT *entry; // entries found by this thread
+    int count;
+    int capacity;
+} SIMFS_MOUNT_WORKER_TYPE;
+
+/*
+ * Adds a folder block to the queue; the caller holds the lock.
+ */
+static void simfsQueueFolderBlock(SIMFS_MOUNT_QUEUE_TYPE *queue, SIMFS_INDEX_TYPE folder, SIMFS_INDEX_TYPE block)
+{
+    if (block == SIMFS_INVALID_INDEX)
+        return;
+
+    if (queue->count == queue->capacity)
+    {
+        int capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+        void *item = realloc(queue->item, capacity * sizeof(queue->item[0]));
+        if (item == NULL)
+        {
+            queue->error = SIMFS_ALLOC_ERROR;
+            return;
+        }
+        queue->item = item;
+        queue->capacity = capacity;
+    }
+
+    queue->item[queue->count][0] = folder;
+    queue->item[queue->count][1] = block;
+    queue->count++;
+    pthread_cond_signal(&queue->changed);
+}
+
+static void *simfsMountWorker(void *argument)
+{
+    SIMFS_MOUNT_WORKER_TYPE *worker = argument;
+    SIMFS_MOUNT_QUEUE_TYPE *queue = worker->queue;
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;)
+    {
+        while (queue->count == 0 && queue->busy > 0 && queue->error == SIMFS_NO_ERROR)
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        if (queue->count == 0 || queue->error != SIMFS_NO_ERROR)
+            break;
+
+        queue->count--;
+        SIMFS_INDEX_TYPE folder = queue->item[queue->count][0];
+        SIMFS_FOLDER_BLOCK_TYPE *block = &SIMFS_BLOCK(queue->item[queue->count][1]).content.folder;
+        queue->busy++;
+        simfsQueueFolderBlock(queue, folder, block->next);
+        pthread_mutex_unlock(&queue->lock);
+
+        int room = (int) (simfsContext.geometry.folderSize / SIMFS_FOLDER_ENTRY_SIZE(0)); // the most entries of a block
+        if (worker->capacity - worker->count < room)
+        {
+            int capacity = worker->capacity == 0 ? 1024 : worker->capacity * 2;
+            while (capacity - worker->count < room)
+                capacity *= 2;
+            SIMFS_DIR_ENT *entry = realloc(worker->entry, capacity * sizeof(SIMFS_DIR_ENT));
+            if (entry == NULL)
+            {
+                pthread_mutex_lock(&queue->lock);
+                queue->error = SIMFS_ALLOC_ERROR;
+                queue->busy--;
+                break;
+            }
+            worker->entry = entry;
+            worker->capacity = capacity;
+        }
+
+        // the names are in the folder block, so only the descriptors of the subfolders are read
+        size_t offset;
+        SIMFS_FOLDER_ENTRY_TYPE *entry;
+        for (offset = 0; offset < block->used; offset += SIMFS_FOLDER_ENTRY_SIZE(entry->nameLength))
+        {
+            entry = simfsFolderEntry(block, offset);
+            SIMFS_DIR_ENT dirEnt = { simfsHash(folder, entry->name), folder, entry->node };
+            worker->entry[worker->count++] = dirEnt;
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        for (offset = 0; offset < block->used; offset += SIMFS_FOLDER_ENTRY_SIZE(entry->nameLength))
+        {
+            entry = simfsFolderEntry(block, offset);
+            if (entry->type == FOLDER_CONTENT_TYPE)
+                simfsQueueFolderBlock(queue, entry->node, SIMFS_DESCRIPTOR(entry->node).block_ref);
+        }
+        queue->busy--;
+        if (queue->busy == 0 && queue->count == 0)
+            pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+/*
+ * Builds the in-memory directory by traversing the hierarchy of folders starting at the root; the subtrees
+ * are split among SIMFS_MOUNT_THREADS threads, and their entries are merged into the directory at the end.
+ */
+static SIMFS_ERROR simfsTraverseFolders(SIMFS_INDEX_TYPE root)
+{
+    SIMFS_MOUNT_QUEUE_TYPE queue = { .item = NULL, .count = 0, .capacity = 0, .busy = 0, .error = SIMFS_NO_ERROR };
+    SIMFS_MOUNT_WORKER_TYPE worker[SIMFS_MOUNT_THREADS];
+    int numberOfThreads = 0;
+
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+    simfsQueueFolderBlock(&queue, root, SIMFS_DESCRIPTOR(root).block_ref);
+
+    for (int i = 0; i < SIMFS_MOUNT_THREADS; i++)
+        worker[i] = (SIMFS_MOUNT_WORKER_TYPE) { .queue = &queue, .entry = NULL, .count = 0, .capacity = 0 };
+
+    while (numberOfThreads < SIMFS_MOUNT_THREADS
+           && pthread_create(&worker[numberOfThreads].thread, NULL, simfsMountWorker, &worker[numberOfThreads]) == 0)
+        numberOfThreads++;
+
+    if (numberOfThreads == 0) // no threads available; traverse in this one
+        simfsMountWorker(&worker[0]);
+
+    for (int i = 0; i < numberOfThreads; i++)
+        pthread_join(worker[i].thread, NULL);
+
+    SIMFS_DIR_ENT *entries[SIMFS_MOUNT_THREADS];
+    unsigned int count[SIMFS_MOUNT_THREADS];
+    for (int i = 0; i < SIMFS_MOUNT_THREADS; i++)
+    {
+        entries[i] = worker[i].entry;
+        count[i] = (unsigned int) worker[i].count;
+    }
+
+    SIMFS_ERROR error = queue.error;
+    if (error == SIMFS_NO_ERROR)
+        error = simfsLoadDirectory(entries, count, SIMFS_MOUNT_THREADS);
+
+    for (int i = 0; i < SIMFS_MOUNT_THREADS; i++)
+        free(worker[i].entry);
+
+    free(queue.item);
+    pthread_cond_destroy(&queue.changed);
+    pthread_mutex_destroy(&queue.lock);
+
+    return error;
+}
+
+/*
+ * Initializes the locks of the context; called once before the first mount.
+ */
+static void simfsInitializeLocks()
+{
+    for (int shard = 0; shard < SIMFS_DIRECTORY_SHARDS; shard++)
+        pthread_rwlock_init(&simfsContext.directory[shard].lock, NULL);
+    for (int i = 0; i < SIMFS_FOLDER_LOCKS; i++)
+        pthread_mutex_init(&simfsContext.folderLock[i], NULL);
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES; i++)
+        pthread_rwlock_init(&simfsContext.globalOpenFileTable[i].lock, NULL);
+    pthread_mutex_init(&simfsContext.openFileLock, NULL);
+    pthread_mutex_init(&simfsContext.dirtyLock, NULL);
+    pthread_mutex_init(&simfsContext.syncLock, NULL);
+    pthread_mutex_init(&simfsContext.cacheLock, NULL);
+
+    pthread_rwlockattr_t attributes; // a waiting capture holds off new operations, so it is not starved
+    pthread_rwlockattr_init(&attributes);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&simfsContext.journal.lock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+    pthread_mutex_init(&simfsContext.journal.stateLock, NULL);
+    pthread_mutex_init(&simfsContext.journal.freedLock, NULL);
+    pthread_cond_init(&simfsContext.journal.requested, NULL);
+    pthread_cond_init(&simfsContext.journal.committed, NULL);
+}
+
+/*
+ * Returns the number of bytes of a volume with the given geometry, or 0 if the geometry is not supported: the
+ * block size must be a power of two from SIMFS_MIN_BLOCK_SIZE to SIMFS_MAX_BLOCK_SIZE, and the number of blocks a
+ * multiple of 64 up to SIMFS_MAX_NUMBER_OF_BLOCKS.
+ */
+size_t simfsVolumeSize(unsigned int blockSize, SIMFS_INDEX_TYPE numberOfBlocks)
+{
+    SIMFS_GEOMETRY_TYPE geometry;
+    if (!simfsComputeGeometry(blockSize, numberOfBlocks, &geometry))
+        return 0;
+
+    return geometry.volumeSize;
+}
+
+/*
+ * Formats a volume of simfsVolumeSize() bytes with the given geometry; the volume is mounted with
+ * simfsMountFileSystem() afterwards. Returns SIMFS_ALLOC_ERROR if the geometry is not supported.
+ */
+SIMFS_ERROR simfsFormatFileSystem(SIMFS_VOLUME *fileSystem, unsigned int blockSize, SIMFS_INDEX_TYPE numberOfBlocks)
+{
+    SIMFS_GEOMETRY_TYPE geometry;
+    if (!simfsComputeGeometry(blockSize, numberOfBlocks, &geometry))
+        return SIMFS_ALLOC_ERROR;
+
+    simfsFormatVolume(fileSystem, &geometry);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Returns whether a magic number is that of a volume with the layout of an earlier version of the file system.
+ */
+static int simfsIsEarlierLayout(uint32_t magic)
+{
+    return magic == SIMFS_FIRST_MAGIC || (magic >= SIMFS_FIRST_NUMBERED_MAGIC && magic < SIMFS_MAGIC);
+}
+
+/*
+ * Constructs in-memory directory of all files is the system.
+ *
+ * Starting with the file system root (pointed to from the superblock) traverses the hierarachy of directories
+ * and adds en entry for each folder or file to the directory by hashing the name together with the reference
+ * to the folder holding it, and storing the entry in the first free slot of the probe sequence. The table grows
+ * as needed.
+ *
+ * If the volume was unmounted (or synced) after its last change, the directory is loaded from the snapshot of its
+ * entries instead, and no folder is traversed. Otherwise the folders are traversed by SIMFS_MOUNT_THREADS threads.
+ *
+ * The function sets the current working directory to refer to the block holding the root of the volume. This will
+ * be changed as the user navigates the file system hierarchy.
+ *
+ * The geometry of the volume is taken from its superblock; the volume must have been formatted by
+ * simfsFormatFileSystem(). SIMFS_READ_ERROR is returned for a volume whose superblock does not describe a file
+ * system, and SIMFS_VERSION_ERROR for a volume with the layout of an earlier version; neither is changed.
+ *
+ * Mounting must not run concurrently with any other function; all other functions can be called concurrently.
+ *
+ */
+SIMFS_ERROR simfsMountFileSystem(SIMFS_VOLUME *fileSystem)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, simfsInitializeLocks);
+
+    if (simfsIsEarlierLayout((uint32_t) fileSystem->superblock.attr.magic))
+        return SIMFS_VERSION_ERROR;
+
+    SIMFS_GEOMETRY_TYPE geometry;
+    SIMFS_INDEX_TYPE numberOfBlocks = fileSystem->superblock.attr.numberOfBlocks;
+    if (fileSystem->superblock.attr.magic != SIMFS_MAGIC
+        || !simfsComputeGeometry(fileSystem->superblock.attr.blockSize, numberOfBlocks, &geometry)
+        || fileSystem->superblock.attr.rootNodeIndex >= numberOfBlocks
+        || (fileSystem->superblock.attr.snapshotValid && fileSystem->superblock.attr.snapshotNode >= numberOfBlocks))
+        return SIMFS_READ_ERROR;
+
+    SIMFS_ERROR error = simfsUseGeometry(fileSystem, &geometry);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    simfsContext.volume = fileSystem;
+    simfsClearDirectory();
+    simfsLoadBitvector(fileSystem);
+
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES; i++)
+    {
+        simfsContext.globalOpenFileTable[i].type = INVALID_CONTENT_TYPE;
+        simfsContext.globalOpenFileTable[i].fileDescriptor = SIMFS_INVALID_INDEX;
+        simfsContext.globalOpenFileTable[i].referenceCount = 0;
+        simfsContext.globalOpenFileTable[i].dirtySlot = -1;
+        simfsContext.globalOpenFileTable[i].nextFree = i + 1 < SIMFS_MAX_NUMBER_OF_OPEN_FILES ? i + 1 : -1;
+        if (simfsContext.globalOpenFileTable[i].content != NULL)
+            simfsEvictContent(&simfsContext.globalOpenFileTable[i]);
+    }
+    simfsContext.freeOpenFile = 0;
+    simfsContext.cacheBytes = 0;
+    simfsContext.cacheHand = 0;
+    memset(simfsContext.openFileMap, 0xFF, sizeof(simfsContext.openFileMap));
+    simfsContext.numberOfDirtyEntries = 0;
+
+    for (int chain = 0; chain < SIMFS_PROCESS_BUCKETS; chain++)
+        while (simfsContext.processControlBlocks[chain] != NULL)
+        {
+            SIMFS_PROCESS_CONTROL_BLOCK_TYPE *next = simfsContext.processControlBlocks[chain]->next;
+            for (int handle = 0; handle < SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS; handle++)
+                if (simfsContext.processControlBlocks[chain]->openFileTable[handle].snapshot != NULL)
+                    simfsReleaseContent(simfsContext.processControlBlocks[chain]->openFileTable[handle].snapshot);
+            simfsPoolProcess(simfsContext.processControlBlocks[chain]);
+            simfsContext.processControlBlocks[chain] = next;
+        }
+
+    if (fileSystem->superblock.attr.snapshotValid)
+        return simfsLoadSnapshot();
+
+    return simfsTraverseFolders(fileSystem->superblock.attr.rootNodeIndex);
+}
+
+/*
+ * Writes the directory snapshot and commits it. A stale snapshot is rewritten in place, so the transaction that
+ * marked it as stale is committed first; otherwise a crash could leave a valid snapshot of a later directory.
+ */
+static SIMFS_ERROR simfsCommitSnapshot()
+{
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (!__atomic_load_n(&simfsContext.volume->superblock.attr.snapshotValid, __ATOMIC_ACQUIRE))
+        error = simfsCommitJournal();
+
+    simfsHoldJournal();
+    simfsWriteSnapshot();
+    simfsReleaseJournal();
+
+    SIMFS_ERROR committed = simfsCommitJournal();
+
+    return error != SIMFS_NO_ERROR ? error : committed;
+}
+
+/*
+ * Writes all pending metadata and the directory snapshot to the volume, so the next mount of the volume can
+ * load the directory without traversing the folders. Open files stay open.
+ *
+ * A volume mapped from an image file is committed, its journal emptied, and it is unmapped; the volume cannot be
+ * used after that.
+ */
+SIMFS_ERROR simfsUnmountFileSystem()
+{
+    if (simfsContext.volume == NULL)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (simfsContext.journal.active)
+    {
+        error = simfsCommitSnapshot();
+
+        SIMFS_ERROR stopped = simfsStopJournal();
+        if (error == SIMFS_NO_ERROR)
+            error = stopped;
+    }
+    else
+    {
+        simfsFlush();
+        simfsWriteSnapshot();
+    }
+
+    if (!simfsContext.volumeMapped)
+        return error;
+
+    munmap(simfsContext.volume, simfsContext.geometry.volumeSize);
+    close(simfsContext.volumeFile);
+    simfsContext.volumeMapped = 0;
+    simfsContext.volume = NULL;
+
+    return error;
+}
+
+/*
+ * Writes a volume formatted in its private mapping to its image file: the superblock, the bitvector, the root
+ * folder, and an empty journal.
+ */
+static SIMFS_ERROR simfsWriteFormat(int file, SIMFS_VOLUME *volume, const SIMFS_GEOMETRY_TYPE *geometry)
+{
+    if (!simfsWriteImage(file, volume, geometry->journalOffset, 0)
+        || !simfsWriteImage(file, (char *) volume + geometry->blocksOffset, geometry->blockSize,
+                            geometry->blocksOffset))
+        return SIMFS_WRITE_ERROR;
+
+    return simfsResetJournal(file, geometry, 1);
+}
+
+/*
+ * Maps an open image file as a volume of the given geometry and mounts it. If format is set, the (empty) file is
+ * extended to the size of the volume, and the volume is formatted first; otherwise, the file must be as large as
+ * the volume, or SIMFS_READ_ERROR is returned. The journal of the file is replayed before it is mapped, and
+ * started after the mount. On failure, the file is unmapped and closed, and no volume is mounted.
+ */
+static SIMFS_ERROR simfsMapVolumeFile(int file, const SIMFS_GEOMETRY_TYPE *geometry, int format)
+{
+    struct stat status;
+    if (fstat(file, &status) != 0 || (!format && (size_t) status.st_size < geometry->volumeSize))
+    {
+        close(file);
+        return SIMFS_READ_ERROR;
+    }
+
+    if (format && ftruncate(file, (off_t) geometry->volumeSize) != 0)
+    {
+        close(file);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    uint64_t sequence = 1;
+    SIMFS_ERROR error = format ? SIMFS_NO_ERROR : simfsReplayJournal(file, geometry, &sequence);
+    if (error != SIMFS_NO_ERROR)
+    {
+        close(file);
+        return error;
+    }
+
+    SIMFS_VOLUME *volume = mmap(NULL, geometry->volumeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    if (volume == MAP_FAILED)
+    {
+        close(file);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    if (format)
+    {
+        simfsFormatVolume(volume, geometry);
+        error = simfsWriteFormat(file, volume, geometry);
+        if (error != SIMFS_NO_ERROR)
+        {
+            munmap(volume, geometry->volumeSize);
+            close(file);
+            return error;
+        }
+    }
+
+    error = simfsMountFileSystem(volume);
+    if (error != SIMFS_NO_ERROR)
+    {
+        if (simfsContext.volume == volume) // the mount got as far as taking the volume
+            simfsContext.volume = NULL;
+        munmap(volume, geometry->volumeSize);
+        close(file);
+        return error;
+    }
+
+    simfsContext.volumeMapped = 1;
+    simfsContext.volumeFile = file;
+
+    error = simfsStartJournal(sequence);
+    if (error != SIMFS_NO_ERROR)
+        simfsUnmountFileSystem();
+
+    return error;
+}
+
+/*
+ * Mounts a volume kept in an image file. The file is mapped into memory as the volume, so blocks are read
+ * from the file on first access (through the page cache) and nothing is read at mount except the superblock,
+ * the bitvector, the journal, and the directory snapshot (or the folders if the snapshot is stale). Changes are
+ * committed to the file through the journal (see the journal section): at least every SIMFS_JOURNAL_INTERVAL
+ * milliseconds, and by simfsSyncFileSystem() and simfsUnmountFileSystem().
+ *
+ * The geometry of the volume is read from the superblock of the file. If format is set, the file is created (or
+ * truncated) and formatted with the default geometry by simfsFormatVolumeFile(); otherwise, the file is neither
+ * created nor changed unless it holds a volume. Returns SIMFS_NOT_FOUND_ERROR if the file cannot be opened,
+ * SIMFS_VERSION_ERROR if it holds a volume with the layout of an earlier version, and SIMFS_READ_ERROR if it does
+ * not hold a volume.
+ */
+SIMFS_ERROR simfsMountVolumeFile(const char *path, int format)
+{
+    if (format)
+        return simfsFormatVolumeFile(path, SIMFS_DEFAULT_BLOCK_SIZE, SIMFS_DEFAULT_NUMBER_OF_BLOCKS);
+
+    if (simfsContext.volumeMapped)
+        simfsUnmountFileSystem();
+
+    int file = open(path, O_RDWR);
+    if (file < 0)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    SIMFS_SUPERBLOCK_TYPE superblock;
+    SIMFS_GEOMETRY_TYPE geometry;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (pread(file, &superblock, sizeof(superblock), 0) != (ssize_t) sizeof(superblock))
+        error = SIMFS_READ_ERROR;
+    else if (simfsIsEarlierLayout((uint32_t) superblock.attr.magic))
+        error = SIMFS_VERSION_ERROR;
+    else if (superblock.attr.magic != SIMFS_MAGIC
+             || !simfsComputeGeometry(superblock.attr.blockSize, superblock.attr.numberOfBlocks, &geometry))
+        error = SIMFS_READ_ERROR;
+
+    if (error != SIMFS_NO_ERROR)
+    {
+        close(file);
+        return error;
+    }
+
+    return simfsMapVolumeFile(file, &geometry, 0);
+}
+
+/*
+ * Creates (or truncates) an image file, formats it as a volume with the given geometry, and mounts it as
+ * simfsMountVolumeFile() does. Returns SIMFS_ALLOC_ERROR if the geometry is not supported.
+ */
+SIMFS_ERROR simfsFormatVolumeFile(const char *path, unsigned int blockSize, SIMFS_INDEX_TYPE numberOfBlocks)
+{
+    SIMFS_GEOMETRY_TYPE geometry;
+    if (!simfsComputeGeometry(blockSize, numberOfBlocks, &geometry))
+        return SIMFS_ALLOC_ERROR;
+
+    if (simfsContext.volumeMapped)
+        simfsUnmountFileSystem();
+
+    int file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file < 0)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    return simfsMapVolumeFile(file, &geometry, 1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Creates a file or a folder in the given folder as described for simfsCreateFile(); the caller holds the lock
+ * of the folder. A file takes its size and its extents or inline content from the descriptor content, unless it
+ * is NULL.
+ */
+static SIMFS_ERROR simfsCreateNode(SIMFS_INDEX_TYPE folder, const char *fileName, SIMFS_CONTENT_TYPE type,
+                                   uid_t uid, mode_t umask, const SIMFS_FILE_DESCRIPTOR_TYPE *content)
+{
+    if (SIMFS_BLOCK(folder).type != FOLDER_CONTENT_TYPE) // the folder has been deleted meanwhile
+        return SIMFS_NOT_FOUND_ERROR;
+
+    if (simfsFindNode(folder, fileName) != SIMFS_INVALID_INDEX)
+        return SIMFS_DUPLICATE_ERROR;
+
+    SIMFS_INDEX_TYPE node = simfsAllocateBlock();
+    if (node == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_BLOCK_TYPE buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = type;
+    buffer.content.fileDescriptor.type = type;
+    strncpy(buffer.content.fileDescriptor.name, fileName, SIMFS_MAX_NAME_LENGTH - 1);
+    buffer.content.fileDescriptor.creationTime = time(NULL);
+    buffer.content.fileDescriptor.lastAccessTime = buffer.content.fileDescriptor.creationTime;
+    buffer.content.fileDescriptor.lastModificationTime = buffer.content.fileDescriptor.creationTime;
+    buffer.content.fileDescriptor.accessRights = umask;
+    buffer.content.fileDescriptor.owner = uid;
+    buffer.content.fileDescriptor.size = 0;
+    buffer.content.fileDescriptor.block_ref = SIMFS_INVALID_INDEX;
+    buffer.content.fileDescriptor.numberOfExtents = 0;
+    if (content != NULL)
+    {
+        buffer.content.fileDescriptor.size = content->size;
+        buffer.content.fileDescriptor.block_ref = content->block_ref;
+        buffer.content.fileDescriptor.numberOfExtents = content->numberOfExtents;
+        memcpy(buffer.content.fileDescriptor.extent, content->extent, sizeof(content->extent));
+    }
+
+    SIMFS_ERROR error = simfsAddToFolder(folder, node, type, buffer.content.fileDescriptor.name);
+    if (error != SIMFS_NO_ERROR)
+    {
+        simfsFreeRun(node, 1);
+        return error;
+    }
+
+    SIMFS_BLOCK(node) = buffer;
+    if (content != NULL && SIMFS_IS_INLINE(*content)) // the inline content extends to the end of the block
+        memcpy(SIMFS_DESCRIPTOR(node).inlineData, content->inlineData, simfsContext.geometry.inlineSize);
+    SIMFS_MARK_DIRTY(SIMFS_BLOCK(node));
+
+    error = simfsAddDirEnt(folder, buffer.content.fileDescriptor.name, node);
+    if (error != SIMFS_NO_ERROR)
+    {
+        simfsRemoveFromFolder(folder, node);
+        simfsFreeRun(node, 1);
+        return error;
+    }
+
+    SIMFS_DESCRIPTOR(folder).lastModificationTime = buffer.content.fileDescriptor.creationTime;
+    SIMFS_MARK_DIRTY(SIMFS_DESCRIPTOR(folder));
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Depending on the type parameter the function creates a file or a folder in the current directory
+ * of the process. If the process does not have an entry in the processControlBlock, then the root directory
+ * is assumed to be its current working directory.
+ *
+ * Hashes the file name and the current directory, and check if the file with such name already exists in the
+ * current directory.
+ * If it is then it return SIMFS_DUPLICATE_ERROR.
+ * Otherwise:
+ *    - finds an available block in the storage using the in-memory bitvector and flips the bit to indicate
+ *      that the block is taken
+ *    - initializes a local buffer for the file descriptor block with the block type depending on the parameter type
+ *      (i.e., folder or file)
+ *    - creates an entry for the file in the in-memory directory
+ *    - copies the local buffer to the disk block that was found to be free
+ *    - copies the in-memory bitvector to the bitevector blocks on the simulated disk
+ *
+ *  The access rights and the the owner are taken from the context (umask and uid correspondingly).
+ *
+ */
+static SIMFS_ERROR simfsCreateFileUntimed(SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type)
+{
+    if (type != FILE_CONTENT_TYPE && type != FOLDER_CONTENT_TYPE)
+        return SIMFS_WRITE_ERROR;
+
+    uid_t uid;
+    pid_t pid;
+    mode_t umask;
+    simfsGetCaller(&uid, &pid, &umask);
+
+    SIMFS_INDEX_TYPE folder = simfsCurrentDirectory(pid);
+    if (simfsIsStatisticsFile(folder, fileName))
+        return SIMFS_DUPLICATE_ERROR;
+
+    simfsLockFolders(folder, SIMFS_INVALID_INDEX);
+    SIMFS_ERROR error = simfsCreateNode(folder, fileName, type, uid, umask, NULL);
+    simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+
+    if (error == SIMFS_NO_ERROR)
+        simfsCommit();
+
+    return error;
+}
+
+SIMFS_ERROR simfsCreateFile(SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type)
+{
+    uint64_t started = simfsBeginOperation();
+    SIMFS_ERROR error = simfsCreateFileUntimed(fileName, type);
+    if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+        error = simfsCreateFileUntimed(fileName, type);
+
+    return simfsEndOperation(SIMFS_CREATE_OPERATION, started, error);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Deletes a file or a folder as described for simfsDeleteFile(); the caller holds the locks of both the folder
+ * holding it and the node itself.
+ */
+static SIMFS_ERROR simfsDeleteNode(SIMFS_INDEX_TYPE folder, SIMFS_INDEX_TYPE node, uid_t uid)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(node);
+
+    if (descriptor->type == FOLDER_CONTENT_TYPE && descriptor->size > 0)
+        return SIMFS_NOT_EMPTY_ERROR;
+
+    if (!simfsHasAccess(descriptor->accessRights, descriptor->owner, uid, S_IWUSR))
+        return SIMFS_ACCESS_ERROR;
+
+    // operations running on an open file finish before its blocks are freed, and the following ones fail
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsFindOpenFileEntry(node);
+    if (globalEntry != NULL)
+        pthread_rwlock_wrlock(&globalEntry->lock);
+
+    if (descriptor->type == FOLDER_CONTENT_TYPE)
+        simfsReleaseFolder(descriptor);
+    else
+        simfsReleaseExtents(descriptor);
+
+    if (globalEntry != NULL)
+    {
+        simfsInvalidateContent(globalEntry);
+
+        pthread_mutex_lock(&simfsContext.openFileLock);
+        pthread_mutex_lock(&simfsContext.dirtyLock);
+        simfsUnmapOpenFile(globalEntry);
+        globalEntry->type = INVALID_CONTENT_TYPE;
+        simfsDiscardEntry(globalEntry);
+        pthread_mutex_unlock(&simfsContext.dirtyLock);
+        pthread_mutex_unlock(&simfsContext.openFileLock);
+
+        pthread_rwlock_unlock(&globalEntry->lock);
+        simfsReleaseOpenFileEntry(globalEntry);
+    }
+
+    simfsRemoveDirEnt(folder, descriptor->name);
+    simfsRemoveFromFolder(folder, node);
+    SIMFS_DESCRIPTOR(folder).lastModificationTime = time(NULL);
+    SIMFS_MARK_DIRTY(SIMFS_DESCRIPTOR(folder));
+
+    SIMFS_BLOCK(node).type = INVALID_CONTENT_TYPE;
+    SIMFS_MARK_DIRTY(SIMFS_BLOCK(node));
+    simfsFreeRun(node, 1);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Deletes the file or folder with the given name from a folder for the user.
+ */
+static SIMFS_ERROR simfsDeleteFromFolder(SIMFS_INDEX_TYPE folder, const char *fileName, uid_t uid)
+{
+    if (simfsIsStatisticsFile(folder, fileName))
+        return SIMFS_ACCESS_ERROR;
+
+    SIMFS_INDEX_TYPE node;
+
+    // the node is looked up again under the locks, as the locks to take depend on it
+    for (;;)
+    {
+        node = simfsFindNode(folder, fileName);
+        if (node == SIMFS_INVALID_INDEX)
+            return SIMFS_NOT_FOUND_ERROR;
+
+        simfsLockFolders(folder, node);
+        if (simfsFindNode(folder, fileName) == node)
+            break;
+        simfsUnlockFolders(folder, node);
+    }
+
+    SIMFS_ERROR error = simfsDeleteNode(folder, node, uid);
+    simfsUnlockFolders(folder, node);
+
+    if (error == SIMFS_NO_ERROR)
+        simfsCommit();
+
+    return error;
+}
+
+/*
+ * Deletes a file from the file system.
+ *
+ * Hashes the file name and the current directory, and check if the file is in the directory. If not, then it
+ * returns SIMFS_NOT_FOUND_ERROR.
+ * Otherwise:
+ *    - finds the reference to the file descriptor block
+ *    - if the referenced block is a folder that is not empty, then returns SIMFS_NOT_EMPTY_ERROR.
+ *    - Otherwise:
+ *       - checks if the process owner can delete this file or folder; if not, it returns SIMFS_ACCESS_ERROR.
+ *       - Otherwise:
+ *          - frees all blocks belonging to the file by flipping the corresponding bits in the in-memory bitvector
+ *          - frees the reference block by flipping the corresponding bit in the in-memory bitvector
+ *          - clears the entry in the folder and removes the entry for this file from the in-memory directory
+ *          - copies the in-memory bitvector to the bitvector blocks on the simulated disk
+ *
+ * The entries of the file in the open file tables become invalid, so further operations on them fail.
+ */
+static SIMFS_ERROR simfsDeleteFileUntimed(SIMFS_NAME_TYPE fileName)
+{
+    uid_t uid;
+    pid_t pid;
+    simfsGetCaller(&uid, &pid, NULL);
+
+    return simfsDeleteFromFolder(simfsCurrentDirectory(pid), fileName, uid);
+}
+
+SIMFS_ERROR simfsDeleteFile(SIMFS_NAME_TYPE fileName)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_DELETE_OPERATION, started, simfsDeleteFileUntimed(fileName));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copies the descriptor of a file or folder, with the times of an open file that are not written back yet; the
+ * caller holds the lock of the node or of its folder, so it is not deleted meanwhile.
+ */
+static void simfsDescribeNode(SIMFS_INDEX_TYPE node, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsFindOpenFileEntry(node);
+    if (globalEntry == NULL)
+    {
+        *infoBuffer = SIMFS_DESCRIPTOR(node);
+        return;
+    }
+
+    pthread_rwlock_rdlock(&globalEntry->lock);
+    pthread_mutex_lock(&simfsContext.dirtyLock); // the times of an open file may not be written back yet
+
+    *infoBuffer = SIMFS_DESCRIPTOR(node);
+    if (globalEntry->dirtySlot >= 0)
+    {
+        infoBuffer->lastAccessTime = globalEntry->lastAccessTime;
+        infoBuffer->lastModificationTime = globalEntry->lastModificationTime;
+    }
+
+    pthread_mutex_unlock(&simfsContext.dirtyLock);
+    pthread_rwlock_unlock(&globalEntry->lock);
+
+    simfsReleaseOpenFileEntry(globalEntry);
+}
+
+/*
+ * Finds the file in the in-memory directory and obtains the information about the file from the file descriptor
+ * block referenced from the directory.
+ *
+ * If the file is not found, then it returns SIMFS_NOT_FOUND_ERROR
+ */
+static SIMFS_ERROR simfsGetFileInfoUntimed(SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    pid_t pid;
+    simfsGetCaller(NULL, &pid, NULL);
+
+    SIMFS_INDEX_TYPE folder = simfsCurrentDirectory(pid);
+    if (simfsIsStatisticsFile(folder, fileName))
+        return simfsGetStatisticsFileInfo(infoBuffer);
+
+    simfsLockFolders(folder, SIMFS_INVALID_INDEX);
+
+    SIMFS_INDEX_TYPE node = simfsFindNode(folder, fileName);
+    if (node == SIMFS_INVALID_INDEX)
+    {
+        simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+        return SIMFS_NOT_FOUND_ERROR;
+    }
+
+    simfsDescribeNode(node, infoBuffer);
+
+    simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsGetFileInfo(SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_GET_INFO_OPERATION, started, simfsGetFileInfoUntimed(fileName, infoBuffer));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Fills a free entry of the global open file table for a file that is not open yet; the entry is returned without
+ * references. The caller holds the openFileLock, and has checked that there is a free entry.
+ */
+static SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *simfsAddOpenFile(SIMFS_INDEX_TYPE node)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(node);
+
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = &simfsContext.globalOpenFileTable[simfsContext.freeOpenFile];
+    simfsContext.freeOpenFile = globalEntry->nextFree;
+
+    globalEntry->type = descriptor->type;
+    globalEntry->fileDescriptor = node;
+    globalEntry->referenceCount = 0;
+    globalEntry->creationTime = descriptor->creationTime;
+    globalEntry->lastAccessTime = descriptor->lastAccessTime;
+    globalEntry->lastModificationTime = descriptor->lastModificationTime;
+    globalEntry->accessRights = descriptor->accessRights;
+    globalEntry->owner = descriptor->owner;
+    globalEntry->size = descriptor->size;
+    globalEntry->dirtySlot = -1;
+    globalEntry->nextFree = -1;
+    simfsMapOpenFile(globalEntry);
+
+    return globalEntry;
+}
+
+/*
+ * Opens a file or a folder for a process as described for simfsOpenFile(); the caller holds the lock of the
+ * folder holding the node, and the openFileLock.
+ */
+static SIMFS_ERROR simfsOpenNode(pid_t pid, uid_t uid, SIMFS_INDEX_TYPE node, SIMFS_FILE_HANDLE_TYPE *fileHandle)
+{
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsFindProcess(pid);
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsLookupOpenFile(node);
+
+    if (pcb != NULL && globalEntry != NULL) // only the handles in use can refer to the file
+        for (uint64_t used = ~pcb->freeHandles; used != 0; used &= used - 1)
+        {
+            int handle = __builtin_ctzll(used);
+            if (handle >= SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS)
+                break;
+
+            if (pcb->openFileTable[handle].globalEntry == globalEntry)
+            {
+                *fileHandle = handle;
+                return SIMFS_DUPLICATE_ERROR;
+            }
+        }
+
+    if ((pcb != NULL && pcb->freeHandles == 0) || (globalEntry == NULL && simfsContext.freeOpenFile < 0))
+        return SIMFS_ALLOC_ERROR;
+
+    if (pcb == NULL)
+    {
+        pcb = simfsAddProcess(pid);
+        if (pcb == NULL)
+            return SIMFS_ALLOC_ERROR;
+    }
+
+    if (globalEntry == NULL)
+        globalEntry = simfsAddOpenFile(node);
+    globalEntry->referenceCount++;
+
+    mode_t accessRights = 0;
+    if (simfsHasAccess(globalEntry->accessRights, globalEntry->owner, uid, S_IRUSR))
+        accessRights |= S_IRUSR;
+    if (simfsHasAccess(globalEntry->accessRights, globalEntry->owner, uid, S_IWUSR))
+        accessRights |= S_IWUSR;
+
+    int handle = __builtin_ctzll(pcb->freeHandles);
+    pcb->freeHandles &= pcb->freeHandles - 1;
+    pcb->openFileTable[handle].accessRights = accessRights;
+    pcb->openFileTable[handle].globalEntry = globalEntry;
+    pcb->numberOfOpenFiles++;
+
+    *fileHandle = handle;
+
+    return SIMFS_NO_ERROR;
+}
+
+/*
+ * Hashes the name and searches for it in the current directory of the process. If the file does not exist,
+ * the SIMFS_NOT_FOUND_ERROR is returned.
+ *
+ * Otherwise:
+ *    - checks the per-process open file table for the process, and if the file has already been opened
+ *      it returns the index of the openFileTable with the entry of the file through the parameter fileHandle, and
+ *      returns SIMFS_DUPLICATE_ERROR as the return value
+ *
+ *    - otherwise, checks if there is a global entry for the file, and if so, then:
+ *       - it increases the reference count for this file
+ *
+ *       - otherwise, it creates an entry in the global open file table for the file copying the information
+ *         from the file descriptor block referenced from the entry for this file in the directory
+ *
+ *       - if the process does not have its process control block in the processControlBlocks hashtable, then
+ *         a file control block for the process is created and added to the hashtable; the current working directory
+ *         is initialized to the root of the volume and the number of the open files is initialized to 0
+ *
+ *       - if an entry for this file does not exits in the per-process open file table, the function finds an
+ *         empty slot in the table and fills it with the information including the reference to the entry for
+ *         this file in the global open file table.
+ *
+ *       - returns the index to the new element of the per-process open file table through the parameter fileHandle
+ *         and SIMFS_NO_ERROR as the return value
+ *
+ * If there is no free slot for the file in either the global file table or in the per-process
+ * file table, or if there is any other allocation problem, then the function returns SIMFS_ALLOC_ERROR.
+ *
+ */
+static SIMFS_ERROR simfsOpenFileUntimed(SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle)
+{
+    uid_t uid;
+    pid_t pid;
+    simfsGetCaller(&uid, &pid, NULL);
+
+    SIMFS_INDEX_TYPE folder = simfsCurrentDirectory(pid);
+    if (simfsIsStatisticsFile(folder, fileName))
+        return simfsOpenStatisticsFile(pid, fileHandle);
+
+    simfsLockFolders(folder, SIMFS_INVALID_INDEX);
+
+    SIMFS_ERROR error = SIMFS_NOT_FOUND_ERROR;
+    SIMFS_INDEX_TYPE node = simfsFindNode(folder, fileName);
+    if (node != SIMFS_INVALID_INDEX)
+    {
+        pthread_mutex_lock(&simfsContext.openFileLock);
+        error = simfsOpenNode(pid, uid, node, fileHandle);
+        pthread_mutex_unlock(&simfsContext.openFileLock);
+    }
+
+    simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+
+    return error;
+}
+
+SIMFS_ERROR simfsOpenFile(SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_OPEN_OPERATION, started, simfsOpenFileUntimed(fileName, fileHandle));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * The function replaces content of a file with new one pointed to by the parameter writeBuffer.
+ *
+ * Checks if the file handle points to a valid file descriptor of an open file. If the entry is invalid
+ * (e.g., if the reference to the global table is NULL, or if the entry in the global table is INVALID_CONTENT_TYPE),
+ * then it returns SIMFS_NOT_FOUND_ERROR.
+ *
+ * Otherwise, it checks the access rights for writing. If the process owner is not allowed to write to the file,
+ * then the function returns SIMFS_ACCESS_ERROR.
+ *
+ * Then, the functions calculates the space needed for the new content and checks if the write buffer can fit into
+ * the remaining free space in the file system. If not, then the SIMFS_ALLOC_ERROR is returned.
+ *
+ * Otherwise, the function keeps the blocks currently held by this file, and only frees the blocks past the end
+ * of the new content or acquires the missing ones at the tail, modifying bits in the in-memory bitvector as needed.
+ * The blocks are acquired in runs of contiguous blocks, and each run is recorded as a single extent of the file.
+ *
+ * It then copies the characters pointed to by the parameter writeBuffer (until '\0' but excluding it) over the
+ * blocks that belong to the file. The function copies any modified block of the in-memory bitvector to
+ * the corresponding bitvector block on the disk.
+ *
+ * Finally, the file descriptor is modified to reflect the new size of the file, and the times of last modification
+ * and access.
+ *
+ * The function returns SIMFS_WRITE_ERROR in response to exception not specified earlier.
+ *
+ */
+static SIMFS_ERROR simfsWriteFileUntimed(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer)
+{
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry;
+    SIMFS_ERROR error = simfsGetOpenFileEntry(fileHandle, S_IWUSR, &globalEntry, NULL);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    pthread_rwlock_wrlock(&globalEntry->lock);
+
+    size_t size = strlen(writeBuffer);
+    if (globalEntry->type != FILE_CONTENT_TYPE)
+        error = SIMFS_WRITE_ERROR;
+    else
+        error = simfsUnshareContent(&SIMFS_DESCRIPTOR(globalEntry->fileDescriptor), 0, size);
+    if (error == SIMFS_NO_ERROR)
+        error = simfsResizeFile(globalEntry, size);
+
+    if (error == SIMFS_NO_ERROR)
+    {
+        simfsTransfer(&SIMFS_DESCRIPTOR(globalEntry->fileDescriptor), 0, writeBuffer, size, 1);
+        simfsInvalidateContent(globalEntry);
+        simfsTouchEntry(globalEntry, 1);
+    }
+
+    pthread_rwlock_unlock(&globalEntry->lock);
+    simfsReleaseOpenFileEntry(globalEntry);
+
+    simfsCommit();
+
+    return error;
+}
+
+SIMFS_ERROR simfsWriteFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer)
+{
+    uint64_t started = simfsBeginOperation();
+    SIMFS_ERROR error = simfsWriteFileUntimed(fileHandle, writeBuffer);
+    if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+        error = simfsWriteFileUntimed(fileHandle, writeBuffer);
+
+    return simfsEndOperation(SIMFS_WRITE_OPERATION, started, error);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * The function returns the complete content of the file to the caller through the parameter readBuffer.
+ *
+ * Checks if the file handle points to a valid file descriptor of an open file. If the entry is invalid
+ * (e.g., if the reference to the global table is NULL, or if the entry in the global table is INVALID_CONTENT_TYPE),
+ * then it returns SIMFS_NOT_FOUND_ERROR.
+ *
+ * Otherwise, it checks the user's access right to read the file. If the process owner is not allowed to read the file,
+ * then the function returns SIMFS_ACCESS_ERROR.
+ *
+ * Otherwise, the function allocates memory sufficient to hold the read content with an appended end of string
+ * character; the pointer to newly allocated memory is passed back through the readBuffer parameter. All the content
+ * of the blocks is concatenated using the allocated space, and an end of string character is appended at the end of
+ * the concatenated content. The blocks are visited extent by extent, so there is a single lookup per run of
+ * contiguous blocks; the assembled content is kept in the content cache, so reading an unchanged file again
+ * only copies it. The memory is taken from the buffers the thread gave back with simfsReleaseReadBuffer() if one
+ * is large enough; either way, the caller may free it or give it back.
+ *
+ * The function returns SIMFS_READ_ERROR in response to exception not specified earlier.
+ *
+ */
+static SIMFS_ERROR simfsReadFileUntimed(SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer)
+{
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry;
+    SIMFS_CACHED_CONTENT_TYPE *snapshot;
+    SIMFS_ERROR error = simfsGetOpenFileEntry(fileHandle, S_IRUSR, &globalEntry, &snapshot);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    if (globalEntry == NULL)
+    {
+        *readBuffer = simfsTakeReadBuffer(snapshot->size + 1);
+        if (*readBuffer != NULL)
+            memcpy(*readBuffer, snapshot->data, snapshot->size + 1);
+        simfsReleaseContent(snapshot);
+
+        return *readBuffer == NULL ? SIMFS_READ_ERROR : SIMFS_NO_ERROR;
+    }
+
+    pthread_rwlock_rdlock(&globalEntry->lock);
+
+    char *buffer = NULL;
+    SIMFS_CACHED_CONTENT_TYPE *content = NULL;
+    if (globalEntry->type == FILE_CONTENT_TYPE)
+        content = simfsGetContent(globalEntry, 1);
+
+    if (content != NULL)
+    {
+        buffer = simfsTakeReadBuffer(content->size + 1);
+        if (buffer != NULL)
+        {
+            memcpy(buffer, content->data, content->size + 1);
+            simfsTouchEntry(globalEntry, 0);
+        }
+        simfsReleaseContent(content);
+    }
+
+    pthread_rwlock_unlock(&globalEntry->lock);
+    simfsReleaseOpenFileEntry(globalEntry);
+
+    if (buffer == NULL)
+        return SIMFS_READ_ERROR;
+
+    simfsCommit();
+
+    *readBuffer = buffer;
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsReadFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_READ_OPERATION, started, simfsReadFileUntimed(fileHandle, readBuffer));
+}
+
+/*
+ * Gives back a buffer returned by simfsReadFile(), so the next reads of the calling thread can reuse it; the
+ * buffer may be freed instead.
+ */
+void simfsReleaseReadBuffer(char *readBuffer)
+{
+    if (readBuffer != NULL)
+        simfsPoolReadBuffer(readBuffer);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns the complete content of the file like simfsReadFile(), but without copying it: the parameter content
+ * points to the cached content of the file, followed by an end of string character, and its length is passed
+ * back through the parameter size.
+ *
+ * The content is read-only and shared with the other readers of the file. It stays valid, and unchanged, until
+ * the caller releases it with simfsReleaseFileView(), even if the file is written, closed, or deleted meanwhile.
+ *
+ * The validity of the file handle and the access rights are checked as in simfsReadFile().
+ */
+static SIMFS_ERROR simfsReadFileViewUntimed(SIMFS_FILE_HANDLE_TYPE fileHandle, const char **content, size_t *size)
+{
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry;
+    SIMFS_CACHED_CONTENT_TYPE *view = NULL;
+    SIMFS_ERROR error = simfsGetOpenFileEntry(fileHandle, S_IRUSR, &globalEntry, &view);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    if (globalEntry == NULL) // the snapshot of a virtual file is handed out as it is
+    {
+        *content = view->data;
+        *size = view->size;
+        return SIMFS_NO_ERROR;
+    }
+
+    pthread_rwlock_rdlock(&globalEntry->lock);
+
+    if (globalEntry->type == FILE_CONTENT_TYPE)
+        view = simfsGetContent(globalEntry, 1);
+    if (view != NULL)
+        simfsTouchEntry(globalEntry, 0);
+
+    pthread_rwlock_unlock(&globalEntry->lock);
+    simfsReleaseOpenFileEntry(globalEntry);
+
+    if (view == NULL)
+        return SIMFS_READ_ERROR;
+
+    simfsCommit();
+
+    *content = view->data;
+    *size = view->size;
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsReadFileView(SIMFS_FILE_HANDLE_TYPE fileHandle, const char **content, size_t *size)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_READ_VIEW_OPERATION, started, simfsReadFileViewUntimed(fileHandle, content, size));
+}
+
+/*
+ * Releases content returned by simfsReadFileView().
+ */
+void simfsReleaseFileView(const char *content)
+{
+    simfsReleaseContent((SIMFS_CACHED_CONTENT_TYPE *) (content - offsetof(SIMFS_CACHED_CONTENT_TYPE, data)));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Reads up to length bytes of the file starting at the given offset into the buffer provided by the caller.
+ * The number of bytes read is passed back through the parameter bytesRead; it is smaller than length if the
+ * range extends past the end of the file, and 0 if the offset is at or past the end. No end of string character
+ * is appended.
+ *
+ * Only the blocks covering the range are visited, and no memory is allocated; if the content of the file is
+ * cached, the range is copied from the cache.
+ *
+ * The validity of the file handle and the access rights are checked as in simfsReadFile().
+ */
+static SIMFS_ERROR simfsReadFileAtUntimed(SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, char *readBuffer,
+                                          size_t length, size_t *bytesRead)
+{
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry;
+    SIMFS_CACHED_CONTENT_TYPE *snapshot;
+    SIMFS_ERROR error = simfsGetOpenFileEntry(fileHandle, S_IRUSR, &globalEntry, &snapshot);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    if (globalEntry == NULL)
+    {
+        size_t available = offset < snapshot->size ? snapshot->size - offset : 0;
+        *bytesRead = length < available ? length : available;
+        if (*bytesRead > 0)
+            memcpy(readBuffer, snapshot->data + offset, *bytesRead);
+        simfsReleaseContent(snapshot);
+
+        return SIMFS_NO_ERROR;
+    }
+
+    pthread_rwlock_rdlock(&globalEntry->lock);
+
+    if (globalEntry->type != FILE_CONTENT_TYPE)
+        error = SIMFS_READ_ERROR;
+    else
+    {
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(globalEntry->fileDescriptor);
+        size_t available = offset < descriptor->size ? descriptor->size - offset : 0;
+        if (length > available)
+            length = available;
+
+        SIMFS_CACHED_CONTENT_TYPE *content = length > 0 ? simfsGetContent(globalEntry, 0) : NULL;
+        if (content == NULL)
+            simfsTransfer(descriptor, offset, readBuffer, length, 0);
+        else
+        {
+            memcpy(readBuffer, content->data + offset, length);
+            simfsReleaseContent(content);
+        }
+        simfsTouchEntry(globalEntry, 0);
+
+        *bytesRead = length;
+    }
+
+    pthread_rwlock_unlock(&globalEntry->lock);
+    simfsReleaseOpenFileEntry(globalEntry);
+
+    if (error == SIMFS_NO_ERROR)
+        simfsCommit();
+
+    return error;
+}
+
+SIMFS_ERROR simfsReadFileAt(SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, char *readBuffer, size_t length,
+                            size_t *bytesRead)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_READ_AT_OPERATION, started,
+                             simfsReadFileAtUntimed(fileHandle, offset, readBuffer, length, bytesRead));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Writes length bytes from the buffer to the file starting at the given offset; the rest of the content is kept.
+ *
+ * If the range extends past the end of the file, the file grows: only the missing blocks are allocated, and
+ * the gap between the old end of the file and the offset is filled with zeros. If there is not enough free space
+ * for the new blocks, then SIMFS_ALLOC_ERROR is returned and the file is not modified.
+ *
+ * Only the blocks covering the range are visited. The validity of the file handle and the access rights are
+ * checked as in simfsWriteFile().
+ */
+static SIMFS_ERROR simfsWriteFileAtUntimed(SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, char *writeBuffer,
+                                           size_t length)
+{
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry;
+    SIMFS_ERROR error = simfsGetOpenFileEntry(fileHandle, S_IWUSR, &globalEntry, NULL);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    pthread_rwlock_wrlock(&globalEntry->lock);
+
+    if (globalEntry->type != FILE_CONTENT_TYPE || offset + length < offset)
+        error = SIMFS_WRITE_ERROR;
+    else
+    {
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(globalEntry->fileDescriptor);
+        size_t size = descriptor->size;
+        size_t start = offset < size ? offset : size; // a gap after the end of the file is filled from there
+
+        error = simfsUnshareContent(descriptor, start, offset + length - start);
+        if (error == SIMFS_NO_ERROR && offset + length > size)
+        {
+            error = simfsResizeFile(globalEntry, offset + length);
+            if (error == SIMFS_NO_ERROR && offset > size)
+                simfsTransfer(descriptor, size, NULL, offset - size, 1);
+        }
+
+        if (error == SIMFS_NO_ERROR)
+        {
+            simfsTransfer(descriptor, offset, writeBuffer, length, 1);
+            simfsInvalidateContent(globalEntry);
+            simfsTouchEntry(globalEntry, 1);
+        }
+    }
+
+    pthread_rwlock_unlock(&globalEntry->lock);
+    simfsReleaseOpenFileEntry(globalEntry);
+
+    simfsCommit();
+
+    return error;
+}
+
+SIMFS_ERROR simfsWriteFileAt(SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, char *writeBuffer, size_t length)
+{
+    uint64_t started = simfsBeginOperation();
+    SIMFS_ERROR error = simfsWriteFileAtUntimed(fileHandle, offset, writeBuffer, length);
+    if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+        error = simfsWriteFileAtUntimed(fileHandle, offset, writeBuffer, length);
+
+    return simfsEndOperation(SIMFS_WRITE_AT_OPERATION, started, error);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Appends the characters pointed to by the parameter writeBuffer (until '\0' but excluding it) to the end of
+ * the file. Only the last partially filled block of the file and the blocks acquired for the rest of the content
+ * are modified.
+ *
+ * The validity of the file handle, the access rights, and the free space are checked as in simfsWriteFile().
+ */
+static SIMFS_ERROR simfsAppendFileUntimed(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer)
+{
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry;
+    SIMFS_ERROR error = simfsGetOpenFileEntry(fileHandle, S_IWUSR, &globalEntry, NULL);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    pthread_rwlock_wrlock(&globalEntry->lock);
+
+    size_t size = globalEntry->size;
+    size_t length = strlen(writeBuffer);
+
+    if (globalEntry->type != FILE_CONTENT_TYPE)
+        error = SIMFS_WRITE_ERROR;
+    else
+        error = simfsUnshareContent(&SIMFS_DESCRIPTOR(globalEntry->fileDescriptor), size, length);
+    if (error == SIMFS_NO_ERROR)
+        error = simfsResizeFile(globalEntry, size + length);
+
+    if (error == SIMFS_NO_ERROR)
+    {
+        simfsTransfer(&SIMFS_DESCRIPTOR(globalEntry->fileDescriptor), size, writeBuffer, length, 1);
+        simfsInvalidateContent(globalEntry);
+        simfsTouchEntry(globalEntry, 1);
+    }
+
+    pthread_rwlock_unlock(&globalEntry->lock);
+    simfsReleaseOpenFileEntry(globalEntry);
+
+    simfsCommit();
+
+    return error;
+}
+
+SIMFS_ERROR simfsAppendFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer)
+{
+    uint64_t started = simfsBeginOperation();
+    SIMFS_ERROR error = simfsAppendFileUntimed(fileHandle, writeBuffer);
+    if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+        error = simfsAppendFileUntimed(fileHandle, writeBuffer);
+
+    return simfsEndOperation(SIMFS_APPEND_OPERATION, started, error);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Removes the entry for the file with the file handle provided as the parameter from the open file table
+ * for this process. It decreases the number of open files for in the process control block of this process, and
+ * if it becomes zero, then the process control block for this process is removed from the processControlBlocks
+ * hashtable.
+ *
+ * Decreases the reference count in the global open file table, and if that number is 0, it also removes the entry
+ * for this file from the global open file table.
+ *
+ */
+
+static SIMFS_ERROR simfsCloseFileUntimed(SIMFS_FILE_HANDLE_TYPE fileHandle)
+{
+    pid_t pid;
+    simfsGetCaller(NULL, &pid, NULL);
+
+    pthread_mutex_lock(&simfsContext.openFileLock);
+
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsFindProcess(pid);
+    if (pcb == NULL || fileHandle < 0 || fileHandle >= SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS
+        || (pcb->openFileTable[fileHandle].globalEntry == NULL && pcb->openFileTable[fileHandle].snapshot == NULL))
+    {
+        pthread_mutex_unlock(&simfsContext.openFileLock);
+        return SIMFS_NOT_FOUND_ERROR;
+    }
+
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = pcb->openFileTable[fileHandle].globalEntry;
+    SIMFS_CACHED_CONTENT_TYPE *snapshot = pcb->openFileTable[fileHandle].snapshot;
+    pcb->openFileTable[fileHandle].globalEntry = NULL;
+    pcb->openFileTable[fileHandle].snapshot = NULL;
+    pcb->openFileTable[fileHandle].accessRights = 0;
+    pcb->freeHandles |= SIMFS_BIT(fileHandle);
+
+    if (globalEntry != NULL)
+        simfsDropOpenFileEntry(globalEntry);
+    else
+        simfsReleaseContent(snapshot);
+
+    if (--pcb->numberOfOpenFiles == 0)
+        simfsRemoveProcess(pcb);
+
+    pthread_mutex_unlock(&simfsContext.openFileLock);
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_CLOSE_OPERATION, started, simfsCloseFileUntimed(fileHandle));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Selects whether modified metadata is written to the volume by each operation or in batches by
+ * simfsSyncFileSystem(). Switching to SIMFS_WRITE_THROUGH writes all pending changes.
+ */
+void simfsSetWriteBackPolicy(SIMFS_WRITE_BACK_POLICY_TYPE policy)
+{
+    __atomic_store_n(&simfsContext.writeBackPolicy, policy, __ATOMIC_RELEASE);
+
+    if (simfsContext.volume != NULL)
+    {
+        simfsHoldJournal();
+        simfsCommit();
+        simfsReleaseJournal();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Writes the bitvector words and the file times modified since the last flush to the volume; a volume kept in an
+ * image file returns when they are committed to the file.
+ */
+static SIMFS_ERROR simfsSyncFileSystemUntimed()
+{
+    if (simfsContext.volume == NULL)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    if (simfsContext.journal.active)
+        return simfsCommitSnapshot();
+
+    simfsFlush();
+    simfsWriteSnapshot();
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsSyncFileSystem()
+{
+    uint64_t started = simfsNanoseconds();
+    return simfsCountOperation(SIMFS_SYNC_OPERATION, started, simfsSyncFileSystemUntimed());
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Returns the statistics in JSON through the parameter json, in memory allocated for the caller:
+ *
+ *    operations - per operation: the calls, the calls that failed, the total time, and the histogram of the call
+ *                 times as pairs of the lower bound of a bucket in nanoseconds and its count (empty buckets are left
+ *                 out; a bucket ends at twice its lower bound)
+ *    directory  - the entries, and the lookups with the slots they visited
+ *    allocation - the free blocks, the runs allocated, the claims lost to other threads, the searches of the
+ *                 bitvector summaries with the top-level words they visited, the blocks freed, the references
+ *                 to data blocks added by clones, and the shared blocks copied before a write
+ *    cache      - the cached bytes, the hits, misses, and evictions
+ *    openFiles  - the entries of the global open file table in use, the processes, and the entries with unwritten
+ *                 times
+ *    journal    - the transactions committed with the metadata blocks and the data blocks they wrote, the
+ *                 checkpoints, and the syncs of the image file
+ *    queue      - the batches and the requests submitted to request queues
+ *    pools      - the slabs of process control blocks allocated, and the reads served by buffers given back
+ *
+ * The counters are kept since the start of the program, across mounts; the state of the volume is left out when
+ * no volume is mounted.
+ */
+SIMFS_ERROR simfsGetStatistics(char **json)
+{
+    static const char *operationNames[SIMFS_NUMBER_OF_OPERATIONS] = {
+        "create", "delete", "getInfo", "open", "write", "append", "read", "readView", "readAt", "writeAt", "close",
+        "sync", "lookup", "list", "truncate", "clone"
+    };
+
+    SIMFS_STATISTICS_TYPE sum;
+    simfsSumStatistics(&sum);
+
+    char *buffer;
+    size_t size;
+    FILE *stream = open_memstream(&buffer, &size);
+    if (stream == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    fprintf(stream, "{\n  \"operations\": {");
+    for (int operation = 0; operation < SIMFS_NUMBER_OF_OPERATIONS; operation++)
+    {
+        fprintf(stream, "%s\n    \"%s\": {\"calls\": %" PRIu64 ", \"errors\": %" PRIu64 ", \"nanoseconds\": %" PRIu64
+                ", \"latency\": [", operation == 0 ? "" : ",", operationNames[operation], sum.calls[operation],
+                sum.errors[operation], sum.nanoseconds[operation]);
+
+        const char *separator = "";
+        for (int bucket = 0; bucket < SIMFS_LATENCY_BUCKETS; bucket++)
+            if (sum.latency[operation][bucket] != 0)
+            {
+                fprintf(stream, "%s[%" PRIu64 ", %" PRIu64 "]", separator,
+                        bucket == 0 ? 0 : (uint64_t) 1 << (bucket - 1), sum.latency[operation][bucket]);
+                separator = ", ";
+            }
+        fprintf(stream, "]}");
+    }
+    fprintf(stream, "\n  },\n");
+
+    unsigned int entries = 0;
+    int freeBlocks = 0;
+    SIMFS_INDEX_TYPE numberOfBlocks = 0;
+    size_t cacheBytes = 0;
+    int openEntries = 0;
+    int processes = 0;
+    int dirtyEntries = 0;
+    int mounted = simfsContext.volume != NULL;
+    if (mounted)
+    {
+        for (int shard = 0; shard < SIMFS_DIRECTORY_SHARDS; shard++)
+        {
+            pthread_rwlock_rdlock(&simfsContext.directory[shard].lock);
+            entries += simfsContext.directory[shard].count;
+            pthread_rwlock_unlock(&simfsContext.directory[shard].lock);
+        }
+
+        freeBlocks = SIMFS_LOAD(simfsContext.numberOfFreeBlocks);
+        numberOfBlocks = simfsContext.geometry.numberOfBlocks;
+
+        pthread_mutex_lock(&simfsContext.openFileLock);
+        for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES; i++)
+            if (simfsContext.globalOpenFileTable[i].referenceCount > 0)
+                openEntries++;
+        for (int chain = 0; chain < SIMFS_PROCESS_BUCKETS; chain++)
+            for (SIMFS_PROCESS_CONTROL_BLOCK_TYPE *pcb = simfsContext.processControlBlocks[chain]; pcb != NULL;
+                 pcb = pcb->next)
+                processes++;
+        pthread_mutex_unlock(&simfsContext.openFileLock);
+
+        pthread_mutex_lock(&simfsContext.dirtyLock);
+        dirtyEntries = simfsContext.numberOfDirtyEntries;
+        pthread_mutex_unlock(&simfsContext.dirtyLock);
+
+        pthread_mutex_lock(&simfsContext.cacheLock);
+        cacheBytes = simfsContext.cacheBytes;
+        pthread_mutex_unlock(&simfsContext.cacheLock);
+    }
+
+    fprintf(stream, "  \"directory\": {");
+    if (mounted)
+        fprintf(stream, "\"entries\": %u, ", entries);
+    fprintf(stream, "\"lookups\": %" PRIu64 ", \"probes\": %" PRIu64 ", \"longestProbe\": %" PRIu64 "},\n",
+            sum.directoryLookups, sum.directoryProbes, sum.longestDirectoryProbe);
+
+    fprintf(stream, "  \"allocation\": {");
+    if (mounted)
+        fprintf(stream, "\"numberOfBlocks\": %u, \"freeBlocks\": %d, ", (unsigned int) numberOfBlocks, freeBlocks);
+    fprintf(stream, "\"runs\": %" PRIu64 ", \"blocks\": %" PRIu64 ", \"retries\": %" PRIu64 ", \"freeWordSearches\": %"
+            PRIu64 ", \"freeWordScans\": %" PRIu64 ", \"freedBlocks\": %" PRIu64 ", \"sharedBlocks\": %" PRIu64
+            ", \"copiedBlocks\": %" PRIu64 "},\n", sum.allocations, sum.allocatedBlocks, sum.allocationRetries,
+            sum.freeWordSearches, sum.freeWordScans, sum.freedBlocks, sum.sharedBlocks, sum.copiedBlocks);
+
+    fprintf(stream, "  \"cache\": {");
+    if (mounted)
+        fprintf(stream, "\"bytes\": %zu, \"capacity\": %d, ", cacheBytes, SIMFS_CACHE_SIZE);
+    fprintf(stream, "\"hits\": %" PRIu64 ", \"misses\": %" PRIu64 ", \"evictions\": %" PRIu64 "},\n", sum.cacheHits,
+            sum.cacheMisses, sum.cacheEvictions);
+
+    fprintf(stream, "  \"journal\": {\"commits\": %" PRIu64 ", \"images\": %" PRIu64 ", \"dataBlocks\": %" PRIu64
+            ", \"checkpoints\": %" PRIu64 ", \"flushes\": %" PRIu64 "}", sum.journalCommits, sum.journalImages,
+            sum.journalDataBlocks, sum.journalCheckpoints, sum.journalFlushes);
+
+    fprintf(stream, ",\n  \"queue\": {\"batches\": %" PRIu64 ", \"requests\": %" PRIu64 "}", sum.queueBatches,
+            sum.queueRequests);
+
+    fprintf(stream, ",\n  \"pools\": {\"processSlabs\": %" PRIu64 ", \"reusedReadBuffers\": %" PRIu64 "}",
+            sum.processSlabs, sum.reusedReadBuffers);
+
+    if (mounted)
+        fprintf(stream, ",\n  \"openFiles\": {\"entries\": %d, \"capacity\": %d, \"processes\": %d, "
+                "\"dirtyEntries\": %d}", openEntries, SIMFS_MAX_NUMBER_OF_OPEN_FILES, processes, dirtyEntries);
+    fprintf(stream, "\n}\n");
+
+    if (fclose(stream) != 0)
+    {
+        free(buffer);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    *json = buffer;
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// operations on nodes
+//
+// Frontends that keep their own references to files and folders (e.g., the FUSE low-level frontend, which uses
+// the descriptor blocks as inode numbers) address them by their node, so there is no lookup by name per request.
+// A node given by such a frontend may have been deleted meanwhile, so it is checked under the lock of its stripe
+// (see simfsLockFolders()), which its deletion holds as well.
+//
+// Files are opened as entries of the global open file table without a process control block: the requests on an
+// open file may come from any process. The content is passed to the frontend as the pieces of the volume that hold
+// it, so it is copied only once, between the volume and the buffers of the frontend.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*
+ * Sets the caller of the operations of the calling thread; a frontend sets it for every request it serves.
+ */
+void simfsSetCaller(uid_t uid, pid_t pid, mode_t umask)
+{
+    simfsCaller.uid = uid;
+    simfsCaller.pid = pid;
+    simfsCaller.umask = umask;
+    simfsCallerSet = 1;
+}
+
+SIMFS_INDEX_TYPE simfsRootNode()
+{
+    return simfsContext.volume->superblock.attr.rootNodeIndex;
+}
+
+void simfsGetUsage(SIMFS_INDEX_TYPE *numberOfBlocks, SIMFS_INDEX_TYPE *freeBlocks, unsigned int *blockSize)
+{
+    *numberOfBlocks = simfsContext.geometry.numberOfBlocks;
+    *freeBlocks = (SIMFS_INDEX_TYPE) SIMFS_LOAD(simfsContext.numberOfFreeBlocks);
+    *blockSize = simfsContext.geometry.blockSize;
+}
+
+/*
+ * Checks that a node given by a frontend is a file or a folder of the given type (INVALID_CONTENT_TYPE for either);
+ * the caller holds the lock of the node.
+ */
+static int simfsIsNode(SIMFS_INDEX_TYPE node, SIMFS_CONTENT_TYPE type)
+{
+    if (node >= simfsContext.geometry.numberOfBlocks || node == simfsContext.volume->superblock.attr.snapshotNode)
+        return 0;
+
+    SIMFS_CONTENT_TYPE nodeType = SIMFS_BLOCK(node).type;
+    if (type != INVALID_CONTENT_TYPE)
+        return nodeType == type;
+
+    return nodeType == FILE_CONTENT_TYPE || nodeType == FOLDER_CONTENT_TYPE;
+}
+
+static SIMFS_ERROR simfsLookupNodeUntimed(SIMFS_INDEX_TYPE folder, const char *name, SIMFS_INDEX_TYPE *node,
+                                          SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    SIMFS_ERROR error = SIMFS_NOT_FOUND_ERROR;
+
+    simfsLockFolders(folder, SIMFS_INVALID_INDEX);
+    if (simfsIsNode(folder, FOLDER_CONTENT_TYPE))
+    {
+        *node = simfsFindNode(folder, name);
+        if (*node != SIMFS_INVALID_INDEX)
+        {
+            simfsDescribeNode(*node, infoBuffer);
+            error = SIMFS_NO_ERROR;
+        }
+    }
+    simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+
+    return error;
+}
+
+SIMFS_ERROR simfsLookupNode(SIMFS_INDEX_TYPE folder, const char *name, SIMFS_INDEX_TYPE *node,
+                            SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_LOOKUP_OPERATION, started, simfsLookupNodeUntimed(folder, name, node, infoBuffer));
+}
+
+static SIMFS_ERROR simfsGetNodeInfoUntimed(SIMFS_INDEX_TYPE node, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    SIMFS_ERROR error = SIMFS_NOT_FOUND_ERROR;
+
+    simfsLockFolders(node, SIMFS_INVALID_INDEX);
+    if (simfsIsNode(node, INVALID_CONTENT_TYPE))
+    {
+        simfsDescribeNode(node, infoBuffer);
+        error = SIMFS_NO_ERROR;
+    }
+    simfsUnlockFolders(node, SIMFS_INVALID_INDEX);
+
+    return error;
+}
+
+SIMFS_ERROR simfsGetNodeInfo(SIMFS_INDEX_TYPE node, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_GET_INFO_OPERATION, started, simfsGetNodeInfoUntimed(node, infoBuffer));
+}
+
+/*
+ * Creates a file or a folder with the given access rights in a folder, as simfsCreateFile() does in the current
+ * directory; the node and its descriptor are returned.
+ */
+static SIMFS_ERROR simfsCreateInFolderUntimed(SIMFS_INDEX_TYPE folder, const char *name, SIMFS_CONTENT_TYPE type,
+                                              mode_t accessRights, SIMFS_INDEX_TYPE *node,
+                                              SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    if (type != FILE_CONTENT_TYPE && type != FOLDER_CONTENT_TYPE)
+        return SIMFS_WRITE_ERROR;
+    if (simfsIsStatisticsFile(folder, name))
+        return SIMFS_DUPLICATE_ERROR;
+
+    uid_t uid;
+    simfsGetCaller(&uid, NULL, NULL);
+
+    SIMFS_ERROR error = SIMFS_NOT_FOUND_ERROR;
+
+    simfsLockFolders(folder, SIMFS_INVALID_INDEX);
+    if (simfsIsNode(folder, FOLDER_CONTENT_TYPE))
+        error = simfsCreateNode(folder, name, type, uid, accessRights, NULL);
+    if (error == SIMFS_NO_ERROR)
+    {
+        *node = simfsFindNode(folder, name);
+        *infoBuffer = SIMFS_DESCRIPTOR(*node);
+    }
+    simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+
+    if (error == SIMFS_NO_ERROR)
+        simfsCommit();
+
+    return error;
+}
+
+SIMFS_ERROR simfsCreateInFolder(SIMFS_INDEX_TYPE folder, const char *name, SIMFS_CONTENT_TYPE type,
+                                mode_t accessRights, SIMFS_INDEX_TYPE *node, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    uint64_t started = simfsBeginOperation();
+    SIMFS_ERROR error = simfsCreateInFolderUntimed(folder, name, type, accessRights, node, infoBuffer);
+    if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+        error = simfsCreateInFolderUntimed(folder, name, type, accessRights, node, infoBuffer);
+
+    return simfsEndOperation(SIMFS_CREATE_OPERATION, started, error);
+}
+
+SIMFS_ERROR simfsDeleteInFolder(SIMFS_INDEX_TYPE folder, const char *name)
+{
+    uint64_t started = simfsBeginOperation();
+
+    uid_t uid;
+    simfsGetCaller(&uid, NULL, NULL);
+
+    return simfsEndOperation(SIMFS_DELETE_OPERATION, started, simfsDeleteFromFolder(folder, name, uid));
+}
+
+/*
+ * Passes the entries of a folder to the callback, starting with the entry at the given position (the count of the
+ * entries before it), until the callback returns non-zero. The positions of the entries following a deleted one
+ * move down by one, so a listing that runs across deletions may skip entries.
+ */
+static SIMFS_ERROR simfsListFolderUntimed(SIMFS_INDEX_TYPE folder, long position, SIMFS_FOLDER_CALLBACK callback,
+                                          void *argument)
+{
+    simfsLockFolders(folder, SIMFS_INVALID_INDEX);
+
+    if (!simfsIsNode(folder, FOLDER_CONTENT_TYPE))
+    {
+        simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+        return SIMFS_NOT_FOUND_ERROR;
+    }
+
+    long index = 0;
+    int stopped = 0;
+    for (SIMFS_INDEX_TYPE block = SIMFS_DESCRIPTOR(folder).block_ref; block != SIMFS_INVALID_INDEX && !stopped;
+         block = SIMFS_BLOCK(block).content.folder.next)
+    {
+        SIMFS_FOLDER_BLOCK_TYPE *folderBlock = &SIMFS_BLOCK(block).content.folder;
+        for (size_t offset = 0; offset < folderBlock->used && !stopped; index++)
+        {
+            SIMFS_FOLDER_ENTRY_TYPE *entry = simfsFolderEntry(folderBlock, offset);
+            if (index >= position)
+                stopped = callback(argument, index, entry->node, (SIMFS_CONTENT_TYPE) entry->type, entry->name);
+            offset += SIMFS_FOLDER_ENTRY_SIZE(entry->nameLength);
+        }
+    }
+
+    simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+
+    return SIMFS_NO_ERROR;
+}
+
+SIMFS_ERROR simfsListFolder(SIMFS_INDEX_TYPE folder, long position, SIMFS_FOLDER_CALLBACK callback, void *argument)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_LIST_OPERATION, started,
+                             simfsListFolderUntimed(folder, position, callback, argument));
+}
+
+/*
+ * Opens a file for the caller with the given rights (S_IRUSR, S_IWUSR, or both); the entry of the file in the
+ * global open file table is returned, with a reference that simfsCloseNodeEntry() gives back.
+ */
+static SIMFS_ERROR simfsOpenNodeEntryUntimed(SIMFS_INDEX_TYPE node, mode_t rights, int *entry)
+{
+    uid_t uid;
+    simfsGetCaller(&uid, NULL, NULL);
+
+    simfsLockFolders(node, SIMFS_INVALID_INDEX);
+
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    if (!simfsIsNode(node, FILE_CONTENT_TYPE))
+        error = SIMFS_NOT_FOUND_ERROR;
+    else
+    {
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(node);
+        if (((rights & S_IRUSR) && !simfsHasAccess(descriptor->accessRights, descriptor->owner, uid, S_IRUSR))
+            || ((rights & S_IWUSR) && !simfsHasAccess(descriptor->accessRights, descriptor->owner, uid, S_IWUSR)))
+            error = SIMFS_ACCESS_ERROR;
+    }
+
+    if (error == SIMFS_NO_ERROR)
+    {
+        pthread_mutex_lock(&simfsContext.openFileLock);
+
+        SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = simfsLookupOpenFile(node);
+        if (globalEntry == NULL && simfsContext.freeOpenFile >= 0)
+            globalEntry = simfsAddOpenFile(node);
+
+        if (globalEntry == NULL)
+            error = SIMFS_ALLOC_ERROR;
+        else
+        {
+            globalEntry->referenceCount++;
+            *entry = (int) (globalEntry - simfsContext.globalOpenFileTable);
+        }
+
+        pthread_mutex_unlock(&simfsContext.openFileLock);
+    }
+
+    simfsUnlockFolders(node, SIMFS_INVALID_INDEX);
+
+    return error;
+}
+
+SIMFS_ERROR simfsOpenNodeEntry(SIMFS_INDEX_TYPE node, mode_t rights, int *entry)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_OPEN_OPERATION, started, simfsOpenNodeEntryUntimed(node, rights, entry));
+}
+
+static SIMFS_ERROR simfsCloseNodeEntryUntimed(int entry)
+{
+    SIMFS_ERROR error = SIMFS_NOT_FOUND_ERROR;
+
+    pthread_mutex_lock(&simfsContext.openFileLock);
+    if (entry >= 0 && entry < SIMFS_MAX_NUMBER_OF_OPEN_FILES
+        && simfsContext.globalOpenFileTable[entry].referenceCount > 0)
+    {
+        simfsDropOpenFileEntry(&simfsContext.globalOpenFileTable[entry]);
+        error = SIMFS_NO_ERROR;
+    }
+    pthread_mutex_unlock(&simfsContext.openFileLock);
+
+    return error;
+}
+
+SIMFS_ERROR simfsCloseNodeEntry(int entry)
+{
+    uint64_t started = simfsBeginOperation();
+    return simfsEndOperation(SIMFS_CLOSE_OPERATION, started, simfsCloseNodeEntryUntimed(entry));
+}
+
+/*
+ * Collects the pieces of the volume holding a range of the content of a file: the inline content, or a part of the
+ * data of every block of the range. The range lies within the content, and there is room for its segments. Blocks
+ * that are written are marked as data blocks.
+ */
+static int simfsMapContent(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, size_t offset, size_t length, int toFile,
+                           SIMFS_SEGMENT_TYPE *segments)
+{
+    if (length == 0)
+        return 0;
+
+    if (SIMFS_IS_INLINE(*descriptor))
+    {
+        segments[0].data = descriptor->inlineData + offset;
+        segments[0].length = length;
+        return 1;
+    }
+
+    size_t dataSize = simfsContext.geometry.dataSize;
+    SIMFS_EXTENT_CURSOR_TYPE cursor;
+    int first;
+    SIMFS_EXTENT_TYPE *extent = simfsSeekExtent(&cursor, descriptor, (int) (offset / dataSize), &first);
+    size_t position = offset % dataSize;
+    int count = 0;
+
+    for (; length > 0 && extent != NULL; first = 0, extent = simfsNextExtent(&cursor))
+        for (int i = first; i < (int) extent->length && length > 0; i++)
+        {
+            SIMFS_BLOCK_TYPE *block = &SIMFS_BLOCK(extent->start + i);
+            size_t chunk = dataSize - position < length ? dataSize - position : length;
+
+            if (toFile)
+                block->type = DATA_CONTENT_TYPE;
+            segments[count].data = block->content.data + position;
+            segments[count].length = chunk;
+            count++;
+
+            length -= chunk;
+            position = 0;
+        }
+
+    return count;
+}
+
+/*
+ * Passes the pieces of the volume holding a range of an open file to the callback, which reads or writes them
+ * while the file is locked; segments has room for maxSegments pieces, and a range that needs more is refused.
+ *
+ * A range to read is cut at the end of the file (so the callback may get no segments). A range to write extends
+ * the file first, filling a gap after its end with zeros; the written blocks are recorded as changed, and the
+ * cached content of the file is dropped.
+ */
+static SIMFS_ERROR simfsMapNodeRangeUntimed(int entry, size_t offset, size_t length, int write,
+                                            SIMFS_SEGMENT_TYPE *segments, int maxSegments,
+                                            SIMFS_SEGMENTS_CALLBACK callback, void *argument)
+{
+    SIMFS_ERROR failure = write ? SIMFS_WRITE_ERROR : SIMFS_READ_ERROR;
+    if (entry < 0 || entry >= SIMFS_MAX_NUMBER_OF_OPEN_FILES || offset + length < offset)
+        return failure;
+
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = &simfsContext.globalOpenFileTable[entry];
+    size_t dataSize = simfsContext.geometry.dataSize;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+
+    if (write)
+        pthread_rwlock_wrlock(&globalEntry->lock);
+    else
+        pthread_rwlock_rdlock(&globalEntry->lock);
+
+    SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(globalEntry->fileDescriptor);
+    if (globalEntry->type != FILE_CONTENT_TYPE) // the file has been deleted
+        error = failure;
+    else if (!write && length > (offset < descriptor->size ? descriptor->size - offset : 0))
+        length = offset < descriptor->size ? descriptor->size - offset : 0;
+
+    if (error == SIMFS_NO_ERROR && length > 0 && (offset + length - 1) / dataSize - offset / dataSize + 1
+                                                 > (size_t) maxSegments)
+        error = failure;
+
+    if (error == SIMFS_NO_ERROR && write)
+    {
+        size_t start = offset < descriptor->size ? offset : descriptor->size;
+        error = simfsUnshareContent(descriptor, start, offset + length - start);
+    }
+
+    if (error == SIMFS_NO_ERROR && write && offset + length > descriptor->size)
+    {
+        size_t size = descriptor->size;
+        error = simfsResizeFile(globalEntry, offset + length);
+        if (error == SIMFS_NO_ERROR && offset > size)
+            simfsTransfer(descriptor, size, NULL, offset - size, 1);
+    }
+
+    if (error == SIMFS_NO_ERROR)
+    {
+        int count = simfsMapContent(descriptor, offset, length, write, segments);
+        if (callback(segments, count, argument) != 0)
+            error = failure;
+
+        if (write)
+        {
+            for (int i = 0; i < count; i++)
+                simfsMarkVolumeDirty(segments[i].data, segments[i].length);
+            simfsInvalidateContent(globalEntry);
+        }
+        simfsTouchEntry(globalEntry, write);
+    }
+
+    pthread_rwlock_unlock(&globalEntry->lock);
+
+    simfsCommit();
+
+    return error;
+}
+
+SIMFS_ERROR simfsMapNodeRange(int entry, size_t offset, size_t length, int write, SIMFS_SEGMENT_TYPE *segments,
+                              int maxSegments, SIMFS_SEGMENTS_CALLBACK callback, void *argument)
+{
+    uint64_t started = simfsBeginOperation();
+    SIMFS_ERROR error = simfsMapNodeRangeUntimed(entry, offset, length, write, segments, maxSegments, callback,
+                                                 argument);
+    if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+        error = simfsMapNodeRangeUntimed(entry, offset, length, write, segments, maxSegments, callback, argument);
+
+    return simfsEndOperation(write ? SIMFS_WRITE_AT_OPERATION : SIMFS_READ_AT_OPERATION, started, error);
+}
+
+/*
+ * Changes the size of a file for the caller; a file that grows is filled with zeros.
+ */
+static SIMFS_ERROR simfsTruncateNodeUntimed(SIMFS_INDEX_TYPE node, size_t size)
+{
+    int entry;
+    SIMFS_ERROR error = simfsOpenNodeEntryUntimed(node, S_IWUSR, &entry);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = &simfsContext.globalOpenFileTable[entry];
+    pthread_rwlock_wrlock(&globalEntry->lock);
+
+    if (globalEntry->type != FILE_CONTENT_TYPE)
+        error = SIMFS_WRITE_ERROR;
+    else
+    {
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &SIMFS_DESCRIPTOR(globalEntry->fileDescriptor);
+        size_t oldSize = descriptor->size;
+
+        if (size > oldSize)
+            error = simfsUnshareContent(descriptor, oldSize, size - oldSize);
+        if (error == SIMFS_NO_ERROR)
+            error = simfsResizeFile(globalEntry, size);
+        if (error == SIMFS_NO_ERROR)
+        {
+            if (size > oldSize)
+                simfsTransfer(descriptor, oldSize, NULL, size - oldSize, 1);
+            simfsInvalidateContent(globalEntry);
+            simfsTouchEntry(globalEntry, 1);
+        }
+    }
+
+    pthread_rwlock_unlock(&globalEntry->lock);
+    simfsReleaseOpenFileEntry(globalEntry);
+
+    simfsCommit();
+
+    return error;
+}
+
+SIMFS_ERROR simfsTruncateNode(SIMFS_INDEX_TYPE node, size_t size)
+{
+    uint64_t started = simfsBeginOperation();
+    SIMFS_ERROR error = simfsTruncateNodeUntimed(node, size);
+    if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+        error = simfsTruncateNodeUntimed(node, size);
+
+    return simfsEndOperation(SIMFS_TRUNCATE_OPERATION, started, error);
+}
 
 //////////////////////////////////////////////////////////////////////////
 //
-// simfs function implementations
+// clones
+//
+// A clone of a file is a new file with the content of the file, which shares the data blocks of the file until
+// either of them writes to them (see the shared blocks section); cloning takes time and space proportional to the
+// extents of the file, not to its content. The descriptor block and the extent blocks are copied, so a clone takes
+// one block, and one more for every extent block of the file.
 //
 //////////////////////////////////////////////////////////////////////////
 
 /*
- * Constructs in-memory directory of all files is the system.
- *
- * Starting with the file system root (pointed to from the superblock) traverses the hierarachy of directories
- * and adds en entry for each folder or file to the directory by hashing the name and adding a directory
- * entry node to the conflict resolution list for that entry. If the entry is NULL, the new node will be
- * the only element of that list.
- *
- * The function sets the current working directory to refer to the block holding the root of the volume. This will
- * be changed as the user navigates the file system hierarchy.
- *
+ * Frees a chain of extent blocks.
  */
-SIMFS_ERROR simfsMountFileSystem(SIMFS_VOLUME *fileSystem)
+static void simfsFreeExtentBlocks(SIMFS_INDEX_TYPE block)
+{
+    while (block != SIMFS_INVALID_INDEX)
+    {
+        SIMFS_INDEX_TYPE next = SIMFS_BLOCK(block).content.extents.next;
+        simfsFreeRun(block, 1);
+        block = next;
+    }
+}
+
+/*
+ * Copies the access rights and the content of a file into the descriptor of a clone (a buffer of the data size of a
+ * block), with copies of its extent blocks, and adds a reference to its data blocks for the clone; the caller holds
+ * the file locked shared. The times are left out, as a flush may write them meanwhile. Returns SIMFS_ALLOC_ERROR if
+ * there is no space for the extent blocks.
+ */
+static SIMFS_ERROR simfsShareContent(SIMFS_FILE_DESCRIPTOR_TYPE *descriptor, SIMFS_FILE_DESCRIPTOR_TYPE *clone)
 {
-    // TODO: implement
+    clone->accessRights = descriptor->accessRights;
+    clone->size = descriptor->size;
+    clone->block_ref = SIMFS_INVALID_INDEX;
+    clone->numberOfExtents = descriptor->numberOfExtents;
+    memcpy(clone->inlineData, descriptor->inlineData, simfsContext.geometry.inlineSize);
+
+    SIMFS_INDEX_TYPE *link = &clone->block_ref;
+    SIMFS_INDEX_TYPE source = descriptor->block_ref;
+    for (int i = simfsExtentBlocksFor((int) descriptor->numberOfExtents); i > 0; i--)
+    {
+        SIMFS_INDEX_TYPE block = simfsAllocateBlock();
+        if (block == SIMFS_INVALID_INDEX)
+        {
+            simfsFreeExtentBlocks(clone->block_ref);
+            return SIMFS_ALLOC_ERROR;
+        }
+
+        memcpy(&SIMFS_BLOCK(block), &SIMFS_BLOCK(source), simfsContext.geometry.blockSize);
+        SIMFS_BLOCK(block).content.extents.next = SIMFS_INVALID_INDEX;
+        simfsMarkVolumeDirty(&SIMFS_BLOCK(block), simfsContext.geometry.blockSize);
+
+        *link = block;
+        link = &SIMFS_BLOCK(block).content.extents.next;
+        source = SIMFS_BLOCK(source).content.extents.next;
+    }
+
+    SIMFS_EXTENT_CURSOR_TYPE cursor;
+    SIMFS_EXTENT_TYPE *extent;
+    simfsFirstExtent(&cursor, descriptor);
+    while ((extent = simfsNextExtent(&cursor)) != NULL)
+        simfsShareRun(extent->start, extent->length);
 
     return SIMFS_NO_ERROR;
 }
 
-//////////////////////////////////////////////////////////////////////////
+/*
+ * Gives back what simfsShareContent() took for a clone that could not be created.
+ */
+static void simfsDropSharedContent(SIMFS_FILE_DESCRIPTOR_TYPE *clone)
+{
+    SIMFS_EXTENT_CURSOR_TYPE cursor;
+    SIMFS_EXTENT_TYPE *extent;
+    simfsFirstExtent(&cursor, clone);
+    while ((extent = simfsNextExtent(&cursor)) != NULL)
+        simfsFreeDataRun(extent->start, (int) extent->length);
+
+    simfsFreeExtentBlocks(clone->block_ref);
+}
 
 /*
- * Depending on the type parameter the function creates a file or a folder in the current directory
- * of the process. If the process does not have an entry in the processControlBlock, then the root directory
- * is assumed to be its current working directory.
- *
- * Hashes the file name and check if the file with such name already exists in the in-memory directory.
- * If it is then it return SIMFS_DUPLICATE_ERROR.
- * Otherwise:
- *    - finds an available block in the storage using the in-memory bitvector and flips the bit to indicate
- *      that the block is taken
- *    - initializes a local buffer for the file descriptor block with the block type depending on the parameter type
- *      (i.e., folder or file)
- *    - creates an entry in the conflict resolution list for the corresponding in-memory directory entry
- *    - copies the local buffer to the disk block that was found to be free
- *    - copies the in-memory bitvector to the bitevector blocks on the simulated disk
- *
- *  The access rights and the the owner are taken from the context (umask and uid correspondingly).
+ * Creates a clone of a file in a folder for the caller, who needs the right to read the file; the clone gets the
+ * access rights of the file. The node of the clone and its descriptor are returned.
  *
+ * The content is shared while the file is locked, and the clone is created afterwards under the lock of the folder,
+ * so the locks are taken in their order; a write to the file in between already finds its blocks shared.
  */
-SIMFS_ERROR simfsCreateFile(SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type)
+static SIMFS_ERROR simfsCloneToFolder(SIMFS_INDEX_TYPE node, SIMFS_INDEX_TYPE folder, const char *name,
+                                      SIMFS_INDEX_TYPE *clone, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
 {
-    // TODO: implement
+    if (simfsIsStatisticsFile(folder, name))
+        return SIMFS_DUPLICATE_ERROR;
 
-    return SIMFS_NO_ERROR;
+    uid_t uid;
+    simfsGetCaller(&uid, NULL, NULL);
+
+    int entry;
+    SIMFS_ERROR error = simfsOpenNodeEntryUntimed(node, S_IRUSR, &entry);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry = &simfsContext.globalOpenFileTable[entry];
+    SIMFS_BLOCK_TYPE *image = malloc(simfsContext.geometry.blockSize); // the descriptor block of the clone
+    int shared = 0;
+    if (image == NULL)
+        error = SIMFS_ALLOC_ERROR;
+    else
+    {
+        pthread_rwlock_rdlock(&globalEntry->lock);
+        if (globalEntry->type != FILE_CONTENT_TYPE) // the file has been deleted
+            error = SIMFS_NOT_FOUND_ERROR;
+        else
+            error = simfsShareContent(&SIMFS_DESCRIPTOR(globalEntry->fileDescriptor), &image->content.fileDescriptor);
+        pthread_rwlock_unlock(&globalEntry->lock);
+    }
+
+    if (error == SIMFS_NO_ERROR)
+    {
+        SIMFS_FILE_DESCRIPTOR_TYPE *descriptor = &image->content.fileDescriptor;
+        shared = 1;
+
+        simfsLockFolders(folder, SIMFS_INVALID_INDEX);
+        if (!simfsIsNode(folder, FOLDER_CONTENT_TYPE))
+            error = SIMFS_NOT_FOUND_ERROR;
+        else
+            error = simfsCreateNode(folder, name, FILE_CONTENT_TYPE, uid, descriptor->accessRights, descriptor);
+        if (error == SIMFS_NO_ERROR)
+        {
+            *clone = simfsFindNode(folder, name);
+            *infoBuffer = SIMFS_DESCRIPTOR(*clone);
+        }
+        simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+
+        if (error != SIMFS_NO_ERROR)
+            simfsDropSharedContent(descriptor);
+    }
+
+    free(image);
+    simfsReleaseOpenFileEntry(globalEntry);
+
+    // a failed clone has dropped its references again; the commit also returns the extent blocks it freed
+    if (shared)
+        simfsCommit();
+
+    return error;
 }
 
-//////////////////////////////////////////////////////////////////////////
+SIMFS_ERROR simfsCloneNode(SIMFS_INDEX_TYPE node, SIMFS_INDEX_TYPE folder, const char *name, SIMFS_INDEX_TYPE *clone,
+                           SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    uint64_t started = simfsBeginOperation();
+    SIMFS_ERROR error = simfsCloneToFolder(node, folder, name, clone, infoBuffer);
+    if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+        error = simfsCloneToFolder(node, folder, name, clone, infoBuffer);
+
+    return simfsEndOperation(SIMFS_CLONE_OPERATION, started, error);
+}
 
 /*
- * Deletes a file from the file system.
+ * Creates a clone of a file of the current directory of the process in the same directory, as simfsCloneNode()
+ * does; the clone shares the content of the file until either of them is written.
  *
- * Hashes the file name and check if the file is in the directory. If not, then it returns SIMFS_NOT_FOUND_ERROR.
- * Otherwise:
- *    - finds the reference to the file descriptor block
- *    - if the referenced block is a folder that is not empty, then returns SIMFS_NOT_EMPTY_ERROR.
- *    - Otherwise:
- *       - checks if the process owner can delete this file or folder; if not, it returns SIMFS_ACCESS_ERROR.
- *       - Otherwise:
- *          - frees all blocks belonging to the file by flipping the corresponding bits in the in-memory bitvector
- *          - frees the reference block by flipping the corresponding bit in the in-memory bitvector
- *          - clears the entry in the folder by removing the corresponding node in the list associated with
- *            the slot for this file
- *          - copies the in-memory bitvector to the bitvector blocks on the simulated disk
+ * Returns SIMFS_NOT_FOUND_ERROR if there is no file with the name of the source, SIMFS_DUPLICATE_ERROR if the name
+ * of the clone is taken, SIMFS_ACCESS_ERROR if the process owner may not read the file, and SIMFS_ALLOC_ERROR if
+ * there is no space for the clone.
  */
-SIMFS_ERROR simfsDeleteFile(SIMFS_NAME_TYPE fileName)
+static SIMFS_ERROR simfsCloneFileUntimed(SIMFS_NAME_TYPE sourceName, SIMFS_NAME_TYPE cloneName)
 {
-    // TODO: implement
+    pid_t pid;
+    simfsGetCaller(NULL, &pid, NULL);
 
-    return SIMFS_NO_ERROR;
+    SIMFS_INDEX_TYPE folder = simfsCurrentDirectory(pid);
+
+    simfsLockFolders(folder, SIMFS_INVALID_INDEX);
+    SIMFS_INDEX_TYPE node = simfsFindNode(folder, sourceName);
+    simfsUnlockFolders(folder, SIMFS_INVALID_INDEX);
+
+    if (node == SIMFS_INVALID_INDEX)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    SIMFS_INDEX_TYPE clone;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    return simfsCloneToFolder(node, folder, cloneName, &clone, &info);
+}
+
+SIMFS_ERROR simfsCloneFile(SIMFS_NAME_TYPE sourceName, SIMFS_NAME_TYPE cloneName)
+{
+    uint64_t started = simfsBeginOperation();
+    SIMFS_ERROR error = simfsCloneFileUntimed(sourceName, cloneName);
+    if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+        error = simfsCloneFileUntimed(sourceName, cloneName);
+
+    return simfsEndOperation(SIMFS_CLONE_OPERATION, started, error);
 }
 
 //////////////////////////////////////////////////////////////////////////
+//
+// request queues
+//
+// The costs shared by the requests of a batch are paid once: a chain sets the caller and holds the journal lock
+// once, and passes its node and entry from request to request instead of looking them up; the metadata changed by
+// a batch is flushed once, when its last chain completes, instead of by every request (see simfsCommit()).
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct simfs_chain_type { // consecutive requests of a batch
+    int first;
+    int count;
+} SIMFS_CHAIN_TYPE;
+
+typedef struct simfs_batch_type { // the requests of a call of simfsSubmitRequests()
+    struct simfs_batch_type *next; // the next batch with chains that no thread has taken
+    SIMFS_REQUEST_TYPE *requests;
+    uid_t uid; // the caller
+    pid_t pid;
+    mode_t umask;
+    int numberOfChains;
+    int nextChain; // the first chain that no thread has taken
+    int pendingChains; // the chains that have not completed
+    SIMFS_CHAIN_TYPE chain[];
+} SIMFS_BATCH_TYPE;
+
+struct simfs_queue_type {
+    pthread_mutex_t lock;
+    pthread_cond_t submitted; // signaled when a batch is submitted or the queue is destroyed
+    pthread_cond_t completed; // signaled when requests complete
+    pthread_t thread[SIMFS_QUEUE_THREADS];
+    SIMFS_BATCH_TYPE *firstBatch; // the batches with chains that no thread has taken, in the order of submission
+    SIMFS_BATCH_TYPE *lastBatch;
+    SIMFS_REQUEST_TYPE **completion; // the completed requests not yet reaped, in a ring
+    int firstCompletion;
+    int numberOfCompletions;
+    int completionCapacity; // at least the requests outstanding, so a completion always has room
+    int outstanding; // the requests submitted and not yet reaped
+    int stopping;
+};
+
+typedef struct simfs_queue_worker_type { // the state of a thread of a request queue
+    SIMFS_SEGMENT_TYPE *segments; // room for the segments of a read or a write
+    int maxSegments;
+} SIMFS_QUEUE_WORKER_TYPE;
+
+static const SIMFS_OPERATION_TYPE simfsRequestOperation[] = {
+    [SIMFS_CREATE_REQUEST] = SIMFS_CREATE_OPERATION,
+    [SIMFS_OPEN_REQUEST] = SIMFS_OPEN_OPERATION,
+    [SIMFS_WRITE_REQUEST] = SIMFS_WRITE_AT_OPERATION,
+    [SIMFS_READ_REQUEST] = SIMFS_READ_AT_OPERATION,
+    [SIMFS_CLOSE_REQUEST] = SIMFS_CLOSE_OPERATION,
+    [SIMFS_DELETE_REQUEST] = SIMFS_DELETE_OPERATION
+};
 
 /*
- * Finds the file in the in-memory directory and obtains the information about the file from the file descriptor
- * block referenced from the directory.
- *
- * If the file is not found, then it returns SIMFS_NOT_FOUND_ERROR
+ * Copies the content of a read or a write request between its buffer and the segments of its range.
  */
-SIMFS_ERROR simfsGetFileInfo(SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+static int simfsCopyRequestSegments(SIMFS_SEGMENT_TYPE *segments, int count, void *argument)
 {
-    // TODO: implement
+    SIMFS_REQUEST_TYPE *request = argument;
 
-    return SIMFS_NO_ERROR;
+    for (int i = 0; i < count; i++)
+    {
+        if (request->kind == SIMFS_WRITE_REQUEST)
+            memcpy(segments[i].data, request->buffer + request->transferred, segments[i].length);
+        else
+            memcpy(request->buffer + request->transferred, segments[i].data, segments[i].length);
+        request->transferred += segments[i].length;
+    }
+
+    return 0;
 }
 
-//////////////////////////////////////////////////////////////////////////
+static SIMFS_ERROR simfsTransferRequest(SIMFS_REQUEST_TYPE *request, SIMFS_QUEUE_WORKER_TYPE *worker)
+{
+    int write = request->kind == SIMFS_WRITE_REQUEST;
+    size_t maxSegments = request->length / simfsContext.geometry.dataSize + 2;
+    if (maxSegments > INT_MAX)
+        return write ? SIMFS_WRITE_ERROR : SIMFS_READ_ERROR;
+
+    if ((int) maxSegments > worker->maxSegments)
+    {
+        SIMFS_SEGMENT_TYPE *segments = realloc(worker->segments, maxSegments * sizeof(SIMFS_SEGMENT_TYPE));
+        if (segments == NULL)
+            return SIMFS_ALLOC_ERROR;
+        worker->segments = segments;
+        worker->maxSegments = (int) maxSegments;
+    }
+
+    request->transferred = 0;
+    return simfsMapNodeRangeUntimed(request->entry, request->offset, request->length, write, worker->segments,
+                                    worker->maxSegments, simfsCopyRequestSegments, request);
+}
+
+static SIMFS_ERROR simfsExecuteRequest(SIMFS_REQUEST_TYPE *request, SIMFS_QUEUE_WORKER_TYPE *worker)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    uid_t uid;
+
+    switch (request->kind)
+    {
+        case SIMFS_CREATE_REQUEST:
+            return simfsCreateInFolderUntimed(request->folder, request->name, request->type, request->accessRights,
+                                              &request->node, &info);
+        case SIMFS_OPEN_REQUEST:
+            if (request->name != NULL)
+                error = simfsLookupNodeUntimed(request->folder, request->name, &request->node, &info);
+            if (error == SIMFS_NO_ERROR)
+                error = simfsOpenNodeEntryUntimed(request->node, request->accessRights, &request->entry);
+            return error;
+        case SIMFS_WRITE_REQUEST:
+        case SIMFS_READ_REQUEST:
+            return simfsTransferRequest(request, worker);
+        case SIMFS_CLOSE_REQUEST:
+            return simfsCloseNodeEntryUntimed(request->entry);
+        default:
+            simfsGetCaller(&uid, NULL, NULL);
+            return simfsDeleteFromFolder(request->folder, request->name, uid);
+    }
+}
 
 /*
- * Hashes the name and searches for it in the in-memory directory. If the file does not exist,
- * the SIMFS_NOT_FOUND_ERROR is returned.
- *
- * Otherwise:
- *    - checks the per-process open file table for the process, and if the file has already been opened
- *      it returns the index of the openFileTable with the entry of the file through the parameter fileHandle, and
- *      returns SIMFS_DUPLICATE_ERROR as the return value
- *
- *    - otherwise, checks if there is a global entry for the file, and if so, then:
- *       - it increases the reference count for this file
- *
- *       - otherwise, it creates an entry in the global open file table for the file copying the information
- *         from the file descriptor block referenced from the entry for this file in the directory
- *
- *       - if the process does not have its process control block in the processControlBlocks list, then
- *         a file control block for the process is created and added to the list; the current working directory
- *         is initialized to the root of the volume and the number of the open files is initialized to 0
- *
- *       - if an entry for this file does not exits in the per-process open file table, the function finds an
- *         empty slot in the table and fills it with the information including the reference to the entry for
- *         this file in the global open file table.
- *
- *       - returns the index to the new element of the per-process open file table through the parameter fileHandle
- *         and SIMFS_NO_ERROR as the return value
- *
- * If there is no free slot for the file in either the global file table or in the per-process
- * file table, or if there is any other allocation problem, then the function returns SIMFS_ALLOC_ERROR.
- *
+ * Runs a chain of requests as the caller of its batch, holding the journal lock; the metadata is not flushed.
  */
-SIMFS_ERROR simfsOpenFile(SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle)
+static void simfsRunChain(SIMFS_BATCH_TYPE *batch, SIMFS_CHAIN_TYPE chain, SIMFS_QUEUE_WORKER_TYPE *worker)
 {
-    // TODO: implement
+    simfsSetCaller(batch->uid, batch->pid, batch->umask);
+    simfsCommitDeferred = 1;
+    simfsHoldJournal();
 
-    return SIMFS_NO_ERROR;
-}
+    SIMFS_INDEX_TYPE node = SIMFS_INVALID_INDEX;
+    int entry = -1;
+    int opened = 0; // the entry has been opened by the chain and not closed
+    SIMFS_ERROR failure = SIMFS_NO_ERROR;
 
-//////////////////////////////////////////////////////////////////////////
+    for (int i = 0; i < chain.count; i++)
+    {
+        SIMFS_REQUEST_TYPE *request = &batch->requests[chain.first + i];
+        if (i > 0)
+        {
+            request->node = node;
+            request->entry = entry;
+        }
+        request->transferred = 0;
+
+        if (failure != SIMFS_NO_ERROR && !(request->kind == SIMFS_CLOSE_REQUEST && opened))
+            request->error = failure;
+        else
+        {
+            uint64_t started = simfsNanoseconds();
+            SIMFS_ERROR error = simfsExecuteRequest(request, worker);
+            if (error == SIMFS_ALLOC_ERROR && simfsReclaimFreedBlocks())
+                error = simfsExecuteRequest(request, worker);
+            request->error = simfsCountOperation(simfsRequestOperation[request->kind], started, error);
+
+            if (error == SIMFS_NO_ERROR && request->kind == SIMFS_OPEN_REQUEST)
+                opened = 1;
+            else if (error == SIMFS_NO_ERROR && request->kind == SIMFS_CLOSE_REQUEST)
+                opened = 0;
+        }
+
+        if (failure == SIMFS_NO_ERROR)
+            failure = request->error;
+        node = request->node;
+        entry = request->entry;
+    }
+
+    simfsReleaseJournal();
+    simfsCommitDeferred = 0;
+}
 
 /*
- * The function replaces content of a file with new one pointed to by the parameter writeBuffer.
- *
- * Checks if the file handle points to a valid file descriptor of an open file. If the entry is invalid
- * (e.g., if the reference to the global table is NULL, or if the entry in the global table is INVALID_CONTENT_TYPE),
- * then it returns SIMFS_NOT_FOUND_ERROR.
- *
- * Otherwise, it checks the access rights for writing. If the process owner is not allowed to write to the file,
- * then the function returns SIMFS_ACCESS_ERROR.
- *
- * Then, the functions calculates the space needed for the new content and checks if the write buffer can fit into
- * the remaining free space in the file system. If not, then the SIMFS_ALLOC_ERROR is returned.
- *
- * Otherwise, the function removes all blocks currently held by this file, and then acquires new blocks as needed
- * modifying bits in the in-memory bitvector as needed.
- *
- * It then copies the characters pointed to by the parameter writeBuffer (until '\0' but excluding it) to the
- * new blocks that belong to the file. The function copies any modified block of the in-memory bitvector to
- * the corresponding bitvector block on the disk.
- *
- * Finally, the file descriptor is modified to reflect the new size of the file, and the times of last modification
- * and access.
- *
- * The function returns SIMFS_WRITE_ERROR in response to exception not specified earlier.
- *
+ * The threads of a request queue take the chains in the order of submission until the queue is destroyed and no
+ * chain is left; the thread completing the last chain of a batch flushes the metadata before completing it.
  */
-SIMFS_ERROR simfsWriteFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer)
+static void *simfsQueueWorker(void *argument)
 {
-    // TODO: implement
+    SIMFS_QUEUE_TYPE *queue = argument;
+    SIMFS_QUEUE_WORKER_TYPE worker = {NULL, 0};
 
-    return SIMFS_NO_ERROR;
+    pthread_mutex_lock(&queue->lock);
+    for (;;)
+    {
+        while (queue->firstBatch == NULL && !queue->stopping)
+            pthread_cond_wait(&queue->submitted, &queue->lock);
+        if (queue->firstBatch == NULL)
+            break;
+
+        SIMFS_BATCH_TYPE *batch = queue->firstBatch;
+        SIMFS_CHAIN_TYPE chain = batch->chain[batch->nextChain++];
+        if (batch->nextChain == batch->numberOfChains)
+        {
+            queue->firstBatch = batch->next;
+            if (queue->firstBatch == NULL)
+                queue->lastBatch = NULL;
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        simfsRunChain(batch, chain, &worker);
+
+        pthread_mutex_lock(&queue->lock);
+        int last = --batch->pendingChains == 0;
+        if (last)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            simfsHoldJournal();
+            simfsCommit();
+            simfsReleaseJournal();
+            pthread_mutex_lock(&queue->lock);
+        }
+
+        for (int i = 0; i < chain.count; i++)
+        {
+            int slot = (queue->firstCompletion + queue->numberOfCompletions++) % queue->completionCapacity;
+            queue->completion[slot] = &batch->requests[chain.first + i];
+        }
+        pthread_cond_broadcast(&queue->completed);
+
+        if (last)
+            free(batch);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    free(worker.segments);
+
+    return NULL;
 }
 
-//////////////////////////////////////////////////////////////////////////
+/*
+ * Makes room in the ring of completions of a queue for the given number of requests; the caller holds the lock of
+ * the queue.
+ */
+static int simfsReserveCompletions(SIMFS_QUEUE_TYPE *queue, int count)
+{
+    if (count > INT_MAX - queue->outstanding)
+        return 0;
+    if (queue->outstanding + count <= queue->completionCapacity)
+        return 1;
+
+    int capacity = queue->completionCapacity > 0 ? queue->completionCapacity : 64;
+    while (capacity < queue->outstanding + count)
+        capacity = capacity > INT_MAX / 2 ? INT_MAX : capacity * 2;
+
+    SIMFS_REQUEST_TYPE **completion = malloc((size_t) capacity * sizeof(SIMFS_REQUEST_TYPE *));
+    if (completion == NULL)
+        return 0;
+
+    for (int i = 0; i < queue->numberOfCompletions; i++)
+        completion[i] = queue->completion[(queue->firstCompletion + i) % queue->completionCapacity];
+    free(queue->completion);
+
+    queue->completion = completion;
+    queue->firstCompletion = 0;
+    queue->completionCapacity = capacity;
+
+    return 1;
+}
 
 /*
- * The function returns the complete content of the file to the caller through the parameter readBuffer.
- *
- * Checks if the file handle points to a valid file descriptor of an open file. If the entry is invalid
- * (e.g., if the reference to the global table is NULL, or if the entry in the global table is INVALID_CONTENT_TYPE),
- * then it returns SIMFS_NOT_FOUND_ERROR.
- *
- * Otherwise, it checks the user's access right to read the file. If the process owner is not allowed to read the file,
- * then the function returns SIMFS_ACCESS_ERROR.
- *
- * Otherwise, the function allocates memory sufficient to hold the read content with an appended end of string
- * character; the pointer to newly allocated memory is passed back through the readBuffer parameter. All the content
- * of the blocks is concatenated using the allocated space, and an end of string character is appended at the end of
- * the concatenated content.
- *
- * The function returns SIMFS_READ_ERROR in response to exception not specified earlier.
- *
+ * Creates a request queue with its pool of threads.
  */
-SIMFS_ERROR simfsReadFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer)
+SIMFS_ERROR simfsCreateQueue(SIMFS_QUEUE_TYPE **queue)
 {
-    // TODO: implement
+    SIMFS_QUEUE_TYPE *newQueue = calloc(1, sizeof(SIMFS_QUEUE_TYPE));
+    if (newQueue == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    pthread_mutex_init(&newQueue->lock, NULL);
+    pthread_cond_init(&newQueue->submitted, NULL);
+    pthread_cond_init(&newQueue->completed, NULL);
+
+    int started = 0;
+    while (started < SIMFS_QUEUE_THREADS
+           && pthread_create(&newQueue->thread[started], NULL, simfsQueueWorker, newQueue) == 0)
+        started++;
+
+    if (started < SIMFS_QUEUE_THREADS)
+    {
+        pthread_mutex_lock(&newQueue->lock);
+        newQueue->stopping = 1;
+        pthread_cond_broadcast(&newQueue->submitted);
+        pthread_mutex_unlock(&newQueue->lock);
+
+        for (int i = 0; i < started; i++)
+            pthread_join(newQueue->thread[i], NULL);
+
+        pthread_cond_destroy(&newQueue->completed);
+        pthread_cond_destroy(&newQueue->submitted);
+        pthread_mutex_destroy(&newQueue->lock);
+        free(newQueue);
+
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    *queue = newQueue;
 
     return SIMFS_NO_ERROR;
 }
 
-//////////////////////////////////////////////////////////////////////////
+/*
+ * Submits a batch of requests to a queue, and returns without waiting for them; a request with a kind that is
+ * not known rejects the whole batch.
+ */
+SIMFS_ERROR simfsSubmitRequests(SIMFS_QUEUE_TYPE *queue, SIMFS_REQUEST_TYPE *requests, int count)
+{
+    if (count <= 0)
+        return SIMFS_NO_ERROR;
+
+    int numberOfChains = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if ((unsigned int) requests[i].kind > SIMFS_DELETE_REQUEST)
+            return SIMFS_WRITE_ERROR;
+        if (i == 0 || !requests[i].linked)
+            numberOfChains++;
+    }
+
+    SIMFS_BATCH_TYPE *batch = malloc(sizeof(SIMFS_BATCH_TYPE) + (size_t) numberOfChains * sizeof(SIMFS_CHAIN_TYPE));
+    if (batch == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    batch->next = NULL;
+    batch->requests = requests;
+    simfsGetCaller(&batch->uid, &batch->pid, &batch->umask);
+    batch->numberOfChains = numberOfChains;
+    batch->nextChain = 0;
+    batch->pendingChains = numberOfChains;
+
+    int chain = -1;
+    for (int i = 0; i < count; i++)
+    {
+        if (i == 0 || !requests[i].linked)
+        {
+            chain++;
+            batch->chain[chain].first = i;
+            batch->chain[chain].count = 0;
+        }
+        batch->chain[chain].count++;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (!simfsReserveCompletions(queue, count))
+    {
+        pthread_mutex_unlock(&queue->lock);
+        free(batch);
+        return SIMFS_ALLOC_ERROR;
+    }
+    queue->outstanding += count;
+
+    if (queue->lastBatch == NULL)
+        queue->firstBatch = batch;
+    else
+        queue->lastBatch->next = batch;
+    queue->lastBatch = batch;
+    pthread_cond_broadcast(&queue->submitted);
+
+    pthread_mutex_unlock(&queue->lock);
+
+    SIMFS_COUNT(queueBatches, 1);
+    SIMFS_COUNT(queueRequests, (uint64_t) count);
+
+    return SIMFS_NO_ERROR;
+}
 
 /*
- * Removes the entry for the file with the file handle provided as the parameter from the open file table
- * for this process. It decreases the number of open files for in the process control block of this process, and
- * if it becomes zero, then the process control block for this process is removed from the processControlBlocks list.
- *
- * Decreases the reference count in the global open file table, and if that number is 0, it also removes the entry
- * for this file from the global open file table.
- *
+ * Returns up to maxCompleted completed requests in the order of completion; with wait set, waits for a completion
+ * while requests are outstanding.
  */
+int simfsReapRequests(SIMFS_QUEUE_TYPE *queue, SIMFS_REQUEST_TYPE **completed, int maxCompleted, int wait)
+{
+    pthread_mutex_lock(&queue->lock);
 
-SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle)
+    while (wait && queue->numberOfCompletions == 0 && queue->outstanding > 0)
+        pthread_cond_wait(&queue->completed, &queue->lock);
+
+    int count = 0;
+    while (count < maxCompleted && queue->numberOfCompletions > 0)
+    {
+        completed[count++] = queue->completion[queue->firstCompletion];
+        queue->firstCompletion = (queue->firstCompletion + 1) % queue->completionCapacity;
+        queue->numberOfCompletions--;
+        queue->outstanding--;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return count;
+}
+
+/*
+ * Runs the requests submitted to a queue to completion, and destroys the queue; the completions that have not been
+ * reaped are dropped.
+ */
+void simfsDestroyQueue(SIMFS_QUEUE_TYPE *queue)
 {
-    // TODO: implement
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = 1;
+    pthread_cond_broadcast(&queue->submitted);
+    pthread_mutex_unlock(&queue->lock);
 
-    return SIMFS_NO_ERROR;
+    for (int i = 0; i < SIMFS_QUEUE_THREADS; i++)
+        pthread_join(queue->thread[i], NULL);
+
+    pthread_cond_destroy(&queue->completed);
+    pthread_cond_destroy(&queue->submitted);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->completion);
+    free(queue);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -232,14 +6210,20 @@ SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle)
 //////////////////////////////////////////////////////////////////////////
 
 /*
- * Simulates FUSE context to get values for user ID, process ID, and umask through fuse_context
+ * Simulates FUSE context to get values for user ID, process ID, and umask through fuse_context; the values are
+ * random unless the calling thread fixed them with simfs_debug_set_context() or simfsSetCaller(). Like the one of
+ * fuse_get_context(), the context belongs to the calling thread and stays valid until its next call.
  */
 
 struct fuse_context *simfs_debug_get_context() {
 
-    // TODO: replace its use with FUSE's fuse_get_context()
+    struct fuse_context *context = &simfsDebugContext;
 
-    struct fuse_context *context = malloc(sizeof(struct fuse_context));
+    if (simfsCallerSet)
+    {
+        *context = simfsCaller;
+        return context;
+    }
 
     context->fuse = NULL;
     context->uid = (uid_t) rand()%10+1;
@@ -251,6 +6235,17 @@ struct fuse_context *simfs_debug_get_context() {
     return context;
 }
 
+/*
+ * Makes simfs_debug_get_context() return the given context in the calling thread, so the callers of a test or a
+ * benchmark can be reproduced; NULL restores the random values.
+ */
+void simfs_debug_set_context(const struct fuse_context *context)
+{
+    if (context != NULL)
+        simfsCaller = *context;
+    simfsCallerSet = context != NULL;
+}
+
 char *simfsGenerateContent(int size)
 {
     size = (size <= 0 ? rand()%1000 : size); // arbitrarily chosen as an example
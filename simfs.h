@@ -2,8 +2,15 @@
 #define __SIMFS_H_
 
 #include <time.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h> // the locks of the in-memory structures declared below
+#include <sys/stat.h>
 #include <fuse.h>
 
 //////////////////////////////////////////////////////////////////////////
@@ -12,11 +19,24 @@
 //
 //////////////////////////////////////////////////////////////////////////
 
-#define SIMFS_BLOCK_SIZE 256
-#define SIMFS_NUMBER_OF_BLOCKS 65536 // 2^16
+//
+// the geometry of a volume (the size and the number of its blocks) is chosen when the volume is formatted, and
+// recorded in its superblock; the structures of the blocks are declared for the smallest block size, and larger
+// blocks hold more data, references, or extents (see SIMFS_GEOMETRY_TYPE)
+//
+#define SIMFS_MIN_BLOCK_SIZE 256
+#define SIMFS_MAX_BLOCK_SIZE 65536 // block sizes are powers of two
+#define SIMFS_MAX_NUMBER_OF_BLOCKS 0x7FFFFFC0u // a multiple of 64, like every number of blocks; at most INT_MAX
+#define SIMFS_DEFAULT_BLOCK_SIZE 256 // geometry of the volumes formatted by simfsMountVolumeFile()
+#define SIMFS_DEFAULT_NUMBER_OF_BLOCKS 65536
 #define SIMFS_MAX_NAME_LENGTH 128
-#define SIMFS_DATA_SIZE 254 // SIMFS_BLOCK_SIZE - sizeof(SIMFS_NODE_TYPE)
-#define SIMFS_INDEX_SIZE 127 // two bytes => x0000 - xFFFF => 2^16 range
+#define SIMFS_MIN_DATA_SIZE 248 // SIMFS_MIN_BLOCK_SIZE - offsetof(SIMFS_BLOCK_TYPE, content)
+#define SIMFS_MIN_FOLDER_SIZE 240 // SIMFS_MIN_DATA_SIZE - 2 * sizeof(SIMFS_INDEX_TYPE)
+#define SIMFS_DIRECT_EXTENTS 8 // extents held directly in the file descriptor
+#define SIMFS_MIN_EXTENTS_PER_BLOCK 30 // (SIMFS_MIN_DATA_SIZE - 8) / sizeof(SIMFS_EXTENT_TYPE)
+#define SIMFS_MIN_JOURNAL_SIZE (256 * 1024) // the journal takes 1/32 of the size of the blocks, within these bounds
+#define SIMFS_MAX_JOURNAL_SIZE (64 * 1024 * 1024)
+#define SIMFS_MIN_JOURNAL_BLOCKS 16
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -24,10 +44,23 @@
 //
 //////////////////////////////////////////////////////////////////////////
 
-#define SIMFS_DIRECTORY_SIZE 65551 // prime number for the size of the directory (it is larger than 2^16)
+#define SIMFS_DIRECTORY_INITIAL_SIZE 64 // initial number of slots of the directory; must be a power of two
+#define SIMFS_DIRECTORY_SHARDS 16 // number of independently locked parts of the directory; a power of two, at most 256
+#define SIMFS_FOLDER_LOCKS 64 // number of locks striped over the folders by their node index
+#define SIMFS_MOUNT_THREADS 4 // number of threads traversing the folders at mount without a valid snapshot
 #define SIMFS_MAX_NUMBER_OF_OPEN_FILES 1024
 #define SIMFS_MAX_NUMBER_OF_PROCESSES 1024
-#define SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS 64
+#define SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS 64 // at most 64; the free handles of a process are kept in one word
+#define SIMFS_PROCESS_BUCKETS 1024 // number of chains of the hashtable of process control blocks; a power of two
+#define SIMFS_PROCESS_SLAB_SIZE 32 // process control blocks allocated at once when none is free
+#define SIMFS_READ_BUFFERS_PER_THREAD 4 // buffers of simfsReadFile() given back and kept by a thread for its reads
+#define SIMFS_MAX_POOLED_READ_BUFFER (1024 * 1024) // larger read buffers are freed when they are given back
+#define SIMFS_CACHE_SIZE (4 * 1024 * 1024) // bytes of file content cached for the open files
+#define SIMFS_OPEN_FILE_SLOTS (2 * SIMFS_MAX_NUMBER_OF_OPEN_FILES) // slots of the node -> open file map; a power of two
+#define SIMFS_LATENCY_BUCKETS 40 // bucket i of a latency histogram counts [2^(i-1), 2^i) nanoseconds; the last is open
+#define SIMFS_STATISTICS_FILE_NAME ".simfs-stats" // read-only virtual file in the root folder with the statistics
+#define SIMFS_JOURNAL_INTERVAL 1000 // milliseconds between the group commits of a volume kept in an image file
+#define SIMFS_QUEUE_THREADS 4 // threads of a request queue running the chains of requests
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -38,13 +71,14 @@
 typedef enum {
     FOLDER_CONTENT_TYPE,
     FILE_CONTENT_TYPE,
-    INDEX_CONTENT_TYPE,
+    INDEX_CONTENT_TYPE, // entries of a folder
     DATA_CONTENT_TYPE,
+    EXTENT_CONTENT_TYPE,
     INVALID_CONTENT_TYPE
 } SIMFS_CONTENT_TYPE;
 
-typedef unsigned short SIMFS_INDEX_TYPE; // is used to index blocks in the file system
-#define SIMFS_INVALID_INDEX 0xFF
+typedef uint32_t SIMFS_INDEX_TYPE; // is used to index blocks in the file system
+#define SIMFS_INVALID_INDEX 0xFFFFFFFF // above SIMFS_MAX_NUMBER_OF_BLOCKS, so it is never a valid block
 
 //
 // superblock starting block in the whole file system
@@ -53,12 +87,22 @@ typedef unsigned short SIMFS_INDEX_TYPE; // is used to index blocks in the file
 // numberOfBlock determines the size of the file system
 // blockSize is the size of a single block of the file system
 //
+// magic identifies a formatted volume and its layout; a volume without it is refused with SIMFS_READ_ERROR on
+// mounting, and a volume of an earlier layout with SIMFS_VERSION_ERROR (it is not converted)
+//
+#define SIMFS_MAGIC 0x53494D35 // "SIM5"; changes with the layout of the volume
+#define SIMFS_FIRST_MAGIC 0x53494D46 // "SIMF", the first layout
+#define SIMFS_FIRST_NUMBERED_MAGIC 0x53494D32 // "SIM2"; the later layouts are numbered up to SIMFS_MAGIC
+
 typedef union simfs_superblock_type { // size of the block with some unused part
-    char spacer_dummy[SIMFS_BLOCK_SIZE]; // this makes the struct exactly one block
+    char spacer_dummy[SIMFS_MIN_BLOCK_SIZE]; // the superblock takes the whole first block of the volume
     struct attr {
         SIMFS_INDEX_TYPE rootNodeIndex; // should point to the first block after the last bitvector block
-        int numberOfBlocks;
+        SIMFS_INDEX_TYPE numberOfBlocks;
         int blockSize;
+        int magic;
+        SIMFS_INDEX_TYPE snapshotNode; // hidden file holding the directory entries for fast mounts
+        int snapshotValid; // cleared by every change of the directory
     } attr;
 } SIMFS_SUPERBLOCK_TYPE;
 
@@ -67,15 +111,24 @@ typedef union simfs_superblock_type { // size of the block with some unused part
 //
 //   for files:
 //       te size indicates the size of the file
-//       the block reference is initialized to SIMFS_INVALID_INDEX
-//           - it will point to an index block when the file has content
+//       the content is mapped by extents, i.e., runs of contiguous data blocks
+//           - the first SIMFS_DIRECT_EXTENTS extents are held in the descriptor itself
+//           - the block reference is initialized to SIMFS_INVALID_INDEX
+//           - it will point to the first extent block when the file needs more extents
+//       a small file without extents holds its content inline instead, in place of the extents and the rest of the
+//       descriptor block (up to the inline size of the geometry); it is moved to data blocks when it grows larger
 //
 //   for directories:
 //       the size indicates the number of files or directories in this folder
-//       the block reference points to an index block that holds references to the file and folder blocks
+//       the block reference points to the first folder block, which holds the entries of the files and folders
 //
 typedef char SIMFS_NAME_TYPE[SIMFS_MAX_NAME_LENGTH]; // for folder and file names
 
+typedef struct simfs_extent_type {
+    SIMFS_INDEX_TYPE start; // first block of the run
+    SIMFS_INDEX_TYPE length; // number of blocks in the run
+} SIMFS_EXTENT_TYPE;
+
 typedef struct simfs_file_descriptor_type {
     SIMFS_CONTENT_TYPE type; // folder or file
     SIMFS_NAME_TYPE name;
@@ -84,25 +137,62 @@ typedef struct simfs_file_descriptor_type {
     time_t lastModificationTime; // last modification
     mode_t accessRights; // access rights for the file
     uid_t owner; // owner ID
-    size_t size; // capacity limited for this project to 2s^16
-    SIMFS_INDEX_TYPE block_ref; // reference to the data or index block
+    size_t size; // bytes of a file, bounded only by the free blocks of the volume; entries of a folder
+    SIMFS_INDEX_TYPE block_ref; // reference to the first folder block (folders) or the first extent block (files)
+    unsigned int numberOfExtents; // number of extents mapping the content of a file; 0 if it is held inline
+    union {
+        SIMFS_EXTENT_TYPE extent[SIMFS_DIRECT_EXTENTS]; // the first extents of a file
+        char inlineData[SIMFS_DIRECT_EXTENTS * sizeof(SIMFS_EXTENT_TYPE)]; // extends to the end of the block
+    };
 } SIMFS_FILE_DESCRIPTOR_TYPE;
 
 //
 // a block for holding data
 //
-typedef char SIMFS_DATA_TYPE[SIMFS_DATA_SIZE];
+typedef char SIMFS_DATA_TYPE[SIMFS_MIN_DATA_SIZE];
+
+//
+// a block for holding extents of a file that did not fit into its descriptor
+//
+typedef struct simfs_extent_block_type {
+    SIMFS_INDEX_TYPE next; // next extent block of the file or SIMFS_INVALID_INDEX
+    SIMFS_INDEX_TYPE count; // number of extents used in this block
+    SIMFS_EXTENT_TYPE extent[SIMFS_MIN_EXTENTS_PER_BLOCK];
+} SIMFS_EXTENT_BLOCK_TYPE;
 
 //
-// various interpretations of a file system block
+// an entry of a folder: the reference to the descriptor block of a file or folder, its type, and its name, which
+// is stored with its length and a terminating '\0'; a scan of the entries of a folder reads only its folder blocks
+//
+typedef struct simfs_folder_entry_type {
+    SIMFS_INDEX_TYPE node;
+    unsigned char type; // FILE_CONTENT_TYPE or FOLDER_CONTENT_TYPE
+    unsigned char nameLength;
+    char name[];
+} SIMFS_FOLDER_ENTRY_TYPE;
+
+#define SIMFS_FOLDER_ENTRY_SIZE(nameLength) \
+    ((offsetof(SIMFS_FOLDER_ENTRY_TYPE, name) + (nameLength) + 1 + 3) & ~(size_t) 3) // padded for the next entry
+
+//
+// a block holding entries of a folder, packed one after another
+//
+typedef struct simfs_folder_block_type {
+    SIMFS_INDEX_TYPE next; // next folder block of the folder or SIMFS_INVALID_INDEX
+    SIMFS_INDEX_TYPE used; // number of bytes taken by the entries
+    char entries[SIMFS_MIN_FOLDER_SIZE];
+} SIMFS_FOLDER_BLOCK_TYPE;
+
+//
+// various interpretations of a file system block; the arrays extend to the end of the block
 //
 typedef struct simfs_node_type {
     SIMFS_CONTENT_TYPE type;
     union { // content depends on the type
         SIMFS_FILE_DESCRIPTOR_TYPE fileDescriptor; // for directories and files
-        SIMFS_DATA_TYPE data[SIMFS_DATA_SIZE]; // for data
-        SIMFS_INDEX_TYPE index[SIMFS_INDEX_SIZE];  // for indices; all indices but the last point to data blocks
-        // the last points to another index block
+        SIMFS_DATA_TYPE data; // for data
+        SIMFS_FOLDER_BLOCK_TYPE folder; // for entries of folders
+        SIMFS_EXTENT_BLOCK_TYPE extents; // for extents of large or fragmented files
     } content;
 } SIMFS_BLOCK_TYPE;
 
@@ -111,17 +201,51 @@ typedef struct simfs_node_type {
 //
 // superblock - one block
 //
-// bitvector - one bit per block ( (SIMFS_NUMBER_OF_BLOCKS/8 / SIMFS_BLOCK_SIZE) blocks )
+// bitvector - one bit per block ( (numberOfBlocks/8 / blockSize) blocks, rounded up )
+//
+// reference counts - one SIMFS_INDEX_TYPE per block: the references to the block besides the first, which are held
+//                    by the clones of a file ( (numberOfBlocks*4 / blockSize) blocks, rounded up )
 //
-// blocks (folder, file, data, or index) - SIMFS_NUMBER_OF_BLOCKS
+// journal - journalBlocks of the geometry; used only by volumes kept in image files
 //
+// blocks (folder, file, data, index, or extent) - numberOfBlocks
+//
+// only the superblock is declared; the rest follows at offsets given by the geometry, and the size of the whole
+// volume is returned by simfsVolumeSize()
 //
 typedef struct simfs_volume {
     SIMFS_SUPERBLOCK_TYPE superblock;
-    char bitvector[SIMFS_NUMBER_OF_BLOCKS / 8]; //
-    SIMFS_BLOCK_TYPE block[SIMFS_NUMBER_OF_BLOCKS];
 } SIMFS_VOLUME;
 
+//
+// journal of a volume kept in an image file
+//
+// the first block of the journal holds the sequence number of the first transaction, which starts in the second
+// block; the transactions follow each other up to the first one that is missing (its sequence number does not
+// follow) or torn (its checksum does not match)
+//
+// a transaction starts with its header and its lists: the volume blocks (counted from the superblock) of its
+// images, followed by the start and the length of every run of blocks freed by it; the images follow in the
+// next blocks, one per block
+//
+#define SIMFS_JOURNAL_MAGIC 0x534A524E // "SJRN"
+#define SIMFS_TRANSACTION_MAGIC 0x53545258 // "STRX"
+
+typedef struct simfs_journal_superblock_type {
+    uint32_t magic;
+    uint64_t sequence; // sequence number of the first transaction in the journal
+} SIMFS_JOURNAL_SUPERBLOCK_TYPE;
+
+typedef struct simfs_transaction_header_type {
+    uint32_t magic;
+    uint32_t headerBlocks; // blocks taken by the header and its lists
+    uint32_t numberOfImages;
+    uint32_t numberOfFreedRuns;
+    uint64_t sequence;
+    uint64_t checksum; // of the whole transaction, computed with this field set to 0
+    SIMFS_INDEX_TYPE list[]; // the volume blocks of the images, then the start and the length of the freed runs
+} SIMFS_TRANSACTION_HEADER_TYPE;
+
 //////////////////////////////////////////////////////////////////////////
 //
 // definitions for in-memory data structures supporting the file system
@@ -131,25 +255,49 @@ typedef struct simfs_volume {
 //
 // file system directory
 //
-// directory entry in the conflict resolution linked list with the head in the hash table slot for
-// the corresponding name
+// directory entry in a slot of the hash table; it is keyed on the folder holding the file and the name of the file
+//
+// the full hash of the key is kept in the slot, so the name in the file descriptor block is compared only when
+// the hashes match; a slot with hash 0 is empty
 //
 typedef struct simfs_dir_ent {
+    uint32_t hash; // hash of the parent reference and the name
+    SIMFS_INDEX_TYPE parentReference; // points to the descriptor node of the folder holding the file
     SIMFS_INDEX_TYPE nodeReference; // points to the "physical" file descriptor node
-    struct simfs_dir_ent *next;
 } SIMFS_DIR_ENT;
 
 //
-// directory implemented as a hash table
+// directory implemented as an open-addressing hash table with linear probing
+//
+// the slots are allocated dynamically; the table doubles when it becomes three quarters full
 //
-// slots are heads to resolution lists for conflicting names
+// the directory is split into SIMFS_DIRECTORY_SHARDS such tables by the top bits of the hash, each with its own lock,
+// so lookups and changes in different shards do not contend
 //
-typedef SIMFS_DIR_ENT SIMFS_DIRECTORY[SIMFS_DIRECTORY_SIZE];
+typedef struct simfs_directory_type {
+    pthread_rwlock_t lock;
+    SIMFS_DIR_ENT *slot;
+    unsigned int capacity; // number of slots; a power of two
+    unsigned int count; // number of used slots
+} SIMFS_DIRECTORY;
+
+//
+// content of a file cached for its readers; it is shared read-only, and freed when the last reference is released
+//
+typedef struct simfs_cached_content_type {
+    int referenceCount; // one for the cache, and one for every reader holding it
+    size_t size;
+    char data[]; // the content followed by a '\0'
+} SIMFS_CACHED_CONTENT_TYPE;
 
 //
 // global open file table
 //
+// an entry is in use while its reference count is not 0; besides the handles of the processes, every operation
+// on the file holds a reference while it runs, so the entry cannot be released under it
+//
 typedef struct simfs_open_file_global_type {
+    pthread_rwlock_t lock; // held shared for reading the content of the file, and exclusively for changing it
     SIMFS_CONTENT_TYPE type; // folder or file
     SIMFS_INDEX_TYPE fileDescriptor; // reference to the file descriptor node
     unsigned short referenceCount; // reference count
@@ -159,6 +307,10 @@ typedef struct simfs_open_file_global_type {
     mode_t accessRights; // access rights for the file
     uid_t owner; // owner ID
     size_t size;
+    int dirtySlot; // position in the list of entries with times not written to the file descriptor yet, or -1
+    int nextFree; // the next entry in the list of free entries, or -1
+    SIMFS_CACHED_CONTENT_TYPE *content; // the cached content of the file, or NULL
+    int referenced; // the content has been read since the clock hand passed the entry
 } SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE;
 
 //
@@ -169,24 +321,200 @@ typedef struct simfs_per_process_open_file_type // a node for a local list of op
 {
     mode_t accessRights; // access rights for this process
     SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *globalEntry; // link to the entry for the file in the global table
+    SIMFS_CACHED_CONTENT_TYPE *snapshot; // the content of an open virtual file, which has no global entry; or NULL
 } SIMFS_PER_PROCESS_OPEN_FILE_TYPE;
 
 typedef struct simfs_process_control_block_type {
     pid_t pid; // process identifier
     int numberOfOpenFiles;
+    uint64_t freeHandles; // one bit per slot of the open file table that is not in use
     SIMFS_INDEX_TYPE currentWorkingDirectory; // current working directory; set to the root of the volume on mounting
     SIMFS_PER_PROCESS_OPEN_FILE_TYPE openFileTable[SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS];
-    struct simfs_process_control_block_type *next;
+    struct simfs_process_control_block_type *next; // the next block in the same chain of the hashtable, or free
 } SIMFS_PROCESS_CONTROL_BLOCK_TYPE;
 
+typedef struct simfs_process_slab_type { // process control blocks allocated together; kept until the program exits
+    struct simfs_process_slab_type *next;
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE block[SIMFS_PROCESS_SLAB_SIZE];
+} SIMFS_PROCESS_SLAB_TYPE;
+
+//
+// geometry of the mounted volume, derived from its superblock
+//
+typedef struct simfs_geometry_type {
+    unsigned int blockSize;
+    int blockShift; // log2 of blockSize
+    SIMFS_INDEX_TYPE numberOfBlocks;
+    size_t dataSize; // bytes of content in a data block
+    size_t inlineSize; // bytes of content held in the descriptor block of a small file
+    size_t folderSize; // bytes of entries in a folder block
+    int extentsPerBlock; // extents in an extent block
+    int bitvectorWords; // 64-bit words of the bitvector
+    int summaryWords; // words of the first summary level of the bitvector
+    int topWords; // words of the second summary level
+    size_t referencesOffset; // offset of the reference counts from the start of the volume
+    int headerBlocks; // blocks of the superblock, the bitvector, and the reference counts
+    size_t journalOffset; // offset of the journal from the start of the volume
+    SIMFS_INDEX_TYPE journalBlocks;
+    size_t blocksOffset; // offset of the first block from the start of the volume
+    size_t volumeSize;
+} SIMFS_GEOMETRY_TYPE;
+
+//
+// write-back policy for the metadata changed by the operations
+//
+//   SIMFS_WRITE_THROUGH - modified bitvector words and file times are written to the volume by every operation
+//   SIMFS_WRITE_BACK - they are written in a batch by simfsSyncFileSystem() (and by simfsCloseFile() for the times)
+//
+typedef enum simfs_write_back_policy_type {
+    SIMFS_WRITE_THROUGH,
+    SIMFS_WRITE_BACK
+} SIMFS_WRITE_BACK_POLICY_TYPE;
+
+//
+// statistics
+//
+// every thread counts into its own SIMFS_STATISTICS_TYPE, so counting takes no locks and shares no cache lines;
+// the counters of all threads are summed when the statistics are read (see simfsGetStatistics())
+//
+typedef enum simfs_operation_type {
+    SIMFS_CREATE_OPERATION,
+    SIMFS_DELETE_OPERATION,
+    SIMFS_GET_INFO_OPERATION,
+    SIMFS_OPEN_OPERATION,
+    SIMFS_WRITE_OPERATION,
+    SIMFS_APPEND_OPERATION,
+    SIMFS_READ_OPERATION,
+    SIMFS_READ_VIEW_OPERATION,
+    SIMFS_READ_AT_OPERATION,
+    SIMFS_WRITE_AT_OPERATION,
+    SIMFS_CLOSE_OPERATION,
+    SIMFS_SYNC_OPERATION,
+    SIMFS_LOOKUP_OPERATION,
+    SIMFS_LIST_OPERATION,
+    SIMFS_TRUNCATE_OPERATION,
+    SIMFS_CLONE_OPERATION,
+    SIMFS_NUMBER_OF_OPERATIONS
+} SIMFS_OPERATION_TYPE;
+
+typedef struct simfs_statistics_type {
+    uint64_t calls[SIMFS_NUMBER_OF_OPERATIONS];
+    uint64_t errors[SIMFS_NUMBER_OF_OPERATIONS]; // calls that returned an error
+    uint64_t nanoseconds[SIMFS_NUMBER_OF_OPERATIONS]; // total time spent in the calls
+    uint64_t latency[SIMFS_NUMBER_OF_OPERATIONS][SIMFS_LATENCY_BUCKETS]; // log2 histograms of the call times
+    uint64_t directoryLookups;
+    uint64_t directoryProbes; // slots of the directory visited by the lookups
+    uint64_t longestDirectoryProbe; // the most slots visited by a single lookup
+    uint64_t allocations; // runs of blocks allocated
+    uint64_t allocatedBlocks;
+    uint64_t allocationRetries; // claims lost to other threads
+    uint64_t freeWordSearches; // searches of the summaries of the bitvector for a word with a free block
+    uint64_t freeWordScans; // words of the top summary level visited by the searches
+    uint64_t freedBlocks;
+    uint64_t sharedBlocks; // references to data blocks added by clones
+    uint64_t copiedBlocks; // shared data blocks copied before a write
+    uint64_t cacheHits;
+    uint64_t cacheMisses;
+    uint64_t cacheEvictions; // content evicted to make room in the cache
+    uint64_t journalCommits; // transactions written to the journal
+    uint64_t journalImages; // metadata blocks written to the journal
+    uint64_t journalDataBlocks; // data blocks written in place before the transactions referring to them
+    uint64_t journalCheckpoints;
+    uint64_t journalFlushes; // fdatasync() calls of the commits and the checkpoints
+    uint64_t queueBatches; // batches submitted to request queues
+    uint64_t queueRequests;
+    uint64_t processSlabs; // slabs of process control blocks allocated
+    uint64_t reusedReadBuffers; // read buffers taken from the pool of the calling thread
+    struct simfs_statistics_type *next; // the statistics of the next thread
+} SIMFS_STATISTICS_TYPE;
+
+//
+// journal of the mounted volume (see the journal section of simfs.c)
+//
+typedef struct simfs_journal_type {
+    int active; // the volume is kept in an image file, and its changes are committed through the journal
+    pthread_rwlock_t lock; // held shared by the operations, and exclusively while a transaction is captured
+    pthread_mutex_t stateLock; // protects the numbers of the transactions and the requests
+    pthread_cond_t requested; // a commit has been requested, or the journal is stopping
+    pthread_cond_t committed; // a transaction has been committed
+    pthread_t thread; // captures, commits, and checkpoints the transactions
+    uint64_t transaction; // the number of the transaction collecting the changes of the running operations
+    uint64_t committedTransaction; // the number of the last transaction committed
+    uint64_t requestedTransaction; // the number of the last transaction a caller waits for
+    unsigned int failures; // transactions that could not be written
+    int stopping;
+    uint64_t sequence; // the sequence number of the next transaction written to the journal
+    SIMFS_INDEX_TYPE head; // the journal block the next transaction is written to
+    pthread_mutex_t freedLock; // protects the runs freed by the operations
+    SIMFS_EXTENT_TYPE *freed; // runs freed by the operations; they are released when the transaction is captured
+    int numberOfFreed;
+    int freedCapacity;
+    SIMFS_EXTENT_TYPE *revoked; // runs released into the transaction being written (and into failed ones)
+    int numberOfRevoked;
+    int revokedCapacity;
+    SIMFS_INDEX_TYPE *images; // volume blocks of the metadata captured into the transaction
+    int numberOfImages;
+    int imagesCapacity;
+    SIMFS_INDEX_TYPE *data; // data blocks changed by the transaction, which are written in place
+    int numberOfData;
+    int dataCapacity;
+    char *buffer; // the transaction being written
+    size_t bufferSize;
+    uint64_t *journaled; // one bit per volume block whose newest image is in the journal but not yet in place
+    SIMFS_INDEX_TYPE *journaledBlocks; // the volume blocks with their bit set in journaled
+    int numberOfJournaled;
+    int journaledCapacity;
+    int checkpointed; // the journal has been checkpointed since the last capture
+    size_t pageSize;
+} SIMFS_JOURNAL_TYPE;
+
 /*
  * file system context
+ *
+ * The operations can be called concurrently from multiple threads (but not concurrently with mounting and
+ * unmounting). The locks are always taken in this order:
+ *
+ *    journal.lock -> syncLock -> folderLock (by increasing index) -> directory[].lock
+ *                 -> globalOpenFileTable[].lock -> openFileLock -> dirtyLock -> cacheLock
+ *
+ * The journal.freedLock and the journal.stateLock are taken last, and the operations never wait for a commit while
+ * they hold the journal.lock.
+ *
+ * The bitvector, its summaries, and the records of changed parts of the volume are updated with atomic operations.
  */
 typedef struct simfs_context_type {
-    SIMFS_DIRECTORY directory; // the hashtable-based in-memory directory
-    char bitvector[SIMFS_NUMBER_OF_BLOCKS / 8]; // an in-memory copy of the bitvector of the simulated volume
+    SIMFS_VOLUME *volume; // the mounted volume
+    SIMFS_GEOMETRY_TYPE geometry;
+    char *blocks; // the first block of the volume
+    SIMFS_DIRECTORY directory[SIMFS_DIRECTORY_SHARDS]; // the hashtable-based in-memory directory
+    pthread_mutex_t folderLock[SIMFS_FOLDER_LOCKS]; // serialize the changes of the content of folders
+    pthread_mutex_t openFileLock; // protects the reference counts of the global open file table and the processes
+    pthread_mutex_t dirtyLock; // protects the times of open files, the list of dirty entries, and flushing
+    pthread_mutex_t syncLock; // serializes writing the snapshot and syncing the volume
+    pthread_mutex_t cacheLock; // protects the cached content of the open files, and the clock hand
+    uint64_t *bitvector; // an in-memory copy of the bitvector of the simulated volume
+    uint64_t *bitvectorSummary; // one bit per bitvector word without free blocks
+    uint64_t *bitvectorTop; // one bit per summary word with all bits set
+    uint64_t *bitvectorDirty; // one bit per bitvector word not copied to the volume yet
+    SIMFS_INDEX_TYPE *references; // the reference counts on the volume, changed in place with atomic operations
+    SIMFS_INDEX_TYPE nextFreeBlock; // where the search for free blocks resumes (next fit)
+    int numberOfFreeBlocks;
+    SIMFS_WRITE_BACK_POLICY_TYPE writeBackPolicy;
     SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE globalOpenFileTable[SIMFS_MAX_NUMBER_OF_OPEN_FILES]; // in-memory
-    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *processControlBlocks;
+    short openFileMap[SIMFS_OPEN_FILE_SLOTS]; // open addressing: node -> index of its entry in the global table, or -1
+    int freeOpenFile; // the first entry of the list of free entries of the global table, or -1
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE *dirtyEntries[SIMFS_MAX_NUMBER_OF_OPEN_FILES]; // entries with unwritten times
+    int numberOfDirtyEntries;
+    size_t cacheBytes; // bytes of content held by the cache
+    int cacheHand; // the next entry of the global open file table considered for eviction
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *processControlBlocks[SIMFS_PROCESS_BUCKETS]; // chained hashtable by pid
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE *freeProcessControlBlocks; // the blocks of the slabs not in use, linked by next
+    SIMFS_PROCESS_SLAB_TYPE *processSlabs;
+    int volumeMapped; // the volume is an image file mapped by simfsMountVolumeFile()
+    int volumeFile; // the file descriptor of the mapped image
+    uint64_t *headerDirty; // one bit per block of the header (before the journal) changed since the last commit
+    uint64_t *volumeDirty; // one bit per block changed since the last commit
+    SIMFS_JOURNAL_TYPE journal;
 } SIMFS_CONTEXT_TYPE;
 
 //////////////////////////////////////////////////////////////////////////
@@ -203,13 +531,21 @@ typedef enum simfs_error {
     SIMFS_NOT_EMPTY_ERROR,
     SIMFS_ACCESS_ERROR,
     SIMFS_WRITE_ERROR,
-    SIMFS_READ_ERROR
+    SIMFS_READ_ERROR,
+    SIMFS_VERSION_ERROR // the volume has the layout of an earlier version
 } SIMFS_ERROR;
 
+size_t simfsVolumeSize(unsigned int blockSize, SIMFS_INDEX_TYPE numberOfBlocks);
+SIMFS_ERROR simfsFormatFileSystem(SIMFS_VOLUME *fileSystem, unsigned int blockSize, SIMFS_INDEX_TYPE numberOfBlocks);
 SIMFS_ERROR simfsMountFileSystem(SIMFS_VOLUME *fileSystem);
+SIMFS_ERROR simfsUnmountFileSystem();
+SIMFS_ERROR simfsMountVolumeFile(const char *path, int format);
+SIMFS_ERROR simfsFormatVolumeFile(const char *path, unsigned int blockSize, SIMFS_INDEX_TYPE numberOfBlocks);
 
 SIMFS_ERROR simfsCreateFile(SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type);
 
+SIMFS_ERROR simfsCloneFile(SIMFS_NAME_TYPE sourceName, SIMFS_NAME_TYPE cloneName);
+
 SIMFS_ERROR simfsDeleteFile(SIMFS_NAME_TYPE fileName);
 
 SIMFS_ERROR simfsGetFileInfo(SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer);
@@ -218,10 +554,107 @@ SIMFS_ERROR simfsOpenFile(SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *file
 
 SIMFS_ERROR simfsWriteFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer);
 
+SIMFS_ERROR simfsAppendFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer);
+
 SIMFS_ERROR simfsReadFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer);
+void simfsReleaseReadBuffer(char *readBuffer);
+
+SIMFS_ERROR simfsReadFileView(SIMFS_FILE_HANDLE_TYPE fileHandle, const char **content, size_t *size);
+void simfsReleaseFileView(const char *content);
+
+SIMFS_ERROR simfsReadFileAt(SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, char *readBuffer, size_t length,
+                            size_t *bytesRead);
+
+SIMFS_ERROR simfsWriteFileAt(SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, char *writeBuffer, size_t length);
 
 SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle);
 
+void simfsSetWriteBackPolicy(SIMFS_WRITE_BACK_POLICY_TYPE policy);
+
+SIMFS_ERROR simfsSyncFileSystem();
+
+SIMFS_ERROR simfsGetStatistics(char **json);
+
+/*
+ * Operations on nodes, i.e., on files and folders addressed by the block of their descriptor, for frontends that
+ * keep their own references to the nodes (like the FUSE low-level frontend). A file is opened as an entry of the
+ * global open file table, which is not owned by any process; the caller is set for every request with
+ * simfsSetCaller().
+ */
+typedef struct simfs_segment_type { // a piece of the volume holding a part of the content of a file
+    char *data;
+    size_t length;
+} SIMFS_SEGMENT_TYPE;
+
+typedef int (*SIMFS_SEGMENTS_CALLBACK)(SIMFS_SEGMENT_TYPE *segments, int count, void *argument); // 0 on success
+typedef int (*SIMFS_FOLDER_CALLBACK)(void *argument, long position, SIMFS_INDEX_TYPE node, SIMFS_CONTENT_TYPE type,
+                                     const char *name); // returns non-zero to stop the listing
+
+void simfsSetCaller(uid_t uid, pid_t pid, mode_t umask);
+SIMFS_INDEX_TYPE simfsRootNode();
+void simfsGetUsage(SIMFS_INDEX_TYPE *numberOfBlocks, SIMFS_INDEX_TYPE *freeBlocks, unsigned int *blockSize);
+
+SIMFS_ERROR simfsLookupNode(SIMFS_INDEX_TYPE folder, const char *name, SIMFS_INDEX_TYPE *node,
+                            SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer);
+SIMFS_ERROR simfsGetNodeInfo(SIMFS_INDEX_TYPE node, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer);
+SIMFS_ERROR simfsCreateInFolder(SIMFS_INDEX_TYPE folder, const char *name, SIMFS_CONTENT_TYPE type,
+                                mode_t accessRights, SIMFS_INDEX_TYPE *node, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer);
+SIMFS_ERROR simfsDeleteInFolder(SIMFS_INDEX_TYPE folder, const char *name);
+SIMFS_ERROR simfsListFolder(SIMFS_INDEX_TYPE folder, long position, SIMFS_FOLDER_CALLBACK callback, void *argument);
+
+SIMFS_ERROR simfsOpenNodeEntry(SIMFS_INDEX_TYPE node, mode_t rights, int *entry);
+SIMFS_ERROR simfsCloseNodeEntry(int entry);
+SIMFS_ERROR simfsMapNodeRange(int entry, size_t offset, size_t length, int write, SIMFS_SEGMENT_TYPE *segments,
+                              int maxSegments, SIMFS_SEGMENTS_CALLBACK callback, void *argument);
+SIMFS_ERROR simfsTruncateNode(SIMFS_INDEX_TYPE node, size_t size);
+SIMFS_ERROR simfsCloneNode(SIMFS_INDEX_TYPE node, SIMFS_INDEX_TYPE folder, const char *name, SIMFS_INDEX_TYPE *clone,
+                           SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer);
+
+/*
+ * Request queues, for submitting batches of operations on nodes and reaping their completions asynchronously.
+ *
+ * A batch is split into chains: a request with linked set belongs to the chain of the previous request, runs after
+ * it, and uses its node and entry (so a file created, opened, written, and closed in one chain is never looked up).
+ * A linked request is skipped with the error of the first request of its chain that failed, except a close, which
+ * still closes the entry opened by the chain. The chains are independent: a pool of SIMFS_QUEUE_THREADS threads runs
+ * them in any order and in parallel, as the caller of simfsSubmitRequests().
+ *
+ * The requests stay owned by the caller and must not be touched until they are reaped. A queue is destroyed, after
+ * its submitted requests have completed, before the volume is unmounted.
+ */
+typedef enum simfs_request_kind_type {
+    SIMFS_CREATE_REQUEST, // creates name in folder with type and accessRights; sets node
+    SIMFS_OPEN_REQUEST, // opens name in folder, or node if name is NULL, with the rights in accessRights; sets entry
+    SIMFS_WRITE_REQUEST, // writes length bytes of buffer at offset of entry; sets transferred
+    SIMFS_READ_REQUEST, // reads up to length bytes at offset of entry into buffer; sets transferred
+    SIMFS_CLOSE_REQUEST, // closes entry
+    SIMFS_DELETE_REQUEST // deletes name in folder
+} SIMFS_REQUEST_KIND_TYPE;
+
+typedef struct simfs_request_type {
+    SIMFS_REQUEST_KIND_TYPE kind;
+    int linked; // the request belongs to the chain of the previous request of the batch
+    SIMFS_INDEX_TYPE folder;
+    const char *name;
+    SIMFS_CONTENT_TYPE type;
+    mode_t accessRights;
+    SIMFS_INDEX_TYPE node;
+    int entry;
+    size_t offset;
+    size_t length;
+    char *buffer;
+    size_t transferred;
+    SIMFS_ERROR error; // the result, set on completion
+    void *userData; // left to the caller
+} SIMFS_REQUEST_TYPE;
+
+typedef struct simfs_queue_type SIMFS_QUEUE_TYPE;
+
+SIMFS_ERROR simfsCreateQueue(SIMFS_QUEUE_TYPE **queue);
+SIMFS_ERROR simfsSubmitRequests(SIMFS_QUEUE_TYPE *queue, SIMFS_REQUEST_TYPE *requests, int count);
+int simfsReapRequests(SIMFS_QUEUE_TYPE *queue, SIMFS_REQUEST_TYPE **completed, int maxCompleted, int wait);
+void simfsDestroyQueue(SIMFS_QUEUE_TYPE *queue);
+
 /*
  * The following functions can be used to simulate FUSE context's user and process identifiers for testing.
  *
@@ -229,6 +662,7 @@ SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle);
  */
 
 struct fuse_context *simfs_debug_get_context(); // follows FUSE naming convention
+void simfs_debug_set_context(const struct fuse_context *context); // fixes the context of the calling thread
 char *simfsGenerateContent(int size);
 
 #endif
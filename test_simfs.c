@@ -1,16 +1,1826 @@
 #include "simfs.h"
 
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
-int main() {
+//////////////////////////////////////////////////////////////////////////
+//
+// checks of the functionality, run by "simfs --check image" (the image file is created and overwritten)
+//
+//////////////////////////////////////////////////////////////////////////
+
+static int simfsFailedChecks;
+
+#define SIMFS_CHECK(condition) simfsCheck((condition), #condition, __LINE__)
+
+static int simfsCheck(int passed, const char *condition, int line)
+{
+    if (!passed)
+    {
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, line, condition);
+        simfsFailedChecks++;
+    }
+
+    return passed;
+}
+
+/*
+ * Mounts a volume of the default geometry formatted in memory; it is freed by simfsUnmountTestVolume().
+ */
+static SIMFS_VOLUME *simfsMountTestVolume()
+{
+    SIMFS_VOLUME *volume = malloc(simfsVolumeSize(SIMFS_DEFAULT_BLOCK_SIZE, SIMFS_DEFAULT_NUMBER_OF_BLOCKS));
+    simfsFormatFileSystem(volume, SIMFS_DEFAULT_BLOCK_SIZE, SIMFS_DEFAULT_NUMBER_OF_BLOCKS);
+    SIMFS_CHECK(simfsMountFileSystem(volume) == SIMFS_NO_ERROR);
+
+    return volume;
+}
+
+static void simfsUnmountTestVolume(SIMFS_VOLUME *volume)
+{
+    SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+    free(volume);
+}
+
+/*
+ * Fills a buffer with letters that depend on the position and on a seed, so misplaced content is detected.
+ */
+static void simfsFillTestContent(char *buffer, size_t length, unsigned int seed)
+{
+    for (size_t i = 0; i < length; i++)
+        buffer[i] = (char) ('a' + (i * 7 + seed) % 26);
+}
+
+/*
+ * Checks that the whole content of a file is the given one, by simfsReadFile(); the content read is a string, so
+ * it must not hold a zero byte.
+ */
+static void simfsCheckContent(SIMFS_FILE_HANDLE_TYPE fileHandle, const char *expected, size_t size)
+{
+    char *content = NULL;
+    if (SIMFS_CHECK(simfsReadFile(fileHandle, &content) == SIMFS_NO_ERROR))
+    {
+        SIMFS_CHECK(strlen(content) == size && memcmp(content, expected, size) == 0);
+        simfsReleaseReadBuffer(content);
+    }
+}
+
+/*
+ * Returns the number of free blocks of the mounted volume.
+ */
+static SIMFS_INDEX_TYPE simfsTestFreeBlocks()
+{
+    SIMFS_INDEX_TYPE numberOfBlocks, freeBlocks;
+    unsigned int blockSize;
+    simfsGetUsage(&numberOfBlocks, &freeBlocks, &blockSize);
+
+    return freeBlocks;
+}
+
+/*
+ * Checks the content of a file by name.
+ */
+static void simfsCheckFileContent(SIMFS_NAME_TYPE name, const char *expected, size_t size)
+{
+    SIMFS_FILE_HANDLE_TYPE fileHandle;
+    if (SIMFS_CHECK(simfsOpenFile(name, &fileHandle) == SIMFS_NO_ERROR))
+    {
+        SIMFS_FILE_DESCRIPTOR_TYPE info;
+        SIMFS_CHECK(simfsGetFileInfo(name, &info) == SIMFS_NO_ERROR && info.size == size);
+        simfsCheckContent(fileHandle, expected, size);
+        SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+    }
+}
+
+typedef struct simfs_test_transfer_type { // a buffer copied to or from the segments of a range of a node
+    char *buffer;
+    int write;
+    size_t transferred;
+} SIMFS_TEST_TRANSFER_TYPE;
+
+static int simfsCopyTestSegments(SIMFS_SEGMENT_TYPE *segments, int count, void *argument)
+{
+    SIMFS_TEST_TRANSFER_TYPE *transfer = argument;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (transfer->write)
+            memcpy(segments[i].data, transfer->buffer + transfer->transferred, segments[i].length);
+        else
+            memcpy(transfer->buffer + transfer->transferred, segments[i].data, segments[i].length);
+        transfer->transferred += segments[i].length;
+    }
+
+    return 0;
+}
+
+/*
+ * Reads or writes a range of a node opened as an entry through simfsMapNodeRange(); passes out the number of
+ * bytes copied, which a read cuts at the end of the file.
+ */
+static SIMFS_ERROR simfsTransferTestRange(int entry, size_t offset, char *buffer, size_t length, int write,
+                                          size_t *transferred)
+{
+    SIMFS_SEGMENT_TYPE segments[64];
+    SIMFS_TEST_TRANSFER_TYPE transfer = { .buffer = buffer, .write = write, .transferred = 0 };
+    SIMFS_ERROR error = simfsMapNodeRange(entry, offset, length, write, segments, 64, simfsCopyTestSegments,
+                                          &transfer);
+    *transferred = transfer.transferred;
+
+    return error;
+}
+
+/*
+ * Fills a volume with files of 100 blocks, whose runs cross the words of the bitvector and the words of its
+ * summary, and the rest of it with one file; frees every third file, and creates them again. On the volume that is
+ * not fragmented, and in the holes of the one that is, every file gets one run, and the free blocks are counted
+ * exactly.
+ */
+static void simfsCheckAllocator()
+{
+    SIMFS_INDEX_TYPE numberOfBlocks = 16384; // 256 words of the bitvector, 4 words of its summary
+    SIMFS_VOLUME *volume = malloc(simfsVolumeSize(SIMFS_DEFAULT_BLOCK_SIZE, numberOfBlocks));
+    SIMFS_CHECK(simfsFormatFileSystem(volume, SIMFS_DEFAULT_BLOCK_SIZE, numberOfBlocks) == SIMFS_NO_ERROR);
+    if (!SIMFS_CHECK(simfsMountFileSystem(volume) == SIMFS_NO_ERROR))
+    {
+        free(volume);
+        return;
+    }
+
+    SIMFS_INDEX_TYPE emptyFreeBlocks = simfsTestFreeBlocks();
+    size_t size = 100 * SIMFS_MIN_DATA_SIZE; // the data of a block of the smallest size
+    char *content = malloc((size_t) numberOfBlocks * SIMFS_MIN_DATA_SIZE + 1);
+    SIMFS_INDEX_TYPE start[200];
+    int count = 0, crossesSummary = 0;
+    SIMFS_NAME_TYPE name;
+    SIMFS_FILE_HANDLE_TYPE fileHandle;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+
+    simfsFillTestContent(content, size, 2);
+    content[size] = '\0';
+    for (; count < 200 && simfsTestFreeBlocks() > 103; count++) // a descriptor, the data, maybe a folder block
+    {
+        SIMFS_INDEX_TYPE freeBlocks = simfsTestFreeBlocks();
+        sprintf(name, "run%d", count);
+        SIMFS_CHECK(simfsCreateFile(name, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsOpenFile(name, &fileHandle) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsWriteFile(fileHandle, content) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(freeBlocks - simfsTestFreeBlocks() == 101 || freeBlocks - simfsTestFreeBlocks() == 102);
+
+        SIMFS_CHECK(simfsGetFileInfo(name, &info) == SIMFS_NO_ERROR && info.numberOfExtents == 1
+                    && info.extent[0].length == 100);
+        start[count] = info.extent[0].start;
+        crossesSummary |= start[count] / 4096 != (start[count] + 99) / 4096;
+    }
+    SIMFS_CHECK(crossesSummary);
+
+    // the rest of the volume goes to one more file, so the holes are all that is free
+    SIMFS_NAME_TYPE rest = "rest";
+    SIMFS_CHECK(simfsCreateFile(rest, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+    size_t restSize = (size_t) simfsTestFreeBlocks() * SIMFS_MIN_DATA_SIZE;
+    simfsFillTestContent(content, restSize, 3);
+    content[restSize] = '\0';
+    SIMFS_CHECK(simfsOpenFile(rest, &fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsWriteFile(fileHandle, content) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == 0);
+
+    int freed = 0;
+    for (int i = 1; i < count; i += 3, freed++)
+    {
+        sprintf(name, "run%d", i);
+        SIMFS_CHECK(simfsDeleteFile(name) == SIMFS_NO_ERROR);
+    }
+    SIMFS_CHECK(simfsTestFreeBlocks() == (SIMFS_INDEX_TYPE) freed * 101);
+
+    // next fit goes round to the first hole; each file takes a hole in order: its descriptor, then its old run
+    simfsFillTestContent(content, size, 2);
+    content[size] = '\0';
+    for (int i = 1; i < count; i += 3)
+    {
+        sprintf(name, "run%d", i);
+        SIMFS_CHECK(simfsCreateFile(name, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsOpenFile(name, &fileHandle) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsWriteFile(fileHandle, content) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsGetFileInfo(name, &info) == SIMFS_NO_ERROR && info.numberOfExtents == 1
+                    && info.extent[0].start == start[i] && info.extent[0].length == 100);
+    }
+    SIMFS_CHECK(simfsTestFreeBlocks() == 0);
+    sprintf(name, "run%d", count - 1);
+    simfsCheckFileContent(name, content, size);
+
+    for (int i = 0; i < count; i++)
+    {
+        sprintf(name, "run%d", i);
+        SIMFS_CHECK(simfsDeleteFile(name) == SIMFS_NO_ERROR);
+    }
+    SIMFS_CHECK(simfsDeleteFile(rest) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == emptyFreeBlocks);
+
+    free(content);
+    simfsUnmountTestVolume(volume);
+}
+
+/*
+ * Creates the same names in three folders, enough of them to grow every shard of the directory several times, and
+ * deletes and creates again some of them in two folders; after every step, each name is found in each folder as
+ * the node created for it there, or not at all once deleted, so the entries shifted back over a deleted one stay in
+ * reach of their probe sequences.
+ */
+static void simfsCheckDirectory()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_INDEX_TYPE root = simfsRootNode();
+    SIMFS_INDEX_TYPE freeBlocks = simfsTestFreeBlocks();
+    SIMFS_INDEX_TYPE folder[3], node;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    const char *folderName[3] = { "first", "second", "third" };
+    int count = 1500; // against 16 shards of 64 slots
+    SIMFS_INDEX_TYPE (*created)[3] = malloc((size_t) count * sizeof(*created));
+    char name[16];
+
+    for (int f = 0; f < 3; f++)
+        SIMFS_CHECK(simfsCreateInFolder(root, folderName[f], FOLDER_CONTENT_TYPE, S_IRWXU, &folder[f], &info)
+                    == SIMFS_NO_ERROR);
+    for (int i = 0; i < count; i++)
+        for (int f = 0; f < 3; f++)
+        {
+            sprintf(name, "n%d", i);
+            SIMFS_CHECK(simfsCreateInFolder(folder[f], name, FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &created[i][f],
+                                            &info) == SIMFS_NO_ERROR);
+        }
+
+    for (int step = 0; step < 3; step++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sprintf(name, "n%d", i);
+            for (int f = 0; f < 3; f++)
+            {
+                int deleted = step == 1 && ((f == 0 && i % 5 == 0) || (f == 1 && i % 3 != 0));
+                SIMFS_ERROR error = simfsLookupNode(folder[f], name, &node, &info);
+                SIMFS_CHECK(deleted ? error == SIMFS_NOT_FOUND_ERROR
+                                    : error == SIMFS_NO_ERROR && node == created[i][f]);
+            }
+            SIMFS_CHECK(created[i][0] != created[i][1] && created[i][1] != created[i][2]);
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            sprintf(name, "n%d", i);
+            for (int f = 0; f < 2; f++)
+            {
+                if ((f == 0 && i % 5 != 0) || (f == 1 && i % 3 == 0))
+                    continue;
+                if (step == 0)
+                    SIMFS_CHECK(simfsDeleteInFolder(folder[f], name) == SIMFS_NO_ERROR);
+                else if (step == 1)
+                    SIMFS_CHECK(simfsCreateInFolder(folder[f], name, FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR,
+                                                    &created[i][f], &info) == SIMFS_NO_ERROR);
+            }
+        }
+    }
+
+    for (int f = 0; f < 3; f++)
+    {
+        SIMFS_CHECK(simfsGetNodeInfo(folder[f], &info) == SIMFS_NO_ERROR && info.size == (size_t) count);
+        for (int i = 0; i < count; i++)
+        {
+            sprintf(name, "n%d", i);
+            SIMFS_CHECK(simfsDeleteInFolder(folder[f], name) == SIMFS_NO_ERROR);
+        }
+        SIMFS_CHECK(simfsDeleteInFolder(root, folderName[f]) == SIMFS_NO_ERROR);
+    }
+    SIMFS_CHECK(simfsLookupNode(root, folderName[0], &node, &info) == SIMFS_NOT_FOUND_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks);
+
+    free(created);
+    simfsUnmountTestVolume(volume);
+}
+
+typedef struct simfs_test_listing_type { // the entries of a folder passed by simfsListFolder()
+    SIMFS_NAME_TYPE name[64];
+    int count;
+    int misplaced; // entries passed with a position other than their place in the listing
+} SIMFS_TEST_LISTING_TYPE;
+
+static int simfsCollectTestEntry(void *argument, long position, SIMFS_INDEX_TYPE node, SIMFS_CONTENT_TYPE type,
+                                 const char *name)
+{
+    SIMFS_TEST_LISTING_TYPE *listing = argument;
+
+    (void) node;
+    (void) type;
+    listing->misplaced += position != listing->count;
+    if (listing->count < 64)
+        strcpy(listing->name[listing->count], name);
+    listing->count++;
+
+    return 0;
+}
+
+/*
+ * Lists a folder from the given position and checks that it passes the expected names from there, in order.
+ */
+static void simfsCheckListing(SIMFS_INDEX_TYPE folder, long position, SIMFS_NAME_TYPE *expected, int count)
+{
+    SIMFS_TEST_LISTING_TYPE *listing = calloc(1, sizeof(SIMFS_TEST_LISTING_TYPE));
+    listing->count = (int) position;
+
+    SIMFS_CHECK(simfsListFolder(folder, position, simfsCollectTestEntry, listing) == SIMFS_NO_ERROR);
+    if (SIMFS_CHECK(listing->count == count && listing->misplaced == 0))
+        for (int i = (int) position; i < count; i++)
+            SIMFS_CHECK(strcmp(listing->name[i], expected[i]) == 0);
+
+    free(listing);
+}
+
+/*
+ * Changes a folder with entries packed into folder blocks: a removed entry is closed up by the ones after it, so a
+ * new entry takes the room left at the end of its block, a block left empty is unlinked from the folder and freed,
+ * and names of the maximum length fill blocks up to their last byte. The listing shows the entries in the order
+ * of the blocks, and the blocks held are counted by the free blocks.
+ */
+static void simfsCheckFolderEntries()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_INDEX_TYPE root = simfsRootNode();
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_INDEX_TYPE folder, node;
+    SIMFS_NAME_TYPE expected[64];
+    int count = 0;
+
+    SIMFS_CHECK(simfsCreateInFolder(root, "packed", FOLDER_CONTENT_TYPE, S_IRWXU, &folder, &info) == SIMFS_NO_ERROR);
+    SIMFS_INDEX_TYPE freeBlocks = simfsTestFreeBlocks();
+
+    // names of 3 characters take 12 bytes, so 20 of them fill a block of 240 bytes
+    for (; count < 40; count++)
+    {
+        sprintf(expected[count], "e%02d", count);
+        SIMFS_CHECK(simfsCreateInFolder(folder, expected[count], FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                    == SIMFS_NO_ERROR);
+    }
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - 40 - 2);
+    simfsCheckListing(folder, 0, expected, count);
+
+    // the entries after a removed one move up, and a new entry takes the room left at the end of the first block
+    SIMFS_CHECK(simfsDeleteInFolder(folder, "e05") == SIMFS_NO_ERROR);
+    memmove(expected[5], expected[6], 14 * sizeof(SIMFS_NAME_TYPE));
+    strcpy(expected[19], "e40");
+    SIMFS_CHECK(simfsCreateInFolder(folder, "e40", FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - 40 - 2);
+    simfsCheckListing(folder, 0, expected, count);
+    simfsCheckListing(folder, 18, expected, count);
+
+    // the second block is freed when it is emptied, and appended again for the next entry
+    for (int i = 20; i < 40; i++)
+        SIMFS_CHECK(simfsDeleteInFolder(folder, expected[i]) == SIMFS_NO_ERROR);
+    count = 20;
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - 20 - 1);
+    simfsCheckListing(folder, 0, expected, count);
+    strcpy(expected[count++], "e41");
+    SIMFS_CHECK(simfsCreateInFolder(folder, "e41", FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - 21 - 2);
+
+    // the first block is unlinked from the folder when it is emptied, so the second one becomes the first
+    for (int i = 0; i < 20; i++)
+        SIMFS_CHECK(simfsDeleteInFolder(folder, expected[i]) == SIMFS_NO_ERROR);
+    memmove(expected[0], expected[20], sizeof(SIMFS_NAME_TYPE));
+    count = 1;
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - 1 - 1);
+    simfsCheckListing(folder, 0, expected, count);
+    strcpy(expected[count++], "e42");
+    SIMFS_CHECK(simfsCreateInFolder(folder, "e42", FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - 2 - 1);
+    simfsCheckListing(folder, 0, expected, count);
+    for (int i = 0; i < count; i++)
+        SIMFS_CHECK(simfsDeleteInFolder(folder, expected[i]) == SIMFS_NO_ERROR);
+    count = 0;
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks);
+
+    // a name of the maximum length takes 136 bytes and one of 97 characters 104, which fill a block exactly
+    for (int i = 0; i < 4; i++)
+    {
+        size_t length = i % 2 == 0 ? SIMFS_MAX_NAME_LENGTH - 1 : 97;
+        memset(expected[count], 'a' + i, length);
+        expected[count][length] = '\0';
+        SIMFS_CHECK(simfsCreateInFolder(folder, expected[count++], FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node,
+                                        &info) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - (SIMFS_INDEX_TYPE) count - (SIMFS_INDEX_TYPE) (i / 2 + 1));
+    }
+    strcpy(expected[count++], "z");
+    SIMFS_CHECK(simfsCreateInFolder(folder, "z", FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - 5 - 3);
+    simfsCheckListing(folder, 0, expected, count);
+    for (int i = 0; i < count; i++)
+        SIMFS_CHECK(simfsLookupNode(folder, expected[i], &node, &info) == SIMFS_NO_ERROR
+                    && strcmp(info.name, expected[i]) == 0);
+
+    // the room of a removed name at the end of the first block is taken again by a name that fits it exactly
+    SIMFS_CHECK(simfsDeleteInFolder(folder, expected[1]) == SIMFS_NO_ERROR);
+    memset(expected[1], 'y', 97);
+    SIMFS_CHECK(simfsCreateInFolder(folder, expected[1], FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - 5 - 3);
+    simfsCheckListing(folder, 0, expected, count);
+
+    for (int i = 0; i < count; i++)
+        SIMFS_CHECK(simfsDeleteInFolder(folder, expected[i]) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks);
+    SIMFS_CHECK(simfsDeleteInFolder(root, "packed") == SIMFS_NO_ERROR);
+
+    simfsUnmountTestVolume(volume);
+}
+
+/*
+ * Looks up every node of the tree built by simfsCheckSnapshot(): 8 folders of 8 folders of 20 files each. Records
+ * the nodes if record is set, and checks them against the recorded ones otherwise.
+ */
+static void simfsLookupTestTree(SIMFS_INDEX_TYPE *nodes, int record)
+{
+    SIMFS_INDEX_TYPE node;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    char name[16];
+    int n = 0;
+
+    for (int i = 0; i < 8; i++)
+    {
+        sprintf(name, "d%d", i);
+        SIMFS_CHECK(simfsLookupNode(simfsRootNode(), name, &node, &info) == SIMFS_NO_ERROR);
+        if (record)
+            nodes[n] = node;
+        SIMFS_CHECK(nodes[n] == node);
+        SIMFS_INDEX_TYPE folder = nodes[n++];
+        for (int j = 0; j < 8; j++)
+        {
+            sprintf(name, "s%d", j);
+            SIMFS_CHECK(simfsLookupNode(folder, name, &node, &info) == SIMFS_NO_ERROR
+                        && info.type == FOLDER_CONTENT_TYPE);
+            if (record)
+                nodes[n] = node;
+            SIMFS_CHECK(nodes[n] == node);
+            SIMFS_INDEX_TYPE subfolder = nodes[n++];
+            for (int k = 0; k < 20; k++, n++)
+            {
+                sprintf(name, "f%d", k);
+                SIMFS_ERROR error = simfsLookupNode(subfolder, name, &node, &info);
+                if (record)
+                    nodes[n] = error == SIMFS_NO_ERROR ? node : SIMFS_INVALID_INDEX;
+                else
+                    SIMFS_CHECK(nodes[n] == SIMFS_INVALID_INDEX ? error == SIMFS_NOT_FOUND_ERROR
+                                                                : error == SIMFS_NO_ERROR && nodes[n] == node);
+            }
+        }
+    }
+}
+
+/*
+ * Builds a tree of folders, changes it, and mounts the volume once with the directory snapshot written by the
+ * unmount, and once with the snapshot marked as stale, as a change not followed by an unmount leaves it, so the
+ * folders are traversed in parallel instead; every lookup gives the same node both times.
+ */
+static void simfsCheckSnapshot()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_INDEX_TYPE folder, subfolder, node;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_INDEX_TYPE *nodes = malloc(8 * 8 * 22 * sizeof(SIMFS_INDEX_TYPE));
+    char name[16];
+
+    for (int i = 0; i < 8; i++)
+    {
+        sprintf(name, "d%d", i);
+        SIMFS_CHECK(simfsCreateInFolder(simfsRootNode(), name, FOLDER_CONTENT_TYPE, S_IRWXU, &folder, &info)
+                    == SIMFS_NO_ERROR);
+        for (int j = 0; j < 8; j++)
+        {
+            sprintf(name, "s%d", j);
+            SIMFS_CHECK(simfsCreateInFolder(folder, name, FOLDER_CONTENT_TYPE, S_IRWXU, &subfolder, &info)
+                        == SIMFS_NO_ERROR);
+            for (int k = 0; k < 20; k++)
+            {
+                sprintf(name, "f%d", k);
+                if ((i + j + k) % 7 != 0)
+                    SIMFS_CHECK(simfsCreateInFolder(subfolder, name, FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node,
+                                                    &info) == SIMFS_NO_ERROR);
+            }
+        }
+    }
+    simfsLookupTestTree(nodes, 1);
+
+    SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+    SIMFS_CHECK(volume->superblock.attr.snapshotValid);
+    SIMFS_CHECK(simfsMountFileSystem(volume) == SIMFS_NO_ERROR);
+    simfsLookupTestTree(nodes, 0);
+
+    // a file deleted and one created after the snapshot was written
+    SIMFS_CHECK(simfsLookupNode(simfsRootNode(), "d1", &folder, &info) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsLookupNode(folder, "s1", &subfolder, &info) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsDeleteInFolder(subfolder, "f1") == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCreateInFolder(subfolder, "f5", FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                == SIMFS_NO_ERROR);
+    SIMFS_CHECK(!volume->superblock.attr.snapshotValid);
+    simfsLookupTestTree(nodes, 1);
+
+    SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsMountFileSystem(volume) == SIMFS_NO_ERROR);
+    simfsLookupTestTree(nodes, 0);
+
+    SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+    volume->superblock.attr.snapshotValid = 0;
+    SIMFS_CHECK(simfsMountFileSystem(volume) == SIMFS_NO_ERROR);
+    simfsLookupTestTree(nodes, 0);
+
+    free(nodes);
+    simfsUnmountTestVolume(volume);
+}
+
+typedef struct simfs_test_thread_type {
+    pthread_t thread;
+    int number;
+    SIMFS_INDEX_TYPE ownFolder; // a folder used only by this thread
+    SIMFS_INDEX_TYPE sharedFolder; // a folder used by all threads
+    int failed; // operations that failed, counted by the thread itself
+} SIMFS_TEST_THREAD_TYPE;
+
+#define SIMFS_TEST_THREADS 4
+#define SIMFS_TEST_ROUNDS 60
+
+/*
+ * Returns the length and fills the content of the file of a round of a thread of simfsCheckThreads(); the kind
+ * tells the files in the root, in the own folder, and in the shared folder apart.
+ */
+static size_t simfsTestThreadContent(char *content, int thread, int round, int kind)
+{
+    size_t length = (size_t) (round * 37 + thread * 11 + kind * 501) % 3000 + 1;
+    simfsFillTestContent(content, length, (unsigned int) (thread * 1000 + round * 3 + kind));
+    content[length] = '\0';
+
+    return length;
+}
+
+/*
+ * Returns whether the file of a round of a thread is deleted again by the thread, in a later round.
+ */
+static int simfsTestThreadDeletes(int round, int kind)
+{
+    return round < SIMFS_TEST_ROUNDS - 2 && round % (kind + 2) == 1;
+}
+
+static void *simfsRunTestThread(void *argument)
+{
+    SIMFS_TEST_THREAD_TYPE *thread = argument;
+    char *content = malloc(3001);
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_INDEX_TYPE node;
+    SIMFS_FILE_HANDLE_TYPE fileHandle;
+    SIMFS_NAME_TYPE name;
+    int entry;
+    size_t transferred;
+
+    simfsSetCaller(1, 100 + thread->number, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    for (int round = 0; round < SIMFS_TEST_ROUNDS; round++)
+    {
+        // the root, by name, as the current working directory of every thread
+        simfsTestThreadContent(content, thread->number, round, 0);
+        sprintf(name, "root%d-%d", thread->number, round);
+        thread->failed += simfsCreateFile(name, FILE_CONTENT_TYPE) != SIMFS_NO_ERROR
+                          || simfsOpenFile(name, &fileHandle) != SIMFS_NO_ERROR
+                          || simfsWriteFile(fileHandle, content) != SIMFS_NO_ERROR
+                          || simfsCloseFile(fileHandle) != SIMFS_NO_ERROR;
+
+        // the own folder and the shared one, by node
+        for (int kind = 1; kind <= 2; kind++)
+        {
+            size_t length = simfsTestThreadContent(content, thread->number, round, kind);
+            SIMFS_INDEX_TYPE folder = kind == 1 ? thread->ownFolder : thread->sharedFolder;
+            sprintf(name, "node%d-%d", thread->number, round);
+            thread->failed += simfsCreateInFolder(folder, name, FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                              != SIMFS_NO_ERROR
+                              || simfsOpenNodeEntry(node, S_IRUSR | S_IWUSR, &entry) != SIMFS_NO_ERROR
+                              || simfsTransferTestRange(entry, 0, content, length, 1, &transferred) != SIMFS_NO_ERROR
+                              || simfsCloseNodeEntry(entry) != SIMFS_NO_ERROR;
+        }
+
+        if (round >= 2)
+            for (int kind = 0; kind <= 2; kind++)
+                if (simfsTestThreadDeletes(round - 2, kind))
+                {
+                    if (kind == 0)
+                        sprintf(name, "root%d-%d", thread->number, round - 2);
+                    else
+                        sprintf(name, "node%d-%d", thread->number, round - 2);
+                    thread->failed += (kind == 0 ? simfsDeleteFile(name)
+                                       : simfsDeleteInFolder(kind == 1 ? thread->ownFolder : thread->sharedFolder,
+                                                             name)) != SIMFS_NO_ERROR;
+                }
+    }
+
+    free(content);
+    return NULL;
+}
+
+/*
+ * Lets threads of different processes create, write, and delete files at the same time: in the root, each in a
+ * folder of its own, and all in one shared folder. Every file left has the content written to it, the deleted ones
+ * are gone, and deleting the rest returns every block. The threads check nothing themselves, so the check can run
+ * under ThreadSanitizer.
+ */
+static void simfsCheckThreads()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_INDEX_TYPE root = simfsRootNode();
+    SIMFS_INDEX_TYPE freeBlocks = simfsTestFreeBlocks();
+    SIMFS_TEST_THREAD_TYPE threads[SIMFS_TEST_THREADS];
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_INDEX_TYPE sharedFolder, node;
+    SIMFS_NAME_TYPE name;
+    char *content = malloc(3001);
+    char *readBack = malloc(3001);
+
+    SIMFS_CHECK(simfsCreateInFolder(root, "shared", FOLDER_CONTENT_TYPE, S_IRWXU, &sharedFolder, &info)
+                == SIMFS_NO_ERROR);
+    for (int t = 0; t < SIMFS_TEST_THREADS; t++)
+    {
+        threads[t] = (SIMFS_TEST_THREAD_TYPE) { .number = t, .sharedFolder = sharedFolder, .failed = 0 };
+        sprintf(name, "own%d", t);
+        SIMFS_CHECK(simfsCreateInFolder(root, name, FOLDER_CONTENT_TYPE, S_IRWXU, &threads[t].ownFolder, &info)
+                    == SIMFS_NO_ERROR);
+    }
+
+    for (int t = 0; t < SIMFS_TEST_THREADS; t++)
+        SIMFS_CHECK(pthread_create(&threads[t].thread, NULL, simfsRunTestThread, &threads[t]) == 0);
+    for (int t = 0; t < SIMFS_TEST_THREADS; t++)
+    {
+        SIMFS_CHECK(pthread_join(threads[t].thread, NULL) == 0);
+        SIMFS_CHECK(threads[t].failed == 0);
+    }
+
+    for (int t = 0; t < SIMFS_TEST_THREADS; t++)
+        for (int round = 0; round < SIMFS_TEST_ROUNDS; round++)
+            for (int kind = 0; kind <= 2; kind++)
+            {
+                size_t length = simfsTestThreadContent(content, t, round, kind);
+                int deleted = simfsTestThreadDeletes(round, kind);
+                if (kind == 0)
+                {
+                    sprintf(name, "root%d-%d", t, round);
+                    if (deleted)
+                        SIMFS_CHECK(simfsGetFileInfo(name, &info) == SIMFS_NOT_FOUND_ERROR);
+                    else
+                    {
+                        simfsCheckFileContent(name, content, length);
+                        SIMFS_CHECK(simfsDeleteFile(name) == SIMFS_NO_ERROR);
+                    }
+                    continue;
+                }
+
+                SIMFS_INDEX_TYPE folder = kind == 1 ? threads[t].ownFolder : sharedFolder;
+                sprintf(name, "node%d-%d", t, round);
+                SIMFS_ERROR error = simfsLookupNode(folder, name, &node, &info);
+                if (deleted)
+                {
+                    SIMFS_CHECK(error == SIMFS_NOT_FOUND_ERROR);
+                    continue;
+                }
+
+                int entry;
+                size_t transferred = 0;
+                if (SIMFS_CHECK(error == SIMFS_NO_ERROR && info.size == length)
+                    && SIMFS_CHECK(simfsOpenNodeEntry(node, S_IRUSR, &entry) == SIMFS_NO_ERROR))
+                {
+                    SIMFS_CHECK(simfsTransferTestRange(entry, 0, readBack, 3001, 0, &transferred) == SIMFS_NO_ERROR);
+                    SIMFS_CHECK(transferred == length && memcmp(readBack, content, length) == 0);
+                    SIMFS_CHECK(simfsCloseNodeEntry(entry) == SIMFS_NO_ERROR);
+                }
+                SIMFS_CHECK(simfsDeleteInFolder(folder, name) == SIMFS_NO_ERROR);
+            }
+
+    for (int t = 0; t < SIMFS_TEST_THREADS; t++)
+    {
+        sprintf(name, "own%d", t);
+        SIMFS_CHECK(simfsDeleteInFolder(root, name) == SIMFS_NO_ERROR);
+    }
+    SIMFS_CHECK(simfsDeleteInFolder(root, "shared") == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks);
+
+    free(readBack);
+    free(content);
+    simfsUnmountTestVolume(volume);
+}
+
+/*
+ * Writes ranges of a file with simfsWriteFileAt(), across blocks and past its end, and reads them back with
+ * simfsReadFileAt(), against a copy of the content kept in memory.
+ */
+static void simfsCheckReadWriteAt()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_NAME_TYPE name = "ranges";
+    SIMFS_CHECK(simfsCreateFile(name, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+
+    SIMFS_FILE_HANDLE_TYPE fileHandle;
+    SIMFS_CHECK(simfsOpenFile(name, &fileHandle) == SIMFS_NO_ERROR);
+
+    size_t capacity = 64 * SIMFS_DEFAULT_BLOCK_SIZE;
+    char *expected = calloc(capacity, 1);
+    char *buffer = malloc(capacity);
+    size_t size = 0;
+
+    srand(4);
+    for (int i = 0; i < 2000; i++)
+    {
+        size_t offset = (size_t) rand() % (size + SIMFS_DEFAULT_BLOCK_SIZE) % capacity;
+        size_t length = (size_t) rand() % (i % 4 == 0 ? 8 * SIMFS_DEFAULT_BLOCK_SIZE : 300);
+        if (offset + length > capacity)
+            length = capacity - offset;
+
+        if (rand() % 2)
+        {
+            simfsFillTestContent(buffer, length, (unsigned int) i);
+            SIMFS_CHECK(simfsWriteFileAt(fileHandle, offset, buffer, length) == SIMFS_NO_ERROR);
+
+            memcpy(expected + offset, buffer, length); // a gap after the end reads as zeros, as expected holds
+            if (offset + length > size)
+                size = offset + length;
+        }
+        else
+        {
+            size_t bytesRead = SIZE_MAX;
+            SIMFS_CHECK(simfsReadFileAt(fileHandle, offset, buffer, length, &bytesRead) == SIMFS_NO_ERROR);
+            SIMFS_CHECK(bytesRead == (offset < size ? (size - offset < length ? size - offset : length) : 0));
+            SIMFS_CHECK(bytesRead <= length && memcmp(buffer, expected + offset, bytesRead) == 0);
+        }
+    }
+
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_CHECK(simfsGetFileInfo(name, &info) == SIMFS_NO_ERROR && info.size == size);
+
+    size_t bytesRead = SIZE_MAX; // the gaps hold zeros, so the whole file is read as a range rather than a string
+    SIMFS_CHECK(simfsReadFileAt(fileHandle, 0, buffer, capacity, &bytesRead) == SIMFS_NO_ERROR && bytesRead == size);
+    SIMFS_CHECK(memcmp(buffer, expected, size) == 0);
+    SIMFS_CHECK(simfsReadFileAt(fileHandle, size + 1, buffer, 10, &bytesRead) == SIMFS_NO_ERROR && bytesRead == 0);
+    SIMFS_CHECK(simfsReadFileAt(fileHandle + 1, 0, buffer, 10, &bytesRead) == SIMFS_NOT_FOUND_ERROR);
+    SIMFS_CHECK(simfsWriteFileAt(fileHandle + 1, 0, buffer, 10) == SIMFS_NOT_FOUND_ERROR);
+
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+
+    free(buffer);
+    free(expected);
+    simfsUnmountTestVolume(volume);
+}
+
+/*
+ * Appends lines to a file with simfsAppendFile(), also after the file is rewritten shorter by simfsWriteFile(), and
+ * reads the whole content back.
+ */
+static void simfsCheckAppend()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_NAME_TYPE name = "log";
+    SIMFS_CHECK(simfsCreateFile(name, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+
+    SIMFS_FILE_HANDLE_TYPE fileHandle;
+    SIMFS_CHECK(simfsOpenFile(name, &fileHandle) == SIMFS_NO_ERROR);
+
+    size_t capacity = 100000;
+    char *expected = malloc(capacity + 1);
+    size_t size = 0;
+    char line[32];
+
+    for (int i = 0; i < 3000; i++)
+    {
+        if (i == 2000) // cut the file, so the appends go on from a smaller size
+        {
+            size = 1000;
+            expected[size] = '\0';
+            SIMFS_CHECK(simfsWriteFile(fileHandle, expected) == SIMFS_NO_ERROR);
+        }
+
+        int length = sprintf(line, "line %d\n", i);
+        SIMFS_CHECK(simfsAppendFile(fileHandle, line) == SIMFS_NO_ERROR);
+        memcpy(expected + size, line, (size_t) length);
+        size += (size_t) length;
+
+        if (i % 500 == 0)
+            simfsCheckContent(fileHandle, expected, size);
+    }
+
+    SIMFS_CHECK(simfsAppendFile(fileHandle, "") == SIMFS_NO_ERROR);
+
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_CHECK(simfsGetFileInfo(name, &info) == SIMFS_NO_ERROR && info.size == size);
+    simfsCheckContent(fileHandle, expected, size);
+
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsAppendFile(fileHandle, line) == SIMFS_NOT_FOUND_ERROR);
+
+    free(expected);
+    simfsUnmountTestVolume(volume);
+}
+
+/*
+ * Checks the content of a file that moves between its descriptor block and data blocks, read with
+ * simfsReadFileAt(), and that it holds just the data blocks its size needs beyond the given free blocks.
+ */
+static void simfsCheckInlineState(SIMFS_FILE_HANDLE_TYPE fileHandle, const char *expected, size_t size,
+                                  SIMFS_INDEX_TYPE freeBlocks)
+{
+    size_t inlineSize = SIMFS_MIN_DATA_SIZE - offsetof(SIMFS_FILE_DESCRIPTOR_TYPE, inlineData);
+    size_t blocks = size <= inlineSize ? 0 : (size + SIMFS_MIN_DATA_SIZE - 1) / SIMFS_MIN_DATA_SIZE;
+    char buffer[600];
+    size_t bytesRead;
+
+    SIMFS_CHECK(simfsReadFileAt(fileHandle, 0, buffer, sizeof(buffer), &bytesRead) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(bytesRead == size && memcmp(buffer, expected, size) == 0);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks - blocks);
+}
+
+/*
+ * Grows and shrinks a file around the inline size of the geometry, 64 bytes at 256 byte blocks, with every call
+ * that changes the size of a file, so its content moves to a data block and back without losing or leaking
+ * bytes; the bytes of a file that grows again after shrinking inline are zeros.
+ */
+static void simfsCheckInlineContent()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    size_t inlineSize = SIMFS_MIN_DATA_SIZE - offsetof(SIMFS_FILE_DESCRIPTOR_TYPE, inlineData);
+    SIMFS_NAME_TYPE name = "small";
+    SIMFS_FILE_HANDLE_TYPE fileHandle;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_INDEX_TYPE node;
+    char expected[600], write[600];
+    size_t size = 0;
+
+    SIMFS_CHECK(simfsCreateFile(name, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsOpenFile(name, &fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsLookupNode(simfsRootNode(), name, &node, &info) == SIMFS_NO_ERROR);
+    SIMFS_INDEX_TYPE freeBlocks = simfsTestFreeBlocks();
+
+    // replacing the whole content
+    size_t sizes[] = { inlineSize - 1, inlineSize, inlineSize + 1, inlineSize, inlineSize - 1, 0, inlineSize,
+                       SIMFS_MIN_DATA_SIZE, SIMFS_MIN_DATA_SIZE + 1, inlineSize + 1, inlineSize, 1 };
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        size = sizes[i];
+        simfsFillTestContent(expected, size, i);
+        memcpy(write, expected, size);
+        write[size] = '\0';
+        SIMFS_CHECK(simfsWriteFile(fileHandle, write) == SIMFS_NO_ERROR);
+        simfsCheckInlineState(fileHandle, expected, size, freeBlocks);
+    }
+
+    // appending a byte at a time across the inline size
+    for (unsigned int i = 0; size < inlineSize + 3; i++)
+    {
+        expected[size] = (char) ('a' + i % 26);
+        write[0] = expected[size++];
+        write[1] = '\0';
+        SIMFS_CHECK(simfsAppendFile(fileHandle, write) == SIMFS_NO_ERROR);
+        simfsCheckInlineState(fileHandle, expected, size, freeBlocks);
+    }
+
+    // writing ranges that end at, after, and far after the inline size, from inline content
+    SIMFS_CHECK(simfsTruncateNode(node, 10) == SIMFS_NO_ERROR);
+    size = 10;
+    simfsCheckInlineState(fileHandle, expected, size, freeBlocks);
+    size_t ends[] = { inlineSize, inlineSize + 1, 300 };
+    for (unsigned int i = 0; i < sizeof(ends) / sizeof(ends[0]); i++)
+    {
+        size_t offset = ends[i] - 5;
+        if (offset > size)
+            memset(expected + size, 0, offset - size);
+        simfsFillTestContent(expected + offset, 5, 20 + i);
+        SIMFS_CHECK(simfsWriteFileAt(fileHandle, offset, expected + offset, 5) == SIMFS_NO_ERROR);
+        size = ends[i];
+        simfsCheckInlineState(fileHandle, expected, size, freeBlocks);
+
+        if (i < 2) // back inline, so the next range starts there again
+        {
+            SIMFS_CHECK(simfsTruncateNode(node, 10) == SIMFS_NO_ERROR);
+            size = 10;
+        }
+    }
+
+    // truncating into the inline size and growing out of it, which fills zeros
+    size_t truncated[] = { inlineSize + 1, inlineSize, 10, inlineSize, inlineSize + 1, SIMFS_MIN_DATA_SIZE + 1, 0 };
+    for (unsigned int i = 0; i < sizeof(truncated) / sizeof(truncated[0]); i++)
+    {
+        if (truncated[i] > size)
+            memset(expected + size, 0, truncated[i] - size);
+        size = truncated[i];
+        SIMFS_CHECK(simfsTruncateNode(node, size) == SIMFS_NO_ERROR);
+        simfsCheckInlineState(fileHandle, expected, size, freeBlocks);
+    }
+
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsDeleteFile(name) == SIMFS_NO_ERROR);
+    simfsUnmountTestVolume(volume);
+}
+
+/*
+ * Takes a view of a file through one handle while the file is changed through the handle of another process: by
+ * simfsWriteFile(), simfsWriteFileAt(), simfsAppendFile(), a node mapping, and finally by deleting it. The view
+ * held keeps the content it had, and the next view of the first handle shows the change instead of the cached
+ * content.
+ */
+static void simfsCheckViews()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_NAME_TYPE name = "viewed";
+    SIMFS_FILE_HANDLE_TYPE reader, writer;
+    char expected[2001], held[2001];
+    const char *view, *again;
+    size_t size = 600, heldSize, viewSize;
+
+    simfsFillTestContent(expected, size, 11);
+    expected[size] = '\0';
+    SIMFS_CHECK(simfsCreateFile(name, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsOpenFile(name, &reader) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsWriteFile(reader, expected) == SIMFS_NO_ERROR);
+    simfsSetCaller(1, 2, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    SIMFS_CHECK(simfsOpenFile(name, &writer) == SIMFS_NO_ERROR);
+
+    for (int change = 0; change < 5; change++)
+    {
+        simfsSetCaller(1, 1, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (!SIMFS_CHECK(simfsReadFileView(reader, &view, &viewSize) == SIMFS_NO_ERROR))
+            break;
+        SIMFS_CHECK(viewSize == size && memcmp(view, expected, size + 1) == 0);
+        SIMFS_CHECK(simfsReadFileView(reader, &again, &viewSize) == SIMFS_NO_ERROR && again == view);
+        simfsReleaseFileView(again);
+        memcpy(held, expected, size + 1);
+        heldSize = size;
+
+        simfsSetCaller(1, 2, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (change == 0)
+        {
+            size = 300;
+            simfsFillTestContent(expected, size, 12);
+            expected[size] = '\0';
+            SIMFS_CHECK(simfsWriteFile(writer, expected) == SIMFS_NO_ERROR);
+        }
+        else if (change == 1)
+        {
+            expected[100] = expected[100] == 'x' ? 'y' : 'x';
+            SIMFS_CHECK(simfsWriteFileAt(writer, 100, expected + 100, 1) == SIMFS_NO_ERROR);
+        }
+        else if (change == 2)
+        {
+            simfsFillTestContent(expected + size, 200, 13);
+            expected[size + 200] = '\0';
+            SIMFS_CHECK(simfsAppendFile(writer, expected + size) == SIMFS_NO_ERROR);
+            size += 200;
+        }
+        else if (change == 3)
+        {
+            SIMFS_INDEX_TYPE node;
+            SIMFS_FILE_DESCRIPTOR_TYPE info;
+            int entry;
+            size_t transferred;
+            expected[0] = expected[0] == 'x' ? 'y' : 'x';
+            SIMFS_CHECK(simfsLookupNode(simfsRootNode(), name, &node, &info) == SIMFS_NO_ERROR
+                        && simfsOpenNodeEntry(node, S_IWUSR, &entry) == SIMFS_NO_ERROR
+                        && simfsTransferTestRange(entry, 0, expected, 1, 1, &transferred) == SIMFS_NO_ERROR
+                        && simfsCloseNodeEntry(entry) == SIMFS_NO_ERROR);
+        }
+        else
+            SIMFS_CHECK(simfsDeleteFile(name) == SIMFS_NO_ERROR);
+
+        SIMFS_CHECK(memcmp(view, held, heldSize + 1) == 0);
+
+        simfsSetCaller(1, 1, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (change < 4)
+        {
+            SIMFS_CHECK(simfsReadFileView(reader, &again, &viewSize) == SIMFS_NO_ERROR);
+            SIMFS_CHECK(viewSize == size && memcmp(again, expected, size + 1) == 0);
+            simfsReleaseFileView(again);
+        }
+        else
+            SIMFS_CHECK(simfsReadFileView(reader, &again, &viewSize) != SIMFS_NO_ERROR);
+        simfsReleaseFileView(view);
+    }
+
+    // a file created again under the name does not show the content of the deleted one
+    SIMFS_CHECK(simfsCreateFile(name, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+    simfsCheckFileContent(name, "", 0);
+
+    SIMFS_CHECK(simfsCloseFile(reader) == SIMFS_NO_ERROR);
+    simfsSetCaller(1, 2, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    SIMFS_CHECK(simfsCloseFile(writer) == SIMFS_NO_ERROR);
+    simfsSetCaller(1, 1, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    simfsUnmountTestVolume(volume);
+}
+
+static const char *simfsSkipTestSpace(const char *text)
+{
+    while (*text == ' ' || *text == '\n' || *text == '\t' || *text == '\r')
+        text++;
+
+    return text;
+}
+
+/*
+ * Parses the JSON value at the start of the text; returns the text after it, or NULL if it is not valid JSON.
+ */
+static const char *simfsParseTestJson(const char *text)
+{
+    text = simfsSkipTestSpace(text);
+
+    if (*text == '"')
+    {
+        for (text++; *text != '"'; text++)
+            if ((unsigned char) *text < ' ' || (*text == '\\' && *++text == '\0'))
+                return NULL;
+        return text + 1;
+    }
+
+    if (*text == '{' || *text == '[')
+    {
+        char close = *text == '{' ? '}' : ']';
+        text = simfsSkipTestSpace(text + 1);
+        if (*text == close)
+            return text + 1;
+
+        for (;;)
+        {
+            if (close == '}')
+            {
+                text = simfsSkipTestSpace(text);
+                if (*text != '"' || (text = simfsParseTestJson(text)) == NULL)
+                    return NULL;
+                text = simfsSkipTestSpace(text);
+                if (*text++ != ':')
+                    return NULL;
+            }
+            if ((text = simfsParseTestJson(text)) == NULL)
+                return NULL;
+            text = simfsSkipTestSpace(text);
+            if (*text == close)
+                return text + 1;
+            if (*text++ != ',')
+                return NULL;
+        }
+    }
+
+    if (*text == '-' || (*text >= '0' && *text <= '9'))
+    {
+        char *end;
+        strtod(text, &end);
+        return end;
+    }
+
+    const char *literals[] = { "true", "false", "null" };
+    for (int i = 0; i < 3; i++)
+        if (strncmp(text, literals[i], strlen(literals[i])) == 0)
+            return text + strlen(literals[i]);
+
+    return NULL;
+}
+
+static int simfsIsTestJson(const char *text)
+{
+    text = simfsParseTestJson(text);
+
+    return text != NULL && *simfsSkipTestSpace(text) == '\0';
+}
+
+/*
+ * Returns the number of the given key in the first object of the statistics with the given name, or UINT64_MAX if
+ * there is none.
+ */
+static uint64_t simfsTestCounter(const char *json, const char *object, const char *key)
+{
+    char pattern[64];
+    sprintf(pattern, "\"%s\": {", object);
+    const char *found = strstr(json, pattern);
+    if (found == NULL)
+        return UINT64_MAX;
+
+    const char *end = strchr(found, '}');
+    sprintf(pattern, "\"%s\": ", key);
+    found = strstr(found, pattern);
+    if (found == NULL || found > end)
+        return UINT64_MAX;
+
+    return strtoull(found + strlen(pattern), NULL, 10);
+}
+
+/*
+ * Runs a known sequence of calls, some of them failing, and checks that the statistics are valid JSON that count
+ * each call and each error of it; the file SIMFS_STATISTICS_FILE_NAME holds the same JSON as simfsGetStatistics()
+ * at the time it is opened, read unchanged through the handle until it is closed, and cannot be deleted.
+ */
+static void simfsCheckStatistics()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    const char *operations[] = { "create", "delete", "getInfo", "open", "write", "read", "readAt", "close" };
+    int calls[] = { 2, 2, 2, 1, 1, 1, 1, 2 };
+    int errors[] = { 1, 2, 1, 0, 0, 0, 0, 1 };
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_FILE_HANDLE_TYPE fileHandle, statisticsHandle;
+    SIMFS_NAME_TYPE name = "counted", missing = "uncounted", statistics = SIMFS_STATISTICS_FILE_NAME;
+    char *before, *after, *content, *again, buffer[8];
+    size_t bytesRead;
+
+    if (!SIMFS_CHECK(simfsGetStatistics(&before) == SIMFS_NO_ERROR))
+        return;
+    SIMFS_CHECK(simfsIsTestJson(before));
+
+    SIMFS_CHECK(simfsCreateFile(name, FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCreateFile(name, FILE_CONTENT_TYPE) == SIMFS_DUPLICATE_ERROR);
+    SIMFS_CHECK(simfsGetFileInfo(missing, &info) == SIMFS_NOT_FOUND_ERROR);
+    SIMFS_CHECK(simfsGetFileInfo(name, &info) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsOpenFile(name, &fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsWriteFile(fileHandle, "statistics") == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsReadFile(fileHandle, &content) == SIMFS_NO_ERROR);
+    simfsReleaseReadBuffer(content);
+    SIMFS_CHECK(simfsReadFileAt(fileHandle, 2, buffer, sizeof(buffer), &bytesRead) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NOT_FOUND_ERROR);
+    SIMFS_CHECK(simfsDeleteFile(missing) == SIMFS_NOT_FOUND_ERROR);
+    SIMFS_CHECK(simfsDeleteFile(statistics) == SIMFS_ACCESS_ERROR);
+
+    if (SIMFS_CHECK(simfsGetStatistics(&after) == SIMFS_NO_ERROR))
+    {
+        SIMFS_CHECK(simfsIsTestJson(after));
+        for (int i = 0; i < 8; i++)
+        {
+            SIMFS_CHECK(simfsTestCounter(after, operations[i], "calls")
+                        == simfsTestCounter(before, operations[i], "calls") + (uint64_t) calls[i]);
+            SIMFS_CHECK(simfsTestCounter(after, operations[i], "errors")
+                        == simfsTestCounter(before, operations[i], "errors") + (uint64_t) errors[i]);
+        }
+        SIMFS_CHECK(simfsTestCounter(after, "allocation", "freeBlocks") == simfsTestFreeBlocks());
+
+        // the snapshot of the file is taken by the open, which is counted only after it
+        SIMFS_CHECK(simfsOpenFile(statistics, &statisticsHandle) == SIMFS_NO_ERROR);
+        if (SIMFS_CHECK(simfsReadFile(statisticsHandle, &content) == SIMFS_NO_ERROR))
+        {
+            SIMFS_CHECK(strcmp(content, after) == 0);
+            SIMFS_CHECK(simfsDeleteFile(name) == SIMFS_NO_ERROR);
+            SIMFS_CHECK(simfsReadFile(statisticsHandle, &again) == SIMFS_NO_ERROR && strcmp(again, content) == 0);
+            simfsReleaseReadBuffer(again);
+            simfsReleaseReadBuffer(content);
+        }
+        SIMFS_CHECK(simfsWriteFile(statisticsHandle, "{}") == SIMFS_ACCESS_ERROR);
+        SIMFS_CHECK(simfsCloseFile(statisticsHandle) == SIMFS_NO_ERROR);
+
+        SIMFS_CHECK(simfsOpenFile(statistics, &statisticsHandle) == SIMFS_NO_ERROR);
+        if (SIMFS_CHECK(simfsReadFile(statisticsHandle, &content) == SIMFS_NO_ERROR))
+        {
+            SIMFS_CHECK(simfsIsTestJson(content));
+            SIMFS_CHECK(simfsTestCounter(content, "delete", "calls") == simfsTestCounter(after, "delete", "calls") + 1);
+            SIMFS_CHECK(simfsTestCounter(content, "open", "calls") == simfsTestCounter(after, "open", "calls") + 1);
+            SIMFS_CHECK(simfsTestCounter(content, "write", "errors") == simfsTestCounter(after, "write", "errors") + 1);
+            simfsReleaseReadBuffer(content);
+        }
+        SIMFS_CHECK(simfsCloseFile(statisticsHandle) == SIMFS_NO_ERROR);
+        free(after);
+    }
+    free(before);
+
+    simfsUnmountTestVolume(volume);
+}
+
+static int simfsStopAtTestEntry(void *argument, long position, SIMFS_INDEX_TYPE node, SIMFS_CONTENT_TYPE type,
+                                const char *name)
+{
+    simfsCollectTestEntry(argument, position, node, type, name);
+
+    return 1;
+}
+
+static int simfsCountTestSegments(SIMFS_SEGMENT_TYPE *segments, int count, void *argument)
+{
+    (void) segments;
+    *(int *) argument = count;
+
+    return 0;
+}
+
+static int simfsFailTestSegments(SIMFS_SEGMENT_TYPE *segments, int count, void *argument)
+{
+    (void) segments;
+    (void) count;
+    (void) argument;
+
+    return 1;
+}
+
+/*
+ * Uses the calls that the FUSE adapter is built on without mounting it: maps ranges of a file with
+ * simfsMapNodeRange(), which fills the gap before a write past the end of the file with zeros, cuts a read at the
+ * end, and refuses a range of more blocks than segments without changing the file; changes the size with
+ * simfsTruncateNode(); and lists a folder with simfsListFolder() from a position, and until the callback stops it.
+ */
+static void simfsCheckNodeRanges()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_INDEX_TYPE root = simfsRootNode();
+    SIMFS_INDEX_TYPE freeBlocks = simfsTestFreeBlocks();
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_INDEX_TYPE folder, node;
+    SIMFS_SEGMENT_TYPE segments[3];
+    char expected[2000], buffer[2000];
+    size_t transferred;
+    int entry, count;
+
+    SIMFS_CHECK(simfsCreateInFolder(root, "nodes", FOLDER_CONTENT_TYPE, S_IRWXU, &folder, &info) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCreateInFolder(folder, "ranged", FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                == SIMFS_NO_ERROR);
+    if (!SIMFS_CHECK(simfsOpenNodeEntry(node, S_IRUSR | S_IWUSR, &entry) == SIMFS_NO_ERROR))
+        return;
+
+    // a write past the end of the file fills the gap with zeros
+    memset(expected, 0, 1000);
+    simfsFillTestContent(expected + 1000, 300, 31);
+    SIMFS_CHECK(simfsTransferTestRange(entry, 1000, expected + 1000, 300, 1, &transferred) == SIMFS_NO_ERROR
+                && transferred == 300);
+    SIMFS_CHECK(simfsGetNodeInfo(node, &info) == SIMFS_NO_ERROR && info.size == 1300);
+    SIMFS_CHECK(simfsTransferTestRange(entry, 0, buffer, 1300, 0, &transferred) == SIMFS_NO_ERROR
+                && transferred == 1300 && memcmp(buffer, expected, 1300) == 0);
+
+    // a read is cut at the end of the file
+    SIMFS_CHECK(simfsTransferTestRange(entry, 1200, buffer, 500, 0, &transferred) == SIMFS_NO_ERROR
+                && transferred == 100 && memcmp(buffer, expected + 1200, 100) == 0);
+    SIMFS_CHECK(simfsTransferTestRange(entry, 1300, buffer, 10, 0, &transferred) == SIMFS_NO_ERROR
+                && transferred == 0);
+    SIMFS_CHECK(simfsTransferTestRange(entry, 5000, buffer, 10, 0, &transferred) == SIMFS_NO_ERROR
+                && transferred == 0);
+
+    // a range of more blocks than segments is refused, and a write refused so does not grow the file
+    SIMFS_CHECK(simfsMapNodeRange(entry, SIMFS_MIN_DATA_SIZE, 2 * SIMFS_MIN_DATA_SIZE, 0, segments, 2,
+                                  simfsCountTestSegments, &count) == SIMFS_NO_ERROR && count == 2);
+    SIMFS_CHECK(simfsMapNodeRange(entry, SIMFS_MIN_DATA_SIZE - 1, 2 * SIMFS_MIN_DATA_SIZE, 0, segments, 2,
+                                  simfsCountTestSegments, &count) == SIMFS_READ_ERROR);
+    SIMFS_CHECK(simfsMapNodeRange(entry, SIMFS_MIN_DATA_SIZE - 1, 2 * SIMFS_MIN_DATA_SIZE, 1, segments, 2,
+                                  simfsCountTestSegments, &count) == SIMFS_WRITE_ERROR);
+    SIMFS_CHECK(simfsMapNodeRange(entry, 1500, 3 * SIMFS_MIN_DATA_SIZE, 1, segments, 3, simfsCountTestSegments,
+                                  &count) == SIMFS_WRITE_ERROR);
+    SIMFS_CHECK(simfsGetNodeInfo(node, &info) == SIMFS_NO_ERROR && info.size == 1300);
+    SIMFS_CHECK(simfsMapNodeRange(entry, 0, 10, 0, segments, 3, simfsFailTestSegments, NULL) == SIMFS_READ_ERROR);
+
+    // truncating keeps the start of the content, and growing fills zeros
+    SIMFS_CHECK(simfsTruncateNode(node, 1100) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTruncateNode(node, 1600) == SIMFS_NO_ERROR);
+    memset(expected + 1100, 0, 500);
+    SIMFS_CHECK(simfsTransferTestRange(entry, 0, buffer, sizeof(buffer), 0, &transferred) == SIMFS_NO_ERROR
+                && transferred == 1600 && memcmp(buffer, expected, 1600) == 0);
+    SIMFS_CHECK(simfsTruncateNode(node, 0) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsGetNodeInfo(node, &info) == SIMFS_NO_ERROR && info.size == 0);
+    SIMFS_CHECK(simfsTruncateNode(folder, 0) == SIMFS_NOT_FOUND_ERROR);
+    SIMFS_CHECK(simfsCloseNodeEntry(entry) == SIMFS_NO_ERROR);
+
+    // the listing of a folder starts at the position given, and stops when the callback says so
+    SIMFS_NAME_TYPE names[5] = { "ranged", "b", "c", "d", "e" };
+    for (int i = 1; i < 5; i++)
+        SIMFS_CHECK(simfsCreateInFolder(folder, names[i], FILE_CONTENT_TYPE, S_IRUSR | S_IWUSR, &node, &info)
+                    == SIMFS_NO_ERROR);
+    for (int position = 0; position <= 6; position++)
+        simfsCheckListing(folder, position, names, position <= 5 ? 5 : position);
+
+    SIMFS_TEST_LISTING_TYPE *listing = calloc(1, sizeof(SIMFS_TEST_LISTING_TYPE));
+    listing->count = 2;
+    SIMFS_CHECK(simfsListFolder(folder, 2, simfsStopAtTestEntry, listing) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(listing->count == 3 && listing->misplaced == 0 && strcmp(listing->name[2], "c") == 0);
+    free(listing);
+    SIMFS_CHECK(simfsListFolder(node, 0, simfsCollectTestEntry, NULL) == SIMFS_NOT_FOUND_ERROR);
+
+    for (int i = 0; i < 5; i++)
+        SIMFS_CHECK(simfsDeleteInFolder(folder, names[i]) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsDeleteInFolder(root, "nodes") == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks);
+
+    simfsUnmountTestVolume(volume);
+}
+
+/*
+ * Returns a counter of the "pools" section of the statistics.
+ */
+static uint64_t simfsTestPoolCounter(const char *key)
+{
+    char *json;
+    if (!SIMFS_CHECK(simfsGetStatistics(&json) == SIMFS_NO_ERROR))
+        return 0;
+
+    uint64_t counter = simfsTestCounter(json, "pools", key);
+    free(json);
+
+    return counter;
+}
+
+/*
+ * Opens the file from the given processes at the same time, keeping their handles, or closes it again.
+ */
+static void simfsOpenFromTestProcesses(SIMFS_NAME_TYPE name, SIMFS_FILE_HANDLE_TYPE *fileHandle, int first,
+                                       int count, int close)
+{
+    for (int process = first; process < first + count; process++)
+    {
+        simfsSetCaller(1, 1000 + process, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        SIMFS_CHECK((close ? simfsCloseFile(fileHandle[process]) : simfsOpenFile(name, &fileHandle[process]))
+                    == SIMFS_NO_ERROR);
+    }
+    simfsSetCaller(1, 1, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+}
+
+/*
+ * Reads files from a thread of its own, whose pool of read buffers starts empty; the thread that starts it waits
+ * for it, so it may check.
+ */
+static void *simfsRunReadBufferThread(void *argument)
+{
+    SIMFS_FILE_HANDLE_TYPE *fileHandle = argument; // a small file, a larger one, and one too large for the pool
+    uint64_t reused = simfsTestPoolCounter("reusedReadBuffers");
+    char *buffer[SIMFS_READ_BUFFERS_PER_THREAD + 1], *again;
+
+    simfsSetCaller(1, 1, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    // a buffer given back serves the next read of a file that fits it, but not one of a larger file
+    SIMFS_CHECK(simfsReadFile(fileHandle[0], &buffer[0]) == SIMFS_NO_ERROR);
+    simfsReleaseReadBuffer(buffer[0]);
+    SIMFS_CHECK(simfsReadFile(fileHandle[0], &again) == SIMFS_NO_ERROR && again == buffer[0]);
+    SIMFS_CHECK(simfsTestPoolCounter("reusedReadBuffers") == reused + 1);
+    simfsReleaseReadBuffer(again);
+    SIMFS_CHECK(simfsReadFile(fileHandle[1], &buffer[1]) == SIMFS_NO_ERROR && buffer[1] != again);
+    SIMFS_CHECK(simfsTestPoolCounter("reusedReadBuffers") == reused + 1);
+    simfsReleaseReadBuffer(buffer[1]);
+
+    // the pool keeps the largest buffers given back, up to the buffers per thread, so the small one is freed
+    for (int i = 0; i <= SIMFS_READ_BUFFERS_PER_THREAD; i++)
+        SIMFS_CHECK(simfsReadFile(fileHandle[1], &buffer[i]) == SIMFS_NO_ERROR);
+    reused = simfsTestPoolCounter("reusedReadBuffers");
+    for (int i = 0; i <= SIMFS_READ_BUFFERS_PER_THREAD; i++)
+        simfsReleaseReadBuffer(buffer[i]);
+    for (int i = 0; i <= SIMFS_READ_BUFFERS_PER_THREAD; i++)
+        SIMFS_CHECK(simfsReadFile(fileHandle[1], &buffer[i]) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsTestPoolCounter("reusedReadBuffers") == reused + SIMFS_READ_BUFFERS_PER_THREAD);
+    for (int i = 0; i <= SIMFS_READ_BUFFERS_PER_THREAD; i++)
+        simfsReleaseReadBuffer(buffer[i]);
+
+    // a buffer larger than SIMFS_MAX_POOLED_READ_BUFFER is freed when it is given back
+    reused = simfsTestPoolCounter("reusedReadBuffers");
+    for (int i = 0; i < 2; i++)
+    {
+        SIMFS_CHECK(simfsReadFile(fileHandle[2], &buffer[0]) == SIMFS_NO_ERROR);
+        simfsReleaseReadBuffer(buffer[0]);
+    }
+    SIMFS_CHECK(simfsTestPoolCounter("reusedReadBuffers") == reused);
+
+    return NULL;
+}
+
+/*
+ * Checks the pools: processes opening and closing a file again and again, before and after a remount, take their
+ * process control blocks from the slabs already allocated, and a new slab is allocated only for more processes
+ * with open files than the slabs hold; the buffers of simfsReadFile() given back serve the next reads of the thread.
+ */
+static void simfsCheckPools()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_NAME_TYPE name[3] = { "pooled", "larger", "largest" };
+    size_t size[3] = { 100, 5000, SIMFS_MAX_POOLED_READ_BUFFER + 1 };
+    SIMFS_FILE_HANDLE_TYPE fileHandle[3];
+    char *content = malloc(size[2] + 1);
+
+    for (int i = 0; i < 3; i++)
+    {
+        simfsFillTestContent(content, size[i], (unsigned int) i);
+        content[size[i]] = '\0';
+        SIMFS_CHECK(simfsCreateFile(name[i], FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsOpenFile(name[i], &fileHandle[i]) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsWriteFile(fileHandle[i], content) == SIMFS_NO_ERROR);
+    }
+
+    // the blocks of the slabs allocated so far serve all processes but the one of this thread, before a new slab
+    uint64_t slabs = simfsTestPoolCounter("processSlabs");
+    int processes = (int) slabs * SIMFS_PROCESS_SLAB_SIZE - 1;
+    SIMFS_FILE_HANDLE_TYPE *processHandle = malloc((size_t) (processes + 10) * sizeof(SIMFS_FILE_HANDLE_TYPE));
+    for (int round = 0; round < 10; round++)
+    {
+        simfsOpenFromTestProcesses(name[0], processHandle, round, processes, 0);
+        simfsOpenFromTestProcesses(name[0], processHandle, round, processes, 1);
+    }
+    SIMFS_CHECK(simfsTestPoolCounter("processSlabs") == slabs);
+
+    // the blocks of the processes still open at the unmount go back to the pool
+    simfsOpenFromTestProcesses(name[0], processHandle, 0, processes, 0);
+    SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsMountFileSystem(volume) == SIMFS_NO_ERROR);
+    for (int i = 0; i < 3; i++)
+        SIMFS_CHECK(simfsOpenFile(name[i], &fileHandle[i]) == SIMFS_NO_ERROR);
+    simfsOpenFromTestProcesses(name[0], processHandle, 0, processes, 0);
+    SIMFS_CHECK(simfsTestPoolCounter("processSlabs") == slabs);
+    simfsOpenFromTestProcesses(name[0], processHandle, processes, 1, 0);
+    SIMFS_CHECK(simfsTestPoolCounter("processSlabs") == slabs + 1);
+    simfsOpenFromTestProcesses(name[0], processHandle, 0, processes + 1, 1);
+
+#ifdef __GLIBC__ // elsewhere the buffers given back are freed
+    pthread_t thread;
+    SIMFS_CHECK(pthread_create(&thread, NULL, simfsRunReadBufferThread, fileHandle) == 0
+                && pthread_join(thread, NULL) == 0);
+#endif
+
+    for (int i = 0; i < 3; i++)
+    {
+        SIMFS_CHECK(simfsCloseFile(fileHandle[i]) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsDeleteFile(name[i]) == SIMFS_NO_ERROR);
+    }
+
+    free(processHandle);
+    free(content);
+    simfsUnmountTestVolume(volume);
+}
+
+/*
+ * Lets a child process change a volume of the given geometry kept in an image file, syncing it after every
+ * syncInterval files, change it further, and exit without unmounting; the volume mounted again must hold what was
+ * synced, which is replayed from the journal, or was written in place by a transaction larger than the journal.
+ */
+static void simfsCheckJournalReplay(const char *path, unsigned int blockSize, SIMFS_INDEX_TYPE numberOfBlocks,
+                                    int syncInterval)
+{
+    int pipeFiles[2];
+    if (!SIMFS_CHECK(pipe(pipeFiles) == 0))
+        return;
+
+    char *content = malloc(20 * SIMFS_DEFAULT_BLOCK_SIZE + 1);
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        int failed = simfsFormatVolumeFile(path, blockSize, numberOfBlocks) != SIMFS_NO_ERROR;
+        simfsSetWriteBackPolicy(SIMFS_WRITE_BACK);
+
+        for (int i = 0; i < 40 && !failed; i++)
+        {
+            SIMFS_NAME_TYPE name;
+            sprintf(name, "synced%d", i);
+            simfsFillTestContent(content, (size_t) i * SIMFS_DEFAULT_BLOCK_SIZE / 2, (unsigned int) i);
+            content[(size_t) i * SIMFS_DEFAULT_BLOCK_SIZE / 2] = '\0';
+
+            SIMFS_FILE_HANDLE_TYPE fileHandle;
+            failed = simfsCreateFile(name, i % 8 ? FILE_CONTENT_TYPE : FOLDER_CONTENT_TYPE) != SIMFS_NO_ERROR
+                     || (i % 8 && (simfsOpenFile(name, &fileHandle) != SIMFS_NO_ERROR
+                                   || simfsWriteFile(fileHandle, content) != SIMFS_NO_ERROR
+                                   || simfsCloseFile(fileHandle) != SIMFS_NO_ERROR));
+            if (i % syncInterval == syncInterval - 1 && !failed)
+                failed = simfsSyncFileSystem() != SIMFS_NO_ERROR;
+        }
+        SIMFS_INDEX_TYPE freeBlocks = failed ? 0 : simfsTestFreeBlocks();
+        failed = write(pipeFiles[1], &freeBlocks, sizeof(freeBlocks)) != sizeof(freeBlocks);
+
+        SIMFS_NAME_TYPE name = "lost"; // not synced, so it may or may not be committed
+        simfsCreateFile(name, FILE_CONTENT_TYPE);
+
+        _exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    SIMFS_INDEX_TYPE childFreeBlocks = 0;
+    int status = -1;
+    SIMFS_CHECK(read(pipeFiles[0], &childFreeBlocks, sizeof(childFreeBlocks)) == sizeof(childFreeBlocks));
+    SIMFS_CHECK(waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    close(pipeFiles[0]);
+    close(pipeFiles[1]);
+
+    if (SIMFS_CHECK(simfsMountVolumeFile(path, 0) == SIMFS_NO_ERROR))
+    {
+        for (int i = 0; i < 40; i++)
+        {
+            SIMFS_NAME_TYPE name;
+            sprintf(name, "synced%d", i);
+            SIMFS_FILE_DESCRIPTOR_TYPE info;
+            if (!SIMFS_CHECK(simfsGetFileInfo(name, &info) == SIMFS_NO_ERROR)
+                || !SIMFS_CHECK(info.type == (i % 8 ? FILE_CONTENT_TYPE : FOLDER_CONTENT_TYPE)) || i % 8 == 0)
+                continue;
+
+            SIMFS_FILE_HANDLE_TYPE fileHandle;
+            SIMFS_CHECK(simfsOpenFile(name, &fileHandle) == SIMFS_NO_ERROR);
+            simfsFillTestContent(content, (size_t) i * SIMFS_DEFAULT_BLOCK_SIZE / 2, (unsigned int) i);
+            simfsCheckContent(fileHandle, content, (size_t) i * SIMFS_DEFAULT_BLOCK_SIZE / 2);
+            SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+        }
+
+        SIMFS_NAME_TYPE name = "lost";
+        SIMFS_FILE_DESCRIPTOR_TYPE info;
+        if (simfsGetFileInfo(name, &info) == SIMFS_NOT_FOUND_ERROR)
+            SIMFS_CHECK(simfsTestFreeBlocks() == childFreeBlocks);
+
+        SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+    }
+
+    free(content);
+}
+
+/*
+ * Reaps the given number of completed requests of a queue, and returns how many of them failed.
+ */
+static int simfsReapTestRequests(SIMFS_QUEUE_TYPE *queue, int count)
+{
+    SIMFS_REQUEST_TYPE *completed[64];
+    int failed = 0;
+
+    while (count > 0)
+    {
+        int reaped = simfsReapRequests(queue, completed, 64, 1);
+        if (!SIMFS_CHECK(reaped > 0))
+            break;
+        for (int i = 0; i < reaped; i++)
+            failed += completed[i]->error != SIMFS_NO_ERROR;
+        count -= reaped;
+    }
+
+    return failed;
+}
+
+/*
+ * Submits chains of requests that create, open, write, and close files, and read them back; a chain whose first
+ * request fails skips the rest with its error, and a close still closes the entry opened by its chain.
+ */
+static void simfsCheckQueueChains()
+{
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_QUEUE_TYPE *queue;
+    if (!SIMFS_CHECK(simfsCreateQueue(&queue) == SIMFS_NO_ERROR))
+    {
+        simfsUnmountTestVolume(volume);
+        return;
+    }
+
+    SIMFS_INDEX_TYPE root = simfsRootNode();
+    int count = 100;
+    char (*names)[16] = malloc((size_t) count * sizeof(*names));
+    char *content = malloc(2000);
+    char *readBack = calloc((size_t) count, 2000);
+    SIMFS_REQUEST_TYPE *requests = calloc((size_t) count * 4, sizeof(SIMFS_REQUEST_TYPE));
+
+    simfsFillTestContent(content, 2000, 19);
+    for (int i = 0; i < count; i++)
+    {
+        SIMFS_REQUEST_TYPE *chain = &requests[4 * i];
+        sprintf(names[i], "queued%d", i);
+        chain[0] = (SIMFS_REQUEST_TYPE) { .kind = SIMFS_CREATE_REQUEST, .folder = root, .name = names[i],
+                                          .type = FILE_CONTENT_TYPE, .accessRights = S_IRUSR | S_IWUSR };
+        chain[1] = (SIMFS_REQUEST_TYPE) { .kind = SIMFS_OPEN_REQUEST, .linked = 1,
+                                          .accessRights = S_IRUSR | S_IWUSR };
+        chain[2] = (SIMFS_REQUEST_TYPE) { .kind = SIMFS_WRITE_REQUEST, .linked = 1, .buffer = content,
+                                          .length = (size_t) i * 20 };
+        chain[3] = (SIMFS_REQUEST_TYPE) { .kind = SIMFS_CLOSE_REQUEST, .linked = 1 };
+    }
+    SIMFS_CHECK(simfsSubmitRequests(queue, requests, 4 * count) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsReapTestRequests(queue, 4 * count) == 0);
+    for (int i = 0; i < count; i++)
+        SIMFS_CHECK(requests[4 * i + 2].transferred == (size_t) i * 20);
+
+    for (int i = 0; i < count; i++)
+    {
+        SIMFS_REQUEST_TYPE *chain = &requests[3 * i];
+        chain[0] = (SIMFS_REQUEST_TYPE) { .kind = SIMFS_OPEN_REQUEST, .folder = root, .name = names[i],
+                                          .accessRights = S_IRUSR };
+        chain[1] = (SIMFS_REQUEST_TYPE) { .kind = SIMFS_READ_REQUEST, .linked = 1, .buffer = readBack + 2000 * i,
+                                          .length = 2000 };
+        chain[2] = (SIMFS_REQUEST_TYPE) { .kind = SIMFS_CLOSE_REQUEST, .linked = 1 };
+    }
+    SIMFS_CHECK(simfsSubmitRequests(queue, requests, 3 * count) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsReapTestRequests(queue, 3 * count) == 0);
+    for (int i = 0; i < count; i++)
+        SIMFS_CHECK(requests[3 * i + 1].transferred == (size_t) i * 20
+                    && memcmp(readBack + 2000 * i, content, (size_t) i * 20) == 0);
+
+    // a duplicate create fails, and the rest of its chain is skipped with the same error
+    SIMFS_REQUEST_TYPE duplicate[4] = {
+        { .kind = SIMFS_CREATE_REQUEST, .folder = root, .name = names[0], .type = FILE_CONTENT_TYPE,
+          .accessRights = S_IRUSR | S_IWUSR },
+        { .kind = SIMFS_OPEN_REQUEST, .linked = 1, .accessRights = S_IWUSR },
+        { .kind = SIMFS_WRITE_REQUEST, .linked = 1, .buffer = content, .length = 10 },
+        { .kind = SIMFS_CLOSE_REQUEST, .linked = 1 }
+    };
+    SIMFS_CHECK(simfsSubmitRequests(queue, duplicate, 4) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsReapTestRequests(queue, 4) == 4);
+    for (int i = 0; i < 4; i++)
+        SIMFS_CHECK(duplicate[i].error == SIMFS_DUPLICATE_ERROR);
+
+    // a write far beyond the space of the volume fails, and the close after it still runs
+    SIMFS_REQUEST_TYPE tooFar[3] = {
+        { .kind = SIMFS_OPEN_REQUEST, .folder = root, .name = names[1], .accessRights = S_IRUSR | S_IWUSR },
+        { .kind = SIMFS_WRITE_REQUEST, .linked = 1, .buffer = content, .length = 10, .offset = SIZE_MAX / 2 },
+        { .kind = SIMFS_CLOSE_REQUEST, .linked = 1 }
+    };
+    SIMFS_CHECK(simfsSubmitRequests(queue, tooFar, 3) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsReapTestRequests(queue, 3) == 1);
+    SIMFS_CHECK(tooFar[0].error == SIMFS_NO_ERROR && tooFar[1].error != SIMFS_NO_ERROR
+                && tooFar[2].error == SIMFS_NO_ERROR);
+
+    for (int i = 0; i < count; i++)
+        requests[i] = (SIMFS_REQUEST_TYPE) { .kind = SIMFS_DELETE_REQUEST, .folder = root, .name = names[i] };
+    SIMFS_CHECK(simfsSubmitRequests(queue, requests, count) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsReapTestRequests(queue, count) == 0);
+
+    SIMFS_INDEX_TYPE node;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_CHECK(simfsLookupNode(root, names[count - 1], &node, &info) == SIMFS_NOT_FOUND_ERROR);
+
+    simfsDestroyQueue(queue);
+    free(requests);
+    free(readBack);
+    free(content);
+    free(names);
+    simfsUnmountTestVolume(volume);
+}
+
+/*
+ * Clones a file on a volume kept in an image file, and changes the source and the clones with simfsWriteFileAt(),
+ * simfsAppendFile(), and a shorter simfsWriteFile(); every file keeps its own content, also after the volume is
+ * mounted again, and deleting them all returns every block they took.
+ */
+static void simfsCheckClones(const char *path)
+{
+    if (!SIMFS_CHECK(simfsFormatVolumeFile(path, SIMFS_DEFAULT_BLOCK_SIZE, SIMFS_DEFAULT_NUMBER_OF_BLOCKS)
+                     == SIMFS_NO_ERROR))
+        return;
+
+    SIMFS_NAME_TYPE names[3] = { "source", "written", "appended" };
+    for (int i = 0; i < 3; i++) // the root folder grows to hold the names before the blocks are counted
+        SIMFS_CHECK(simfsCreateFile(names[i], FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+    for (int i = 0; i < 3; i++)
+        SIMFS_CHECK(simfsDeleteFile(names[i]) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsSyncFileSystem() == SIMFS_NO_ERROR);
+    SIMFS_INDEX_TYPE freeBlocks = simfsTestFreeBlocks();
+
+    size_t size = 100 * SIMFS_DEFAULT_BLOCK_SIZE + 17;
+    char *expected[3];
+    for (int i = 0; i < 3; i++)
+        expected[i] = malloc(size + 100);
+    simfsFillTestContent(expected[0], size, 20);
+    expected[0][size] = '\0';
+
+    SIMFS_FILE_HANDLE_TYPE fileHandle;
+    SIMFS_CHECK(simfsCreateFile(names[0], FILE_CONTENT_TYPE) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsOpenFile(names[0], &fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsWriteFile(fileHandle, expected[0]) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsSyncFileSystem() == SIMFS_NO_ERROR);
+    SIMFS_INDEX_TYPE sourceBlocks = freeBlocks - simfsTestFreeBlocks();
+
+    SIMFS_CHECK(simfsCloneFile(names[0], names[1]) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCloneFile(names[0], names[2]) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCloneFile(names[0], names[1]) == SIMFS_DUPLICATE_ERROR);
+    SIMFS_CHECK(simfsSyncFileSystem() == SIMFS_NO_ERROR);
+    SIMFS_CHECK(freeBlocks - simfsTestFreeBlocks() < sourceBlocks + 2 * 4); // the clones share the data blocks
+    memcpy(expected[1], expected[0], size);
+    memcpy(expected[2], expected[0], size);
+
+    SIMFS_CHECK(simfsOpenFile(names[1], &fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsWriteFileAt(fileHandle, size / 2, "written", 7) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+    memcpy(expected[1] + size / 2, "written", 7);
+
+    SIMFS_CHECK(simfsOpenFile(names[2], &fileHandle) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsAppendFile(fileHandle, "appended") == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+    memcpy(expected[2] + size, "appended", 8);
+
+    size_t sizes[3] = { 100, size, size + 8 };
+    SIMFS_CHECK(simfsOpenFile(names[0], &fileHandle) == SIMFS_NO_ERROR);
+    expected[0][sizes[0]] = '\0';
+    SIMFS_CHECK(simfsWriteFile(fileHandle, expected[0]) == SIMFS_NO_ERROR);
+    SIMFS_CHECK(simfsCloseFile(fileHandle) == SIMFS_NO_ERROR);
+
+    for (int i = 0; i < 3; i++)
+        simfsCheckFileContent(names[i], expected[i], sizes[i]);
+
+    SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+    if (SIMFS_CHECK(simfsMountVolumeFile(path, 0) == SIMFS_NO_ERROR))
+    {
+        for (int i = 0; i < 3; i++)
+            simfsCheckFileContent(names[i], expected[i], sizes[i]);
+
+        for (int i = 0; i < 3; i++)
+            SIMFS_CHECK(simfsDeleteFile(names[i]) == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsSyncFileSystem() == SIMFS_NO_ERROR);
+        SIMFS_CHECK(simfsTestFreeBlocks() == freeBlocks);
+
+        SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+    }
+
+    for (int i = 0; i < 3; i++)
+        free(expected[i]);
+}
+
+/*
+ * Mounts an image file whose superblock has a root folder outside the volume, and one that does not hold a whole
+ * volume, twice each; every mount fails without leaving a volume mounted or the file open, and a volume in memory
+ * is mounted and unmounted as such afterwards.
+ */
+static void simfsCheckBadImages(const char *path)
+{
+    if (!SIMFS_CHECK(simfsFormatVolumeFile(path, SIMFS_DEFAULT_BLOCK_SIZE, SIMFS_DEFAULT_NUMBER_OF_BLOCKS)
+                     == SIMFS_NO_ERROR))
+        return;
+    SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+
+    FILE *image = fopen(path, "r+b");
+    SIMFS_SUPERBLOCK_TYPE superblock;
+    if (!SIMFS_CHECK(image != NULL && fread(&superblock, sizeof(superblock), 1, image) == 1))
+    {
+        if (image != NULL)
+            fclose(image);
+        return;
+    }
+    superblock.attr.rootNodeIndex = superblock.attr.numberOfBlocks;
+    rewind(image);
+    SIMFS_CHECK(fwrite(&superblock, sizeof(superblock), 1, image) == 1);
+    fclose(image);
+
+    int unusedFile = dup(STDIN_FILENO); // the lowest unused file descriptor, which a file left open would take
+    close(unusedFile);
+    for (int i = 0; i < 2; i++)
+    {
+        SIMFS_CHECK(simfsMountVolumeFile(path, 0) == SIMFS_READ_ERROR);
+        SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NOT_FOUND_ERROR);
+    }
+
+    SIMFS_CHECK(truncate(path, (off_t) simfsVolumeSize(SIMFS_DEFAULT_BLOCK_SIZE, SIMFS_DEFAULT_NUMBER_OF_BLOCKS) / 2)
+                == 0);
+    for (int i = 0; i < 2; i++)
+    {
+        SIMFS_CHECK(simfsMountVolumeFile(path, 0) == SIMFS_READ_ERROR);
+        SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NOT_FOUND_ERROR);
+    }
+    int file = dup(STDIN_FILENO);
+    SIMFS_CHECK(file == unusedFile);
+    close(file);
+
+    SIMFS_VOLUME *volume = simfsMountTestVolume();
+    SIMFS_CHECK(simfsUnmountFileSystem() == SIMFS_NO_ERROR);
+    SIMFS_CHECK(volume->superblock.attr.magic == SIMFS_MAGIC); // still allocated, not unmapped as an image
+    free(volume);
+}
+
+/*
+ * Runs the checks on the given image file; returns the number of failed checks.
+ */
+static int simfsRunChecks(const char *path)
+{
+    // the operations of the checks come from the same process, which may read and write the files it creates
+    simfsSetCaller(1, 1, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    simfsCheckAllocator();
+    simfsCheckReadWriteAt();
+    simfsCheckAppend();
+    simfsCheckInlineContent();
+    simfsCheckViews();
+    simfsCheckStatistics();
+    simfsCheckNodeRanges();
+    simfsCheckPools();
+    simfsCheckDirectory();
+    simfsCheckFolderEntries();
+    simfsCheckSnapshot();
+    simfsCheckThreads();
+    simfsCheckJournalReplay(path, SIMFS_DEFAULT_BLOCK_SIZE, SIMFS_DEFAULT_NUMBER_OF_BLOCKS, 10);
+    // the 40 descriptor blocks of one transaction do not fit into the 16 blocks of the journal of this geometry
+    simfsCheckJournalReplay(path, SIMFS_MAX_BLOCK_SIZE, 256, 40);
+    simfsCheckQueueChains();
+    simfsCheckClones(path);
+    simfsCheckBadImages(path);
+
+    return simfsFailedChecks;
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc > 2 && strcmp(argv[1], "--check") == 0)
+    {
+        int failed = simfsRunChecks(argv[2]);
+        printf("%d checks failed\n", failed);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
 //    srand(time(NULL)); // uncomment to get true random values in get_context()
 
-    SIMFS_VOLUME *simfs_volume = malloc(sizeof(SIMFS_VOLUME));
+    if (argc > 1) // the volume is kept in the given image file, which is created if it does not exist
+    {
+        if (simfsMountVolumeFile(argv[1], 0) == SIMFS_NOT_FOUND_ERROR)
+            simfsMountVolumeFile(argv[1], 1);
+    }
+    else
+    {
+        SIMFS_VOLUME *simfs_volume = malloc(simfsVolumeSize(SIMFS_DEFAULT_BLOCK_SIZE,
+                                                            SIMFS_DEFAULT_NUMBER_OF_BLOCKS));
+        simfsFormatFileSystem(simfs_volume, SIMFS_DEFAULT_BLOCK_SIZE, SIMFS_DEFAULT_NUMBER_OF_BLOCKS);
 
-    simfsMountFileSystem(simfs_volume);
+        simfsMountFileSystem(simfs_volume);
+    }
 
-    // TODO: implement thorough testing of all the functionality
+    // the functionality is checked by "simfs --check image" (see simfsRunChecks())
 
     // the following is just some sample code for simulating user and process identifiers that are
     // needed in the simfs functions
@@ -26,5 +1836,7 @@ int main() {
         printf("\"content = %s\"\n", content);
     }
 
+    simfsUnmountFileSystem();
+
     return EXIT_SUCCESS;
 }